@@ -0,0 +1,255 @@
+#include "PC_AEC.hpp"
+
+#include <cmath>
+#include <cstring>
+#include <chrono>
+#include <algorithm>
+
+/* Constants
+ * FFT_SIZE: Blocks are filtered with 50% overlap-save
+ * BINS: Non-redundant bins of a real FFT_SIZE transform
+ * FIFO_SIZE: Max far end samples queued between playback() and capture()
+ * STEP: NLMS step size
+ * GEIGEL: Near end louder than this many times the usual echo coupling means double talk
+ * HANGOVER: Blocks adaptation stays frozen after double talk
+ * FAR_SILENCE: Far end peak below which there is nothing to learn from
+ * DIVERGE_LIMIT: Blocks in a row the filter may make things worse before a reset
+ */
+#define FFT_SIZE (2 * AEC_BLOCK)
+#define BINS (AEC_BLOCK + 1)
+#define FIFO_SIZE 8192
+#define STEP 0.5f
+#define GEIGEL 2.0f
+#define HANGOVER 16
+#define FAR_SILENCE 1e-3f
+#define DIVERGE_LIMIT 50
+
+/* EchoCanceller Constructor
+ * Allocates the filter for tail_ms of echo at sample_rate.
+ */
+EchoCanceller::EchoCanceller(int sample_rate, int tail_ms)
+	: fft(FFT_SIZE),
+	  partitions((size_t) std::max(1, sample_rate / 1000 * tail_ms / AEC_BLOCK)),
+	  fifo(FIFO_SIZE),
+	  Xr(partitions * BINS), Xi(partitions * BINS),
+	  Wr(partitions * BINS), Wi(partitions * BINS),
+	  power(BINS), power_avg(BINS), far_peak(partitions), x_prev(AEC_BLOCK),
+	  re(FFT_SIZE), im(FFT_SIZE), Yr(BINS), Yi(BINS),
+	  sample_rate(sample_rate)
+{
+	// Regularization: far end at about -60 dBFS across the whole tail
+	delta = partitions * FFT_SIZE * 1e-6f;
+}
+
+/* reset()
+ * Clears the learned echo path and the reference queue.
+ */
+void EchoCanceller::reset() noexcept {
+	std::fill(Xr.begin(), Xr.end(), 0.0f);
+	std::fill(Xi.begin(), Xi.end(), 0.0f);
+	std::fill(Wr.begin(), Wr.end(), 0.0f);
+	std::fill(Wi.begin(), Wi.end(), 0.0f);
+	std::fill(power.begin(), power.end(), 0.0f);
+	std::fill(power_avg.begin(), power_avg.end(), 0.0f);
+	std::fill(far_peak.begin(), far_peak.end(), 0.0f);
+	std::fill(x_prev.begin(), x_prev.end(), 0.0f);
+	fifo_read = fifo_write = 0;
+	hold = diverged = 0;
+	coupling = 0.3f;
+	d_energy = e_energy = 0.0f;
+}
+
+/* playback()
+ * Queues what we're about to play as the reference for the next capture().
+ * When the queue is full the oldest samples are dropped.
+ */
+void EchoCanceller::playback(const float *spk, size_t n, int channels) noexcept {
+	for (size_t i = 0; i < n; ++i) {
+		float x = spk[i * channels];
+		for (int c = 1; c < channels; ++c)
+			x += spk[i * channels + c];
+		fifo[fifo_write % FIFO_SIZE] = x / channels;
+		fifo_write++;
+	}
+	if (fifo_write - fifo_read > FIFO_SIZE)
+		fifo_read = fifo_write - FIFO_SIZE;
+}
+
+/* capture()
+ * Cancels echo from n mic samples in place, one AEC_BLOCK at a time.  Times
+ * itself and stops adapting while the average load is over AEC_MAX_LOAD.
+ */
+void EchoCanceller::capture(float *mic, size_t n) noexcept {
+	if (!enabled) {
+		fifo_read = fifo_write;
+		return;
+	}
+	auto start = std::chrono::steady_clock::now();
+	bool adapt = load <= AEC_MAX_LOAD;
+	if (!adapt)
+		skipped++;
+
+	float far[AEC_BLOCK];
+	for (size_t offset = 0; offset + AEC_BLOCK <= n; offset += AEC_BLOCK) {
+		// Reference that was played one callback ago (zeros until there is one)
+		for (size_t i = 0; i < AEC_BLOCK; ++i) {
+			if (fifo_read < fifo_write) {
+				far[i] = fifo[fifo_read % FIFO_SIZE];
+				fifo_read++;
+			} else {
+				far[i] = 0.0f;
+			}
+		}
+		processBlock(mic + offset, far, adapt);
+	}
+
+	// CPU Budget
+	std::chrono::duration<float, std::micro> took = std::chrono::steady_clock::now() - start;
+	float budget = 1e6f * n / sample_rate;
+	load = 0.9f * load + 0.1f * (took.count() / budget);
+	load_avg = load;
+}
+
+/* processBlock()
+ * One block of overlap-save filtering, and the NLMS update if adapt.
+ */
+void EchoCanceller::processBlock(float *mic, const float *far, bool adapt) noexcept {
+	// Far end spectrum of [previous block, this block] becomes the newest partition
+	std::memcpy(re.data(), x_prev.data(), sizeof(float) * AEC_BLOCK);
+	std::memcpy(re.data() + AEC_BLOCK, far, sizeof(float) * AEC_BLOCK);
+	std::fill(im.begin(), im.end(), 0.0f);
+	fft.forward(re.data(), im.data());
+	std::memcpy(x_prev.data(), far, sizeof(float) * AEC_BLOCK);
+
+	head = (head + partitions - 1) % partitions;
+	float *xr = &Xr[head * BINS], *xi = &Xi[head * BINS];
+	float peak = 0.0f;
+	for (size_t i = 0; i < AEC_BLOCK; ++i)
+		peak = std::max(peak, std::fabs(far[i]));
+	far_peak[head] = peak;
+	for (size_t k = 0; k < BINS; ++k) {
+		power[k] -= xr[k] * xr[k] + xi[k] * xi[k];
+		xr[k] = re[k];
+		xi[k] = im[k];
+		power[k] = std::max(0.0f, power[k] + xr[k] * xr[k] + xi[k] * xi[k]);
+	}
+
+	// Echo estimate Y = sum W_p * X_(k-p)
+	std::fill(Yr.begin(), Yr.end(), 0.0f);
+	std::fill(Yi.begin(), Yi.end(), 0.0f);
+	for (size_t p = 0; p < partitions; ++p) {
+		size_t slot = ((head + p) % partitions) * BINS;
+		const float *wr = &Wr[p * BINS], *wi = &Wi[p * BINS];
+		const float *pr = &Xr[slot], *pi = &Xi[slot];
+		for (size_t k = 0; k < BINS; ++k) {
+			Yr[k] += wr[k] * pr[k] - wi[k] * pi[k];
+			Yi[k] += wr[k] * pi[k] + wi[k] * pr[k];
+		}
+	}
+	for (size_t k = 0; k < BINS; ++k) {
+		re[k] = Yr[k];
+		im[k] = Yi[k];
+	}
+	for (size_t k = BINS; k < FFT_SIZE; ++k) {
+		re[k] = Yr[FFT_SIZE - k];
+		im[k] = -Yi[FFT_SIZE - k];
+	}
+	fft.inverse(re.data(), im.data());
+
+	// Error = mic - echo estimate (second half of the overlap-save output)
+	float e[AEC_BLOCK];
+	float d_sum = 0.0f, e_sum = 0.0f, near_peak = 0.0f;
+	for (size_t i = 0; i < AEC_BLOCK; ++i) {
+		e[i] = mic[i] - re[AEC_BLOCK + i];
+		d_sum += mic[i] * mic[i];
+		e_sum += e[i] * e[i];
+		near_peak = std::max(near_peak, std::fabs(mic[i]));
+	}
+
+	// Double talk: Near end louder than the echo could be.  How loud the echo
+	// usually is (coupling) is learned, laptop speakers can be as loud as the far end.
+	float far_max = *std::max_element(far_peak.begin(), far_peak.end());
+	if (far_max > FAR_SILENCE) {
+		float ratio = near_peak / far_max;
+		float rate = (ratio < coupling) ? 0.05f : ((hold > 0) ? 0.002f : 0.02f);
+		coupling += rate * (ratio - coupling);
+	}
+	if (near_peak > GEIGEL * coupling * far_max)
+		hold = HANGOVER;
+	else if (hold > 0)
+		hold--;
+
+	// NLMS update: W_p += mu * conj(X_p) * E / (power + delta)
+	if (adapt && hold == 0 && far_max > FAR_SILENCE) {
+		std::fill(re.begin(), re.begin() + AEC_BLOCK, 0.0f);
+		std::memcpy(re.data() + AEC_BLOCK, e, sizeof(float) * AEC_BLOCK);
+		std::fill(im.begin(), im.end(), 0.0f);
+		fft.forward(re.data(), im.data());
+
+		// Normalize by the tail's power, but no less than what a full tail usually
+		// holds.  Right after a pause only the newest partitions have any signal
+		// and normalizing by just those makes the filter overshoot.
+		float gain[BINS];
+		for (size_t k = 0; k < BINS; ++k) {
+			power_avg[k] = 0.99f * power_avg[k] + 0.01f * (xr[k] * xr[k] + xi[k] * xi[k]);
+			gain[k] = STEP / (std::max(power[k], partitions * power_avg[k]) + delta);
+		}
+		for (size_t p = 0; p < partitions; ++p) {
+			size_t slot = ((head + p) % partitions) * BINS;
+			float *wr = &Wr[p * BINS], *wi = &Wi[p * BINS];
+			const float *pr = &Xr[slot], *pi = &Xi[slot];
+			for (size_t k = 0; k < BINS; ++k) {
+				wr[k] += gain[k] * (pr[k] * re[k] + pi[k] * im[k]);
+				wi[k] += gain[k] * (pr[k] * im[k] - pi[k] * re[k]);
+			}
+		}
+
+		// Keep one partition a proper linear (not circular) filter per block
+		constrain(constrain_next);
+		constrain_next = (constrain_next + 1) % partitions;
+	}
+
+	// Never make the mic worse.  If the filter keeps doing that while the far end
+	// is playing, start over.
+	if (e_sum > d_sum && d_sum > 0.0f) {
+		if (peak > FAR_SILENCE && e_sum > 2.0f * d_sum && ++diverged > DIVERGE_LIMIT) {
+			std::fill(Wr.begin(), Wr.end(), 0.0f);
+			std::fill(Wi.begin(), Wi.end(), 0.0f);
+			diverged = 0;
+		}
+		e_sum = d_sum;
+	} else {
+		if (peak > FAR_SILENCE)
+			diverged = 0;
+		std::memcpy(mic, e, sizeof(float) * AEC_BLOCK);
+	}
+
+	// ERLE
+	d_energy = 0.995f * d_energy + d_sum;
+	e_energy = 0.995f * e_energy + e_sum;
+	if (e_energy > 0.0f)
+		erle = 10.0f * std::log10(d_energy / e_energy);
+}
+
+/* constrain()
+ * Zeros the second half of partition p's impulse response.
+ */
+void EchoCanceller::constrain(size_t p) noexcept {
+	float *wr = &Wr[p * BINS], *wi = &Wi[p * BINS];
+	for (size_t k = 0; k < BINS; ++k) {
+		re[k] = wr[k];
+		im[k] = wi[k];
+	}
+	for (size_t k = BINS; k < FFT_SIZE; ++k) {
+		re[k] = wr[FFT_SIZE - k];
+		im[k] = -wi[FFT_SIZE - k];
+	}
+	fft.inverse(re.data(), im.data());
+	std::fill(re.begin() + AEC_BLOCK, re.end(), 0.0f);
+	std::fill(im.begin(), im.end(), 0.0f);
+	fft.forward(re.data(), im.data());
+	for (size_t k = 0; k < BINS; ++k) {
+		wr[k] = re[k];
+		wi[k] = im[k];
+	}
+}
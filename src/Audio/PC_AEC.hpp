@@ -0,0 +1,113 @@
+#ifndef _PC_AEC_HPP
+#define _PC_AEC_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <atomic>
+
+#include "PC_FFT.hpp"
+
+/* Constants
+ * AEC_BLOCK is the block size the filter adapts on (samples).  The FFT is twice that.
+ * AEC_TAIL_MS is the longest echo path (playback -> room -> capture) we can cancel,
+ *             including the device latency between the two.
+ * AEC_MAX_LOAD is the share of real time the canceller may use before it stops
+ *              adapting (filtering only costs about half as much).
+ */
+#define AEC_BLOCK 64
+#define AEC_TAIL_MS 200
+#define AEC_MAX_LOAD 0.15f
+
+// EchoCanceller Class ---------------------------------------------------------
+/* EchoCanceller: Removes our own playback from the microphone signal
+ *
+ * Partitioned block frequency domain NLMS filter.  The far end reference is
+ * what we played (the final mix), the near end is what the mic captured.  The
+ * filter learns the echo path and subtracts its estimate of the echo from the
+ * mic.  Adaptation freezes while the near end talks over the far end (Geigel
+ * double talk detector against a learned coupling) and while we're over our
+ * CPU budget.
+ *
+ * Everything runs on the audio thread: playback() at the end of a callback,
+ * capture() at the start of the next one.  Buffers are allocated by the
+ * constructor only.
+ *
+ * @constructor EchoCanceller(2)  sample_rate (Hz), tail_ms (ms)
+ *
+ * @method capture(2)  Cancel echo in a block of mic samples, in place.  n should be
+ *                     a multiple of AEC_BLOCK, any remainder is left untouched.
+ *
+ * @method playback(3)  Feed the block we're about to play (interleaved if
+ *                      channels > 1, it is downmixed) as the far end reference
+ *
+ * @method reset()  Forget the learned echo path and the queued reference
+ *
+ * @method setEnabled(1)  Turn cancellation on/off, safe from any thread
+ *
+ * @method getERLE()  Echo return loss enhancement (dB), how much quieter the mic
+ *                    got. Around 0 with no echo, 20+ once converged.
+ *
+ * @method getLoad()  Average share of real time spent in the canceller
+ *
+ * @method getSkipped()  Frames that didn't adapt because we were over budget
+ */
+class EchoCanceller
+{
+private:
+	FFT fft;
+	size_t partitions;
+	float delta;
+
+	// Far end reference queue (playback -> capture)
+	std::vector<float> fifo;
+	size_t fifo_read = 0;
+	size_t fifo_write = 0;
+
+	// Far end spectra, newest at head, and the filter (bins 0..AEC_BLOCK)
+	std::vector<float> Xr, Xi;
+	std::vector<float> Wr, Wi;
+	std::vector<float> power;
+	std::vector<float> power_avg;
+	std::vector<float> far_peak;
+	std::vector<float> x_prev;
+	size_t head = 0;
+	size_t constrain_next = 0;
+
+	// Scratch
+	std::vector<float> re, im;
+	std::vector<float> Yr, Yi;
+
+	// Double talk / safety
+	int hold = 0;
+	float coupling = 0.3f;
+	int diverged = 0;
+
+	// Stats
+	float d_energy = 0.0f;
+	float e_energy = 0.0f;
+	float load = 0.0f;
+	int sample_rate;
+	std::atomic<bool> enabled = {true};
+	std::atomic<float> erle = {0.0f};
+	std::atomic<float> load_avg = {0.0f};
+	std::atomic<uint32_t> skipped = {0};
+
+	void processBlock(float *mic, const float *far, bool adapt) noexcept;
+	void constrain(size_t p) noexcept;
+
+public:
+	EchoCanceller(int sample_rate, int tail_ms = AEC_TAIL_MS);
+
+	void capture(float *mic, size_t n) noexcept;
+	void playback(const float *spk, size_t n, int channels) noexcept;
+	void reset() noexcept;
+
+	inline void setEnabled(bool x) noexcept { this->enabled = x; }
+	inline bool getEnabled() noexcept { return this->enabled; }
+	inline float getERLE() noexcept { return this->erle; }
+	inline float getLoad() noexcept { return this->load_avg; }
+	inline uint32_t getSkipped() noexcept { return this->skipped; }
+};
+
+#endif//_PC_AEC_HPP
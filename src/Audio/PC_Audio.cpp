@@ -1,7 +1,11 @@
 #include "PC_Audio.hpp"
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
 
-uint32_t PACKETS_LOST = 0;
-uint32_t TOTAL_PACKETS = 0;
+std::atomic<uint32_t> PACKETS_LOST = {0};
+std::atomic<uint32_t> TOTAL_PACKETS = {0};
 
 // Forward Declarations
 void opus_error_check(const std::string &message, int error, bool critical);
@@ -9,17 +13,41 @@ void Pa_ErrorCheck(const std::string &message, int error, bool critical);
 
 // Static variables for use within the static Pa_Callback() portaudio function
 OpusEncoder *APeer::encoder = nullptr;
-OpusDecoder *APeer::decoder = nullptr;
-float APeer::inputVolume = 1.0f;
-float APeer::outputVolume = 0.5f;
-bool APeer::micMute = false;
-bool APeer::deafen = false;
+std::atomic<float> APeer::inputVolume = {1.0f};
+std::atomic<float> APeer::outputVolume = {0.5f};
+std::atomic<bool> APeer::micMute = {false};
+std::atomic<bool> APeer::deafen = {false};
+APeer::PeerStream APeer::streams[MAX_STREAMS];
+EchoCanceller *APeer::aec = nullptr;
+CapturePreprocessor *APeer::preprocess = nullptr;
+std::atomic<uint32_t> APeer::xruns = {0};
+int APeer::outputChannels = 1;
+Resampler *APeer::inResampler = nullptr;
+Resampler *APeer::outResampler = nullptr;
+std::vector<float> APeer::captureFifo;
+std::vector<float> APeer::playFifo;
+size_t APeer::captureFill = 0;
+size_t APeer::playFill = 0;
+size_t APeer::playPrime = 0;
+unsigned long APeer::blockFrames = FRAME_SIZE;
+bool APeer::dspMode = false;
+SPSCRing<float> *APeer::captureRing = nullptr;
+SPSCRing<float> *APeer::playRing = nullptr;
+size_t APeer::dspPrime = 0;
+std::atomic<bool> APeer::dspRunning = {false};
+std::mutex APeer::dspLock;
+std::condition_variable APeer::dspWake;
+std::atomic<uint32_t> APeer::dspUnderruns = {0};
+std::atomic<uint32_t> APeer::dspResyncs = {0};
+std::atomic<uint32_t> APeer::dspDropped = {0};
+ForkJoin *APeer::decodeJobs = nullptr;
+SeqLock<AudioLevel> APeer::levels[MAX_STREAMS + 1];
 
 extern PeersChatNetwork *Network;
 
 /* APeer Constructor
- * Initialize PortAudio, set default devices, create an encoder and decoder
- * state, and set encoder settings.
+ * Initialize PortAudio, open the chosen (or default) devices, create an encoder
+ * and decoder state, and set encoder settings.
  */
 APeer::APeer() {
 	#ifdef AUDIO_DEBUG
@@ -29,28 +57,62 @@ APeer::APeer() {
 	portaudioError = Pa_Initialize();
 	Pa_ErrorCheck("Failed to initialize portaudio", portaudioError, true);
 	portaudioVersion = Pa_GetVersionText();
-	portaudioError = Pa_OpenDefaultStream(&stream, 1, 1,
-	                                      paFloat32,
-	                                      SAMPLE_RATE,
-	                                      FRAME_SIZE,
-	                                      Pa_Callback,
-	                                      Network);
-	Pa_ErrorCheck("Failed to open audio stream", portaudioError, true);
-	// Check default devices
-	defaultInput = Pa_GetDeviceInfo(Pa_GetDefaultInputDevice())->name;
-	defaultOutput = Pa_GetDeviceInfo(Pa_GetDefaultOutputDevice())->name;
+
+	// Stereo output if asked for, devices by index or name
+	const char *stereo = getenv("PEERSCHAT_STEREO");
+	stereoRequested = stereo && atoi(stereo) != 0;
+	const char *dspThreadEnv = getenv("PEERSCHAT_DSP_THREAD");
+	dspMode = dspThreadEnv && atoi(dspThreadEnv) != 0;
+	inputDevice = findDevice(getenv("PEERSCHAT_INPUT_DEVICE"), true);
+	outputDevice = findDevice(getenv("PEERSCHAT_OUTPUT_DEVICE"), false);
+	openStream();
+	#ifdef AUDIO_DEBUG
+	for (const AudioDevice &device : getDevices())
+		std::cout << "Audio device " << device.index << ": " << device.name << " (" << device.maxInputChannels
+		          << " in, " << device.maxOutputChannels << " out, " << device.defaultSampleRate << " Hz)" << std::endl;
+	#endif
 
 	opusVersion = opus_get_version_string();
 	// Create and error check encoder and decoder states
 	encoder = opus_encoder_create(SAMPLE_RATE, CHANNELS, OPUS_APPLICATION_VOIP, &opusError);
 	opus_error_check("Failed to create encoder", opusError, true);
-	decoder = opus_decoder_create(SAMPLE_RATE, CHANNELS, &opusError);
-	opus_error_check("Failed to create decoder", opusError, true);
+	for (PeerStream &stream : streams) {
+		stream.decoder = opus_decoder_create(SAMPLE_RATE, CHANNELS, &opusError);
+		opus_error_check("Failed to create decoder", opusError, true);
+		stream.drift = new Resampler(SAMPLE_RATE, SAMPLE_RATE, CHANNELS, FRAME_SIZE, true);
+	}
+
+	// Echo canceller, on unless PEERSCHAT_AEC=0
+	aec = new EchoCanceller(SAMPLE_RATE);
+	const char *aecEnv = getenv("PEERSCHAT_AEC");
+	if (aecEnv && atoi(aecEnv) == 0)
+		aec->setEnabled(false);
+
+	// Capture cleanup, each stage on unless PEERSCHAT_HPF/NS/AGC=0
+	preprocess = new CapturePreprocessor(SAMPLE_RATE);
+	const char *env;
+	if ((env = getenv("PEERSCHAT_HPF")) && atoi(env) == 0)
+		preprocess->setHighPass(false);
+	if ((env = getenv("PEERSCHAT_NS")) && atoi(env) == 0)
+		preprocess->setNoiseSuppression(false);
+	if ((env = getenv("PEERSCHAT_AGC")) && atoi(env) == 0)
+		preprocess->setAutoGain(false);
+
+	// Decode helpers, PEERSCHAT_DECODE_THREADS=n (0 decodes everything inline)
+	if ((env = getenv("PEERSCHAT_DECODE_THREADS")) && atoi(env) > 0) {
+		decodeJobs = new ForkJoin();
+		auto decode = [](size_t i) { return decodePeer(streams[i].peer, &streams[i], streams[i].play); };
+		if (!decodeJobs->start(MAX_STREAMS, std::min(atoi(env), MAX_STREAMS - 1), THREAD_AUDIO, decode)) {
+			delete decodeJobs;
+			decodeJobs = nullptr;
+		}
+	}
 
 	// Set some encoder settings
 	opus_encoder_ctl(encoder, OPUS_SET_SIGNAL(OPUS_SIGNAL_VOICE));
 	opus_encoder_ctl(encoder, OPUS_SET_VBR(0));
 	opus_encoder_ctl(encoder, OPUS_SET_BITRATE(BITRATE));
+	opus_encoder_ctl(encoder, OPUS_SET_DTX(1));
 	//opus_encoder_ctl(encoder, OPUS_SET_INBAND_FEC(1));
 	//opus_encoder_ctl(encoder, OPUS_SET_PACKET_LOSS_PERC(50));
 	#ifdef AUDIO_DEBUG
@@ -67,19 +129,175 @@ APeer::~APeer() {
 	std::cout << "APeer Destructor Called" << std::endl;
 	#endif
 	Pa_AbortStream(stream);
+	stopDSP();
 	Pa_CloseStream(stream);
+	delete inResampler;
+	delete outResampler;
+	delete captureRing;
+	delete playRing;
+	if (decodeJobs) {
+		decodeJobs->stop();
+		delete decodeJobs;
+		decodeJobs = nullptr;
+	}
 	opus_encoder_destroy(encoder);
-	opus_decoder_destroy(decoder);
+	for (PeerStream &stream : streams) {
+		opus_decoder_destroy(stream.decoder);
+		delete stream.drift;
+		stream.drift = nullptr;
+	}
+	delete aec;
+	aec = nullptr;
+	delete preprocess;
+	preprocess = nullptr;
 	Pa_Terminate();
 	#ifdef AUDIO_DEBUG
 	std::cout << "Apeer Destructor Completed" << std::endl;
 	#endif
 }
 
+/* getStream()
+ * Returns the PeerStream for the peer with the given ID, claiming a free slot
+ * and resetting its decoder if the peer doesn't have one yet.  Returns nullptr
+ * if every slot is taken.
+ */
+APeer::PeerStream *APeer::getStream(int id) {
+	PeerStream *freeSlot = nullptr;
+	for (PeerStream &stream : streams) {
+		if (stream.id == id)
+			return &stream;
+		if (stream.id == 0 && !freeSlot && !streamBusy(&stream))
+			freeSlot = &stream;
+	}
+	if (freeSlot) {
+		opus_decoder_init(freeSlot->decoder, SAMPLE_RATE, CHANNELS);
+		freeSlot->drift->reset();
+		freeSlot->fill = 0;
+		freeSlot->id = id;
+		freeSlot->concealed = PLC_MAX_FRAMES;
+		freeSlot->gainL = 0.0f;
+		freeSlot->gainR = 0.0f;
+	}
+	return freeSlot;
+}
+
+/* decodePeer()
+ * Fills the stream's pcm buffer with the peer's next frame at our clock.  The
+ * peer's frames are stretched or squeezed by its playout rate on the way into
+ * the fifo, so now and then that takes two packets or none.  Returns true if
+ * the pcm buffer holds audio for this block.
+ * play: false when deafened; a packet is consumed but not decoded.
+ */
+bool APeer::decodePeer(NPeer *peer, PeerStream *stream, bool play) {
+	if (!play) {
+		stream->fill = 0;
+		decodePacket(peer, stream, false);
+		return false;
+	}
+
+	stream->drift->setRatio(peer->getPlayoutRate());
+	while (stream->fill < FRAME_SIZE) {
+		int decoded = decodePacket(peer, stream, true);
+		if (decoded <= 0) {
+			// Gone quiet -- What is left would only be the tail of the concealment
+			stream->fill = 0;
+			return false;
+		}
+		stream->fill += stream->drift->process(stream->frame, (size_t) decoded, &stream->fifo[stream->fill * CHANNELS],
+		                                       STREAM_FIFO_SIZE - stream->fill);
+	}
+
+	std::memcpy(stream->pcm, stream->fifo, sizeof(float) * FRAME_SIZE * CHANNELS);
+	stream->fill -= FRAME_SIZE;
+	std::memmove(stream->fifo, &stream->fifo[FRAME_SIZE * CHANNELS], sizeof(float) * stream->fill * CHANNELS);
+	return true;
+}
+
+/* decodePacket()
+ * Pulls the next packet from a peer and decodes it into the stream's frame
+ * buffer.  Runs packet loss concealment for a few frames when a packet is
+ * missing.  Returns the samples decoded, 0 or less if there are none.
+ * play: false when deafened; the packet is consumed but not decoded.
+ */
+int APeer::decodePacket(NPeer *peer, PeerStream *stream, bool play) {
+	// Get Audio From Peer
+	uint32_t lastPacketID = peer->getInPacketId();
+	std::unique_ptr<AudioInPacket> inPacket(peer->getAudioInPacket());
+
+	if (inPacket.get() == nullptr) {
+		// Conceal a missing packet, go quiet after a while (DTX)
+		if (!play || stream->concealed >= PLC_MAX_FRAMES)
+			return 0;
+		stream->concealed++;
+		return opus_decode_float(stream->decoder, nullptr, 0, stream->frame, FRAME_SIZE, 0);
+	}
+
+	// Gather Packet Loss Statistics
+	PACKETS_LOST += inPacket->packet_id - lastPacketID - 1;
+	TOTAL_PACKETS = inPacket->packet_id;
+
+	// Decode Audio Input
+	int decodedFrame = 0;
+	if (play) {
+		decodedFrame = opus_decode_float(stream->decoder, inPacket->packet.get(), inPacket->packet_len,
+		                                 stream->frame, FRAME_SIZE, 0);
+		#ifdef AUDIO_DEBUG
+		opus_error_check("Failed to decode frame", decodedFrame, false);
+		#endif
+		stream->concealed = 0;
+	}
+	peer->retireEmptyInPacket(inPacket.release());
+	return decodedFrame;
+}
+
+/* decodeAll()
+ * Decodes the next frame of every stream marked seen.  Without helpers that is
+ * a plain loop.  Otherwise the streams are queued, helpers are woken (a
+ * semaphore post, no lock), and the mixer decodes alongside them until all
+ * are done or DECODE_DEADLINE_US is up, sleeping on the helpers rather than
+ * spinning.  Streams nobody started by then stay undecoded (their packet is
+ * kept for the next frame); streams still decoding are abandoned and sit out
+ * this frame and every one until their helper lets go.  Either way they are
+ * mixed as a lost frame.
+ */
+void APeer::decodeAll(bool play) {
+	if (!decodeJobs) {
+		for (PeerStream &stream : streams)
+			stream.decoded = stream.seen && decodePeer(stream.peer, &stream, play);
+		return;
+	}
+
+	for (int i = 0; i < MAX_STREAMS; i++) {
+		PeerStream &stream = streams[i];
+		stream.decoded = false;
+		if (!stream.seen || decodeJobs->busy(i))
+			continue;
+		stream.play = play;
+		decodeJobs->queue(i);
+	}
+	decodeJobs->run(std::chrono::steady_clock::now() + std::chrono::microseconds(DECODE_DEADLINE_US));
+
+	// Only what finished in time is ours to mix
+	for (int i = 0; i < MAX_STREAMS; i++)
+		streams[i].decoded = streams[i].seen && decodeJobs->done(i) && decodeJobs->result(i);
+}
+
+/* streamBusy()
+ * True while a decode helper that missed its deadline is still on the stream.
+ * Until then nothing of it (peer, decoder, buffers) may be touched.
+ */
+bool APeer::streamBusy(const PeerStream *stream) {
+	return decodeJobs && decodeJobs->busy(stream - streams);
+}
+
 /* Pa_Callback()
  * Called automatically every time the PortAudio engine has
- * captured audio data.  Encoding/decoding, input/output volumes, and enqueueing
- * audio packets is done here.
+ * captured audio data.  Normally the buffers are processed right here by
+ * processBlock().  With the DSP thread the callback only swaps audio with the
+ * rings: the mic goes into captureRing, the output comes out of playRing.  If
+ * the DSP thread fell behind we play silence (an underrun), and if it then
+ * catches up with more queued than the lead we drop the excess (a resync) so
+ * the latency doesn't stay grown.
  */
 int APeer::Pa_Callback(const void *input,
                        void *output,
@@ -88,74 +306,440 @@ int APeer::Pa_Callback(const void *input,
                        PaStreamCallbackFlags status_flags,
                        void *userData)
 {
-	// Buffer For Audio Out
-	static uint8_t buffer[BUFFER_SIZE];
-	uint32_t buffer_len = 0;
-
 	// Cast to correct type
 	float *in = (float *) input;
 	float *out = (float *) output;
 
-	// Mic Input Volume Multiplier
-	if(micMute)
+	// Raise the callback thread's priority the first time through
+	static bool policy_applied = false;
+	if(!policy_applied)
 	{
-		std::memset((void*) in, 0, sizeof(float) * framesPerBuffer);
+		apply_thread_policy(THREAD_AUDIO);
+		policy_applied = true;
+	}
+
+	// Count Under/Overruns
+	if(status_flags & (paInputUnderflow | paInputOverflow | paOutputUnderflow | paOutputOverflow))
+		xruns++;
+
+	if(!dspMode)
+	{
+		processBlock(in, out, framesPerBuffer);
+		return 0;
+	}
+
+	// Hand the mic to the DSP thread, wake it once it has a whole block
+	if(captureRing->write(in, framesPerBuffer) < framesPerBuffer)
+		dspDropped++;
+	if(captureRing->available() >= blockFrames)
+		dspWake.notify_one();
+
+	// Play what the DSP thread has ready
+	const size_t outSamples = framesPerBuffer * outputChannels;
+	size_t queued = playRing->available() / outputChannels;
+	if(queued > dspPrime + framesPerBuffer)
+	{
+		playRing->discard((queued - dspPrime) * outputChannels);
+		dspResyncs++;
+	}
+	size_t got = playRing->read(out, outSamples);
+	if(got < outSamples)
+	{
+		std::memset(out + got, 0, sizeof(float) * (outSamples - got));
+		dspUnderruns++;
+	}
+	return 0;
+}
+
+/* processBlock()
+ * One device buffer, from Pa_Callback or the DSP thread.  When the devices run
+ * at SAMPLE_RATE it goes straight to processFrame().  Otherwise the mic is
+ * converted to SAMPLE_RATE, processed one FRAME_SIZE at a time, and the output
+ * converted back; FIFOs take up the difference in block sizes.
+ */
+void APeer::processBlock(float *in, float *out, unsigned long framesPerBuffer)
+{
+	// Device runs at our rate and block size
+	if(!inResampler)
+	{
+		processFrame(in, out);
+		return;
+	}
+
+	// Device rate -> SAMPLE_RATE, then process every whole frame we have
+	static float frameOut[FRAME_SIZE * 2];
+	captureFill += inResampler->process(in, framesPerBuffer, &captureFifo[captureFill], captureFifo.size() - captureFill);
+	while(captureFill >= FRAME_SIZE)
+	{
+		processFrame(captureFifo.data(), frameOut);
+		captureFill -= FRAME_SIZE;
+		std::memmove(captureFifo.data(), captureFifo.data() + FRAME_SIZE, sizeof(float) * captureFill);
+
+		// SAMPLE_RATE -> device rate
+		size_t room = playFifo.size() / outputChannels - playFill;
+		playFill += outResampler->process(frameOut, FRAME_SIZE, &playFifo[playFill * outputChannels], room);
+	}
+
+	// Hand the device what we have, silence (and an xrun) if it isn't enough
+	size_t frames = std::min((size_t) framesPerBuffer, playFill);
+	std::memcpy(out, playFifo.data(), sizeof(float) * frames * outputChannels);
+	if(frames < framesPerBuffer)
+	{
+		std::memset(out + frames * outputChannels, 0, sizeof(float) * (framesPerBuffer - frames) * outputChannels);
+		xruns++;
 	}
-	else if (inputVolume < 0.98f || inputVolume > 1.02f)
+	playFill -= frames;
+	std::memmove(playFifo.data(), playFifo.data() + frames * outputChannels, sizeof(float) * playFill * outputChannels);
+}
+
+/* dspLoop()
+ * The DSP thread.  Takes blockFrames of mic audio at a time from captureRing,
+ * runs processBlock() on it and queues the result on playRing.  Sleeps while
+ * there isn't a whole block; the timeout covers a wake-up the callback sent
+ * just before we started waiting.
+ */
+void APeer::dspLoop()
+{
+	apply_thread_policy(THREAD_AUDIO);
+	std::vector<float> in(blockFrames);
+	std::vector<float> out(blockFrames * outputChannels);
+	const auto period = std::chrono::microseconds(1000000 * blockFrames / DSP_PERIODS / SAMPLE_RATE);
+
+	while(dspRunning)
 	{
-		for (unsigned int i = 0; i < framesPerBuffer; ++i)
-			in[i] *= inputVolume;
+		if(captureRing->available() < blockFrames)
+		{
+			std::unique_lock<std::mutex> guard(dspLock);
+			dspWake.wait_for(guard, period);
+			continue;
+		}
+		captureRing->read(in.data(), blockFrames);
+		processBlock(in.data(), out.data(), blockFrames);
+		playRing->write(out.data(), out.size());
 	}
+}
+
+/* startDSP()
+ * Empties the rings, queues dspPrime frames of silence so the device has
+ * something to play while the first block is gathered, and starts the DSP
+ * thread.  Does nothing unless PEERSCHAT_DSP_THREAD is set.
+ */
+void APeer::startDSP() {
+	if (!dspMode || dspRunning)
+		return;
+	captureRing->clear();
+	playRing->clear();
+	std::vector<float> silence(dspPrime * outputChannels, 0.0f);
+	playRing->write(silence.data(), silence.size());
+	dspRunning = true;
+	dspThread = std::thread(dspLoop);
+}
+
+/* stopDSP()
+ * Stops and joins the DSP thread.  The stream has to be stopped first.
+ */
+void APeer::stopDSP() {
+	if (!dspRunning)
+		return;
+	dspRunning = false;
+	dspWake.notify_one();
+	if (dspThread.joinable())
+		dspThread.join();
+}
+
+/* processFrame()
+ * One FRAME_SIZE block at SAMPLE_RATE.  Echo cancellation, capture cleanup,
+ * encoding/decoding, input/output volumes, and enqueueing audio packets is done
+ * here.  Every peer is decoded with its own decoder and mixed into the output
+ * with its own gain.  In stereo mode the peers are spread evenly from left to
+ * right in the order they were joined.
+ */
+void APeer::processFrame(float *in, float *out)
+{
+	// Buffer For Audio Out
+	static const DSPKernels &kernels = dsp();
+	static uint8_t buffer[BUFFER_SIZE];
+	static uint32_t capture_time = 0;
+	const unsigned long framesPerBuffer = FRAME_SIZE;
+	uint32_t buffer_len = 0;
+
+	// Take this block's parameters
+	const bool deaf = deafen.load(std::memory_order_relaxed);
+	const float inVol = micMute.load(std::memory_order_relaxed) ? 0.0f : inputVolume.load(std::memory_order_relaxed);
+	const float outVol = outputVolume.load(std::memory_order_relaxed);
+
+	// Remove what the mic picked up of our last output
+	aec->capture(in, framesPerBuffer);
+
+	// High-pass, noise suppression and AGC
+	preprocess->process(in, framesPerBuffer);
+
+	// Mic Input Volume Multiplier -- Ramp from the last block's volume so changes don't click
+	static float lastInputVolume = 1.0f;
+	if(inVol != lastInputVolume)
+		kernels.gain_ramp(in, lastInputVolume, inVol, framesPerBuffer);
+	else if(inVol == 0.0f)
+		std::memset((void*) in, 0, sizeof(float) * framesPerBuffer);
+	else if(inVol < 0.98f || inVol > 1.02f)
+		kernels.gain(in, inVol, framesPerBuffer);
+	lastInputVolume = inVol;
+	publishLevel(MAX_STREAMS, 0, in, framesPerBuffer);
 
 	// Encode Audio Into Opus Packet and Store into Buffer
 	buffer_len = opus_encode_float(encoder, in, FRAME_SIZE, buffer, BUFFER_SIZE);
 	#ifdef AUDIO_DEBUG
 	opus_error_check("Failed to encode frame", buffer_len, true);
 	#endif
+	uint8_t flags = (buffer_len <= 2) ? AUDIO_DTX : 0;
 
-	// Clear Output Buffer If it isn't getting filled with more data
-	if(Network->getNumberPeers() == 0 || deafen)
-		std::memset((void*) out, 0, sizeof(float) * framesPerBuffer);
+	// Peers get mixed into the output buffer
+	const unsigned long outSamples = framesPerBuffer * outputChannels;
+	std::memset((void*) out, 0, sizeof(float) * outSamples);
+	for (PeerStream &stream : streams)
+		stream.seen = false;
 
-	// Send/Retrieve Data From Peers
-	for (int i = 0; i < Network->getNumberPeers(); i++)
+	// Send To Peers, line up a stream for each to decode into
+	const int numPeers = Network->getNumberPeers();
+	PeerStream *order[MAX_STREAMS];
+	float targets[MAX_STREAMS];
+	int positions[MAX_STREAMS];
+	int numStreams = 0;
+	for (int i = 0; i < numPeers; i++)
 	{
 		NPeer *peer = (*Network)[i];
+		if (!peer) continue;
 
 		// Give Peer Copy of Output Audio
 		std::unique_ptr<AudioOutPacket> out_pack(peer->getEmptyOutPacket());
 		std::memcpy(out_pack->packet.get(), buffer, buffer_len);
 		out_pack->packet_len = buffer_len;
+		out_pack->timestamp = capture_time;
+		out_pack->flags = flags;
 		peer->enqueue_out(out_pack.release());
 
-		// Get Audio From Peer
-		uint32_t lastPacketID = peer->getInPacketId();
-		std::unique_ptr<AudioInPacket> inPacket(peer->getAudioInPacket());
-		if (inPacket.get() == nullptr) continue;
+		PeerStream *stream = getStream(peer->getID());
+		if (!stream || numStreams == MAX_STREAMS) continue;
+		stream->seen = true;
+		if (!streamBusy(stream))
+			stream->peer = peer;
+		order[numStreams] = stream;
+		targets[numStreams] = (deaf || peer->getMute()) ? 0.0f : peer->getGain();
+		positions[numStreams] = i;
+		numStreams++;
+	}
 
-		// Gather Packet Loss Statistics
-		PACKETS_LOST += inPacket->packet_id - lastPacketID - 1;
-		TOTAL_PACKETS = inPacket->packet_id;
+	// Decode every peer's next frame
+	decodeAll(!deaf);
 
-		// Decode Audio Input
-		if(deafen)
-		{
-			peer->retireEmptyInPacket(inPacket.release());
+	// Mix them in, ramping to each peer's gain (0 if muted)
+	for (int n = 0; n < numStreams; n++)
+	{
+		PeerStream *stream = order[n];
+		const float target = targets[n];
+		const int i = positions[n];
+		if (!stream->decoded) {
+			stream->gainL = stream->gainR = 0.0f;
 			continue;
 		}
+		if (outputChannels == 2) {
+			// Constant power pan: position -1 (left) .. 1 (right)
+			float position = (numPeers > 1) ? PAN_WIDTH * (2.0f * i / (numPeers - 1) - 1.0f) : 0.0f;
+			float angle = (position + 1.0f) * (float) M_PI / 4.0f;
+			float left = target * std::cos(angle), right = target * std::sin(angle);
+			if (left != stream->gainL || right != stream->gainR || target != 0.0f)
+				kernels.mix_pan(out, stream->pcm, stream->gainL, stream->gainR, left, right, framesPerBuffer);
+			stream->gainL = left;
+			stream->gainR = right;
+		} else {
+			if (target != stream->gainL)
+				kernels.mix_ramp(out, stream->pcm, stream->gainL, target, framesPerBuffer);
+			else if (target != 0.0f)
+				kernels.mix(out, stream->pcm, target, framesPerBuffer);
+			stream->gainL = target;
+		}
+	}
 
-		int decodedFrame = opus_decode_float(decoder, inPacket->packet.get(), inPacket->packet_len, out, FRAME_SIZE, 0);
-		#ifdef AUDIO_DEBUG
-		opus_error_check("Failed to decode frame", decodedFrame, false);
-		#endif
-		peer->retireEmptyInPacket(inPacket.release());
+	// Release the streams of peers that left (once nobody is decoding into them)
+	for (PeerStream &stream : streams)
+		if (!stream.seen && !streamBusy(&stream))
+			stream.id = 0;
+
+	// Meter what each peer said this frame (silence if nothing was decoded)
+	for (int slot = 0; slot < MAX_STREAMS; slot++) {
+		PeerStream &stream = streams[slot];
+		publishLevel(slot, stream.id ? stream.id : -1, (stream.seen && stream.decoded) ? stream.pcm : nullptr, framesPerBuffer);
 	}
 
-	// Apply Output Volume Multiplier
-	if(!deafen && (Network->getNumberPeers() > 0) && (outputVolume < 0.98f || outputVolume > 1.02f))
-		for(unsigned int j = 0; j < framesPerBuffer; ++j)
-			out[j] *= outputVolume;
-	return 0;
+	// Advance Media Clock
+	capture_time += FRAME_SIZE;
+
+	// Apply Output Volume Multiplier and keep the peaks from hard clipping
+	static float lastOutputVolume = 1.0f;
+	if(!deaf && (numPeers > 0))
+	{
+		if(outVol != lastOutputVolume)
+			kernels.gain_ramp(out, lastOutputVolume, outVol, outSamples);
+		else if(outVol < 0.98f || outVol > 1.02f)
+			kernels.gain(out, outVol, outSamples);
+		kernels.soft_clip(out, outSamples);
+		lastOutputVolume = outVol;
+	}
+
+	// What we play is the echo reference for the next callback
+	aec->playback(out, framesPerBuffer, outputChannels);
+}
+
+/* publishLevel()
+ * Meters a frame for the GUI.  pcm nullptr meters silence.  Runs once per frame
+ * per slot on the mixing thread, the only writer of levels[] and of last[].
+ */
+void APeer::publishLevel(int slot, int id, const float *pcm, size_t n) {
+	static AudioLevel last[MAX_STREAMS + 1];
+	AudioLevel &level = last[slot];
+	float peak = 0.0f, rms = 0.0f;
+	if (pcm)
+		dsp().peak_rms(pcm, n, &peak, &rms);
+
+	// New occupant starts from zero
+	if (level.id != id)
+		level = AudioLevel();
+	level.id = id;
+	level.peak = std::max(peak, level.peak * LEVEL_RELEASE);
+	level.rms = std::max(rms, level.rms * LEVEL_RELEASE);
+	levels[slot].store(level);
+}
+
+/* getLevel()
+ * Latest meter reading for a peer ID, 0 for our mic.
+ */
+bool APeer::getLevel(int id, AudioLevel &level) {
+	if (id < 0)
+		return false;
+	for (const SeqLock<AudioLevel> &slot : levels) {
+		level = slot.load();
+		if (level.id == id)
+			return true;
+	}
+	return false;
+}
+
+/* findDevice()
+ * Looks up a device from a PEERSCHAT_*_DEVICE value: an index, or part of a
+ * device name.  Returns paNoDevice (use the default) if nothing matches.
+ */
+PaDeviceIndex APeer::findDevice(const char *spec, bool input) {
+	if (!spec || !*spec)
+		return paNoDevice;
+	std::string name(spec);
+	bool isIndex = name.find_first_not_of("0123456789") == std::string::npos;
+	for (const AudioDevice &device : getDevices()) {
+		int channels = input ? device.maxInputChannels : device.maxOutputChannels;
+		if (channels <= 0)
+			continue;
+		if (isIndex ? (device.index == atoi(spec)) : (device.name.find(name) != std::string::npos))
+			return device.index;
+	}
+	std::cerr << "No " << (input ? "input" : "output") << " device matching \"" << name << "\", using the default" << std::endl;
+	return paNoDevice;
+}
+
+/* openStream()
+ * Opens inputDevice/outputDevice (default if paNoDevice).  The stream runs at
+ * the first rate both devices support out of: the input's native rate, the
+ * output's native rate, SAMPLE_RATE.  If that isn't SAMPLE_RATE the resamplers
+ * and FIFOs for Pa_Callback are set up here.  With the DSP thread the device
+ * runs DSP_PERIODS callbacks per block and the rings are sized here too.
+ */
+void APeer::openStream() {
+	PaDeviceIndex input = (inputDevice == paNoDevice) ? Pa_GetDefaultInputDevice() : inputDevice;
+	PaDeviceIndex output = (outputDevice == paNoDevice) ? Pa_GetDefaultOutputDevice() : outputDevice;
+	const PaDeviceInfo *inputInfo = Pa_GetDeviceInfo(input);
+	const PaDeviceInfo *outputInfo = Pa_GetDeviceInfo(output);
+	if (!inputInfo || !outputInfo)
+		Pa_ErrorCheck("Failed to find audio devices", paInvalidDevice, true);
+
+	outputChannels = (stereoRequested && outputInfo->maxOutputChannels >= 2) ? 2 : 1;
+	PaStreamParameters inParams = { input, 1, paFloat32, inputInfo->defaultLowInputLatency, nullptr };
+	PaStreamParameters outParams = { output, outputChannels, paFloat32, outputInfo->defaultLowOutputLatency, nullptr };
+
+	// Sample Rate Negotiation
+	const double rates[] = { inputInfo->defaultSampleRate, outputInfo->defaultSampleRate, (double) SAMPLE_RATE };
+	streamRate = SAMPLE_RATE;
+	for (double rate : rates) {
+		if (Pa_IsFormatSupported(&inParams, &outParams, rate) == paFormatIsSupported) {
+			streamRate = rate;
+			break;
+		}
+	}
+
+	// Rate Conversion
+	delete inResampler;
+	delete outResampler;
+	inResampler = outResampler = nullptr;
+	unsigned long deviceFrames = FRAME_SIZE;
+	if ((int) streamRate != SAMPLE_RATE) {
+		deviceFrames = (unsigned long) std::lround(FRAME_SIZE * streamRate / SAMPLE_RATE);
+		inResampler = new Resampler((int) streamRate, SAMPLE_RATE, 1, deviceFrames);
+		outResampler = new Resampler(SAMPLE_RATE, (int) streamRate, outputChannels, FRAME_SIZE);
+		captureFifo.assign(2 * FRAME_SIZE + inResampler->maxOutput(deviceFrames), 0.0f);
+		playFifo.assign((4 * deviceFrames + outResampler->maxOutput(FRAME_SIZE)) * outputChannels, 0.0f);
+		playPrime = deviceFrames;
+		resetRateConversion();
+	}
+	blockFrames = deviceFrames;
+
+	// DSP Thread: Smaller device buffers, the thread gets DSP_LEAD of them to finish a block
+	unsigned long callbackFrames = deviceFrames;
+	delete captureRing;
+	delete playRing;
+	captureRing = playRing = nullptr;
+	if (dspMode) {
+		callbackFrames = deviceFrames / DSP_PERIODS;
+		dspPrime = deviceFrames + DSP_LEAD * callbackFrames;
+		captureRing = new SPSCRing<float>(4 * deviceFrames);
+		playRing = new SPSCRing<float>((4 * deviceFrames + dspPrime) * outputChannels);
+	}
+
+	portaudioError = Pa_OpenStream(&stream, &inParams, &outParams, streamRate, callbackFrames,
+	                               paNoFlag, Pa_Callback, Network);
+	Pa_ErrorCheck("Failed to open audio stream", portaudioError, true);
+	defaultInput = inputInfo->name;
+	defaultOutput = outputInfo->name;
+	#ifdef AUDIO_DEBUG
+	std::cout << "Audio stream: " << defaultInput << " -> " << defaultOutput << " at " << streamRate
+	          << " Hz, " << getLatency() << " ms" << std::endl;
+	#endif
+}
+
+/* resetRateConversion()
+ * Empties the FIFOs and primes the output one device buffer ahead, so the
+ * device never waits on a frame that is still being gathered.
+ */
+void APeer::resetRateConversion() {
+	if (!inResampler)
+		return;
+	inResampler->reset();
+	outResampler->reset();
+	captureFill = 0;
+	playFill = playPrime;
+	std::fill(playFifo.begin(), playFifo.end(), 0.0f);
+}
+
+/* setDevices()
+ * Switches to other devices (paNoDevice for the default).  Reopens the stream,
+ * and restarts it if it was running.
+ */
+void APeer::setDevices(PaDeviceIndex input, PaDeviceIndex output) {
+	bool running = Pa_IsStreamActive(stream) == 1;
+	if (running)
+		Pa_AbortStream(stream);
+	stopDSP();
+	Pa_CloseStream(stream);
+	inputDevice = input;
+	outputDevice = output;
+	openStream();
+	if (running)
+		startVoiceStream();
 }
 
 /* startVoiceStream()
@@ -164,6 +748,10 @@ int APeer::Pa_Callback(const void *input,
  */
 void APeer::startVoiceStream() {
 	if (Pa_IsStreamStopped(stream)) {
+		aec->reset();
+		preprocess->reset();
+		resetRateConversion();
+		startDSP();
 		portaudioError = Pa_StartStream(stream);
 		Pa_ErrorCheck("Failed to start stream", portaudioError, true);
 		std::cout << "Audio Stream Opened" << std::endl;
@@ -180,7 +768,20 @@ void APeer::stopVoiceStream() {
 		Pa_AbortStream(stream);
 //		Pa_StopStream(stream);
 		Pa_ErrorCheck("Failed to stop stream", portaudioError, true);
-		std::cout << "Audio Stream Stopped" << std::endl;
+		stopDSP();
+		std::cout << "Audio Stream Stopped (" << xruns.load() << " xruns)" << std::endl;
+		#ifdef AUDIO_DEBUG
+		if (dspMode)
+			std::cout << "DSP thread: " << dspUnderruns.load() << " underruns, " << dspResyncs.load()
+			          << " resyncs, " << dspDropped.load() << " mic buffers dropped" << std::endl;
+		std::cout << "AEC: ERLE " << aec->getERLE() << " dB, load " << aec->getLoad()
+		          << ", " << aec->getSkipped() << " frames over budget" << std::endl;
+		if (decodeJobs)
+			std::cout << "Decode helpers: " << decodeJobs->helpers() << ", " << decodeJobs->getLate()
+			          << " streams past the deadline" << std::endl;
+		std::cout << "Preprocess: AGC gain " << preprocess->getGain() << ", load " << preprocess->getLoad()
+		          << ", " << preprocess->getBypassed() << " frames without noise suppression" << std::endl;
+		#endif
 	} else {
 		std::cout << "No stream currently open" << std::endl;
 	}
@@ -202,15 +803,52 @@ float APeer::getOutputVolume() {
 	return outputVolume;
 }
 
+/* getXRuns()
+ * Returns the number of callbacks that reported an input/output underflow or
+ * overflow through status_flags.
+ */
+uint32_t APeer::getXRuns() {
+	return xruns;
+}
+
+/* getMuteMic()
+ * Returns true if the mic is muted.
+ */
+bool APeer::getMuteMic() {
+	return micMute;
+}
+
+/* getDSPUnderruns()
+ * Returns how many callbacks found playRing short because the DSP thread was
+ * late.  Always 0 without the DSP thread.
+ */
+uint32_t APeer::getDSPUnderruns() {
+	return dspUnderruns;
+}
+
+/* getEchoCancel()
+ * Returns true if echo cancellation is on.
+ */
+bool APeer::getEchoCancel() {
+	return aec->getEnabled();
+}
+
+/* isStereo()
+ * Returns true if the output stream was opened with two channels.
+ */
+bool APeer::isStereo() {
+	return outputChannels == 2;
+}
+
 /* getDefaultInput()
- * Returns a string that contains the name of the current default input device.
+ * Returns a string that contains the name of the input device in use.
  */
 std::string APeer::getDefaultInput() {
 	return defaultInput;
 }
 
 /* getDefaultOutput()
- * Returns a string that contains the name of the current default output device.
+ * Returns a string that contains the name of the output device in use.
  */
 std::string APeer::getDefaultOutput() {
 	return defaultOutput;
@@ -238,6 +876,46 @@ const PaStreamInfo *APeer::getStreamInfo() {
 	return Pa_GetStreamInfo(stream);
 }
 
+/* getDevices()
+ * Lists every device PortAudio knows about.
+ */
+std::vector<AudioDevice> APeer::getDevices() {
+	std::vector<AudioDevice> devices;
+	for (PaDeviceIndex i = 0; i < Pa_GetDeviceCount(); i++) {
+		const PaDeviceInfo *info = Pa_GetDeviceInfo(i);
+		if (info)
+			devices.push_back({ i, info->name, info->maxInputChannels, info->maxOutputChannels, info->defaultSampleRate });
+	}
+	return devices;
+}
+
+/* getSampleRate()
+ * Returns the rate the devices run at.  Anything but SAMPLE_RATE is resampled.
+ */
+double APeer::getSampleRate() {
+	return streamRate;
+}
+
+/* getLatency()
+ * Returns the mic to speaker latency (ms) we know of: the devices' own
+ * latency, the noise suppressor's window, when resampling both filters plus
+ * the output FIFO's head start, and with the DSP thread the audio queued
+ * ahead on playRing.
+ */
+double APeer::getLatency() {
+	const PaStreamInfo *info = Pa_GetStreamInfo(stream);
+	double seconds = info ? info->inputLatency + info->outputLatency : 0.0;
+	seconds += (double) NS_FFT_SIZE / SAMPLE_RATE;
+	if (inResampler) {
+		seconds += inResampler->getDelay() / SAMPLE_RATE;
+		seconds += outResampler->getDelay() / streamRate;
+		seconds += playPrime / streamRate;
+	}
+	if (dspMode)
+		seconds += dspPrime / streamRate;
+	return seconds * 1000.0;
+}
+
 /* getCPULoad()
  * Returns the current CPU load of the port audio stream.
  */
@@ -284,6 +962,34 @@ void APeer::setDeafen(bool deafenState) {
 	deafen = deafenState;
 }
 
+/* setNoiseSuppression()
+ * Turns capture noise suppression on or off.  Safe while the stream is running.
+ */
+void APeer::setNoiseSuppression(bool state) {
+	preprocess->setNoiseSuppression(state);
+}
+
+/* setAutoGain()
+ * Turns capture automatic gain control on or off.  Safe while the stream is running.
+ */
+void APeer::setAutoGain(bool state) {
+	preprocess->setAutoGain(state);
+}
+
+/* setHighPass()
+ * Turns the capture high-pass filter on or off.  Safe while the stream is running.
+ */
+void APeer::setHighPass(bool state) {
+	preprocess->setHighPass(state);
+}
+
+/* setEchoCancel()
+ * Turns echo cancellation on or off.  Safe while the stream is running.
+ */
+void APeer::setEchoCancel(bool state) {
+	aec->setEnabled(state);
+}
+
 // Non class functions ---------------------------------------------------------
 
 /* opus_ErrorCheck()
@@ -9,8 +9,16 @@
 #include <opus.h>     // https://opus-codec.org/docs/opus_api-1.3.1/index.html
 #include <portaudio.h>// http://portaudio.com/docs/v19-doxydocs/
 #include <memory>
+#include <atomic>
+#include <vector>
+#include <string>
 
 #include "PC_Network.hpp"
+#include "PC_DSP.hpp"
+#include "PC_AEC.hpp"
+#include "PC_Preprocess.hpp"
+#include "PC_Resampler.hpp"
+#include <PC_Thread.hpp>
 
 /* Constants
  * SAMPLE_RATE of input signal (Hz) Must be either 8000, 12000, 16000, 24000, or 48000
@@ -23,14 +31,169 @@
 #define FRAME_SIZE 960
 #define BITRATE 24000
 
+/* PLC_MAX_FRAMES is how many frames in a row packet loss concealment fills in
+ * for a peer before we consider them silent (DTX) and stop decoding.
+ */
+#define PLC_MAX_FRAMES 5
+
+/* MAX_STREAMS is how many peers the mixer can play at once, keep it >= MAX_PEERS
+ */
+#define MAX_STREAMS 8
+
+/* STREAM_FIFO_SIZE is how many samples (per channel) of a peer's audio can wait
+ * between its clock and ours: less than a frame left over, plus one frame
+ * stretched by at most DRIFT_MAX_PPM
+ */
+#define STREAM_FIFO_SIZE (2 * FRAME_SIZE + 16)
+
+/* PAN_WIDTH is how far apart peers are spread in stereo mode, 1.0 puts the
+ * outermost peers hard left/right
+ */
+#define PAN_WIDTH 0.8f
+
+/* DSP_PERIODS is how many device callbacks make up one block when encoding and
+ * decoding run on the DSP thread (PEERSCHAT_DSP_THREAD=1).
+ * DSP_LEAD is how many of those callback periods the DSP thread has to finish a
+ * block before the output runs dry.  It adds that much latency.
+ */
+#define DSP_PERIODS 4
+#define DSP_LEAD 1
+
+/* DECODE_DEADLINE_US is how long (us) the mixer waits for the decode helpers
+ * (PEERSCHAT_DECODE_THREADS=n) before mixing without the streams that aren't done
+ */
+#define DECODE_DEADLINE_US 4000
+
+class NPeer;
+
+/* LEVEL_RELEASE is how much of the last frame's level meter reading is kept
+ * each frame (20 ms) when the audio gets quieter.  Louder frames show at once.
+ */
+#define LEVEL_RELEASE 0.75f
+
+// AudioLevel Struct -----------------------------------------------------------
+/* AudioLevel: Level meter reading for a peer (or our mic), see APeer::getLevel()
+ *
+ * id  NPeer ID, 0 for our mic, -1 for an unused slot
+ *
+ * peak  Peak sample (0.0 - 1.0), instant attack and LEVEL_RELEASE decay
+ *
+ * rms  RMS over the frame, same ballistics as peak
+ */
+struct AudioLevel {
+	int id = -1;
+	float peak = 0.0f;
+	float rms = 0.0f;
+};
+
+// AudioDevice Struct ----------------------------------------------------------
+/* AudioDevice: What PortAudio tells us about a device
+ *
+ * index  PortAudio device index, pass to APeer::setDevices()
+ *
+ * name  Device name
+ *
+ * maxInputChannels/maxOutputChannels  0 if it can't record/play
+ *
+ * defaultSampleRate  The rate the device runs at natively (Hz)
+ */
+struct AudioDevice {
+	PaDeviceIndex index;
+	std::string name;
+	int maxInputChannels;
+	int maxOutputChannels;
+	double defaultSampleRate;
+};
+
 // APeer Class -----------------------------------------------------------------
 /* APeer: A class for handling audio input/output and encoding/decoding
+ *
+ * Parameters (volumes, mutes) are atomics.  The GUI thread writes them whenever
+ * it likes, Pa_Callback reads each one once at the start of a block and ramps
+ * from the value it used for the previous block, so there are no data races
+ * and no clicks.
+ *
+ * @member streams  One PeerStream per peer being played.  Holds that peer's
+ *                  decoder, decoded frame and the gain used last block.  Slots
+ *                  are claimed/released by the callback as peers come and go;
+ *                  the decoders are allocated up front so that never allocates.
+ *                  Each also has an adjustable Resampler that plays the peer's
+ *                  audio at NPeer::getPlayoutRate(), so a peer whose clock runs
+ *                  a little fast or slow next to ours doesn't slowly fill or
+ *                  drain its jitter buffer.  Its output waits in fifo until
+ *                  there is a whole frame to mix.
+ *
+ * @member outputChannels  1 (mono) or 2 (stereo).  In stereo each peer gets
+ *                         its own spot between left and right (constant power
+ *                         panning) which makes several voices easier to tell apart.
+ *                         Picked when the stream is opened: PEERSCHAT_STEREO=1
+ *                         and an output device with two channels.
+ *
+ * @member aec  Echo canceller.  Takes the mic at the start of each callback and
+ *              the final output at the end (PEERSCHAT_AEC=0 to start it off).
+ *
+ * @member preprocess  High-pass, noise suppression and AGC on the mic, after
+ *                     the echo canceller and before the input volume.
+ *
+ * @member inResampler/outResampler  Convert between the devices' rate and
+ *                                   SAMPLE_RATE.  nullptr when the devices run
+ *                                   at SAMPLE_RATE (no conversion, no FIFOs).
+ *
+ * @member captureFifo/playFifo  Mic audio at SAMPLE_RATE waiting to fill a frame,
+ *                               and output at the device rate waiting to be played
+ *
+ * @member dspMode  PEERSCHAT_DSP_THREAD=1: Encoding, decoding, mixing and the
+ *                  packet queues run on dspThread instead of in the callback,
+ *                  which then only copies audio to/from captureRing and playRing
+ *                  (lock-free).  Keeps codec spikes and peers_lock out of the
+ *                  real-time path at the cost of dspPrime frames of latency.
+ *
+ * @member dspPrime  Output frames queued ahead: one block (gathered before the
+ *                   thread can run) plus DSP_LEAD callback periods of slack
+ *
+ * @member decodeJobs  Helpers that decode peers in parallel with the mixer
+ *                     (fork-join per frame, job i is streams[i]).  nullptr
+ *                     decodes them one by one.  A stream a helper is still on
+ *                     after the deadline is abandoned: the helper finishes
+ *                     but its frame is thrown away, and the mixer leaves the
+ *                     stream alone until the helper let go (streamBusy()).
+ *
+ * @member levels  Level meter of every PeerStream (same index) and of our mic
+ *                 (last slot).  Published once per frame by the mixer, read by
+ *                 the GUI whenever it redraws, without either waiting on the other.
  *
  * @constructor APeer()  Default constructor
  *
  * @method Pa_Callback(6)  Called by the portaudio engine whenever it has
  *                         captured audio data.
  *
+ * @method processBlock(3)  One device buffer: rate conversion and processFrame()
+ *
+ * @method processFrame(2)  Everything done to one FRAME_SIZE block at SAMPLE_RATE
+ *
+ * @method dspLoop()  Body of the DSP thread
+ *
+ * @method startDSP()/stopDSP()  Start/join the DSP thread (if dspMode)
+ *
+ * @method openStream()  Opens the selected devices at a rate both support
+ *
+ * @method findDevice(2)  Device index from an index or part of a name
+ *
+ * @method getStream(1)  Finds or claims the PeerStream for a peer ID
+ *
+ * @method decodePeer(3)  Decodes a peer's next frame into its PeerStream,
+ *                        following the peer's clock
+ *
+ * @method decodePacket(3)  Decodes a peer's next packet (or conceals a lost
+ *                          one) into its PeerStream's frame buffer
+ *
+ * @method decodeAll(1)  Decodes every stream in use this frame, in parallel if
+ *                       there are helpers, giving up on them at the deadline
+ *
+ * @method streamBusy(1)  Is a decode helper still working on this stream?
+ *
+ * @method publishLevel(4)  Meters @n samples of @pcm into levels[@slot] for @id
+ *
  * @method startVoiceStream()  Begins a portaudio audio stream that will
  *                             run until stopVoiceStream() is called. The
  *                             voice stream is ran on its own unique thread.
@@ -42,36 +205,133 @@
  *
  * @method getPortAudioVersion()  Returns string of current portaudio version
  *
- * @method getDefaultInput()  Returns string of current default input device
+ * @method getDefaultInput()  Returns name of the input device in use
  *
- * @method getDefaultOutput()  Returns string of current default output device
+ * @method getDefaultOutput()  Returns name of the output device in use
+ *
+ * @method getDevices()  Lists the audio devices
+ *
+ * @method getSampleRate()  Returns the rate the devices run at
+ *
+ * @method getLatency()  Returns the latency (ms) the devices and our processing add
  *
  * @method getInputVolume()  Returns input device audio multiplier
  *
  * @method getOutputVolume()  Returns output device audio multiplier
  *
+ * @method getXRuns()  Returns how many callbacks PortAudio flagged with an
+ *                     input/output underflow or overflow since the stream opened
+ *
+ * @method getMuteMic()  Returns true if the mic is muted
+ *
+ * @method getDSPUnderruns()  Returns how often the DSP thread was too late
+ *
+ * @method getLevel(2)  Latest level meter reading for a peer ID (0 for our mic).
+ *                      Lock-free, safe from any thread.  Returns false if that
+ *                      peer isn't being played.
+ *
+ * @method isStereo()  Returns true if the output stream is stereo
+ *
+ * @method getEchoCancel()  Returns true if echo cancellation is on
+ *
  * @method setInputVolume(float)  Sets the input device audio multiplier
  *
  * @method setOutputVolume(float)  Sets the input device audio multiplier
+ *
+ * @method setDevices(2)  Switch input/output devices (paNoDevice for the default).
+ *                       Can be called while the stream is running.
+ *
+ * @method setEchoCancel(bool)  Turns echo cancellation on/off
+ *
+ * @method setNoiseSuppression(bool)  Turns capture noise suppression on/off
+ *
+ * @method setAutoGain(bool)  Turns capture AGC on/off
+ *
+ * @method setHighPass(bool)  Turns the capture high-pass filter on/off
  */
 class APeer {
 private:
 	// Opus Related
 	static OpusEncoder *encoder;
-	static OpusDecoder *decoder;
-	static float inputVolume;
-	static float outputVolume;
+	static std::atomic<float> inputVolume;
+	static std::atomic<float> outputVolume;
 	std::string opusVersion;
 	int opusError = 0;
 
 	// PortAudio Related
 	PaStream *stream = nullptr;
 	PaError portaudioError = 0;
+	PaDeviceIndex inputDevice = paNoDevice;
+	PaDeviceIndex outputDevice = paNoDevice;
+	double streamRate = SAMPLE_RATE;
+	bool stereoRequested = false;
 	std::string portaudioVersion;
 	std::string defaultInput;
 	std::string defaultOutput;
-	static bool micMute;
-	static bool deafen;
+	static std::atomic<bool> micMute;
+	static std::atomic<bool> deafen;
+	static std::atomic<uint32_t> xruns;
+	static int outputChannels;
+	static EchoCanceller *aec;
+	static CapturePreprocessor *preprocess;
+
+	// Rate Conversion
+	static Resampler *inResampler;
+	static Resampler *outResampler;
+	static std::vector<float> captureFifo;
+	static std::vector<float> playFifo;
+	static size_t captureFill;
+	static size_t playFill;
+	static size_t playPrime;
+	static unsigned long blockFrames;
+	static void resetRateConversion();
+
+	// DSP Thread
+	static bool dspMode;
+	static SPSCRing<float> *captureRing;
+	static SPSCRing<float> *playRing;
+	static size_t dspPrime;
+	static std::atomic<bool> dspRunning;
+	static std::mutex dspLock;
+	static std::condition_variable dspWake;
+	static std::atomic<uint32_t> dspUnderruns;
+	static std::atomic<uint32_t> dspResyncs;
+	static std::atomic<uint32_t> dspDropped;
+	std::thread dspThread;
+	static void dspLoop();
+	void startDSP();
+	void stopDSP();
+	void openStream();
+	PaDeviceIndex findDevice(const char *spec, bool input);
+
+	// Mixer
+	struct PeerStream {
+		int id = 0;
+		bool seen = false;
+		bool play = false;
+		bool decoded = false;
+		NPeer *peer = nullptr;
+		int concealed = 0;
+		float gainL = 0.0f;
+		float gainR = 0.0f;
+		OpusDecoder *decoder = nullptr;
+		Resampler *drift = nullptr;
+		size_t fill = 0;
+		float frame[FRAME_SIZE * CHANNELS];
+		float fifo[STREAM_FIFO_SIZE * CHANNELS];
+		float pcm[FRAME_SIZE * CHANNELS];
+	};
+	static PeerStream streams[MAX_STREAMS];
+	static PeerStream *getStream(int id);
+	static bool decodePeer(NPeer *peer, PeerStream *stream, bool play);
+	static int decodePacket(NPeer *peer, PeerStream *stream, bool play);
+	static ForkJoin *decodeJobs;
+	static void decodeAll(bool play);
+	static bool streamBusy(const PeerStream *stream);
+	static SeqLock<AudioLevel> levels[MAX_STREAMS + 1];
+	static void publishLevel(int slot, int id, const float *pcm, size_t n);
+	static void processBlock(float *in, float *out, unsigned long framesPerBuffer);
+	static void processFrame(float *in, float *out);
 	static int Pa_Callback(const void *input,
 	                       void *output,
 	                       unsigned long framesPerBuffer,
@@ -93,14 +353,28 @@ public:
 	std::string getPortAudioVersion();
 	std::string getDefaultInput();
 	std::string getDefaultOutput();
+	std::vector<AudioDevice> getDevices();
+	double getSampleRate();
+	double getLatency();
 	float getInputVolume();
 	float getOutputVolume();
+	uint32_t getXRuns();
+	bool getMuteMic();
+	uint32_t getDSPUnderruns();
+	bool getLevel(int id, AudioLevel &level);
+	bool isStereo();
+	bool getEchoCancel();
 
 	// Setters
+	void setDevices(PaDeviceIndex input, PaDeviceIndex output);
 	void setInputVolume(float);
 	void setOutputVolume(float);
 	void setMuteMic(bool);
 	void setDeafen(bool);
+	void setEchoCancel(bool);
+	void setNoiseSuppression(bool);
+	void setAutoGain(bool);
+	void setHighPass(bool);
 };
 
 #endif//_PC_Audio_H
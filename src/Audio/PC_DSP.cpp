@@ -0,0 +1,583 @@
+#include "PC_DSP.hpp"
+
+#include <cmath>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define DSP_X86
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define DSP_NEON
+#include <arm_neon.h>
+#endif
+
+// Soft clip: Pade approximation of tanh, exact 1.0 at |x| = 3
+#define CLIP_LIMIT 3.0f
+
+// Scalar Kernels --------------------------------------------------------------
+static inline float clip_sample(float x) {
+	x = (x > CLIP_LIMIT) ? CLIP_LIMIT : ((x < -CLIP_LIMIT) ? -CLIP_LIMIT : x);
+	float x2 = x * x;
+	return x * (27.0f + x2) / (27.0f + 9.0f * x2);
+}
+
+static inline int16_t to_int16_sample(float x) {
+	float y = x * 32767.0f;
+	y = (y > 32767.0f) ? 32767.0f : ((y < -32768.0f) ? -32768.0f : y);
+	return (int16_t) std::lrintf(y);
+}
+
+static void gain_scalar(float *x, float g, size_t n) {
+	for (size_t i = 0; i < n; ++i)
+		x[i] *= g;
+}
+
+static void gain_ramp_scalar(float *x, float g0, float g1, size_t n) {
+	float step = (g1 - g0) / n;
+	for (size_t i = 0; i < n; ++i)
+		x[i] *= g0 + step * (i + 1);
+}
+
+static void mix_scalar(float *dst, const float *src, float g, size_t n) {
+	for (size_t i = 0; i < n; ++i)
+		dst[i] += src[i] * g;
+}
+
+static void mix_ramp_scalar(float *dst, const float *src, float g0, float g1, size_t n) {
+	float step = (g1 - g0) / n;
+	for (size_t i = 0; i < n; ++i)
+		dst[i] += src[i] * (g0 + step * (i + 1));
+}
+
+static void soft_clip_scalar(float *x, size_t n) {
+	for (size_t i = 0; i < n; ++i)
+		x[i] = clip_sample(x[i]);
+}
+
+static void peak_rms_scalar(const float *x, size_t n, float *peak, float *rms) {
+	float p = 0.0f, sum = 0.0f;
+	for (size_t i = 0; i < n; ++i) {
+		float a = std::fabs(x[i]);
+		p = (a > p) ? a : p;
+		sum += x[i] * x[i];
+	}
+	*peak = p;
+	*rms = (n > 0) ? std::sqrt(sum / n) : 0.0f;
+}
+
+static float dot_scalar(const float *a, const float *b, size_t n) {
+	float sum = 0.0f;
+	for (size_t i = 0; i < n; ++i)
+		sum += a[i] * b[i];
+	return sum;
+}
+
+static void to_int16_scalar(const float *src, int16_t *dst, size_t n) {
+	for (size_t i = 0; i < n; ++i)
+		dst[i] = to_int16_sample(src[i]);
+}
+
+static void from_int16_scalar(const int16_t *src, float *dst, size_t n) {
+	for (size_t i = 0; i < n; ++i)
+		dst[i] = src[i] * (1.0f / 32768.0f);
+}
+
+static void mix_pan_scalar(float *dst, const float *src, float l0, float r0, float l1, float r1, size_t n) {
+	float lstep = (l1 - l0) / n, rstep = (r1 - r0) / n;
+	for (size_t i = 0; i < n; ++i) {
+		dst[2 * i]     += src[i] * (l0 + lstep * (i + 1));
+		dst[2 * i + 1] += src[i] * (r0 + rstep * (i + 1));
+	}
+}
+
+static const DSPKernels SCALAR = {
+	"scalar", gain_scalar, gain_ramp_scalar, mix_scalar, mix_ramp_scalar,
+	soft_clip_scalar, peak_rms_scalar, dot_scalar, to_int16_scalar, from_int16_scalar,
+	mix_pan_scalar
+};
+
+// SSE2 Kernels ----------------------------------------------------------------
+#ifdef DSP_X86
+#define SSE2 __attribute__((target("sse2")))
+
+SSE2 static void gain_sse2(float *x, float g, size_t n) {
+	__m128 vg = _mm_set1_ps(g);
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4)
+		_mm_storeu_ps(x + i, _mm_mul_ps(_mm_loadu_ps(x + i), vg));
+	gain_scalar(x + i, g, n - i);
+}
+
+SSE2 static void gain_ramp_sse2(float *x, float g0, float g1, size_t n) {
+	float step = (g1 - g0) / n;
+	__m128 vg = _mm_setr_ps(g0 + step, g0 + 2 * step, g0 + 3 * step, g0 + 4 * step);
+	__m128 vstep = _mm_set1_ps(4 * step);
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		_mm_storeu_ps(x + i, _mm_mul_ps(_mm_loadu_ps(x + i), vg));
+		vg = _mm_add_ps(vg, vstep);
+	}
+	for (; i < n; ++i)
+		x[i] *= g0 + step * (i + 1);
+}
+
+SSE2 static void mix_sse2(float *dst, const float *src, float g, size_t n) {
+	__m128 vg = _mm_set1_ps(g);
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m128 d = _mm_loadu_ps(dst + i);
+		_mm_storeu_ps(dst + i, _mm_add_ps(d, _mm_mul_ps(_mm_loadu_ps(src + i), vg)));
+	}
+	mix_scalar(dst + i, src + i, g, n - i);
+}
+
+SSE2 static void mix_ramp_sse2(float *dst, const float *src, float g0, float g1, size_t n) {
+	float step = (g1 - g0) / n;
+	__m128 vg = _mm_setr_ps(g0 + step, g0 + 2 * step, g0 + 3 * step, g0 + 4 * step);
+	__m128 vstep = _mm_set1_ps(4 * step);
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m128 d = _mm_loadu_ps(dst + i);
+		_mm_storeu_ps(dst + i, _mm_add_ps(d, _mm_mul_ps(_mm_loadu_ps(src + i), vg)));
+		vg = _mm_add_ps(vg, vstep);
+	}
+	for (; i < n; ++i)
+		dst[i] += src[i] * (g0 + step * (i + 1));
+}
+
+SSE2 static void soft_clip_sse2(float *x, size_t n) {
+	const __m128 lim = _mm_set1_ps(CLIP_LIMIT), nlim = _mm_set1_ps(-CLIP_LIMIT);
+	const __m128 c27 = _mm_set1_ps(27.0f), c9 = _mm_set1_ps(9.0f);
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m128 v = _mm_max_ps(_mm_min_ps(_mm_loadu_ps(x + i), lim), nlim);
+		__m128 v2 = _mm_mul_ps(v, v);
+		__m128 num = _mm_mul_ps(v, _mm_add_ps(c27, v2));
+		__m128 den = _mm_add_ps(c27, _mm_mul_ps(c9, v2));
+		_mm_storeu_ps(x + i, _mm_div_ps(num, den));
+	}
+	soft_clip_scalar(x + i, n - i);
+}
+
+SSE2 static inline float hsum_sse2(__m128 v) {
+	__m128 shuf = _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1));
+	__m128 sums = _mm_add_ps(v, shuf);
+	shuf = _mm_movehl_ps(shuf, sums);
+	return _mm_cvtss_f32(_mm_add_ss(sums, shuf));
+}
+
+SSE2 static inline float hmax_sse2(__m128 v) {
+	v = _mm_max_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+	v = _mm_max_ps(v, _mm_movehl_ps(v, v));
+	return _mm_cvtss_f32(v);
+}
+
+SSE2 static void peak_rms_sse2(const float *x, size_t n, float *peak, float *rms) {
+	const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+	__m128 vpeak = _mm_setzero_ps(), vsum = _mm_setzero_ps();
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m128 v = _mm_loadu_ps(x + i);
+		vpeak = _mm_max_ps(vpeak, _mm_and_ps(v, abs_mask));
+		vsum = _mm_add_ps(vsum, _mm_mul_ps(v, v));
+	}
+	float p = hmax_sse2(vpeak), sum = hsum_sse2(vsum);
+	for (; i < n; ++i) {
+		float a = std::fabs(x[i]);
+		p = (a > p) ? a : p;
+		sum += x[i] * x[i];
+	}
+	*peak = p;
+	*rms = (n > 0) ? std::sqrt(sum / n) : 0.0f;
+}
+
+SSE2 static float dot_sse2(const float *a, const float *b, size_t n) {
+	__m128 vsum = _mm_setzero_ps();
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4)
+		vsum = _mm_add_ps(vsum, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+	return hsum_sse2(vsum) + dot_scalar(a + i, b + i, n - i);
+}
+
+SSE2 static void to_int16_sse2(const float *src, int16_t *dst, size_t n) {
+	const __m128 scale = _mm_set1_ps(32767.0f);
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m128i lo = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(src + i), scale));
+		__m128i hi = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(src + i + 4), scale));
+		_mm_storeu_si128((__m128i*) (dst + i), _mm_packs_epi32(lo, hi));
+	}
+	to_int16_scalar(src + i, dst + i, n - i);
+}
+
+SSE2 static void from_int16_sse2(const int16_t *src, float *dst, size_t n) {
+	const __m128 scale = _mm_set1_ps(1.0f / 32768.0f);
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m128i v = _mm_loadu_si128((const __m128i*) (src + i));
+		__m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+		__m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+		_mm_storeu_ps(dst + i,     _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+		_mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+	}
+	from_int16_scalar(src + i, dst + i, n - i);
+}
+
+SSE2 static void mix_pan_sse2(float *dst, const float *src, float l0, float r0, float l1, float r1, size_t n) {
+	float lstep = (l1 - l0) / n, rstep = (r1 - r0) / n;
+	// Gains for frames i+1, i+2 (lo) and i+3, i+4 (hi), interleaved L R L R
+	__m128 glo = _mm_setr_ps(l0 + lstep, r0 + rstep, l0 + 2 * lstep, r0 + 2 * rstep);
+	__m128 ghi = _mm_setr_ps(l0 + 3 * lstep, r0 + 3 * rstep, l0 + 4 * lstep, r0 + 4 * rstep);
+	__m128 vstep = _mm_setr_ps(4 * lstep, 4 * rstep, 4 * lstep, 4 * rstep);
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m128 s = _mm_loadu_ps(src + i);
+		__m128 slo = _mm_unpacklo_ps(s, s), shi = _mm_unpackhi_ps(s, s);
+		_mm_storeu_ps(dst + 2 * i,     _mm_add_ps(_mm_loadu_ps(dst + 2 * i),     _mm_mul_ps(slo, glo)));
+		_mm_storeu_ps(dst + 2 * i + 4, _mm_add_ps(_mm_loadu_ps(dst + 2 * i + 4), _mm_mul_ps(shi, ghi)));
+		glo = _mm_add_ps(glo, vstep);
+		ghi = _mm_add_ps(ghi, vstep);
+	}
+	for (; i < n; ++i) {
+		dst[2 * i]     += src[i] * (l0 + lstep * (i + 1));
+		dst[2 * i + 1] += src[i] * (r0 + rstep * (i + 1));
+	}
+}
+
+static const DSPKernels SSE2_KERNELS = {
+	"sse2", gain_sse2, gain_ramp_sse2, mix_sse2, mix_ramp_sse2,
+	soft_clip_sse2, peak_rms_sse2, dot_sse2, to_int16_sse2, from_int16_sse2,
+	mix_pan_sse2
+};
+
+// AVX2 Kernels ----------------------------------------------------------------
+#define AVX2 __attribute__((target("avx2,fma")))
+
+AVX2 static void gain_avx2(float *x, float g, size_t n) {
+	__m256 vg = _mm256_set1_ps(g);
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8)
+		_mm256_storeu_ps(x + i, _mm256_mul_ps(_mm256_loadu_ps(x + i), vg));
+	gain_scalar(x + i, g, n - i);
+}
+
+AVX2 static inline __m256 ramp_start_avx2(float g0, float step) {
+	return _mm256_add_ps(_mm256_set1_ps(g0),
+	                     _mm256_mul_ps(_mm256_set1_ps(step), _mm256_setr_ps(1, 2, 3, 4, 5, 6, 7, 8)));
+}
+
+AVX2 static void gain_ramp_avx2(float *x, float g0, float g1, size_t n) {
+	float step = (g1 - g0) / n;
+	__m256 vg = ramp_start_avx2(g0, step);
+	__m256 vstep = _mm256_set1_ps(8 * step);
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		_mm256_storeu_ps(x + i, _mm256_mul_ps(_mm256_loadu_ps(x + i), vg));
+		vg = _mm256_add_ps(vg, vstep);
+	}
+	for (; i < n; ++i)
+		x[i] *= g0 + step * (i + 1);
+}
+
+AVX2 static void mix_avx2(float *dst, const float *src, float g, size_t n) {
+	__m256 vg = _mm256_set1_ps(g);
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8)
+		_mm256_storeu_ps(dst + i, _mm256_fmadd_ps(_mm256_loadu_ps(src + i), vg, _mm256_loadu_ps(dst + i)));
+	mix_scalar(dst + i, src + i, g, n - i);
+}
+
+AVX2 static void mix_ramp_avx2(float *dst, const float *src, float g0, float g1, size_t n) {
+	float step = (g1 - g0) / n;
+	__m256 vg = ramp_start_avx2(g0, step);
+	__m256 vstep = _mm256_set1_ps(8 * step);
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		_mm256_storeu_ps(dst + i, _mm256_fmadd_ps(_mm256_loadu_ps(src + i), vg, _mm256_loadu_ps(dst + i)));
+		vg = _mm256_add_ps(vg, vstep);
+	}
+	for (; i < n; ++i)
+		dst[i] += src[i] * (g0 + step * (i + 1));
+}
+
+AVX2 static void soft_clip_avx2(float *x, size_t n) {
+	const __m256 lim = _mm256_set1_ps(CLIP_LIMIT), nlim = _mm256_set1_ps(-CLIP_LIMIT);
+	const __m256 c27 = _mm256_set1_ps(27.0f), c9 = _mm256_set1_ps(9.0f);
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256 v = _mm256_max_ps(_mm256_min_ps(_mm256_loadu_ps(x + i), lim), nlim);
+		__m256 v2 = _mm256_mul_ps(v, v);
+		__m256 num = _mm256_mul_ps(v, _mm256_add_ps(c27, v2));
+		__m256 den = _mm256_fmadd_ps(c9, v2, c27);
+		_mm256_storeu_ps(x + i, _mm256_div_ps(num, den));
+	}
+	soft_clip_scalar(x + i, n - i);
+}
+
+AVX2 static void peak_rms_avx2(const float *x, size_t n, float *peak, float *rms) {
+	const __m256 abs_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7FFFFFFF));
+	__m256 vpeak = _mm256_setzero_ps(), vsum = _mm256_setzero_ps();
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256 v = _mm256_loadu_ps(x + i);
+		vpeak = _mm256_max_ps(vpeak, _mm256_and_ps(v, abs_mask));
+		vsum = _mm256_fmadd_ps(v, v, vsum);
+	}
+	__m128 p4 = _mm_max_ps(_mm256_castps256_ps128(vpeak), _mm256_extractf128_ps(vpeak, 1));
+	__m128 s4 = _mm_add_ps(_mm256_castps256_ps128(vsum), _mm256_extractf128_ps(vsum, 1));
+	float p = hmax_sse2(p4), sum = hsum_sse2(s4);
+	for (; i < n; ++i) {
+		float a = std::fabs(x[i]);
+		p = (a > p) ? a : p;
+		sum += x[i] * x[i];
+	}
+	*peak = p;
+	*rms = (n > 0) ? std::sqrt(sum / n) : 0.0f;
+}
+
+AVX2 static float dot_avx2(const float *a, const float *b, size_t n) {
+	__m256 vsum = _mm256_setzero_ps();
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8)
+		vsum = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), vsum);
+	__m128 s4 = _mm_add_ps(_mm256_castps256_ps128(vsum), _mm256_extractf128_ps(vsum, 1));
+	return hsum_sse2(s4) + dot_scalar(a + i, b + i, n - i);
+}
+
+AVX2 static void to_int16_avx2(const float *src, int16_t *dst, size_t n) {
+	const __m256 scale = _mm256_set1_ps(32767.0f);
+	size_t i = 0;
+	for (; i + 16 <= n; i += 16) {
+		__m256i lo = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_loadu_ps(src + i), scale));
+		__m256i hi = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_loadu_ps(src + i + 8), scale));
+		// packs works per 128 bit lane, put the quadwords back in order
+		__m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(lo, hi), 0xD8);
+		_mm256_storeu_si256((__m256i*) (dst + i), packed);
+	}
+	to_int16_sse2(src + i, dst + i, n - i);
+}
+
+AVX2 static void from_int16_avx2(const int16_t *src, float *dst, size_t n) {
+	const __m256 scale = _mm256_set1_ps(1.0f / 32768.0f);
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256i v = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*) (src + i)));
+		_mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), scale));
+	}
+	from_int16_scalar(src + i, dst + i, n - i);
+}
+
+AVX2 static void mix_pan_avx2(float *dst, const float *src, float l0, float r0, float l1, float r1, size_t n) {
+	float lstep = (l1 - l0) / n, rstep = (r1 - r0) / n;
+	// Gains for frames i+1..i+4 (lo) and i+5..i+8 (hi), interleaved L R L R ...
+	__m256 frame = _mm256_setr_ps(1, 1, 2, 2, 3, 3, 4, 4);
+	__m256 g0 = _mm256_setr_ps(l0, r0, l0, r0, l0, r0, l0, r0);
+	__m256 step = _mm256_setr_ps(lstep, rstep, lstep, rstep, lstep, rstep, lstep, rstep);
+	__m256 glo = _mm256_fmadd_ps(step, frame, g0);
+	__m256 ghi = _mm256_fmadd_ps(step, _mm256_add_ps(frame, _mm256_set1_ps(4)), g0);
+	__m256 vstep = _mm256_mul_ps(step, _mm256_set1_ps(8));
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256 s = _mm256_loadu_ps(src + i);
+		__m256 a = _mm256_unpacklo_ps(s, s), b = _mm256_unpackhi_ps(s, s);
+		__m256 slo = _mm256_permute2f128_ps(a, b, 0x20), shi = _mm256_permute2f128_ps(a, b, 0x31);
+		_mm256_storeu_ps(dst + 2 * i,     _mm256_fmadd_ps(slo, glo, _mm256_loadu_ps(dst + 2 * i)));
+		_mm256_storeu_ps(dst + 2 * i + 8, _mm256_fmadd_ps(shi, ghi, _mm256_loadu_ps(dst + 2 * i + 8)));
+		glo = _mm256_add_ps(glo, vstep);
+		ghi = _mm256_add_ps(ghi, vstep);
+	}
+	for (; i < n; ++i) {
+		dst[2 * i]     += src[i] * (l0 + lstep * (i + 1));
+		dst[2 * i + 1] += src[i] * (r0 + rstep * (i + 1));
+	}
+}
+
+static const DSPKernels AVX2_KERNELS = {
+	"avx2", gain_avx2, gain_ramp_avx2, mix_avx2, mix_ramp_avx2,
+	soft_clip_avx2, peak_rms_avx2, dot_avx2, to_int16_avx2, from_int16_avx2,
+	mix_pan_avx2
+};
+#endif//DSP_X86
+
+// NEON Kernels ----------------------------------------------------------------
+#ifdef DSP_NEON
+static void gain_neon(float *x, float g, size_t n) {
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4)
+		vst1q_f32(x + i, vmulq_n_f32(vld1q_f32(x + i), g));
+	gain_scalar(x + i, g, n - i);
+}
+
+static void gain_ramp_neon(float *x, float g0, float g1, size_t n) {
+	float step = (g1 - g0) / n;
+	const float start[4] = { g0 + step, g0 + 2 * step, g0 + 3 * step, g0 + 4 * step };
+	float32x4_t vg = vld1q_f32(start);
+	float32x4_t vstep = vdupq_n_f32(4 * step);
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		vst1q_f32(x + i, vmulq_f32(vld1q_f32(x + i), vg));
+		vg = vaddq_f32(vg, vstep);
+	}
+	for (; i < n; ++i)
+		x[i] *= g0 + step * (i + 1);
+}
+
+static void mix_neon(float *dst, const float *src, float g, size_t n) {
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4)
+		vst1q_f32(dst + i, vmlaq_n_f32(vld1q_f32(dst + i), vld1q_f32(src + i), g));
+	mix_scalar(dst + i, src + i, g, n - i);
+}
+
+static void mix_ramp_neon(float *dst, const float *src, float g0, float g1, size_t n) {
+	float step = (g1 - g0) / n;
+	const float start[4] = { g0 + step, g0 + 2 * step, g0 + 3 * step, g0 + 4 * step };
+	float32x4_t vg = vld1q_f32(start);
+	float32x4_t vstep = vdupq_n_f32(4 * step);
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		vst1q_f32(dst + i, vmlaq_f32(vld1q_f32(dst + i), vld1q_f32(src + i), vg));
+		vg = vaddq_f32(vg, vstep);
+	}
+	for (; i < n; ++i)
+		dst[i] += src[i] * (g0 + step * (i + 1));
+}
+
+static void soft_clip_neon(float *x, size_t n) {
+	const float32x4_t lim = vdupq_n_f32(CLIP_LIMIT), nlim = vdupq_n_f32(-CLIP_LIMIT);
+	const float32x4_t c27 = vdupq_n_f32(27.0f);
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		float32x4_t v = vmaxq_f32(vminq_f32(vld1q_f32(x + i), lim), nlim);
+		float32x4_t v2 = vmulq_f32(v, v);
+		float32x4_t num = vmulq_f32(v, vaddq_f32(c27, v2));
+		float32x4_t den = vmlaq_n_f32(c27, v2, 9.0f);
+		// Reciprocal estimate plus two Newton steps
+		float32x4_t r = vrecpeq_f32(den);
+		r = vmulq_f32(r, vrecpsq_f32(den, r));
+		r = vmulq_f32(r, vrecpsq_f32(den, r));
+		vst1q_f32(x + i, vmulq_f32(num, r));
+	}
+	soft_clip_scalar(x + i, n - i);
+}
+
+static void peak_rms_neon(const float *x, size_t n, float *peak, float *rms) {
+	float32x4_t vpeak = vdupq_n_f32(0.0f), vsum = vdupq_n_f32(0.0f);
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		float32x4_t v = vld1q_f32(x + i);
+		vpeak = vmaxq_f32(vpeak, vabsq_f32(v));
+		vsum = vmlaq_f32(vsum, v, v);
+	}
+	float lanes[4], sums[4];
+	vst1q_f32(lanes, vpeak);
+	vst1q_f32(sums, vsum);
+	float p = lanes[0], sum = sums[0] + sums[1] + sums[2] + sums[3];
+	for (int k = 1; k < 4; ++k)
+		p = (lanes[k] > p) ? lanes[k] : p;
+	for (; i < n; ++i) {
+		float a = std::fabs(x[i]);
+		p = (a > p) ? a : p;
+		sum += x[i] * x[i];
+	}
+	*peak = p;
+	*rms = (n > 0) ? std::sqrt(sum / n) : 0.0f;
+}
+
+static float dot_neon(const float *a, const float *b, size_t n) {
+	float32x4_t vsum = vdupq_n_f32(0.0f);
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4)
+		vsum = vmlaq_f32(vsum, vld1q_f32(a + i), vld1q_f32(b + i));
+	float sums[4];
+	vst1q_f32(sums, vsum);
+	return sums[0] + sums[1] + sums[2] + sums[3] + dot_scalar(a + i, b + i, n - i);
+}
+
+static void to_int16_neon(const float *src, int16_t *dst, size_t n) {
+	const float32x4_t scale = vdupq_n_f32(32767.0f);
+	size_t i = 0;
+	#if defined(__aarch64__)
+	for (; i + 8 <= n; i += 8) {
+		int32x4_t lo = vcvtnq_s32_f32(vmulq_f32(vld1q_f32(src + i), scale));
+		int32x4_t hi = vcvtnq_s32_f32(vmulq_f32(vld1q_f32(src + i + 4), scale));
+		vst1q_s16(dst + i, vcombine_s16(vqmovn_s32(lo), vqmovn_s32(hi)));
+	}
+	#endif
+	(void) scale;
+	to_int16_scalar(src + i, dst + i, n - i);
+}
+
+static void from_int16_neon(const int16_t *src, float *dst, size_t n) {
+	const float32x4_t scale = vdupq_n_f32(1.0f / 32768.0f);
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		int16x8_t v = vld1q_s16(src + i);
+		vst1q_f32(dst + i,     vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(v))), scale));
+		vst1q_f32(dst + i + 4, vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(v))), scale));
+	}
+	from_int16_scalar(src + i, dst + i, n - i);
+}
+
+static void mix_pan_neon(float *dst, const float *src, float l0, float r0, float l1, float r1, size_t n) {
+	float lstep = (l1 - l0) / n, rstep = (r1 - r0) / n;
+	const float lo[4] = { l0 + lstep, r0 + rstep, l0 + 2 * lstep, r0 + 2 * rstep };
+	const float hi[4] = { l0 + 3 * lstep, r0 + 3 * rstep, l0 + 4 * lstep, r0 + 4 * rstep };
+	const float st[4] = { 4 * lstep, 4 * rstep, 4 * lstep, 4 * rstep };
+	float32x4_t glo = vld1q_f32(lo), ghi = vld1q_f32(hi), vstep = vld1q_f32(st);
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		float32x4_t s = vld1q_f32(src + i);
+		float32x4x2_t z = vzipq_f32(s, s);
+		vst1q_f32(dst + 2 * i,     vmlaq_f32(vld1q_f32(dst + 2 * i),     z.val[0], glo));
+		vst1q_f32(dst + 2 * i + 4, vmlaq_f32(vld1q_f32(dst + 2 * i + 4), z.val[1], ghi));
+		glo = vaddq_f32(glo, vstep);
+		ghi = vaddq_f32(ghi, vstep);
+	}
+	for (; i < n; ++i) {
+		dst[2 * i]     += src[i] * (l0 + lstep * (i + 1));
+		dst[2 * i + 1] += src[i] * (r0 + rstep * (i + 1));
+	}
+}
+
+static const DSPKernels NEON_KERNELS = {
+	"neon", gain_neon, gain_ramp_neon, mix_neon, mix_ramp_neon,
+	soft_clip_neon, peak_rms_neon, dot_neon, to_int16_neon, from_int16_neon,
+	mix_pan_neon
+};
+#endif//DSP_NEON
+
+// Dispatch --------------------------------------------------------------------
+
+/* select_kernels()
+ * Picks the fastest kernel table the running CPU supports.
+ */
+static const DSPKernels *select_kernels() {
+	#ifdef DSP_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+		return &AVX2_KERNELS;
+	if (__builtin_cpu_supports("sse2"))
+		return &SSE2_KERNELS;
+	#endif
+	#ifdef DSP_NEON
+	return &NEON_KERNELS;
+	#endif
+	return &SCALAR;
+}
+
+/* dsp()
+ * Returns the kernel table for this CPU.  Selected once, thread safe.
+ */
+const DSPKernels& dsp() noexcept {
+	static const DSPKernels *kernels = select_kernels();
+	return *kernels;
+}
+
+/* dsp_scalar()
+ * Returns the plain C++ kernel table.
+ */
+const DSPKernels& dsp_scalar() noexcept {
+	return SCALAR;
+}
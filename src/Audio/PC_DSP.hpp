@@ -0,0 +1,68 @@
+#ifndef _PC_DSP_HPP
+#define _PC_DSP_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+/* PeersChat DSP Kernels
+ * Small sample processing kernels used by the audio callback.  Every kernel has
+ * a scalar version plus SSE2, AVX2 (x86) and NEON (ARM) versions.  The fastest
+ * one the CPU supports is picked the first time dsp() is called.
+ *
+ * All buffers are plain float arrays in the [-1.0, 1.0] range.  There are no
+ * alignment requirements and n does not have to be a multiple of anything.
+ */
+
+// DSPKernels Struct -----------------------------------------------------------
+/* DSPKernels: A table of function pointers for one instruction set
+ *
+ * @member name  Name of the instruction set ("scalar", "sse2", "avx2", "neon")
+ *
+ * @member gain(3)  x[i] *= g
+ *
+ * @member gain_ramp(4)  x[i] *= g0 + (g1 - g0) * (i + 1) / n.  Used instead of
+ *                       gain() when a volume changed since the last block so
+ *                       the change doesn't click (zipper noise).
+ *
+ * @member mix(4)  dst[i] += src[i] * g
+ *
+ * @member mix_ramp(5)  dst[i] += src[i] * (g0 + (g1 - g0) * (i + 1) / n)
+ *
+ * @member soft_clip(2)  Saturate x smoothly into [-1, 1].  Transparent for
+ *                       quiet signals, rounds off peaks instead of hard clipping.
+ *
+ * @member peak_rms(4)  Measure the peak (max |x|) and RMS level of x
+ *
+ * @member dot(3)  Returns sum of a[i] * b[i]
+ *
+ * @member to_int16(3)  Convert float samples to saturated, rounded int16
+ *
+ * @member from_int16(3)  Convert int16 samples to float
+ *
+ * @member mix_pan(7)  Mix a mono src into an interleaved stereo dst (n frames,
+ *                     2n floats), ramping the left gain from l0 to l1 and the
+ *                     right gain from r0 to r1.
+ */
+struct DSPKernels
+{
+	const char *name;
+	void  (*gain)(float *x, float g, size_t n);
+	void  (*gain_ramp)(float *x, float g0, float g1, size_t n);
+	void  (*mix)(float *dst, const float *src, float g, size_t n);
+	void  (*mix_ramp)(float *dst, const float *src, float g0, float g1, size_t n);
+	void  (*soft_clip)(float *x, size_t n);
+	void  (*peak_rms)(const float *x, size_t n, float *peak, float *rms);
+	float (*dot)(const float *a, const float *b, size_t n);
+	void  (*to_int16)(const float *src, int16_t *dst, size_t n);
+	void  (*from_int16)(const int16_t *src, float *dst, size_t n);
+	void  (*mix_pan)(float *dst, const float *src, float l0, float r0, float l1, float r1, size_t n);
+};
+
+/* dsp()  Returns the kernels for the best instruction set this CPU supports
+ *
+ * dsp_scalar()  Returns the plain C++ kernels.  Reference for the others.
+ */
+const DSPKernels& dsp() noexcept;
+const DSPKernels& dsp_scalar() noexcept;
+
+#endif//_PC_DSP_HPP
@@ -0,0 +1,75 @@
+#include "PC_FFT.hpp"
+
+#include <cmath>
+#include <utility>
+
+/* FFT Constructor
+ * Builds the bit reversal and twiddle tables for an n point transform.
+ */
+FFT::FFT(size_t n) : n(n), bitrev(n), cosTable(n / 2), sinTable(n / 2) {
+	size_t bits = 0;
+	while (((size_t) 1 << bits) < n)
+		bits++;
+
+	for (size_t i = 0; i < n; ++i) {
+		size_t r = 0;
+		for (size_t b = 0; b < bits; ++b)
+			if (i & ((size_t) 1 << b))
+				r |= (size_t) 1 << (bits - 1 - b);
+		bitrev[i] = r;
+	}
+
+	for (size_t i = 0; i < n / 2; ++i) {
+		cosTable[i] = (float) std::cos(2.0 * M_PI * i / n);
+		sinTable[i] = (float) std::sin(2.0 * M_PI * i / n);
+	}
+}
+
+/* transform()
+ * Iterative decimation in time.  inverse flips the sign of the twiddles.
+ */
+void FFT::transform(float *re, float *im, bool inverse) const noexcept {
+	for (size_t i = 0; i < n; ++i) {
+		size_t j = bitrev[i];
+		if (j > i) {
+			std::swap(re[i], re[j]);
+			std::swap(im[i], im[j]);
+		}
+	}
+
+	const float sign = inverse ? 1.0f : -1.0f;
+	for (size_t len = 2; len <= n; len <<= 1) {
+		size_t half = len / 2, stride = n / len;
+		for (size_t start = 0; start < n; start += len) {
+			for (size_t k = 0; k < half; ++k) {
+				float wr = cosTable[k * stride], wi = sign * sinTable[k * stride];
+				size_t a = start + k, b = a + half;
+				float tr = re[b] * wr - im[b] * wi;
+				float ti = re[b] * wi + im[b] * wr;
+				re[b] = re[a] - tr;
+				im[b] = im[a] - ti;
+				re[a] += tr;
+				im[a] += ti;
+			}
+		}
+	}
+}
+
+/* forward()
+ * In-place forward transform.
+ */
+void FFT::forward(float *re, float *im) const noexcept {
+	transform(re, im, false);
+}
+
+/* inverse()
+ * In-place inverse transform, scaled by 1/n.
+ */
+void FFT::inverse(float *re, float *im) const noexcept {
+	transform(re, im, true);
+	const float scale = 1.0f / n;
+	for (size_t i = 0; i < n; ++i) {
+		re[i] *= scale;
+		im[i] *= scale;
+	}
+}
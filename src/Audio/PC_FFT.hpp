@@ -0,0 +1,41 @@
+#ifndef _PC_FFT_HPP
+#define _PC_FFT_HPP
+
+#include <cstddef>
+#include <vector>
+
+// FFT Class -------------------------------------------------------------------
+/* FFT: Radix-2 complex FFT of a fixed size
+ *
+ * Real and imaginary parts are kept in separate arrays.  The tables are built
+ * by the constructor, forward()/inverse() never allocate so they are safe to
+ * call from the audio callback.
+ *
+ * @constructor FFT(1)  n must be a power of two
+ *
+ * @method size()  Returns n
+ *
+ * @method forward(2)  In-place transform, not scaled
+ *
+ * @method inverse(2)  In-place inverse transform, scaled by 1/n so that
+ *                     inverse(forward(x)) == x
+ */
+class FFT
+{
+private:
+	size_t n;
+	std::vector<size_t> bitrev;
+	std::vector<float> cosTable;
+	std::vector<float> sinTable;
+
+	void transform(float *re, float *im, bool inverse) const noexcept;
+
+public:
+	explicit FFT(size_t n);
+
+	inline size_t size() const noexcept { return this->n; }
+	void forward(float *re, float *im) const noexcept;
+	void inverse(float *re, float *im) const noexcept;
+};
+
+#endif//_PC_FFT_HPP
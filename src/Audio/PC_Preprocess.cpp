@@ -0,0 +1,205 @@
+#include "PC_Preprocess.hpp"
+#include "PC_DSP.hpp"
+
+#include <cmath>
+#include <cstring>
+#include <chrono>
+#include <algorithm>
+
+/* Constants
+ * HOP: Frames overlap by half
+ * BINS: Non-redundant bins of a real NS_FFT_SIZE transform
+ * FIFO_SIZE: Processed samples waiting to be handed back
+ * NS_FLOOR: Most a bin gets turned down (0.1 = -20 dB), more sounds watery
+ * NS_SMOOTH: Smoothing of the per bin power the noise floor is tracked on
+ * NS_RISE: How fast the noise floor may creep up per frame (~3 dB/s)
+ * NS_DD: Decision directed a priori SNR weight
+ * VAD_SNR: Frame energy over the energy floor that counts as speech (6 dB)
+ * AGC_MIN/AGC_MAX: Range of the AGC gain (-10 dB .. +20 dB)
+ * AGC_DOWN/AGC_UP: Most the AGC gain moves per call (-1 dB / +0.1 dB)
+ */
+#define HOP (NS_FFT_SIZE / 2)
+#define BINS (NS_FFT_SIZE / 2 + 1)
+#define FIFO_SIZE (2 * NS_FFT_SIZE)
+#define NS_FLOOR 0.1f
+#define NS_SMOOTH 0.7f
+#define NS_RISE 1.002f
+#define NS_DD 0.98f
+#define VAD_SNR 4.0f
+#define AGC_MIN 0.3f
+#define AGC_MAX 10.0f
+#define AGC_DOWN 0.89f
+#define AGC_UP 1.012f
+
+/* CapturePreprocessor Constructor
+ * Designs the high-pass filter for sample_rate and allocates the noise
+ * suppressor's buffers.
+ */
+CapturePreprocessor::CapturePreprocessor(int sample_rate)
+	: fft(NS_FFT_SIZE), sample_rate(sample_rate),
+	  window(NS_FFT_SIZE), in_frame(NS_FFT_SIZE), ola(NS_FFT_SIZE), out_fifo(FIFO_SIZE),
+	  re(NS_FFT_SIZE), im(NS_FFT_SIZE),
+	  smoothed(BINS), noise(BINS), prev_clean(BINS)
+{
+	// Butterworth high-pass (RBJ cookbook, Q = 1/sqrt(2))
+	double w0 = 2.0 * M_PI * HPF_CUTOFF / sample_rate;
+	double alpha = std::sin(w0) / std::sqrt(2.0);
+	double a0 = 1.0 + alpha;
+	b0 = (float) ((1.0 + std::cos(w0)) / 2.0 / a0);
+	b1 = (float) (-(1.0 + std::cos(w0)) / a0);
+	b2 = b0;
+	a1 = (float) (-2.0 * std::cos(w0) / a0);
+	a2 = (float) ((1.0 - alpha) / a0);
+
+	// sqrt(Hann): analysis * synthesis sums to 1 at 50% overlap
+	for (size_t i = 0; i < NS_FFT_SIZE; ++i)
+		window[i] = (float) std::sqrt(0.5 - 0.5 * std::cos(2.0 * M_PI * i / NS_FFT_SIZE));
+
+	reset();
+}
+
+/* reset()
+ * Clears all filter, noise and gain state.  Output is silent for the first
+ * NS_FFT_SIZE samples afterwards.
+ */
+void CapturePreprocessor::reset() noexcept {
+	z1 = z2 = 0.0f;
+	std::fill(in_frame.begin(), in_frame.end(), 0.0f);
+	std::fill(ola.begin(), ola.end(), 0.0f);
+	std::fill(out_fifo.begin(), out_fifo.end(), 0.0f);
+	std::fill(prev_clean.begin(), prev_clean.end(), 0.0f);
+	in_count = 0;
+	out_read = 0;
+	out_write = HOP;
+	frames_seen = 0;
+	agc_gain = agc_applied = 1.0f;
+	speech_level = 0.0f;
+	energy_floor = 0.0f;
+}
+
+/* process()
+ * High-pass, then frame into the noise suppressor, then AGC on what comes out.
+ * Times itself and bypasses the noise suppressor while over budget.
+ */
+void CapturePreprocessor::process(float *x, size_t n) noexcept {
+	static const DSPKernels &kernels = dsp();
+	auto start = std::chrono::steady_clock::now();
+
+	suppress = denoise && load <= PREPROCESS_MAX_LOAD;
+	if (denoise && !suppress)
+		bypassed++;
+
+	const bool hp = highpass;
+	for (size_t i = 0; i < n; ++i) {
+		float s = x[i];
+		if (hp) {
+			float y = b0 * s + z1;
+			z1 = b1 * s - a1 * y + z2;
+			z2 = b2 * s - a2 * y;
+			s = y;
+		}
+
+		// Into the current frame, out of the processed queue
+		in_frame[HOP + in_count] = s;
+		if (++in_count == HOP) {
+			processFrame();
+			std::memmove(in_frame.data(), in_frame.data() + HOP, sizeof(float) * HOP);
+			in_count = 0;
+		}
+		x[i] = out_fifo[out_read % FIFO_SIZE];
+		out_read++;
+	}
+
+	// AGC: Follow the speech level, hold still in between
+	if (autogain) {
+		if (speech) {
+			float peak, rms;
+			kernels.peak_rms(x, n, &peak, &rms);
+			speech_level = (speech_level == 0.0f) ? rms : 0.9f * speech_level + 0.1f * rms;
+			float desired = AGC_TARGET / std::max(speech_level, 1e-4f);
+			desired = std::min(std::max(desired, AGC_MIN), AGC_MAX);
+			float step = desired / agc_gain;
+			agc_gain *= std::min(std::max(step, AGC_DOWN), AGC_UP);
+		}
+	} else {
+		agc_gain = 1.0f;
+	}
+	if (agc_gain != agc_applied)
+		kernels.gain_ramp(x, agc_applied, agc_gain, n);
+	else if (agc_gain != 1.0f)
+		kernels.gain(x, agc_gain, n);
+	if (agc_gain > 1.0f)
+		kernels.soft_clip(x, n);
+	agc_applied = agc_gain;
+	gain_out = agc_gain;
+
+	// CPU Budget
+	std::chrono::duration<float, std::micro> took = std::chrono::steady_clock::now() - start;
+	float budget = 1e6f * n / sample_rate;
+	load = 0.9f * load + 0.1f * (took.count() / budget);
+	load_avg = load;
+}
+
+/* processFrame()
+ * One NS_FFT_SIZE frame of weighted overlap-add.  Suppresses noise if enabled,
+ * otherwise just windows (which reconstructs the input exactly).  Pushes HOP
+ * finished samples onto the output queue.
+ */
+void CapturePreprocessor::processFrame() noexcept {
+	// Voice activity: Energy of the new half frame against a slowly rising floor
+	float energy = 0.0f;
+	for (size_t i = HOP; i < NS_FFT_SIZE; ++i)
+		energy += in_frame[i] * in_frame[i];
+	energy_floor = (energy_floor == 0.0f || energy < energy_floor) ? energy : energy_floor * NS_RISE;
+	speech = energy > VAD_SNR * energy_floor && energy > 1e-6f;
+
+	if (suppress) {
+		for (size_t i = 0; i < NS_FFT_SIZE; ++i) {
+			re[i] = in_frame[i] * window[i];
+			im[i] = 0.0f;
+		}
+		fft.forward(re.data(), im.data());
+
+		for (size_t k = 0; k < BINS; ++k) {
+			float power = re[k] * re[k] + im[k] * im[k];
+
+			// Noise floor: Minimum of the smoothed power, allowed to creep up
+			if (frames_seen == 0) {
+				smoothed[k] = noise[k] = power;
+			} else {
+				smoothed[k] = NS_SMOOTH * smoothed[k] + (1.0f - NS_SMOOTH) * power;
+				noise[k] = std::min(smoothed[k], noise[k] * NS_RISE);
+			}
+
+			// Wiener gain from the decision directed a priori SNR
+			float n = noise[k] + 1e-10f;
+			float post = power / n;
+			float prio = NS_DD * prev_clean[k] / n + (1.0f - NS_DD) * std::max(post - 1.0f, 0.0f);
+			float gain = std::max(prio / (1.0f + prio), NS_FLOOR);
+			prev_clean[k] = gain * gain * power;
+			re[k] *= gain;
+			im[k] *= gain;
+		}
+		for (size_t k = BINS; k < NS_FFT_SIZE; ++k) {
+			re[k] = re[NS_FFT_SIZE - k];
+			im[k] = -im[NS_FFT_SIZE - k];
+		}
+		fft.inverse(re.data(), im.data());
+		for (size_t i = 0; i < NS_FFT_SIZE; ++i)
+			re[i] *= window[i];
+		frames_seen++;
+	} else {
+		for (size_t i = 0; i < NS_FFT_SIZE; ++i)
+			re[i] = in_frame[i] * window[i] * window[i];
+	}
+
+	// Overlap-add, the first half is finished
+	for (size_t i = 0; i < NS_FFT_SIZE; ++i)
+		ola[i] += re[i];
+	for (size_t i = 0; i < HOP; ++i) {
+		out_fifo[out_write % FIFO_SIZE] = ola[i];
+		out_write++;
+	}
+	std::memmove(ola.data(), ola.data() + HOP, sizeof(float) * HOP);
+	std::fill(ola.begin() + HOP, ola.end(), 0.0f);
+}
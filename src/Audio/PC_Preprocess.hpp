@@ -0,0 +1,114 @@
+#ifndef _PC_PREPROCESS_HPP
+#define _PC_PREPROCESS_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <atomic>
+
+#include "PC_FFT.hpp"
+
+/* Constants
+ * NS_FFT_SIZE is the noise suppressor's analysis window (samples).  Frames overlap
+ *             by half, so it adds NS_FFT_SIZE samples of latency.
+ * HPF_CUTOFF is the high-pass filter corner (Hz)
+ * AGC_TARGET is the speech level the AGC aims for (RMS, 0.1 = -20 dBFS)
+ * PREPROCESS_MAX_LOAD is the share of real time the chain may use before the noise
+ *                     suppressor is bypassed (it is by far the most expensive stage)
+ */
+#define NS_FFT_SIZE 256
+#define HPF_CUTOFF 80.0f
+#define AGC_TARGET 0.1f
+#define PREPROCESS_MAX_LOAD 0.10f
+
+// CapturePreprocessor Class ---------------------------------------------------
+/* CapturePreprocessor: Cleans up the mic signal before it is encoded
+ *
+ * Three stages, each can be switched on/off from any thread while running:
+ *   High-pass  2nd order Butterworth at HPF_CUTOFF.  Removes rumble, handling
+ *              noise and DC that would otherwise cost bits.
+ *   Noise      Spectral noise suppression.  Tracks the noise floor per frequency
+ *              bin (minimum statistics) and applies a Wiener gain with a decision
+ *              directed SNR estimate.  Its frame SNR also drives isSpeech().
+ *   AGC        Slowly moves a digital gain so speech sits around AGC_TARGET.  Only
+ *              adapts while isSpeech() so it doesn't pump up the background.
+ *
+ * Runs on the audio thread, never allocates after construction.
+ *
+ * @constructor CapturePreprocessor(1)  sample_rate (Hz)
+ *
+ * @method process(2)  Process n samples in place.  Output is delayed by
+ *                     NS_FFT_SIZE samples whether or not noise suppression is on.
+ *
+ * @method reset()  Forget noise estimates, filter state and AGC gain
+ *
+ * @method isSpeech()  Did the last frame look like speech?
+ *
+ * @method getGain()  Current AGC gain
+ *
+ * @method getLoad()  Average share of real time spent in process()
+ *
+ * @method getBypassed()  Frames the noise suppressor skipped to stay in budget
+ */
+class CapturePreprocessor
+{
+private:
+	FFT fft;
+	int sample_rate;
+
+	// High-pass biquad (transposed direct form II)
+	float b0, b1, b2, a1, a2;
+	float z1 = 0.0f, z2 = 0.0f;
+
+	// Noise suppressor
+	std::vector<float> window;
+	std::vector<float> in_frame;
+	std::vector<float> ola;
+	std::vector<float> out_fifo;
+	size_t in_count = 0;
+	size_t out_read = 0;
+	size_t out_write = 0;
+	std::vector<float> re, im;
+	std::vector<float> smoothed;
+	std::vector<float> noise;
+	std::vector<float> prev_clean;
+	int frames_seen = 0;
+	float energy_floor = 0.0f;
+	bool suppress = true;
+
+	// AGC
+	float agc_gain = 1.0f;
+	float agc_applied = 1.0f;
+	float speech_level = 0.0f;
+
+	// Stats
+	float load = 0.0f;
+	std::atomic<bool> highpass = {true};
+	std::atomic<bool> denoise = {true};
+	std::atomic<bool> autogain = {true};
+	std::atomic<bool> speech = {false};
+	std::atomic<float> gain_out = {1.0f};
+	std::atomic<float> load_avg = {0.0f};
+	std::atomic<uint32_t> bypassed = {0};
+
+	void processFrame() noexcept;
+
+public:
+	explicit CapturePreprocessor(int sample_rate);
+
+	void process(float *x, size_t n) noexcept;
+	void reset() noexcept;
+
+	inline void setHighPass(bool x) noexcept { this->highpass = x; }
+	inline void setNoiseSuppression(bool x) noexcept { this->denoise = x; }
+	inline void setAutoGain(bool x) noexcept { this->autogain = x; }
+	inline bool getHighPass() noexcept { return this->highpass; }
+	inline bool getNoiseSuppression() noexcept { return this->denoise; }
+	inline bool getAutoGain() noexcept { return this->autogain; }
+	inline bool isSpeech() noexcept { return this->speech; }
+	inline float getGain() noexcept { return this->gain_out; }
+	inline float getLoad() noexcept { return this->load_avg; }
+	inline uint32_t getBypassed() noexcept { return this->bypassed; }
+};
+
+#endif//_PC_PREPROCESS_HPP
@@ -0,0 +1,292 @@
+#include "PC_Recorder.hpp"
+
+#include <opus.h>
+#include <cstring>
+#include <ctime>
+#include <chrono>
+
+/* Constants
+ * OGG_HEADER_SIZE: Fixed part of an Ogg page header, before the segment table
+ * OGG_BOS/OGG_EOS: Page header type flags for the first/last page of a stream
+ * OPUS_RATE: Opus granule positions always count 48 kHz samples
+ */
+#define OGG_HEADER_SIZE 27
+#define OGG_BOS 0x02
+#define OGG_EOS 0x04
+#define OPUS_RATE 48000
+
+/* ogg_crc()
+ * CRC-32 of an Ogg page: polynomial 0x04c11db7, MSB first, no reflection, no
+ * final xor.  Not the zlib CRC.
+ */
+static uint32_t ogg_crc(uint32_t crc, const uint8_t *data, size_t len) {
+	static uint32_t table[256];
+	static bool ready = false;
+	if (!ready) {
+		for (uint32_t i = 0; i < 256; ++i) {
+			uint32_t r = i << 24;
+			for (int k = 0; k < 8; ++k)
+				r = (r & 0x80000000u) ? (r << 1) ^ 0x04c11db7u : (r << 1);
+			table[i] = r;
+		}
+		ready = true;
+	}
+	for (size_t i = 0; i < len; ++i)
+		crc = (crc << 8) ^ table[((crc >> 24) ^ data[i]) & 0xff];
+	return crc;
+}
+
+static inline void put16(uint8_t *p, uint16_t x) { p[0] = x & 0xff; p[1] = x >> 8; }
+static inline void put32(uint8_t *p, uint32_t x) { put16(p, x & 0xffff); put16(p + 2, x >> 16); }
+static inline void put64(uint8_t *p, uint64_t x) { put32(p, (uint32_t) x); put32(p + 4, (uint32_t) (x >> 32)); }
+
+// OggOpusWriter ---------------------------------------------------------------
+
+/* OggOpusWriter Constructor
+ * Opens the file and writes the two header pages: OpusHead (mono, 48 kHz,
+ * OGG_PRESKIP) and OpusTags.
+ */
+OggOpusWriter::OggOpusWriter(const std::string &path, uint32_t serial) : serial(serial) {
+	file = std::fopen(path.c_str(), "wb");
+	if (!file)
+		return;
+	std::setvbuf(file, nullptr, _IOFBF, RECORDER_FILE_BUFFER);
+
+	uint8_t head[19] = {'O', 'p', 'u', 's', 'H', 'e', 'a', 'd', 1, 1};
+	put16(head + 10, OGG_PRESKIP);
+	put32(head + 12, OPUS_RATE);
+	put16(head + 16, 0);
+	head[18] = 0;
+	addPacket(head, sizeof(head), 0);
+	writePage(OGG_BOS, 0);
+
+	static const char vendor[] = "PeersChat";
+	uint8_t tags[8 + 4 + sizeof(vendor) - 1 + 4] = {'O', 'p', 'u', 's', 'T', 'a', 'g', 's'};
+	put32(tags + 8, sizeof(vendor) - 1);
+	std::memcpy(tags + 12, vendor, sizeof(vendor) - 1);
+	put32(tags + 12 + sizeof(vendor) - 1, 0);
+	addPacket(tags, sizeof(tags), 0);
+	writePage(0, 0);
+}
+
+/* OggOpusWriter Destructor
+ * Finishes the file if close() wasn't called.
+ */
+OggOpusWriter::~OggOpusWriter() noexcept {
+	close();
+}
+
+/* write()
+ * Fills a gap with TOC only copies of the previous packet's TOC (same mode and
+ * duration, no frames), then appends the packet.
+ */
+void OggOpusWriter::write(const uint8_t *data, size_t len, int samples, uint32_t missing) noexcept {
+	if (!file || len == 0)
+		return;
+	uint8_t filler = last_toc & 0xfc;
+	for (uint32_t i = 0; i < missing && last_samples > 0; ++i)
+		addPacket(&filler, 1, last_samples);
+	addPacket(data, len, samples);
+	last_toc = data[0];
+	last_samples = samples;
+}
+
+/* close()
+ * Writes what is left as the end of stream page and closes the file.
+ */
+void OggOpusWriter::close() noexcept {
+	if (!file)
+		return;
+	writePage(OGG_EOS, granule);
+	std::fclose(file);
+	file = nullptr;
+}
+
+/* addPacket()
+ * Adds a packet's lacing values and data to the current page.  Pages end after
+ * OGG_PAGE_PACKETS packets, and before the segment table would overflow, so no
+ * packet ever spans two pages.
+ */
+void OggOpusWriter::addPacket(const uint8_t *data, size_t len, int samples) noexcept {
+	size_t lacing = len / 255 + 1;
+	if (segments.size() + lacing > 255)
+		writePage(0, granule);
+	for (size_t i = 0; i < lacing - 1; ++i)
+		segments.push_back(255);
+	segments.push_back((uint8_t) (len % 255));
+	body.insert(body.end(), data, data + len);
+	granule += samples;
+	if (samples > 0 && ++packets >= OGG_PAGE_PACKETS)
+		writePage(0, granule);
+}
+
+/* writePage()
+ * Writes the current page with the given header type and granule position.
+ */
+void OggOpusWriter::writePage(uint8_t type, uint64_t position) noexcept {
+	uint8_t header[OGG_HEADER_SIZE + 255] = {'O', 'g', 'g', 'S', 0};
+	header[5] = type;
+	put64(header + 6, position);
+	put32(header + 14, serial);
+	put32(header + 18, sequence++);
+	put32(header + 22, 0);
+	header[26] = (uint8_t) segments.size();
+	std::memcpy(header + OGG_HEADER_SIZE, segments.data(), segments.size());
+
+	size_t header_len = OGG_HEADER_SIZE + segments.size();
+	uint32_t crc = ogg_crc(0, header, header_len);
+	crc = ogg_crc(crc, body.data(), body.size());
+	put32(header + 22, crc);
+
+	std::fwrite(header, 1, header_len, file);
+	std::fwrite(body.data(), 1, body.size(), file);
+	bytes += header_len + body.size();
+	segments.clear();
+	body.clear();
+	packets = 0;
+}
+
+// CallRecorder ----------------------------------------------------------------
+
+/* CallRecorder Constructor
+ * Allocates the rings up front so onPacket() never allocates.
+ */
+CallRecorder::CallRecorder(const std::string &directory)
+	: directory(directory), out_ring(RECORDER_RING_SIZE), in_ring(RECORDER_RING_SIZE)
+{
+}
+
+/* CallRecorder Destructor
+ * Finishes the recording if one is running.
+ */
+CallRecorder::~CallRecorder() noexcept {
+	stop();
+}
+
+/* start()
+ * Picks the file name prefix from the current time and starts the writer.
+ */
+bool CallRecorder::start() {
+	if (recording)
+		return false;
+
+	char stamp[32];
+	std::time_t now = std::time(nullptr);
+	std::strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", std::localtime(&now));
+	prefix = directory + "/peerschat-" + stamp;
+	out_seen = false;
+
+	recording = true;
+	writer = std::thread(&CallRecorder::writerLoop, this);
+	std::cout << "Recording to " << prefix << "-*.opus" << std::endl;
+	return true;
+}
+
+/* stop()
+ * Stops the writer, writes out whatever is still queued and closes the files.
+ */
+void CallRecorder::stop() noexcept {
+	if (!recording.exchange(false))
+		return;
+	if (writer.joinable())
+		writer.join();
+	drain(out_ring, false);
+	drain(in_ring, true);
+	streams.clear();
+	std::cout << "Recording stopped (" << bytes.load() << " bytes, " << dropped.load() << " packets dropped)" << std::endl;
+}
+
+/* onPacket()
+ * Audio/network thread side.  Our own packets come through once per peer with
+ * the same timestamp; only the first copy is kept.
+ */
+void CallRecorder::onPacket(NPeer *peer, bool incoming, const AudioPacket &packet) noexcept {
+	if (!recording)
+		return;
+	if (!incoming) {
+		if (out_seen && packet.timestamp == out_last_ts)
+			return;
+		out_seen = true;
+		out_last_ts = packet.timestamp;
+	}
+	Record record = { incoming ? peer->getID() : -1, packet.packet_id, packet.timestamp, packet.packet_len };
+	if (!queue(incoming ? in_ring : out_ring, record, packet.packet.get()))
+		dropped++;
+}
+
+/* queue()
+ * Puts a record and its payload on the ring in one write, so the writer never
+ * sees half of it.  Returns false (and queues nothing) if it doesn't fit.
+ */
+bool CallRecorder::queue(SPSCRing<uint8_t> &ring, const Record &record, const uint8_t *data) noexcept {
+	uint8_t buffer[sizeof(Record) + BUFFER_SIZE];
+	size_t len = sizeof(Record) + record.len;
+	if (record.len > BUFFER_SIZE || ring.space() < len)
+		return false;
+	std::memcpy(buffer, &record, sizeof(Record));
+	std::memcpy(buffer + sizeof(Record), data, record.len);
+	ring.write(buffer, len);
+	return true;
+}
+
+/* drain()
+ * Writer side.  Hands every queued packet to its stream's file, opening the
+ * file on the stream's first packet.  Gaps are found from timestamps, which
+ * also cover the DTX frames a peer held back, except for legacy peers that
+ * send none; those go by packet id.  Duplicates and packets older than what
+ * was already written are skipped.
+ */
+void CallRecorder::drain(SPSCRing<uint8_t> &ring, bool incoming) noexcept {
+	uint8_t data[BUFFER_SIZE];
+	Record record;
+	while (ring.available() >= sizeof(Record)) {
+		ring.read((uint8_t*) &record, sizeof(Record));
+		ring.read(data, record.len);
+
+		Stream &stream = streams[record.peer];
+		if (!stream.writer) {
+			std::string path = prefix + ((record.peer < 0) ? std::string("-self") : "-peer" + std::to_string(record.peer)) + ".opus";
+			uint32_t serial = (uint32_t) std::time(nullptr) ^ ((uint32_t) record.peer * 2654435761u);
+			stream.writer.reset(new OggOpusWriter(path, serial));
+			if (!stream.writer->good())
+				std::cerr << "Failed to open " << path << " for recording" << std::endl;
+		}
+		if (!stream.writer->good())
+			continue;
+
+		int samples = opus_packet_get_nb_samples(data, record.len, OPUS_RATE);
+		if (samples <= 0)
+			continue;
+
+		uint32_t missing = 0;
+		if (!stream.started)
+			stream.timed = !incoming || record.timestamp != 0;
+		else {
+			int32_t ahead = stream.timed ? (int32_t) (record.timestamp - stream.next_ts) / samples
+			                             : (int32_t) (record.packet_id - stream.next_id);
+			if (ahead < 0)
+				continue;
+			missing = (ahead > RECORDER_MAX_GAP) ? 0 : (uint32_t) ahead;
+		}
+		stream.started = true;
+		stream.next_id = record.packet_id + 1;
+		stream.next_ts = record.timestamp + samples;
+
+		uint64_t before = stream.writer->getBytes();
+		stream.writer->write(data, record.len, samples, missing);
+		bytes += stream.writer->getBytes() - before;
+	}
+}
+
+/* writerLoop()
+ * Wakes every RECORDER_FLUSH_MS and drains both rings.  The file buffers
+ * collect the small packets into large writes.
+ */
+void CallRecorder::writerLoop() noexcept {
+	apply_thread_policy(THREAD_CONTROL);
+	while (recording) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(RECORDER_FLUSH_MS));
+		drain(out_ring, false);
+		drain(in_ring, true);
+	}
+}
@@ -0,0 +1,159 @@
+#ifndef _PC_RECORDER_HPP
+#define _PC_RECORDER_HPP
+
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <thread>
+#include <atomic>
+
+#include "PC_Network.hpp"
+#include <PC_Thread.hpp>
+
+/* Constants
+ * RECORDER_RING_SIZE is the bytes of packets each direction can queue for the
+ *                    writer (1 MiB is minutes of audio for a full call)
+ * RECORDER_FLUSH_MS is how often the writer thread wakes up to drain the rings
+ * RECORDER_FILE_BUFFER is the stdio buffer per file, so the disk sees few large writes
+ * RECORDER_MAX_GAP is the longest gap (packets) filled with silence, anything longer
+ *                  is cut out of the recording
+ * OGG_PAGE_PACKETS is how many packets go on one Ogg page (50 = 1 s at 20 ms)
+ * OGG_PRESKIP is the Opus pre-skip written to the header, libopus' encoder delay at 48 kHz
+ */
+#define RECORDER_RING_SIZE (1 << 20)
+#define RECORDER_FLUSH_MS 200
+#define RECORDER_FILE_BUFFER (64 * 1024)
+#define RECORDER_MAX_GAP 3000
+#define OGG_PAGE_PACKETS 50
+#define OGG_PRESKIP 312
+
+// OggOpusWriter Class ---------------------------------------------------------
+/* OggOpusWriter: Writes one mono Opus stream to an Ogg Opus file (RFC 7845)
+ *
+ * Packets are stored as they came off the wire, nothing is decoded or
+ * re-encoded.  Missing packets are filled with 1 byte (TOC only) packets,
+ * which decoders play as silence/concealment, so the file keeps real time.
+ *
+ * @constructor OggOpusWriter(2)  path, serial (Ogg stream serial number)
+ *
+ * @method good()  Did the file open?
+ *
+ * @method write(4)  Append a packet of @samples samples (48 kHz) after first
+ *                   filling in @missing lost ones of the same length
+ *
+ * @method close()  Write the last page (end of stream) and close the file.
+ *                  Also done by the destructor.
+ *
+ * @method getBytes()  Bytes written to the file so far
+ */
+class OggOpusWriter
+{
+private:
+	FILE *file = nullptr;
+	uint32_t serial;
+	uint32_t sequence = 0;
+	uint64_t granule = OGG_PRESKIP;
+	uint64_t bytes = 0;
+	uint8_t last_toc = 0;
+	int last_samples = 0;
+	std::vector<uint8_t> segments;
+	std::vector<uint8_t> body;
+	int packets = 0;
+
+	void addPacket(const uint8_t *data, size_t len, int samples) noexcept;
+	void writePage(uint8_t type, uint64_t position) noexcept;
+
+public:
+	OggOpusWriter(const std::string &path, uint32_t serial);
+	~OggOpusWriter() noexcept;
+	OggOpusWriter(const OggOpusWriter&) = delete;
+	OggOpusWriter& operator=(const OggOpusWriter&) = delete;
+
+	inline bool good() noexcept { return this->file != nullptr; }
+	void write(const uint8_t *data, size_t len, int samples, uint32_t missing) noexcept;
+	void close() noexcept;
+	inline uint64_t getBytes() noexcept { return this->bytes; }
+};
+
+// CallRecorder Class ----------------------------------------------------------
+/* CallRecorder: Records every audio stream of a call, one Ogg Opus file each
+ *
+ * Registered with PeersChatNetwork::setPacketTap() it sees every encoded packet
+ * we send (once, not once per peer) and every packet a peer sends us.
+ * onPacket() runs on the audio and network threads, so all it does is copy the
+ * packet into a lock-free ring (one per direction, each has a single producer)
+ * and return; when a ring is full the packet is dropped and counted, nothing
+ * ever waits.  A writer thread drains the rings every RECORDER_FLUSH_MS and
+ * owns all the files.
+ *
+ * Files are <directory>/peerschat-<date>-<time>-self.opus for our mic and
+ * ...-peer<ID>.opus for each peer, created on the stream's first packet.
+ *
+ * @constructor CallRecorder(1)  directory to write the files to
+ *
+ * @method start()  Start the writer thread
+ *                 @return (bool) false if already recording
+ *
+ * @method stop()  Write out what is queued, finish and close every file
+ *
+ * @method onPacket(3)  PacketTap hook, see PC_Network.hpp
+ *
+ * @method isRecording()  Is the writer running?
+ *
+ * @method getDropped()  Packets lost because a ring was full
+ *
+ * @method getBytes()  Bytes written to all files
+ */
+class CallRecorder : public PacketTap
+{
+private:
+	// Queued packet, followed by len bytes of payload in the ring
+	struct Record {
+		int32_t peer;
+		uint32_t packet_id;
+		uint32_t timestamp;
+		uint16_t len;
+	};
+	struct Stream {
+		std::unique_ptr<OggOpusWriter> writer;
+		bool started = false;
+		bool timed = false;
+		uint32_t next_id = 0;
+		uint32_t next_ts = 0;
+	};
+
+	std::string directory;
+	std::string prefix;
+	SPSCRing<uint8_t> out_ring;
+	SPSCRing<uint8_t> in_ring;
+	std::map<int, Stream> streams;
+	std::thread writer;
+	std::atomic<bool> recording = {false};
+	std::atomic<uint32_t> dropped = {0};
+	std::atomic<uint64_t> bytes = {0};
+	bool out_seen = false;
+	uint32_t out_last_ts = 0;
+
+	static bool queue(SPSCRing<uint8_t> &ring, const Record &record, const uint8_t *data) noexcept;
+	void drain(SPSCRing<uint8_t> &ring, bool incoming) noexcept;
+	void writerLoop() noexcept;
+
+public:
+	explicit CallRecorder(const std::string &directory);
+	~CallRecorder() noexcept;
+	CallRecorder(const CallRecorder&) = delete;
+	CallRecorder& operator=(const CallRecorder&) = delete;
+
+	bool start();
+	void stop() noexcept;
+	void onPacket(NPeer *peer, bool incoming, const AudioPacket &packet) noexcept override;
+
+	inline bool isRecording() noexcept { return this->recording; }
+	inline uint32_t getDropped() noexcept { return this->dropped; }
+	inline uint64_t getBytes() noexcept { return this->bytes; }
+};
+
+#endif//_PC_RECORDER_HPP
@@ -0,0 +1,164 @@
+#include "PC_Resampler.hpp"
+#include "PC_DSP.hpp"
+
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+/* Constants
+ * KAISER_BETA: Window shape, ~80 dB stopband
+ * ROLLOFF: Passband edge as a share of the lower Nyquist frequency
+ */
+#define KAISER_BETA 8.0
+#define ROLLOFF 0.90
+
+/* bessel_i0()
+ * Zeroth order modified Bessel function, for the Kaiser window.
+ */
+static double bessel_i0(double x) {
+	double sum = 1.0, term = 1.0;
+	for (int k = 1; k < 32; ++k) {
+		term *= (x / (2.0 * k)) * (x / (2.0 * k));
+		sum += term;
+	}
+	return sum;
+}
+
+/* Resampler Constructor
+ * Reduces the ratio and designs the prototype filter, split into L phases of
+ * RESAMPLER_TAPS coefficients each (reversed, so they line up with the history).
+ * Adjustable ones get at least RESAMPLER_PHASES phases, plus phase L (phase 0
+ * one input later) so every phase has a neighbour to interpolate towards.
+ */
+Resampler::Resampler(int in_rate, int out_rate, int channels, size_t max_in, bool adjustable)
+	: channels(channels), max_in(max_in), adjustable(adjustable)
+{
+	int a = in_rate, b = out_rate;
+	while (b != 0) {
+		int t = a % b;
+		a = b;
+		b = t;
+	}
+	L = (size_t) (out_rate / a);
+	M = (size_t) (in_rate / a);
+	if (adjustable && L < RESAMPLER_PHASES) {
+		size_t k = (RESAMPLER_PHASES + L - 1) / L;
+		L *= k;
+		M *= k;
+	}
+	step = M;
+
+	const size_t length = L * RESAMPLER_TAPS;
+	const size_t phases = adjustable ? L + 1 : L;
+	const double fc = 0.5 * ROLLOFF / std::max(L, M);
+	const double center = (length - 1) / 2.0;
+	const double norm = bessel_i0(KAISER_BETA);
+	coefs.assign(phases * RESAMPLER_TAPS, 0.0f);
+	for (size_t phase = 0; phase < phases; ++phase) {
+		for (size_t tap = 0; tap < RESAMPLER_TAPS; ++tap) {
+			size_t n = phase + tap * L;
+			if (n >= length)
+				continue;
+			double t = n - center;
+			double sinc = (t == 0.0) ? 1.0 : std::sin(2.0 * M_PI * fc * t) / (2.0 * M_PI * fc * t);
+			double r = t / center;
+			double window = bessel_i0(KAISER_BETA * std::sqrt(std::max(0.0, 1.0 - r * r))) / norm;
+			coefs[phase * RESAMPLER_TAPS + (RESAMPLER_TAPS - 1 - tap)] = (float) (2.0 * fc * sinc * window * L);
+		}
+	}
+
+	history.resize(channels * (RESAMPLER_TAPS - 1 + max_in));
+	reset();
+}
+
+/* reset()
+ * Clears the input history and phase.
+ */
+void Resampler::reset() noexcept {
+	std::fill(history.begin(), history.end(), 0.0f);
+	pos = 0;
+	frac = 0;
+}
+
+/* maxOutput()
+ * Upper bound on how many frames n input frames turn into.
+ */
+size_t Resampler::maxOutput(size_t n) const noexcept {
+	return (n * L + step - 1) / step + 1;
+}
+
+/* setRatio()
+ * The step between output frames becomes M / ratio in the upsampled input,
+ * kept as whole steps plus a 32 bit fraction.
+ */
+void Resampler::setRatio(double ratio) noexcept {
+	if (!adjustable || !(ratio > 0.0))
+		return;
+	double s = M / ratio;
+	if (s < 1.0)
+		s = 1.0;
+	step = (size_t) s;
+	step_frac = (uint32_t) ((s - step) * 4294967296.0);
+}
+
+/* getDelay()
+ * Group delay of the prototype filter, in output frames.
+ */
+double Resampler::getDelay() const noexcept {
+	return (L * RESAMPLER_TAPS - 1) / 2.0 / M;
+}
+
+/* process()
+ * Output frame k sits at pos = k * M in the L times upsampled input.  Its
+ * phase is pos % L and the newest input it needs is pos / L.  Off L/M, pos
+ * also has a fraction and the frame is mixed from its phase and the next.
+ */
+size_t Resampler::process(const float *in, size_t n, float *out, size_t max_out) noexcept {
+	static const DSPKernels &kernels = dsp();
+	const size_t stride = RESAMPLER_TAPS - 1 + max_in;
+	size_t count = 0;
+
+	// Larger blocks than we have history for go through in pieces
+	while (n > 0) {
+		size_t chunk = std::min(n, max_in);
+
+		for (int c = 0; c < channels; ++c) {
+			float *h = &history[c * stride + RESAMPLER_TAPS - 1];
+			for (size_t i = 0; i < chunk; ++i)
+				h[i] = in[i * channels + c];
+		}
+
+		while (count < max_out) {
+			size_t q = pos / L, phase = pos % L;
+			if (q >= chunk)
+				break;
+			const float *taps = &coefs[phase * RESAMPLER_TAPS];
+			if (frac == 0) {
+				for (int c = 0; c < channels; ++c)
+					out[count * channels + c] = kernels.dot(taps, &history[c * stride + q], RESAMPLER_TAPS);
+			} else {
+				const float w = frac * (1.0f / 4294967296.0f);
+				for (int c = 0; c < channels; ++c) {
+					const float *h = &history[c * stride + q];
+					float a = kernels.dot(taps, h, RESAMPLER_TAPS);
+					float b = kernels.dot(taps + RESAMPLER_TAPS, h, RESAMPLER_TAPS);
+					out[count * channels + c] = a + w * (b - a);
+				}
+			}
+			count++;
+			uint32_t f = frac + step_frac;
+			pos += step + (f < frac);
+			frac = f;
+		}
+		pos = (pos >= chunk * L) ? pos - chunk * L : 0;
+
+		for (int c = 0; c < channels; ++c) {
+			float *h = &history[c * stride];
+			std::memmove(h, h + chunk, sizeof(float) * (RESAMPLER_TAPS - 1));
+		}
+
+		in += chunk * channels;
+		n -= chunk;
+	}
+	return count;
+}
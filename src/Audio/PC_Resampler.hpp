@@ -0,0 +1,76 @@
+#ifndef _PC_RESAMPLER_HPP
+#define _PC_RESAMPLER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/* Constants
+ * RESAMPLER_TAPS is the filter length per output sample.  32 keeps aliasing and
+ *                imaging below about -80 dB with a passband up to ~90% of Nyquist.
+ */
+#define RESAMPLER_TAPS 32
+
+/* RESAMPLER_PHASES is the least number of phases an adjustable Resampler keeps.
+ *                  Ratios between phases are interpolated linearly, 256 keeps
+ *                  that error below the filter's own.
+ */
+#define RESAMPLER_PHASES 256
+
+// Resampler Class -------------------------------------------------------------
+/* Resampler: Polyphase windowed sinc sample rate converter
+ *
+ * Converts between any two integer rates with the exact ratio L/M (44100 ->
+ * 48000 is 160/147).  Each output sample is one RESAMPLER_TAPS long dot product
+ * (DSP kernels, so SIMD) with the phase of the Kaiser windowed prototype that
+ * lines up with it.  State carries over between calls so blocks of any size
+ * can be fed in.  Samples are interleaved when channels > 1.
+ *
+ * An adjustable Resampler can also be nudged off L/M by any ratio close to 1
+ * (following another clock).  It keeps at least RESAMPLER_PHASES phases and
+ * interpolates between the two either side of each output sample, so that
+ * costs a second dot product per sample.
+ *
+ * @constructor Resampler(5)  in_rate, out_rate (Hz), channels, max_in (largest
+ *                            number of frames process() will be given),
+ *                            adjustable (allow setRatio(), default false)
+ *
+ * @method process(4)  Convert n frames from in, write at most max_out frames to out.
+ *                     max_out must be at least maxOutput(n).
+ *                    @return (size_t) frames written
+ *
+ * @method maxOutput(1)  Most frames process() can produce from n input frames
+ *
+ * @method setRatio(1)  Produce ratio times as many frames as L/M would, from
+ *                     the next frame on (adjustable only)
+ *
+ * @method getDelay()  Group delay of the filter in output frames
+ *
+ * @method reset()  Clear history, as if just constructed
+ */
+class Resampler
+{
+private:
+	size_t L;
+	size_t M;
+	int channels;
+	size_t max_in;
+	size_t pos = 0;
+	uint32_t frac = 0;
+	size_t step;
+	uint32_t step_frac = 0;
+	bool adjustable;
+	std::vector<float> coefs;
+	std::vector<float> history;
+
+public:
+	Resampler(int in_rate, int out_rate, int channels, size_t max_in, bool adjustable = false);
+
+	size_t process(const float *in, size_t n, float *out, size_t max_out) noexcept;
+	size_t maxOutput(size_t n) const noexcept;
+	void setRatio(double ratio) noexcept;
+	double getDelay() const noexcept;
+	void reset() noexcept;
+};
+
+#endif//_PC_RESAMPLER_HPP
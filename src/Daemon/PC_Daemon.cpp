@@ -0,0 +1,267 @@
+#include "PC_Daemon.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <sstream>
+#include <algorithm>
+#include <poll.h>
+#include <sys/mman.h>
+
+using namespace std::chrono;
+
+
+// Globals
+extern PeersChatNetwork *Network;
+extern APeer *Audio;
+
+
+// Static Initialization
+std::atomic<bool> PeersChatDaemon::quit = {false};
+
+// Stage of the last host/join, written by its progress callback on the control thread
+static std::atomic<int> join_stage = {-1};
+
+static void join_progress(JoinStage stage)
+{
+	join_stage = stage;
+}
+
+
+// Constructor/Destructor
+PeersChatDaemon::PeersChatDaemon(const std::string &path) noexcept : path(path)
+{
+	this->shared = ipc_create_shared(this->shared_fd);
+	if(!this->shared) return;
+	this->listener = ipc_listen(path);
+	this->last_publish = steady_clock::now();
+}
+
+
+PeersChatDaemon::~PeersChatDaemon() noexcept
+{
+	for(int client : this->clients)
+		close(client);
+	if(this->listener >= 0)
+	{
+		close(this->listener);
+		unlink(this->path.c_str());
+	}
+	if(this->shared)
+	{
+		this->shared->~SharedState();
+		munmap(this->shared, sizeof(SharedState));
+	}
+	if(this->shared_fd >= 0)
+		close(this->shared_fd);
+}
+
+
+// Main Loop
+int PeersChatDaemon::run() noexcept
+{
+	std::cout << "PeersChatd listening on " << this->path << std::endl;
+
+	std::vector<pollfd> fds;
+	while(!PeersChatDaemon::quit)
+	{
+		// Listener first, then every front end
+		fds.clear();
+		fds.push_back({this->listener, POLLIN, 0});
+		for(int client : this->clients)
+			fds.push_back({client, POLLIN, 0});
+
+		int ready = poll(fds.data(), fds.size(), IPC_PUBLISH_MS);
+		if(ready < 0 && errno != EINTR)
+		{
+			perror("PeersChatDaemon::run() poll()");
+			return EXIT_FAILURE;
+		}
+
+		// Requests
+		if(ready > 0)
+		{
+			for(size_t i = 1; i < fds.size(); ++i)
+				if(fds[i].revents)
+					this->serve(fds[i].fd);
+
+			// New front ends
+			if(fds[0].revents & POLLIN)
+			{
+				int client = accept4(this->listener, NULL, NULL, SOCK_CLOEXEC);
+				if(client >= 0 && this->clients.size() < IPC_MAX_CLIENTS)
+					this->clients.push_back(client);
+				else if(client >= 0)
+					close(client);
+			}
+
+			// Drop the ones that hung up
+			this->clients.erase(std::remove(this->clients.begin(), this->clients.end(), -1), this->clients.end());
+		}
+
+		this->followJoin();
+
+		// Snapshot at most every IPC_PUBLISH_MS
+		if(steady_clock::now() - this->last_publish >= milliseconds(IPC_PUBLISH_MS))
+			this->publish();
+	}
+	return EXIT_SUCCESS;
+}
+
+
+void PeersChatDaemon::serve(int client) noexcept
+{
+	std::string line;
+	if(!ipc_recv(client, line))
+	{
+		close(client);
+		std::replace(this->clients.begin(), this->clients.end(), client, -1);
+		return;
+	}
+
+	int fd = -1;
+	std::string reply = this->command(line, fd);
+	ipc_send(client, reply, fd);
+}
+
+
+std::string PeersChatDaemon::command(const std::string &line, int &fd) noexcept
+{
+	std::istringstream in(line);
+	std::string verb;
+	in >> verb;
+
+	if(verb == "ATTACH")
+	{
+		fd = this->shared_fd;
+		return "OK " + std::to_string(sizeof(SharedState));
+	}
+	else if(verb == "NAME")
+	{
+		std::string name;
+		in >> name;
+		return Network->setMyName(name) ? "OK" : "ERR bad name";
+	}
+	else if(verb == "HOST")
+	{
+		int port = 0;
+		if(in >> port)
+		{
+			if(port <= 0 || port > 65535) return "ERR bad port";
+			PORT = (uint16_t) port;
+		}
+		join_stage = -1;
+		return Network->hostAsync(join_progress) ? "OK" : "ERR busy";
+	}
+	else if(verb == "JOIN")
+	{
+		// <ip>:<port> or [<ipv6>]:<port>
+		std::string where;
+		in >> where;
+		PeerAddr addr;
+		if(!PeerAddr::parse(where, 0, addr)) return "ERR not an IP address";
+		if(!addr.valid()) return "ERR expected <ip>:<port>";
+
+		join_stage = -1;
+		return Network->joinAsync(addr, join_progress) ? "OK" : "ERR busy";
+	}
+	else if(verb == "LEAVE")
+	{
+		// Audio first, so nothing reads the peers the network retires
+		Network->cancelJoin();
+		if(this->audio_running) Audio->stopVoiceStream();
+		this->audio_running = false;
+		Network->disconnectAsync();
+		join_stage = -1;
+		return "OK";
+	}
+	else if(verb == "MUTE" || verb == "GAIN")
+	{
+		int id = -1;
+		float value = 0.0f;
+		if(!(in >> id >> value)) return "ERR expected <id> <value>";
+
+		if(id == 0 && verb == "MUTE") Audio->setMuteMic(value != 0.0f);
+		else if(id == 0) Audio->setInputVolume(std::min(value, 1.25f));
+		else
+		{
+			NPeer *peer = Network->findID(id);
+			if(!peer) return "ERR no such peer";
+			if(verb == "MUTE") peer->setMute(value != 0.0f);
+			else peer->setGain(value);
+		}
+		return "OK";
+	}
+	else if(verb == "VOLUME")
+	{
+		float value = 0.0f;
+		if(!(in >> value)) return "ERR expected <volume>";
+		Audio->setOutputVolume(std::max(0.0f, std::min(value, 2.0f)));
+		return "OK";
+	}
+	else if(verb == "QUIT")
+	{
+		PeersChatDaemon::requestQuit();
+		return "OK";
+	}
+	return "ERR unknown command";
+}
+
+
+void PeersChatDaemon::followJoin() noexcept
+{
+	int stage = join_stage.load();
+	if(stage == JOIN_STARTED && !this->audio_running)
+	{
+		Audio->startVoiceStream();
+		this->audio_running = true;
+	}
+}
+
+
+void PeersChatDaemon::publish() noexcept
+{
+	SharedSnapshot snapshot;
+	std::memset(&snapshot, 0, sizeof(snapshot));
+	snapshot.serial        = ++this->serial;
+	snapshot.stage         = join_stage.load();
+	snapshot.in_call       = this->audio_running;
+	snapshot.mic_muted     = Audio->getMuteMic();
+	snapshot.port          = PORT;
+	snapshot.input_volume  = Audio->getInputVolume();
+	snapshot.output_volume = Audio->getOutputVolume();
+	snapshot.xruns         = Audio->getXRuns();
+
+	AudioLevel level;
+	if(Audio->getLevel(0, level))
+	{
+		snapshot.mic_peak = level.peak;
+		snapshot.mic_rms  = level.rms;
+	}
+
+	// Roster -- Same walk the mixer does
+	int count = std::min(Network->getNumberPeers(), IPC_MAX_PEERS);
+	for(int i = 0; i < count; ++i)
+	{
+		NPeer *peer = (*Network)[i];
+		if(!peer) break;
+
+		SharedPeer &out = snapshot.peers[snapshot.count++];
+		out.id = peer->getID();
+		std::strncpy(out.name, peer->getName().c_str(), IPC_NAME_LEN);
+		out.muted     = peer->getMute();
+		out.gain      = peer->getGain();
+		out.loss      = peer->getLoss();
+		out.jitter_us = peer->getJitter();
+		out.rtt_us    = peer->getRTT();
+		if(Audio->getLevel(out.id, level))
+		{
+			out.peak = level.peak;
+			out.rms  = level.rms;
+		}
+	}
+
+	this->shared->snapshot.store(snapshot);
+	this->last_publish = steady_clock::now();
+}
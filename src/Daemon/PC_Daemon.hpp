@@ -0,0 +1,91 @@
+#ifndef _PC_DAEMON_HPP
+#define _PC_DAEMON_HPP
+
+
+/*
+ *  PeersChat Daemon Header: Runs the engine headless and serves front ends (see PC_IPC.hpp)
+ */
+
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <PC_Network.hpp>
+#include <PC_Audio.hpp>
+#include "PC_IPC.hpp"
+
+
+// PeersChatDaemon Class -----------------------------------------------------------------
+/* PeersChatDaemon: Control socket and shared memory publisher around the global Network
+ *                  and Audio engine -- Everything runs on the thread that calls run()
+ *
+(IMPLEMENTATION DETAILS)
+Members:
+ * path  Where the control socket lives
+ *
+ * listener  Listening control socket
+ *
+ * clients  Connected front ends
+ *
+ * shared_fd/shared  Shared memory segment, handed out on ATTACH
+ *
+ * audio_running  Did we start the voice stream for the current call?
+ *
+ * serial  Snapshots published
+ *
+ * last_publish  When the last snapshot went out
+ *
+ * quit  (static) Set by a signal or QUIT, makes run() return
+ *
+The join/host progress callback runs on the network's control thread and only stores
+the stage in an atomic (file scope, so a join finishing after we're gone can't touch
+us).  run() notices JOIN_STARTED and starts the voice stream on its own thread, like
+the GUI does from the main loop.
+ *
+ *
+(CLIENT INTERFACE)
+Public Methods:
+ * PeersChatDaemon(1)  Listen on @path and create the shared memory
+ *
+ * good()  Is the socket listening and the shared memory mapped?
+ *
+ * run()  Serve front ends and publish snapshots until requestQuit()
+ *       @return (int) exit status
+ *
+ * requestQuit()  (static, async signal safe) Make run() return
+ *
+ */
+class PeersChatDaemon
+{
+	// Members
+private:
+	std::string path;
+	int listener = -1;
+	std::vector<int> clients;
+	int shared_fd = -1;
+	SharedState *shared = NULL;
+	bool audio_running = false;
+	uint32_t serial = 0;
+	std::chrono::steady_clock::time_point last_publish;
+	static std::atomic<bool> quit;
+
+public:
+	explicit PeersChatDaemon(const std::string &path) noexcept;
+	~PeersChatDaemon() noexcept;
+	PeersChatDaemon(const PeersChatDaemon&) = delete;
+	PeersChatDaemon& operator=(const PeersChatDaemon&) = delete;
+
+	inline bool good() noexcept { return this->listener >= 0 && this->shared != NULL; }
+	int run() noexcept;
+	static inline void requestQuit() noexcept { PeersChatDaemon::quit = true; }
+
+private:
+	void serve(int client) noexcept;
+	std::string command(const std::string &line, int &fd) noexcept;
+	void followJoin() noexcept;
+	void publish() noexcept;
+};
+
+
+#endif
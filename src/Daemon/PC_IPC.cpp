@@ -0,0 +1,216 @@
+#include "PC_IPC.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <algorithm>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+
+// Control Socket ------------------------------------------------------------------------
+std::string ipc_default_socket()
+{
+	const char *path = std::getenv("PEERSCHAT_SOCKET");
+	if(path && *path) return path;
+
+	const char *runtime = std::getenv("XDG_RUNTIME_DIR");
+	if(runtime && *runtime) return std::string(runtime) + "/peerschat.sock";
+
+	return "/tmp/peerschat-" + std::to_string(getuid()) + ".sock";
+}
+
+
+static bool ipc_address(const std::string &path, sockaddr_un &addr) noexcept
+{
+	std::memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if(path.size() >= sizeof(addr.sun_path))
+	{
+		fprintf(stderr, "Socket path too long: %s\n", path.c_str());
+		return false;
+	}
+	std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+	return true;
+}
+
+
+int ipc_listen(const std::string &path) noexcept
+{
+	sockaddr_un addr;
+	if(!ipc_address(path, addr)) return -1;
+
+	int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if(sock < 0)
+	{
+		perror("ipc_listen() socket()");
+		return -1;
+	}
+
+	// Nobody answering means it's left over from a daemon that died
+	int probe = ipc_connect(path);
+	if(probe >= 0)
+	{
+		close(probe);
+		close(sock);
+		fprintf(stderr, "A daemon is already listening on %s\n", path.c_str());
+		return -1;
+	}
+	unlink(path.c_str());
+
+	// Only we get to talk to our engine
+	mode_t mask = umask(0077);
+	int bound = bind(sock, (sockaddr*) &addr, sizeof(addr));
+	umask(mask);
+	if(bound < 0 || listen(sock, IPC_MAX_CLIENTS) < 0)
+	{
+		perror("ipc_listen() bind()/listen()");
+		close(sock);
+		return -1;
+	}
+	return sock;
+}
+
+
+int ipc_connect(const std::string &path) noexcept
+{
+	sockaddr_un addr;
+	if(!ipc_address(path, addr)) return -1;
+
+	int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if(sock < 0) return -1;
+	if(connect(sock, (sockaddr*) &addr, sizeof(addr)) < 0)
+	{
+		close(sock);
+		return -1;
+	}
+	return sock;
+}
+
+
+bool ipc_send(int sock, const std::string &text, int fd) noexcept
+{
+	iovec iov;
+	iov.iov_base = (void*) text.data();
+	iov.iov_len  = std::min<size_t>(text.size(), IPC_LINE_MAX);
+
+	msghdr msg;
+	std::memset(&msg, 0, sizeof(msg));
+	msg.msg_iov    = &iov;
+	msg.msg_iovlen = 1;
+
+	// Pass the fd along as SCM_RIGHTS
+	union {
+		char buffer[CMSG_SPACE(sizeof(int))];
+		cmsghdr align;
+	} control;
+	if(fd >= 0)
+	{
+		msg.msg_control    = control.buffer;
+		msg.msg_controllen = sizeof(control.buffer);
+		cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type  = SCM_RIGHTS;
+		cmsg->cmsg_len   = CMSG_LEN(sizeof(int));
+		std::memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+	}
+
+	return sendmsg(sock, &msg, MSG_NOSIGNAL) == (ssize_t) iov.iov_len;
+}
+
+
+bool ipc_recv(int sock, std::string &text, int *fd) noexcept
+{
+	char buffer[IPC_LINE_MAX];
+	iovec iov;
+	iov.iov_base = buffer;
+	iov.iov_len  = sizeof(buffer);
+
+	union {
+		char buffer[CMSG_SPACE(sizeof(int))];
+		cmsghdr align;
+	} control;
+	msghdr msg;
+	std::memset(&msg, 0, sizeof(msg));
+	msg.msg_iov        = &iov;
+	msg.msg_iovlen     = 1;
+	msg.msg_control    = control.buffer;
+	msg.msg_controllen = sizeof(control.buffer);
+
+	ssize_t r = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+	if(r <= 0) return false;
+	text.assign(buffer, r);
+
+	// Take the fd if one came along, close it if nobody asked for it
+	int received = -1;
+	for(cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+		if(cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+			std::memcpy(&received, CMSG_DATA(cmsg), sizeof(int));
+	if(fd) *fd = received;
+	else if(received >= 0) close(received);
+	return true;
+}
+
+
+// Shared Memory -------------------------------------------------------------------------
+SharedState* ipc_create_shared(int &fd) noexcept
+{
+	// Unlinked right away: the fd we pass over the socket is the only way in
+	std::string name = "/peerschat-" + std::to_string(getpid());
+	fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+	if(fd < 0)
+	{
+		perror("ipc_create_shared() shm_open()");
+		return NULL;
+	}
+	shm_unlink(name.c_str());
+
+	if(ftruncate(fd, sizeof(SharedState)) < 0)
+	{
+		perror("ipc_create_shared() ftruncate()");
+		close(fd);
+		fd = -1;
+		return NULL;
+	}
+
+	void *memory = mmap(NULL, sizeof(SharedState), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if(memory == MAP_FAILED)
+	{
+		perror("ipc_create_shared() mmap()");
+		close(fd);
+		fd = -1;
+		return NULL;
+	}
+
+	SharedState *state = new (memory) SharedState;
+	state->magic   = IPC_MAGIC;
+	state->version = IPC_VERSION;
+	state->size    = sizeof(SharedState);
+	return state;
+}
+
+
+const SharedState* ipc_attach_shared(int fd) noexcept
+{
+	struct stat info;
+	if(fstat(fd, &info) < 0 || (size_t) info.st_size < sizeof(SharedState))
+		return NULL;
+
+	void *memory = mmap(NULL, sizeof(SharedState), PROT_READ, MAP_SHARED, fd, 0);
+	if(memory == MAP_FAILED)
+		return NULL;
+
+	const SharedState *state = static_cast<const SharedState*>(memory);
+	if(state->magic != IPC_MAGIC || state->version != IPC_VERSION || state->size != sizeof(SharedState))
+	{
+		munmap(memory, sizeof(SharedState));
+		return NULL;
+	}
+	return state;
+}
@@ -0,0 +1,150 @@
+#ifndef _PC_IPC_HPP
+#define _PC_IPC_HPP
+
+
+/*
+ *  PeersChat IPC Header: How front ends talk to the engine daemon (PeersChatd)
+ *
+ * The engine (APeer + PeersChatNetwork) can run on its own in PeersChatd so a stalled
+ * or crashed front end never takes the call down with it, and a front end can be
+ * restarted mid-call.  Front ends reach it two ways:
+ *
+ *    Control socket: A Unix SOCK_SEQPACKET socket.  Every request is one packet of
+ *                    text, every reply is one packet starting with "OK" or "ERR".
+ *
+ *        ATTACH                  OK <bytes>, with the shared memory fd attached
+ *        NAME <name>             Set our name
+ *        HOST [port]             Host a call
+ *        JOIN <ip>:<port>        Join a call -- progress shows up in the snapshot
+ *        LEAVE                   Leave the call (or stop joining)
+ *        MUTE <id> <0|1>         Mute a peer, id 0 is our mic
+ *        GAIN <id> <x>           Set a peer's volume (0 - 2), id 0 is our mic (0 - 1.25)
+ *        VOLUME <x>              Set the output volume (0 - 2)
+ *        QUIT                    Stop the daemon
+ *
+ *    Shared memory: A SharedState the daemon rewrites every IPC_PUBLISH_MS with the
+ *                   roster, join progress, levels and link stats.  It is one seqlocked
+ *                   snapshot (see SeqLock) in a fixed layout, so publishing never
+ *                   allocates, never waits on a reader, and a front end that attaches
+ *                   late sees the whole state at once instead of replaying events.
+ *                   The segment is unlinked as soon as it is created; the only way in
+ *                   is the fd ATTACH hands out.
+ *
+ */
+
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <PC_Thread.hpp>
+
+
+// Pre-Compiler Constants
+#define IPC_MAGIC 0x50434950       // "PCIP"
+#define IPC_VERSION 1
+#define IPC_NAME_LEN 18            // MAX_NAME_LEN
+#define IPC_MAX_PEERS 8            // >= MAX_PEERS
+#define IPC_MAX_CLIENTS 8
+#define IPC_LINE_MAX 256
+#define IPC_PUBLISH_MS 50
+
+
+// Shared Memory Layout ------------------------------------------------------------------
+/* SharedPeer: One peer in the snapshot
+ *
+ * @member id  NPeer ID
+ * @member name  Their name, NUL terminated
+ * @member muted  Are we muting them?
+ * @member gain  Their playback volume
+ * @member peak/rms  Level meter (see AudioLevel)
+ * @member loss  Fraction of their packets lost
+ * @member jitter_us/rtt_us  Link stats, 0 if not known
+ */
+struct SharedPeer
+{
+	int32_t  id;
+	char     name[IPC_NAME_LEN+1];
+	uint8_t  muted;
+	float    gain;
+	float    peak;
+	float    rms;
+	float    loss;
+	uint32_t jitter_us;
+	uint32_t rtt_us;
+};
+
+
+/* SharedSnapshot: Everything a front end shows, as of one publish
+ *
+ * @member serial  Publish counter, a front end can skip redrawing if it didn't move
+ * @member stage  JoinStage of the last host/join, -1 if none since the last LEAVE
+ * @member in_call  Is the network running?
+ * @member port  TCP/UDP port we listen on
+ * @member mic_muted/mic_peak/mic_rms  Our mic
+ * @member input_volume/output_volume  Volumes
+ * @member xruns  Audio callbacks PortAudio flagged as late
+ * @member count  Peers in @peers
+ */
+struct SharedSnapshot
+{
+	uint32_t   serial;
+	int32_t    stage;
+	uint8_t    in_call;
+	uint8_t    mic_muted;
+	uint16_t   port;
+	float      mic_peak;
+	float      mic_rms;
+	float      input_volume;
+	float      output_volume;
+	uint32_t   xruns;
+	int32_t    count;
+	SharedPeer peers[IPC_MAX_PEERS];
+};
+
+
+/* SharedState: The shared memory segment.  magic/version/size are written once before
+ *              the fd is ever handed out.
+ */
+struct SharedState
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t size;
+	SeqLock<SharedSnapshot> snapshot;
+};
+
+
+// Helpers -------------------------------------------------------------------------------
+/* ipc_default_socket()  $PEERSCHAT_SOCKET, else $XDG_RUNTIME_DIR/peerschat.sock, else
+ *                       /tmp/peerschat-<uid>.sock
+ *
+ * ipc_listen(1)  Bind and listen on the control socket at @path (replacing a stale one)
+ *               @return (int) socket, -1 on failure
+ *
+ * ipc_connect(1)  Connect to the control socket at @path
+ *                @return (int) socket, -1 on failure
+ *
+ * ipc_send(3)  Send one packet of text, with @fd attached if it isn't -1
+ *             @return (bool) success?
+ *
+ * ipc_recv(3)  Receive one packet of text, and the fd attached to it if @fd isn't NULL
+ *             (-1 if none)
+ *             @return (bool) false on error or hang up
+ *
+ * ipc_create_shared(1)  Daemon: Create, size, map and initialize an anonymous segment
+ *                      @param fd (int&) its fd, to hand out
+ *                      @return (SharedState*) NULL on failure
+ *
+ * ipc_attach_shared(1)  Front end: Map the segment behind @fd read only and check it
+ *                      @return (const SharedState*) NULL if it isn't ours
+ */
+std::string ipc_default_socket();
+int ipc_listen(const std::string &path) noexcept;
+int ipc_connect(const std::string &path) noexcept;
+bool ipc_send(int sock, const std::string &text, int fd = -1) noexcept;
+bool ipc_recv(int sock, std::string &text, int *fd = NULL) noexcept;
+SharedState* ipc_create_shared(int &fd) noexcept;
+const SharedState* ipc_attach_shared(int fd) noexcept;
+
+
+#endif
@@ -6,8 +6,72 @@
 extern PeersChatNetwork *Network;
 extern APeer *Audio;
 
-// Speedup GUI Leave
-std::unique_ptr<std::thread> DISCONNECT_THREAD;
+
+/*
+ *	Join/Host Progress
+ *
+ *	Network reports how a join/host is going from one of its own threads.
+ *	Every report is handed to the main loop with g_idle_add so GTK and the
+ *	audio stream are only ever touched from here.  Reports from a join/host
+ *	the user already walked away from (left, or started another) are dropped.
+ */
+
+struct JoinUpdate
+{
+	PC_GuiHandler *gh;
+	unsigned session;
+	bool hosting;
+	JoinStage stage;
+};
+
+// Bumped by every host/join/leave, main loop only
+static unsigned session = 0;
+
+static gboolean join_progress_main(gpointer data)
+{
+	std::unique_ptr<JoinUpdate> update(static_cast<JoinUpdate*>(data));
+	if(update->session != session)
+		return G_SOURCE_REMOVE;
+
+	PC_GuiHandler* gh = update->gh;
+	switch(update->stage)
+	{
+		case JOIN_CONNECTING:
+			gh->set_status("Connecting...");
+			break;
+		case JOIN_WAITING:
+			gh->set_status("Waiting to be let in...");
+			break;
+		case JOIN_PEERS:
+			gh->set_status("Getting the other peers...");
+			break;
+		case JOIN_STARTED:
+			// start audio library
+			Audio->startVoiceStream();
+			gh->set_status(update->hosting ? "Hosting" : "Connected, getting names...");
+			std::cout << (update->hosting ? "Hosting" : "Joining") << " Successful, Starting Voice Stream" << std::endl;
+			break;
+		case JOIN_DONE:
+			gh->set_status(update->hosting ? "Hosting" : "Connected");
+			break;
+		case JOIN_FAILED:
+			printf("ERROR: Connection could not be established\n");
+			gh->set_status("Connection could not be established");
+			break;
+		case JOIN_CANCELLED:
+			gh->set_status("Cancelled");
+			break;
+	}
+	return G_SOURCE_REMOVE;
+}
+
+static JoinCallback join_progress(PC_GuiHandler *gh, bool hosting)
+{
+	unsigned current = ++session;
+	return [gh, current, hosting](JoinStage stage) {
+		g_idle_add(join_progress_main, new JoinUpdate{gh, current, hosting, stage});
+	};
+}
 
 
 /*
@@ -26,9 +90,6 @@ void activate_callback(GtkApplication *app, gpointer data)
 
 void host_button_callback(GtkWidget *widget, gpointer data)
 {
-	if(DISCONNECT_THREAD.get() && DISCONNECT_THREAD->joinable())
-		DISCONNECT_THREAD->join();
-
 	PC_GuiHandler* gh = static_cast<PC_GuiHandler*>(data);
 	GtkWidget* widget_box = gh->get_widget_box();
 
@@ -49,25 +110,15 @@ void host_button_callback(GtkWidget *widget, gpointer data)
 		return;
 	}
 
-	// host network
-	if (Network->host() != TRUE)
-	{
-		printf("ERROR: Connection could not be established\n");
-	}
-
-	else
+	// host network -- audio starts once it reports back
+	if (!Network->hostAsync(join_progress(gh, true)))
 	{
-		// start audio library
-		Audio->startVoiceStream();
-		std::cout << "Hosting Successful, Starting Voice Stream" << std::endl;
+		gh->set_status("A join is already in progress");
 	}
 }
 
 void join_button_callback(GtkWidget *widget, gpointer data)
 {
-	if(DISCONNECT_THREAD.get() && DISCONNECT_THREAD->joinable())
-		DISCONNECT_THREAD->join();
-
 	PC_GuiHandler* gh = static_cast<PC_GuiHandler*>(data);
 	GtkWidget* widget_box = gh->get_widget_box();
 
@@ -88,28 +139,19 @@ void join_button_callback(GtkWidget *widget, gpointer data)
 	{
 		return;
 	}
-	// parse link_text for IP address and port
-	std::string str(link_text);
-	size_t pos = str.find_first_of(':', 0);
-	std::string ip = str.substr(0, pos);
-	std::string host_port = str.substr(pos + 1, 10);
-
-	// define socket address and join connection
-	sockaddr_in addr;
-	if (inet_pton(AF_INET, ip.c_str(), &addr.sin_addr) < 1)
-	{
-		printf("ERROR: IP Address String is not a valid IPv4 Address.\n");
-	}
-	addr.sin_port = htons((uint16_t) atoi(host_port.c_str()));
-	if (Network->join(addr) != TRUE)
+	// parse link_text for IP address and port -- "ip:port" or "[v6]:port"
+	PeerAddr addr;
+	if (!PeerAddr::parse(std::string(link_text), 0, addr) || !addr.valid())
 	{
-		printf("ERROR: Connection could not be established\n");
+		printf("ERROR: IP Address String is not a valid IPv4/IPv6 Address.\n");
+		gh->set_status("Not a valid IP address and port");
+		return;
 	}
 
-	else
+	// join on a network thread -- audio starts once it reports back
+	if (!Network->joinAsync(addr, join_progress(gh, false)))
 	{
-		// start audio library
-		Audio->startVoiceStream();
+		gh->set_status("A join is already in progress");
 	}
 }
 
@@ -197,6 +239,27 @@ void volume_callback(GtkVolumeButton *v1, gdouble value)
 	Audio->setOutputVolume(value);
 }
 
+void peer_volume_callback(GtkRange *range, gpointer data)
+{
+	PC_GuiHandler* gh = static_cast<PC_GuiHandler*>(data);
+	GtkWidget* list_row = gtk_widget_get_parent(GTK_WIDGET(range));
+	const gchar* id = gtk_widget_get_name(list_row);
+	gdouble value = gtk_range_get_value(range);
+
+	if(strcmp(id, "UserRow") == 0)
+	{
+		Audio->setInputVolume(value > 1.25 ? 1.25 : value);
+		return;
+	}
+
+	NPeer* peer = gh->get_npeer(atoi(id));
+	if(peer == NULL) {
+		printf("ERROR: Could not find user to set volume\n");
+		return;
+	}
+	peer->setGain(value);
+}
+
 void leave_button_callback(GtkWidget *widget, gpointer data)
 {
 	PC_GuiHandler* gh = static_cast<PC_GuiHandler*>(data);
@@ -204,10 +267,10 @@ void leave_button_callback(GtkWidget *widget, gpointer data)
 	gh->leaveButtonPressed(widget, widget_box);
 
 
-	// disconnect from network
-	if(DISCONNECT_THREAD.get() && DISCONNECT_THREAD->joinable())
-		DISCONNECT_THREAD->join();
-	DISCONNECT_THREAD.reset(new std::thread((void (PeersChatNetwork::*)(void))&PeersChatNetwork::disconnect, Network));
+	// audio first, then disconnect from network -- host/join wait for it to finish
+	session++;
+	Network->cancelJoin();
 	Audio->stopVoiceStream();
+	Network->disconnectAsync();
 }
 
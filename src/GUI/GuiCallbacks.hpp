@@ -19,13 +19,16 @@
  *                      			  of GUI.
  *
  * @method host_button_callback(2)  Called when "Host Session" button 
- *                                  is pressed.
+ *                                  is pressed.  Hosts on a network thread and
+ *                                  starts audio once that reports back.
  *                                    @param widget: Pointer to widget that emitted signal
  *                                    @param gpointer: void* pointer to data being passed
  *                                                     into callback function.
  * 
  * @method join_button_callback(2)  Called when "Join Session" button 
- *                                  is pressed.
+ *                                  is pressed.  Returns right away; the join runs
+ *                                  on a network thread and its progress shows up
+ *                                  in the lobby's status line.
  *                                    @param widget: Pointer to widget that emitted signal
  *                                    @param gpointer: void* pointer to data being passed
  *                                                     into callback function
@@ -57,8 +60,15 @@
  *                               @param value: Double precision value updated every
  *                                             time slider has been moved
  *
+ * @method peer_volume_callback(2)  Called whenever the volume slider on a row
+ *                                  of the user list is moved.  Sets that peer's
+ *                                  playback volume, or the mic volume on our own row.
+ *                                    @param range: Pointer to slider that emitted signal
+ *                                    @param gpointer: void* pointer to data being passed
+ *                                                     into callback function
+ *
  * @method leave_button_callback(2) Called when "Leave Session" button 
- *                                  is pressed.
+ *                                  is pressed.  Cancels a join still under way.
  *                                    @param widget: Pointer to widget that emitted signal
  *                                    @param gpointer: void* pointer to data being passed
  *                                                     into callback function 
@@ -72,6 +82,7 @@ void kick_button_callback(GtkWidget *widget, gpointer data);
 void direct_checkmark_callback(GtkWidget *widget);
 void indirect_checkmark_callback(GtkWidget *widget);
 void volume_callback(GtkVolumeButton *v1, gdouble value);
+void peer_volume_callback(GtkRange *range, gpointer data);
 void leave_button_callback(GtkWidget *widget, gpointer data);
 
 #endif
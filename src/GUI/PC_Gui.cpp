@@ -1,7 +1,8 @@
 #include <PC_Gui.hpp>
+#include <cmath>
 
 extern PeersChatNetwork *Network;
-extern std::unique_ptr<std::thread> DISCONNECT_THREAD;
+extern APeer *Audio;
 
 
 // Constructor
@@ -9,6 +10,9 @@ PC_GuiHandler::PC_GuiHandler()
 {
 	widget_box = NULL;
 	name_list = NULL;
+	status_label = NULL;
+	meter_source = 0;
+	meter_ticks = 0;
 
 	user_name = NULL;
 	user_link = NULL;
@@ -27,10 +31,6 @@ PC_GuiHandler::PC_GuiHandler()
 // Destructor
 PC_GuiHandler::~PC_GuiHandler()
 {
-
-	// Optimize Leave Button Destructor
-	if(DISCONNECT_THREAD.get() && DISCONNECT_THREAD->joinable())
-		DISCONNECT_THREAD->join();
 }
 
 // Begins GUI event loop
@@ -59,6 +59,7 @@ void PC_GuiHandler::add_self_to_session(const gchar *name)
 	GtkWidget *new_row = create_new_user_row(name, FALSE, FALSE);
 	gtk_widget_set_name(new_row, "UserRow");
 	gtk_container_add(GTK_CONTAINER(name_list), new_row);
+	self_row = find_row_widgets(new_row);
 }
 
 void PC_GuiHandler::add_user_to_session(const gchar *name, bool kickable)
@@ -94,26 +95,196 @@ void PC_GuiHandler::remove_name_from_session(const gchar *name)
 	}
 }
 
+// Roster changes from network threads -- queued here, applied by apply_roster_events()
+
 void PC_GuiHandler::add_npeer_to_gui(NPeer* peer)
 {
-	g_print("Npeer added to gui\n");
-	users.push_back(peer);
-	add_user_to_session(peer->getName().c_str(), peer->getID(), FALSE);
+	post_roster_event(RosterEvent::ROSTER_ADD, peer);
 }
 
 void PC_GuiHandler::remove_npeer_from_gui(NPeer* peer)
 {
-	std::vector<NPeer*>::iterator users_iter;
-	for(users_iter = users.begin(); users_iter != users.end(); ++users_iter)
+	post_roster_event(RosterEvent::ROSTER_REMOVE, peer);
+}
+
+void PC_GuiHandler::rename_npeer_in_gui(NPeer* peer)
+{
+	post_roster_event(RosterEvent::ROSTER_RENAME, peer);
+}
+
+static gboolean roster_timeout(gpointer data)
+{
+	static_cast<PC_GuiHandler*>(data)->apply_roster_events();
+	return G_SOURCE_REMOVE;
+}
+
+void PC_GuiHandler::post_roster_event(RosterEvent::Type type, NPeer *peer)
+{
+	RosterEvent event;
+	event.type = type;
+	event.id = peer->getID();
+	std::strncpy(event.name, peer->getName().c_str(), MAX_NAME_LEN);
+	event.name[MAX_NAME_LEN] = 0;
+
+	// First event since the last drain schedules the next one
+	if(roster.push(event))
+		g_timeout_add(ROSTER_FRAME_MS, roster_timeout, this);
+}
+
+void PC_GuiHandler::apply_roster_events()
+{
+	std::vector<RosterEvent> events;
+	if(roster.drain(events) == 0)
+		return;
+
+	// Fold each peer's events into where they end up
+	struct Change
 	{
-		if(*users_iter == peer)
+		bool present;
+		const char *name;
+	};
+	std::map<int, Change> changes;
+	for(const RosterEvent &event : events)
+	{
+		auto found = changes.find(event.id);
+		if(found == changes.end())
+			found = changes.insert({event.id, {rows.count(event.id) > 0, NULL}}).first;
+
+		Change &change = found->second;
+		if(event.type == RosterEvent::ROSTER_REMOVE)
 		{
-			const gchar *row_id = std::to_string(peer->getID()).c_str();
-			remove_name_from_session(row_id);
-			users.erase(users_iter);
-			break;
+			change.present = false;
+			change.name = NULL;
+		}
+		else if(event.type == RosterEvent::ROSTER_ADD || change.present)
+		{
+			change.present = true;
+			change.name = event.name;
 		}
 	}
+
+	// Left the lobby, nothing to show them in
+	if(name_list == NULL)
+		return;
+
+	// Touch only the rows that changed
+	for(const auto &entry : changes)
+	{
+		const int id = entry.first;
+		const Change &change = entry.second;
+		auto row = rows.find(id);
+
+		if(!change.present && row != rows.end())
+		{
+			gtk_widget_destroy(gtk_widget_get_parent(row->second.box));
+			rows.erase(row);
+		}
+		else if(change.present && row == rows.end())
+		{
+			GtkWidget *new_row = create_new_user_row(change.name, FALSE, FALSE);
+			gtk_widget_set_name(new_row, std::to_string(id).c_str());
+			gtk_container_add(GTK_CONTAINER(name_list), new_row);
+			gtk_widget_show_all(gtk_widget_get_parent(new_row));
+			rows[id] = find_row_widgets(new_row);
+		}
+		else if(change.present && change.name != NULL)
+		{
+			rename_user_row(row->second.box, change.name);
+		}
+	}
+}
+
+// Level meters and link badges -- sampled, never pushed, so audio never waits on GTK
+
+static gboolean meter_timeout(gpointer data)
+{
+	static_cast<PC_GuiHandler*>(data)->update_meters();
+	return G_SOURCE_CONTINUE;
+}
+
+void PC_GuiHandler::update_meters()
+{
+	if(name_list == NULL)
+		return;
+
+	AudioLevel level;
+	if(!Audio->getLevel(0, level))
+		level = AudioLevel();
+	update_row_meter(self_row, level);
+
+	bool link = (++meter_ticks % LINK_REFRESH_TICKS) == 0;
+	for(auto &entry : rows)
+	{
+		if(!Audio->getLevel(entry.first, level))
+			level = AudioLevel();
+		update_row_meter(entry.second, level);
+		if(link)
+			update_row_link(entry.second, Network->findID(entry.first));
+	}
+}
+
+void PC_GuiHandler::update_row_meter(RosterRow &row, const AudioLevel &level)
+{
+	if(row.box == NULL)
+		return;
+
+	// Peak in dB, METER_FLOOR_DB below full scale is empty
+	double db = 20.0 * std::log10(std::max(level.peak, 1e-6f));
+	double value = std::min(1.0, std::max(0.0, (db + METER_FLOOR_DB) / METER_FLOOR_DB));
+	if(std::fabs(value - row.shown) > 0.01)
+	{
+		gtk_level_bar_set_value(GTK_LEVEL_BAR(row.level), value);
+		row.shown = value;
+	}
+
+	bool talking = level.rms > SPEAKING_RMS;
+	if(talking != row.talking)
+	{
+		gtk_widget_set_opacity(row.speaking, talking ? 1.0 : 0.15);
+		row.talking = talking;
+	}
+}
+
+void PC_GuiHandler::update_row_link(RosterRow &row, NPeer *peer)
+{
+	if(row.box == NULL || peer == NULL)
+		return;
+
+	float loss = peer->getLoss();
+	uint32_t jitter = peer->getJitter();
+	uint32_t rtt = peer->getRTT();
+
+	const char *colour = "#2e7d32";
+	if(loss > LINK_LOSS_BAD || jitter > LINK_JITTER_BAD_US || rtt > LINK_RTT_BAD_US)
+		colour = "#c62828";
+	else if(loss > LINK_LOSS_WARN || jitter > LINK_JITTER_WARN_US || rtt > LINK_RTT_WARN_US)
+		colour = "#f9a825";
+
+	char jitter_text[16] = "-";
+	char rtt_text[16] = "-";
+	if(jitter > 0)
+		snprintf(jitter_text, sizeof(jitter_text), "%u", (jitter + 500) / 1000);
+	if(rtt > 0)
+		snprintf(rtt_text, sizeof(rtt_text), "%u", (rtt + 500) / 1000);
+
+	char markup[128];
+	snprintf(markup, sizeof(markup), "<span foreground=\"%s\">\u25CF</span> %.0f%% %s/%s ms",
+	         colour, 100.0f * loss, jitter_text, rtt_text);
+	if(row.link_text != markup)
+	{
+		gtk_label_set_markup(GTK_LABEL(row.link), markup);
+		row.link_text = markup;
+	}
+}
+
+RosterRow PC_GuiHandler::find_row_widgets(GtkWidget *box)
+{
+	RosterRow row;
+	row.box = box;
+	row.speaking = get_widget_by_name(box, "row_speaking");
+	row.level = get_widget_by_name(box, "row_level");
+	row.link = get_widget_by_name(box, "row_link");
+	return row;
 }
 
 void PC_GuiHandler::refresh_name_list()
@@ -143,6 +314,12 @@ void PC_GuiHandler::refresh_name_list()
 	gtk_widget_show_all(name_list);
 }
 
+void PC_GuiHandler::set_status(const gchar *text)
+{
+	if(status_label != NULL)
+		gtk_label_set_text(GTK_LABEL(status_label), text);
+}
+
 
 // GTK+ Callback functions bound to GtkObjects
 
@@ -256,6 +433,13 @@ void PC_GuiHandler::leaveButtonPressed(GtkWidget *widget, gpointer data)
 
 	GtkWidget *lobby_box = get_widget_by_name(GTK_WIDGET(data), "LobbyBox");
 	gtk_widget_destroy(lobby_box);
+	status_label = NULL;
+	name_list = NULL;
+	rows.clear();
+	self_row = RosterRow();
+	if(meter_source != 0)
+		g_source_remove(meter_source);
+	meter_source = 0;
 	gtk_widget_show_all(GTK_WIDGET(data));
 }
 
@@ -346,34 +530,12 @@ gchar* PC_GuiHandler::get_user_port()
 
 NPeer* PC_GuiHandler::get_npeer(const gchar *peer_name)
 {
-	NPeer* return_peer = NULL;
-	for(size_t user_index = 0; user_index < users.size(); ++user_index)
-	{
-		NPeer* current_peer = users[user_index];
-		gchar *current_name = const_cast<gchar*>((current_peer->getName()).c_str());
-		if(strcmp(current_name, peer_name) == 0)
-		{
-			return_peer = current_peer;
-			break;
-		}
-	}
-	return return_peer;
+	return (*Network)[std::string(peer_name)];
 }
 
 NPeer* PC_GuiHandler::get_npeer(const int id)
 {
-	NPeer* return_peer = NULL;
-	for(size_t user_index = 0; user_index < users.size(); ++user_index)
-	{
-		NPeer* current_peer = users[user_index];
-		const int current_id = current_peer->getID();
-		if(id == current_id)
-		{
-			return_peer = current_peer;
-			break;
-		}
-	}
-	return return_peer;
+	return Network->findID(id);
 }
 
 // Private Utility Functions
@@ -400,9 +562,18 @@ GtkWidget* PC_GuiHandler::create_new_user_row(const gchar *name, bool is_host, b
 	GtkWidget *new_row;
 	GtkWidget *name_label;
 	GtkWidget *mute_button;
+	GtkWidget *volume_scale;
+	GtkWidget *speaking_dot;
+	GtkWidget *level_bar;
+	GtkWidget *link_label;
 
 	new_row = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 0);
 
+	speaking_dot = gtk_label_new("\u25CF ");
+	gtk_widget_set_name(speaking_dot, "row_speaking");
+	gtk_widget_set_opacity(speaking_dot, 0.15);
+	gtk_box_pack_start(GTK_BOX(new_row), speaking_dot, FALSE, FALSE, FALSE);
+
 	name_label = gtk_label_new(NULL);
 	if(is_host)
 	{
@@ -432,6 +603,24 @@ GtkWidget* PC_GuiHandler::create_new_user_row(const gchar *name, bool is_host, b
 	g_signal_connect(mute_button, "clicked", G_CALLBACK(mute_button_callback), this);
 	gtk_box_pack_end(GTK_BOX(new_row), mute_button, FALSE, FALSE, FALSE);
 
+	volume_scale = gtk_scale_new_with_range(GTK_ORIENTATION_HORIZONTAL, 0.0, 2.0, 0.05);
+	gtk_range_set_value(GTK_RANGE(volume_scale), 1.0);
+	gtk_scale_set_draw_value(GTK_SCALE(volume_scale), FALSE);
+	gtk_widget_set_size_request(volume_scale, 80, -1);
+	g_signal_connect(volume_scale, "value-changed", G_CALLBACK(peer_volume_callback), this);
+	gtk_box_pack_end(GTK_BOX(new_row), volume_scale, FALSE, FALSE, FALSE);
+
+	level_bar = gtk_level_bar_new_for_interval(0.0, 1.0);
+	gtk_widget_set_name(level_bar, "row_level");
+	gtk_widget_set_size_request(level_bar, 60, -1);
+	gtk_widget_set_valign(level_bar, GTK_ALIGN_CENTER);
+	gtk_box_pack_end(GTK_BOX(new_row), level_bar, FALSE, FALSE, 4);
+
+	link_label = gtk_label_new(NULL);
+	gtk_widget_set_name(link_label, "row_link");
+	gtk_widget_set_tooltip_text(link_label, "Packet loss, jitter/round trip time");
+	gtk_box_pack_end(GTK_BOX(new_row), link_label, FALSE, FALSE, 4);
+
 	return new_row;
 }
 
@@ -455,6 +644,10 @@ void PC_GuiHandler::setup_lobby(GtkWidget *parent, GtkWidget *lobby_box)
 	GtkWidget *port_label = gtk_label_new(port_string.c_str());
 	gtk_container_add(GTK_CONTAINER(lobby_box), port_label);
 
+	status_label = gtk_label_new(NULL);
+	gtk_widget_set_name(status_label, "StatusLabel");
+	gtk_container_add(GTK_CONTAINER(lobby_box), status_label);
+
 	name_list = gtk_list_box_new();
 	gtk_list_box_set_selection_mode(GTK_LIST_BOX(name_list), GTK_SELECTION_NONE);
 	gtk_container_add(GTK_CONTAINER(lobby_box), name_list);
@@ -475,6 +668,9 @@ void PC_GuiHandler::setup_lobby(GtkWidget *parent, GtkWidget *lobby_box)
 	add_self_to_session(user_name);
 
 	gtk_widget_show_all(lobby_box);
+
+	if(meter_source == 0)
+		meter_source = g_timeout_add(METER_REFRESH_MS, meter_timeout, this);
 }
 
 GtkWidget* PC_GuiHandler::create_volume_slider()
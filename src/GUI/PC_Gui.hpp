@@ -12,11 +12,14 @@
 #include <cstring>
 #include <PC_Audio.hpp>
 #include <PC_Network.hpp>
+#include <PC_Thread.hpp>
 #include <GuiCallbacks.hpp>
 #include <chrono>
 #include <string>
 #include <memory>
 #include <thread>
+#include <vector>
+#include <map>
 #include <cinttypes>
 
 // Pre-Compiler Constants
@@ -33,8 +36,69 @@
 // Max name length: Cannot exceed # of characters
 #define MAX_NAME_LEN 18
 
+// Roster changes are applied at most once per frame (~60 Hz)
+#define ROSTER_FRAME_MS 16
+
+// Level meters are sampled every METER_REFRESH_MS (~15 Hz), link badges every
+// LINK_REFRESH_TICKS samples (~1 Hz).  Meters span METER_FLOOR_DB below full scale,
+// a peer counts as speaking above SPEAKING_RMS.
+#define METER_REFRESH_MS 66
+#define LINK_REFRESH_TICKS 15
+#define METER_FLOOR_DB 60.0
+#define SPEAKING_RMS 0.01f
+
+// Link badge turns amber past the first value and red past the second
+#define LINK_LOSS_WARN 0.02f
+#define LINK_LOSS_BAD 0.08f
+#define LINK_JITTER_WARN_US 30000
+#define LINK_JITTER_BAD_US 60000
+#define LINK_RTT_WARN_US 150000
+#define LINK_RTT_BAD_US 300000
+
 // Forward declaration of NPeer to keep track of peers in GUI session
 class NPeer;
+struct AudioLevel;
+
+/* RosterEvent: One change to the people in the call, posted by network threads and
+ *              applied to the name list by the main loop
+ *
+ * @member type  Peer joined, left or told us their name
+ *
+ * @member id  NPeer ID, also the name of their row
+ *
+ * @member name  Their name at the time of the event (copied, the NPeer may be gone
+ *               by the time the main loop gets to it)
+ */
+struct RosterEvent
+{
+	enum Type { ROSTER_ADD, ROSTER_REMOVE, ROSTER_RENAME } type;
+	int id;
+	char name[MAX_NAME_LEN+1];
+};
+
+/* RosterRow: Widgets of one row in the name list and what they show right now, so
+ *            the meters only redraw what actually changed
+ *
+ * @member box  The row (named after the NPeer ID, "UserRow" for us)
+ *
+ * @member speaking  Dot lit while they talk
+ *
+ * @member level  Level meter
+ *
+ * @member link  Loss/jitter/RTT badge, empty for us
+ *
+ * @member shown/talking/link_text  Current level bar value, dot state and badge text
+ */
+struct RosterRow
+{
+	GtkWidget *box = NULL;
+	GtkWidget *speaking = NULL;
+	GtkWidget *level = NULL;
+	GtkWidget *link = NULL;
+	double shown = 0.0;
+	bool talking = true;
+	std::string link_text;
+};
 
 // GuiHandler Class -----------------------------------------------------------------------
 /* GuiHandler: Class for encapsulating GUI functionality
@@ -48,12 +112,26 @@ class NPeer;
  * @member name_list  Pointer to GtkWidget holding rows that hold names of users,
  *                    also containing kick/mute buttons
  *
+ * @member status_label  Label in the lobby showing how far joining/hosting got, NULL
+ *                       outside the lobby
+ *
  * @member user_name  Holds text data for username from textbox entry
  *
  * @member user_link  Holds text data for joining link from textbox entry
  *
  * @member is_host  Boolean that's true if GuiHandler user is hosting a session
  *
+ * @member roster  RosterEvents posted by network threads, drained by the main loop
+ *                 at most once per ROSTER_FRAME_MS
+ *
+ * @member rows  Row of every peer in name_list by NPeer ID -- main loop only
+ *
+ * @member self_row  Our own row
+ *
+ * @member meter_source  GLib source sampling the meters while in the lobby, 0 outside
+ *
+ * @member meter_ticks  Meter samples taken, paces the link badges
+ *
  * @constructor PC_GuiHandler()  Default contructor, initializes private fields as well as
  *                               GtkApplication (serves as root to GtkObjects).
  *
@@ -75,12 +153,34 @@ class NPeer;
  *                                        @param name: User's name to be displayed
  *                                                     in session
  *
+ * @method void set_status(1)  Shows @text in the lobby's status line.  Does nothing
+ *                             outside the lobby.
+ *                               @param text: Status to show
+ *
  * @method void remove_name_from_session(1)  Removes a user from the GUI name_list
  *                                           of an ongoing session.
  *                                             @prereq: GUI is already running through runGui()
  *                                             @param name: User's name to be removed
  *                                                          from session
  *
+ * @method void add_npeer_to_gui(1)  Queues a row for @peer.  Safe from any thread.
+ *                                   (onPeerAdded/onPeerRemoved/onPeerRenamed are the
+ *                                   RosterListener entry points for these three)
+ *
+ * @method void remove_npeer_from_gui(1)  Queues removing @peer's row.  Safe from any
+ *                                        thread.
+ *
+ * @method void rename_npeer_in_gui(1)  Queues showing @peer's new name.  Safe from any
+ *                                      thread.
+ *
+ * @method void update_meters()  Main loop: Samples every row's level (APeer::getLevel,
+ *                               lock-free) and, every LINK_REFRESH_TICKS, the peer's
+ *                               loss/jitter/RTT.  Only changed widgets are redrawn.
+ *
+ * @method void apply_roster_events()  Main loop: Drains @roster, folds every peer's
+ *                                     events into one change and touches only the rows
+ *                                     that changed.
+ *
  * ===Callback Functions===
  * Note: Callback functions of GUI class accessed externally through GuiCallbacks.cpp
  *
@@ -115,7 +215,7 @@ class NPeer;
  *                                 @param gpointer: void* pointer to data being passed
  *                                                  into callback function
  */
-class PC_GuiHandler
+class PC_GuiHandler : public RosterListener
 {
 
 // Member Variables
@@ -123,6 +223,7 @@ private:
 	GtkApplication *app;
 	GtkWidget *widget_box;
 	GtkWidget *name_list;
+	GtkWidget *status_label;
 
 	gchar *user_name;
 	gchar *user_link;
@@ -130,7 +231,11 @@ private:
 
 	bool is_host;
 
-	std::vector<NPeer*> users;
+	MPSCQueue<RosterEvent> roster;
+	std::map<int, RosterRow> rows;
+	RosterRow self_row;
+	guint meter_source;
+	unsigned meter_ticks;
 
 
 // Constructor, destructor, and initializer
@@ -147,7 +252,14 @@ public:
 	void remove_name_from_session(const gchar *name);
 	void add_npeer_to_gui(NPeer* peer);
 	void remove_npeer_from_gui(NPeer* peer);
+	void rename_npeer_in_gui(NPeer* peer);
+	void onPeerAdded(NPeer *peer) noexcept override { add_npeer_to_gui(peer); }
+	void onPeerRemoved(NPeer *peer) noexcept override { remove_npeer_from_gui(peer); }
+	void onPeerRenamed(NPeer *peer) noexcept override { rename_npeer_in_gui(peer); }
+	void apply_roster_events();
+	void update_meters();
 	void refresh_name_list();
+	void set_status(const gchar *text);
 	inline bool name_list_created() { return this->name_list != NULL; }
 
 // Callback Functions
@@ -182,6 +294,10 @@ private:
 	GtkWidget* create_indirect_join_toggle();
 	void show_error_popup(const gchar *message);
 	void username_popup();
+	void post_roster_event(RosterEvent::Type type, NPeer *peer);
+	RosterRow find_row_widgets(GtkWidget *box);
+	void update_row_meter(RosterRow &row, const AudioLevel &level);
+	void update_row_link(RosterRow &row, NPeer *peer);
 
 };
 
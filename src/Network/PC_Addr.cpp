@@ -0,0 +1,218 @@
+#include "PC_Addr.hpp"
+
+#include <cstring>
+#include <cstdlib>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+
+// IPv4 mapped prefix -- ::ffff:0:0/96
+static const uint8_t V4_MAPPED[12] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff};
+
+
+// PeerAddr ------------------------------------------------------------------------------
+PeerAddr::PeerAddr(const sockaddr_in &addr) noexcept
+{
+	std::memcpy(this->ip, V4_MAPPED, sizeof(V4_MAPPED));
+	std::memcpy(this->ip + 12, &addr.sin_addr.s_addr, 4);
+	this->port = addr.sin_port;
+}
+
+
+PeerAddr::PeerAddr(const sockaddr_in6 &addr) noexcept
+{
+	std::memcpy(this->ip, &addr.sin6_addr, 16);
+	this->port = addr.sin6_port;
+}
+
+
+bool PeerAddr::parse(const std::string &text, uint16_t port, PeerAddr &addr) noexcept
+{
+	// "[v6]:port", "[v6]", "v6" (more than one colon), "ip:port" or "ip"
+	std::string ip = text, rest;
+	if(!text.empty() && text[0] == '[')
+	{
+		size_t close = text.find(']');
+		if(close == std::string::npos) return false;
+		ip = text.substr(1, close - 1);
+		rest = text.substr(close + 1);
+		if(!rest.empty() && rest[0] != ':') return false;
+	}
+	else if(text.find(':') == text.rfind(':') && text.find(':') != std::string::npos)
+	{
+		ip = text.substr(0, text.find(':'));
+		rest = text.substr(text.find(':'));
+	}
+
+	if(!rest.empty())
+	{
+		char *end = NULL;
+		long value = std::strtol(rest.c_str() + 1, &end, 10);
+		if(*end != 0 || value <= 0 || value > 65535) return false;
+		port = (uint16_t) value;
+	}
+
+	addr = PeerAddr();
+	in_addr v4;
+	if(inet_pton(AF_INET, ip.c_str(), &v4) == 1)
+	{
+		std::memcpy(addr.ip, V4_MAPPED, sizeof(V4_MAPPED));
+		std::memcpy(addr.ip + 12, &v4.s_addr, 4);
+	}
+	else if(inet_pton(AF_INET6, ip.c_str(), addr.ip) != 1)
+		return false;
+
+	addr.port = htons(port);
+	return true;
+}
+
+
+bool PeerAddr::from(const sockaddr_storage &storage, socklen_t len, PeerAddr &addr) noexcept
+{
+	if(storage.ss_family == AF_INET && len >= (socklen_t) sizeof(sockaddr_in))
+		addr = PeerAddr(*(const sockaddr_in*) &storage);
+	else if(storage.ss_family == AF_INET6 && len >= (socklen_t) sizeof(sockaddr_in6))
+		addr = PeerAddr(*(const sockaddr_in6*) &storage);
+	else return false;
+	return true;
+}
+
+
+bool PeerAddr::valid() const noexcept
+{
+	return this->port != 0;
+}
+
+
+bool PeerAddr::isV4() const noexcept
+{
+	return std::memcmp(this->ip, V4_MAPPED, sizeof(V4_MAPPED)) == 0;
+}
+
+
+socklen_t PeerAddr::toSockaddr(int family, sockaddr_storage &out) const noexcept
+{
+	std::memset(&out, 0, sizeof(out));
+	if(family == AF_INET6)
+	{
+		sockaddr_in6 &addr = *(sockaddr_in6*) &out;
+		addr.sin6_family = AF_INET6;
+		std::memcpy(&addr.sin6_addr, this->ip, 16);
+		addr.sin6_port = this->port;
+		return sizeof(sockaddr_in6);
+	}
+	if(family != AF_INET || !this->isV4()) return 0;
+
+	sockaddr_in &addr = *(sockaddr_in*) &out;
+	addr.sin_family = AF_INET;
+	std::memcpy(&addr.sin_addr.s_addr, this->ip + 12, 4);
+	addr.sin_port = this->port;
+	return sizeof(sockaddr_in);
+}
+
+
+// Wire ----------------------------------------------------------------------------------
+void PeerAddr::write(uint8_t *buffer) const noexcept
+{
+	std::memcpy(buffer, this->ip, 16);
+	std::memcpy(buffer + 16, &this->port, 2);
+}
+
+
+void PeerAddr::read(const uint8_t *buffer) noexcept
+{
+	std::memcpy(this->ip, buffer, 16);
+	std::memcpy(&this->port, buffer + 16, 2);
+}
+
+
+bool PeerAddr::writeV4(uint8_t *buffer) const noexcept
+{
+	if(!this->isV4()) return false;
+	std::memcpy(buffer, this->ip + 12, 4);
+	std::memcpy(buffer + 4, &this->port, 2);
+	return true;
+}
+
+
+void PeerAddr::readV4(const uint8_t *buffer) noexcept
+{
+	std::memcpy(this->ip, V4_MAPPED, sizeof(V4_MAPPED));
+	std::memcpy(this->ip + 12, buffer, 4);
+	std::memcpy(&this->port, buffer + 4, 2);
+}
+
+
+// Lookup --------------------------------------------------------------------------------
+uint64_t PeerAddr::hash() const noexcept
+{
+	// FNV-1a over the address then the port, byte by byte so every host agrees
+	uint64_t x = 0xcbf29ce484222325ULL;
+	for(uint8_t byte : this->ip)
+		x = (x ^ byte) * 0x100000001b3ULL;
+	const uint8_t *port = (const uint8_t*) &this->port;
+	x = (x ^ port[0]) * 0x100000001b3ULL;
+	x = (x ^ port[1]) * 0x100000001b3ULL;
+	return x;
+}
+
+
+std::string PeerAddr::str() const
+{
+	char text[INET6_ADDRSTRLEN + 1] = {0};
+	if(this->isV4())
+		inet_ntop(AF_INET, this->ip + 12, text, INET6_ADDRSTRLEN);
+	else
+		inet_ntop(AF_INET6, this->ip, text, INET6_ADDRSTRLEN);
+
+	std::string port = std::to_string(ntohs(this->port));
+	return this->isV4() ? std::string(text) + ":" + port : "[" + std::string(text) + "]:" + port;
+}
+
+
+bool PeerAddr::operator==(const PeerAddr &other) const noexcept
+{
+	return this->port == other.port && std::memcmp(this->ip, other.ip, 16) == 0;
+}
+
+
+// Sockets -------------------------------------------------------------------------------
+int addr_socket(int type, int &family) noexcept
+{
+	// Dual-stack if we can, the mapped addresses cover IPv4
+	int sock = socket(AF_INET6, type, 0);
+	if(sock >= 0)
+	{
+		int off = 0;
+		if(setsockopt(sock, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off)) == 0)
+		{
+			family = AF_INET6;
+			return sock;
+		}
+		close(sock);
+	}
+
+	family = AF_INET;
+	return socket(AF_INET, type, 0);
+}
+
+
+int addr_bind(int sock, int family, uint16_t port) noexcept
+{
+	sockaddr_storage storage;
+	std::memset(&storage, 0, sizeof(storage));
+	if(family == AF_INET6)
+	{
+		sockaddr_in6 &addr = *(sockaddr_in6*) &storage;
+		addr.sin6_family = AF_INET6;
+		addr.sin6_addr = in6addr_any;
+		addr.sin6_port = htons(port);
+		return bind(sock, (const sockaddr*) &storage, sizeof(sockaddr_in6));
+	}
+
+	sockaddr_in &addr = *(sockaddr_in*) &storage;
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = INADDR_ANY;
+	addr.sin_port = htons(port);
+	return bind(sock, (const sockaddr*) &storage, sizeof(sockaddr_in));
+}
@@ -0,0 +1,127 @@
+#ifndef _PC_ADDR_HPP
+#define _PC_ADDR_HPP
+
+
+/*
+ *  PeersChat Address Header: Where a peer is, over IPv4 or IPv6
+ *
+ * Sockets are dual-stack: one IPv6 socket with IPV6_V6ONLY off talks to IPv4 peers
+ * too, they show up as IPv4-mapped addresses (::ffff:a.b.c.d).  Hosts that have IPv6
+ * turned off fall back to a plain IPv4 socket.
+ *
+ * PeerAddr keeps every address in that mapped form, so an IPv4 peer is the same
+ * PeerAddr whether it came in on an IPv4 or a dual-stack socket, and one comparison and
+ * one hash cover both families.  It turns back into a sockaddr_in/sockaddr_in6 for
+ * whatever socket it is sent on; an IPv6 peer can't be reached from an IPv4 socket.
+ *
+ * Format on the wire, in network order as they are in a sockaddr:
+ *
+ *   [ip:32] [port:16]    Legacy (PEER_ADDR_V4_SIZE), IPv4 only
+ *   [ip:128] [port:16]   Either family (PEER_ADDR_SIZE), IPv4 mapped
+ *
+ * Link-local IPv6 addresses (fe80::/10) need a scope id that doesn't travel, they
+ * aren't supported.
+ *
+ */
+
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+
+// Pre-Compiler Constants
+#define PEER_ADDR_SIZE 18
+#define PEER_ADDR_V4_SIZE 6
+
+
+// PeerAddr Struct -----------------------------------------------------------------------
+/* PeerAddr: IPv4 or IPv6 address and port of a peer
+ *
+ * @member ip  IPv6 address, IPv4 mapped
+ *
+ * @member port  Port in network order
+ *
+ * @constructor PeerAddr(1)  From a sockaddr_in or sockaddr_in6
+ *
+ * @method parse(3)  (static) Parse "ip", "ip:port", "v6" or "[v6]:port" into @addr,
+ *                   @port (host order) if none is given
+ *                  @return (bool) success?
+ *
+ * @method from(3)  (static) From whatever recvfrom()/accept() filled in
+ *                 @return (bool) false if it isn't IPv4/IPv6
+ *
+ * @method valid()  Was it set to something?
+ *
+ * @method isV4()  Is it an IPv4 address?
+ *
+ * @method family()  AF_INET or AF_INET6, what a socket made just for it would be
+ *
+ * @method toSockaddr(2)  Fill @out to send to it on a socket of @family
+ *                       @return (socklen_t) size of @out, 0 if @family can't reach it
+ *
+ * @method write(1)/read(1)  [ip:128] [port:16] (PEER_ADDR_SIZE bytes)
+ *
+ * @method writeV4(1)  [ip:32] [port:16] (PEER_ADDR_V4_SIZE bytes), IPv4 only
+ *                    @return (bool) false if it isn't IPv4
+ *
+ * @method readV4(1)  Read [ip:32] [port:16]
+ *
+ * @method hash()  Same on every host, for hashed lookups and digests
+ *                @return (uint64_t)
+ *
+ * @method str()  "a.b.c.d:port" or "[v6]:port"
+ *               @return (std::string)
+ */
+struct PeerAddr
+{
+	uint8_t ip[16] = {0};
+	uint16_t port = 0;
+
+	PeerAddr() noexcept { }
+	PeerAddr(const sockaddr_in &addr) noexcept;
+	PeerAddr(const sockaddr_in6 &addr) noexcept;
+	static bool parse(const std::string &text, uint16_t port, PeerAddr &addr) noexcept;
+	static bool from(const sockaddr_storage &storage, socklen_t len, PeerAddr &addr) noexcept;
+
+	bool valid() const noexcept;
+	bool isV4() const noexcept;
+	inline int family() const noexcept { return this->isV4() ? AF_INET : AF_INET6; }
+	socklen_t toSockaddr(int family, sockaddr_storage &out) const noexcept;
+
+	void write(uint8_t *buffer) const noexcept;
+	void read(const uint8_t *buffer) noexcept;
+	bool writeV4(uint8_t *buffer) const noexcept;
+	void readV4(const uint8_t *buffer) noexcept;
+
+	uint64_t hash() const noexcept;
+	std::string str() const;
+
+	bool operator==(const PeerAddr &other) const noexcept;
+	inline bool operator!=(const PeerAddr &other) const noexcept { return !(*this == other); }
+};
+
+
+/* PeerAddrHash: PeerAddr::hash() for std::unordered_map/set
+ */
+struct PeerAddrHash
+{
+	inline size_t operator()(const PeerAddr &addr) const noexcept { return (size_t) addr.hash(); }
+};
+
+
+/* addr_socket: Open a dual-stack socket of @type (SOCK_DGRAM/SOCK_STREAM), or an IPv4
+ *             one if IPv6 is off.  @family is set to the one it got.
+ *            @return (int) the socket, -1 on failure
+ */
+int addr_socket(int type, int &family) noexcept;
+
+/* addr_bind: Bind @sock (of @family) to @port (host order) on every interface
+ *           @return (int) bind()'s
+ */
+int addr_bind(int sock, int family, uint16_t port) noexcept;
+
+
+#endif
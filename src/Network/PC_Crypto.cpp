@@ -0,0 +1,554 @@
+#include "PC_Crypto.hpp"
+
+#include <cstring>
+#include <cerrno>
+#include <sys/random.h>
+
+
+// Little Endian Helpers -----------------------------------------------------------------
+static inline uint32_t get_le32(const uint8_t *buffer) noexcept
+{
+	return (uint32_t) buffer[0] | ((uint32_t) buffer[1] << 8) |
+	       ((uint32_t) buffer[2] << 16) | ((uint32_t) buffer[3] << 24);
+}
+
+
+static inline void put_le32(uint8_t *buffer, uint32_t x) noexcept
+{
+	buffer[0] = (uint8_t) x;
+	buffer[1] = (uint8_t) (x >> 8);
+	buffer[2] = (uint8_t) (x >> 16);
+	buffer[3] = (uint8_t) (x >> 24);
+}
+
+
+static void wipe(void *buffer, size_t len) noexcept
+{
+	// Through a volatile pointer so it isn't optimized away
+	volatile uint8_t *p = (volatile uint8_t*) buffer;
+	while(len--) *p++ = 0;
+}
+
+
+static bool random_bytes(uint8_t *buffer, size_t len) noexcept
+{
+	while(len > 0)
+	{
+		ssize_t r = getrandom(buffer, len, 0);
+		if(r < 0 && errno == EINTR) continue;
+		if(r <= 0) return false;
+		buffer += r;
+		len -= r;
+	}
+	return true;
+}
+
+
+// ChaCha20 (RFC 8439 2.3) ---------------------------------------------------------------
+#define ROTL32(x, b) (uint32_t) (((x) << (b)) | ((x) >> (32 - (b))))
+#define QUARTER(a, b, c, d) \
+	a += b; d ^= a; d = ROTL32(d, 16); \
+	c += d; b ^= c; b = ROTL32(b, 12); \
+	a += b; d ^= a; d = ROTL32(d,  8); \
+	c += d; b ^= c; b = ROTL32(b,  7);
+
+static void chacha20_block(const uint8_t key[CRYPTO_KEY_SIZE], uint32_t counter,
+                           const uint8_t nonce[CRYPTO_NONCE_SIZE], uint8_t out[64]) noexcept
+{
+	uint32_t state[16] = {
+		0x61707865, 0x3320646e, 0x79622d32, 0x6b206574,
+		get_le32(key),      get_le32(key + 4),  get_le32(key + 8),  get_le32(key + 12),
+		get_le32(key + 16), get_le32(key + 20), get_le32(key + 24), get_le32(key + 28),
+		counter, get_le32(nonce), get_le32(nonce + 4), get_le32(nonce + 8)
+	};
+
+	uint32_t x[16];
+	std::memcpy(x, state, sizeof(x));
+	for(int i = 0; i < 10; ++i)
+	{
+		QUARTER(x[0], x[4], x[ 8], x[12]);
+		QUARTER(x[1], x[5], x[ 9], x[13]);
+		QUARTER(x[2], x[6], x[10], x[14]);
+		QUARTER(x[3], x[7], x[11], x[15]);
+		QUARTER(x[0], x[5], x[10], x[15]);
+		QUARTER(x[1], x[6], x[11], x[12]);
+		QUARTER(x[2], x[7], x[ 8], x[13]);
+		QUARTER(x[3], x[4], x[ 9], x[14]);
+	}
+
+	for(int i = 0; i < 16; ++i)
+		put_le32(out + 4 * i, x[i] + state[i]);
+}
+
+
+static void chacha20_xor(const uint8_t key[CRYPTO_KEY_SIZE], uint32_t counter,
+                         const uint8_t nonce[CRYPTO_NONCE_SIZE], uint8_t *data, size_t len) noexcept
+{
+	uint8_t stream[64];
+	for(size_t pos = 0; pos < len; pos += 64, ++counter)
+	{
+		chacha20_block(key, counter, nonce, stream);
+		size_t n = (len - pos < 64) ? len - pos : 64;
+		for(size_t i = 0; i < n; ++i)
+			data[pos + i] ^= stream[i];
+	}
+	wipe(stream, sizeof(stream));
+}
+
+
+// Poly1305 (RFC 8439 2.5) ---------------------------------------------------------------
+/* 26 bit limbs so every product fits in 64 bits.  The AEAD pads everything it MACs to
+ * 16 bytes, so only whole blocks are ever fed in.
+ */
+struct Poly1305
+{
+	uint32_t r[5], s[4], h[5] = {0};
+
+	explicit Poly1305(const uint8_t key[32]) noexcept
+	{
+		r[0] = (get_le32(key +  0)     ) & 0x3ffffff;
+		r[1] = (get_le32(key +  3) >> 2) & 0x3ffff03;
+		r[2] = (get_le32(key +  6) >> 4) & 0x3ffc0ff;
+		r[3] = (get_le32(key +  9) >> 6) & 0x3f03fff;
+		r[4] = (get_le32(key + 12) >> 8) & 0x00fffff;
+		for(int i = 0; i < 4; ++i)
+			s[i] = get_le32(key + 16 + 4 * i);
+	}
+
+	void block(const uint8_t m[16]) noexcept
+	{
+		uint32_t s1 = r[1] * 5, s2 = r[2] * 5, s3 = r[3] * 5, s4 = r[4] * 5;
+		h[0] += (get_le32(m +  0)     ) & 0x3ffffff;
+		h[1] += (get_le32(m +  3) >> 2) & 0x3ffffff;
+		h[2] += (get_le32(m +  6) >> 4) & 0x3ffffff;
+		h[3] += (get_le32(m +  9) >> 6) & 0x3ffffff;
+		h[4] += (get_le32(m + 12) >> 8) | (1 << 24);
+
+		uint64_t d0 = (uint64_t) h[0] * r[0] + (uint64_t) h[1] * s4 + (uint64_t) h[2] * s3 + (uint64_t) h[3] * s2 + (uint64_t) h[4] * s1;
+		uint64_t d1 = (uint64_t) h[0] * r[1] + (uint64_t) h[1] * r[0] + (uint64_t) h[2] * s4 + (uint64_t) h[3] * s3 + (uint64_t) h[4] * s2;
+		uint64_t d2 = (uint64_t) h[0] * r[2] + (uint64_t) h[1] * r[1] + (uint64_t) h[2] * r[0] + (uint64_t) h[3] * s4 + (uint64_t) h[4] * s3;
+		uint64_t d3 = (uint64_t) h[0] * r[3] + (uint64_t) h[1] * r[2] + (uint64_t) h[2] * r[1] + (uint64_t) h[3] * r[0] + (uint64_t) h[4] * s4;
+		uint64_t d4 = (uint64_t) h[0] * r[4] + (uint64_t) h[1] * r[3] + (uint64_t) h[2] * r[2] + (uint64_t) h[3] * r[1] + (uint64_t) h[4] * r[0];
+
+		uint32_t c;
+		c = (uint32_t) (d0 >> 26); h[0] = (uint32_t) d0 & 0x3ffffff;
+		d1 += c; c = (uint32_t) (d1 >> 26); h[1] = (uint32_t) d1 & 0x3ffffff;
+		d2 += c; c = (uint32_t) (d2 >> 26); h[2] = (uint32_t) d2 & 0x3ffffff;
+		d3 += c; c = (uint32_t) (d3 >> 26); h[3] = (uint32_t) d3 & 0x3ffffff;
+		d4 += c; c = (uint32_t) (d4 >> 26); h[4] = (uint32_t) d4 & 0x3ffffff;
+		h[0] += c * 5; c = h[0] >> 26; h[0] &= 0x3ffffff;
+		h[1] += c;
+	}
+
+	// Whole blocks, then the rest zero padded -- RFC 8439 2.8's pad16
+	void padded(const uint8_t *data, size_t len) noexcept
+	{
+		for(; len >= 16; data += 16, len -= 16)
+			this->block(data);
+		if(len > 0)
+		{
+			uint8_t last[16] = {0};
+			std::memcpy(last, data, len);
+			this->block(last);
+		}
+	}
+
+	void finish(uint8_t tag[CRYPTO_TAG_SIZE]) noexcept
+	{
+		// Fully carry h
+		uint32_t c = h[1] >> 26; h[1] &= 0x3ffffff;
+		h[2] += c; c = h[2] >> 26; h[2] &= 0x3ffffff;
+		h[3] += c; c = h[3] >> 26; h[3] &= 0x3ffffff;
+		h[4] += c; c = h[4] >> 26; h[4] &= 0x3ffffff;
+		h[0] += c * 5; c = h[0] >> 26; h[0] &= 0x3ffffff;
+		h[1] += c;
+
+		// h - p, and keep it if that didn't go negative
+		uint32_t g[5];
+		g[0] = h[0] + 5; c = g[0] >> 26; g[0] &= 0x3ffffff;
+		g[1] = h[1] + c; c = g[1] >> 26; g[1] &= 0x3ffffff;
+		g[2] = h[2] + c; c = g[2] >> 26; g[2] &= 0x3ffffff;
+		g[3] = h[3] + c; c = g[3] >> 26; g[3] &= 0x3ffffff;
+		g[4] = h[4] + c - (1 << 26);
+		uint32_t mask = (g[4] >> 31) - 1;
+		for(int i = 0; i < 5; ++i)
+			h[i] = (h[i] & ~mask) | (g[i] & mask);
+
+		// h + s mod 2^128
+		uint32_t w[4] = {
+			 h[0]        | (h[1] << 26),
+			(h[1] >>  6) | (h[2] << 20),
+			(h[2] >> 12) | (h[3] << 14),
+			(h[3] >> 18) | (h[4] <<  8)
+		};
+		uint64_t f = 0;
+		for(int i = 0; i < 4; ++i)
+		{
+			f += (uint64_t) w[i] + s[i];
+			put_le32(tag + 4 * i, (uint32_t) f);
+			f >>= 32;
+		}
+	}
+
+	~Poly1305() noexcept
+	{
+		wipe(this->r, sizeof(this->r));
+		wipe(this->s, sizeof(this->s));
+	}
+};
+
+
+// ChaCha20-Poly1305 (RFC 8439 2.8) ------------------------------------------------------
+static void aead_tag(const uint8_t key[CRYPTO_KEY_SIZE], const uint8_t nonce[CRYPTO_NONCE_SIZE],
+                     const uint8_t *aad, size_t aad_len, const uint8_t *data, size_t len,
+                     uint8_t tag[CRYPTO_TAG_SIZE]) noexcept
+{
+	// One time key from block 0
+	uint8_t block[64];
+	chacha20_block(key, 0, nonce, block);
+	Poly1305 mac(block);
+	wipe(block, sizeof(block));
+
+	mac.padded(aad, aad_len);
+	mac.padded(data, len);
+	uint8_t lengths[16] = {0};
+	put_le32(lengths, (uint32_t) aad_len);
+	put_le32(lengths + 4, (uint32_t) ((uint64_t) aad_len >> 32));
+	put_le32(lengths + 8, (uint32_t) len);
+	put_le32(lengths + 12, (uint32_t) ((uint64_t) len >> 32));
+	mac.block(lengths);
+	mac.finish(tag);
+}
+
+
+void aead_seal(const uint8_t key[CRYPTO_KEY_SIZE], const uint8_t nonce[CRYPTO_NONCE_SIZE],
+               const uint8_t *aad, size_t aad_len, uint8_t *data, size_t len,
+               uint8_t tag[CRYPTO_TAG_SIZE]) noexcept
+{
+	chacha20_xor(key, 1, nonce, data, len);
+	aead_tag(key, nonce, aad, aad_len, data, len, tag);
+}
+
+
+bool aead_open(const uint8_t key[CRYPTO_KEY_SIZE], const uint8_t nonce[CRYPTO_NONCE_SIZE],
+               const uint8_t *aad, size_t aad_len, uint8_t *data, size_t len,
+               const uint8_t tag[CRYPTO_TAG_SIZE]) noexcept
+{
+	// Constant time compare, then decrypt
+	uint8_t expected[CRYPTO_TAG_SIZE];
+	aead_tag(key, nonce, aad, aad_len, data, len, expected);
+	uint8_t diff = 0;
+	for(int i = 0; i < CRYPTO_TAG_SIZE; ++i)
+		diff |= expected[i] ^ tag[i];
+	if(diff != 0) return false;
+
+	chacha20_xor(key, 1, nonce, data, len);
+	return true;
+}
+
+
+// X25519 (RFC 7748) ---------------------------------------------------------------------
+/* Field elements mod 2^255 - 19 as 16 limbs of 16 bits, kept in 64 bit words so
+ * products never overflow.  Slow next to a tuned implementation but it only runs a few
+ * times per join, and every step is the same whatever the secret is.
+ */
+typedef int64_t fe[16];
+
+static void fe_carry(fe o) noexcept
+{
+	for(int i = 0; i < 16; ++i)
+	{
+		o[i] += (int64_t) 1 << 16;
+		int64_t c = o[i] >> 16;
+		if(i < 15) o[i + 1] += c - 1;
+		else o[0] += 38 * (c - 1);
+		o[i] -= c * 65536;
+	}
+}
+
+
+static void fe_swap(fe p, fe q, int64_t bit) noexcept
+{
+	int64_t mask = ~(bit - 1);
+	for(int i = 0; i < 16; ++i)
+	{
+		int64_t t = mask & (p[i] ^ q[i]);
+		p[i] ^= t;
+		q[i] ^= t;
+	}
+}
+
+
+static void fe_add(fe o, const fe a, const fe b) noexcept
+{
+	for(int i = 0; i < 16; ++i)
+		o[i] = a[i] + b[i];
+}
+
+
+static void fe_sub(fe o, const fe a, const fe b) noexcept
+{
+	for(int i = 0; i < 16; ++i)
+		o[i] = a[i] - b[i];
+}
+
+
+static void fe_mul(fe o, const fe a, const fe b) noexcept
+{
+	int64_t t[31] = {0};
+	for(int i = 0; i < 16; ++i)
+		for(int j = 0; j < 16; ++j)
+			t[i + j] += a[i] * b[j];
+	for(int i = 0; i < 15; ++i)
+		t[i] += 38 * t[i + 16];
+	for(int i = 0; i < 16; ++i)
+		o[i] = t[i];
+	fe_carry(o);
+	fe_carry(o);
+}
+
+
+static void fe_invert(fe o, const fe x) noexcept
+{
+	// x^(p - 2)
+	fe c;
+	std::memcpy(c, x, sizeof(fe));
+	for(int a = 253; a >= 0; --a)
+	{
+		fe_mul(c, c, c);
+		if(a != 2 && a != 4) fe_mul(c, c, x);
+	}
+	std::memcpy(o, c, sizeof(fe));
+}
+
+
+static void fe_unpack(fe o, const uint8_t in[32]) noexcept
+{
+	for(int i = 0; i < 16; ++i)
+		o[i] = in[2 * i] + ((int64_t) in[2 * i + 1] << 8);
+	o[15] &= 0x7fff;
+}
+
+
+static void fe_pack(uint8_t out[32], const fe n) noexcept
+{
+	fe t, m;
+	std::memcpy(t, n, sizeof(fe));
+	fe_carry(t);
+	fe_carry(t);
+	fe_carry(t);
+
+	// Subtract p (twice at most) without branching
+	for(int j = 0; j < 2; ++j)
+	{
+		m[0] = t[0] - 0xffed;
+		for(int i = 1; i < 15; ++i)
+		{
+			m[i] = t[i] - 0xffff - ((m[i - 1] >> 16) & 1);
+			m[i - 1] &= 0xffff;
+		}
+		m[15] = t[15] - 0x7fff - ((m[14] >> 16) & 1);
+		int64_t borrow = (m[15] >> 16) & 1;
+		m[14] &= 0xffff;
+		fe_swap(t, m, 1 - borrow);
+	}
+
+	for(int i = 0; i < 16; ++i)
+	{
+		out[2 * i] = (uint8_t) (t[i] & 0xff);
+		out[2 * i + 1] = (uint8_t) (t[i] >> 8);
+	}
+}
+
+
+bool x25519(uint8_t out[CRYPTO_KEY_SIZE], const uint8_t scalar[CRYPTO_KEY_SIZE],
+            const uint8_t point[CRYPTO_KEY_SIZE]) noexcept
+{
+	static const fe a24 = {0xdb41, 1};
+
+	// Clamp
+	uint8_t z[32];
+	std::memcpy(z, scalar, 32);
+	z[31] = (z[31] & 127) | 64;
+	z[0] &= 248;
+
+	// Montgomery ladder
+	fe x, a = {1}, b, c = {0}, d = {1}, e, f;
+	fe_unpack(x, point);
+	std::memcpy(b, x, sizeof(fe));
+	for(int i = 254; i >= 0; --i)
+	{
+		int64_t bit = (z[i >> 3] >> (i & 7)) & 1;
+		fe_swap(a, b, bit);
+		fe_swap(c, d, bit);
+		fe_add(e, a, c);
+		fe_sub(a, a, c);
+		fe_add(c, b, d);
+		fe_sub(b, b, d);
+		fe_mul(d, e, e);
+		fe_mul(f, a, a);
+		fe_mul(a, c, a);
+		fe_mul(c, b, e);
+		fe_add(e, a, c);
+		fe_sub(a, a, c);
+		fe_mul(b, a, a);
+		fe_sub(c, d, f);
+		fe_mul(a, c, a24);
+		fe_add(a, a, d);
+		fe_mul(c, c, a);
+		fe_mul(a, d, f);
+		fe_mul(d, b, x);
+		fe_mul(b, e, e);
+		fe_swap(a, b, bit);
+		fe_swap(c, d, bit);
+	}
+
+	fe_invert(c, c);
+	fe_mul(a, a, c);
+	fe_pack(out, a);
+	wipe(z, sizeof(z));
+
+	uint8_t any = 0;
+	for(int i = 0; i < 32; ++i)
+		any |= out[i];
+	return any != 0;
+}
+
+
+// ReplayWindow --------------------------------------------------------------------------
+bool ReplayWindow::fresh(uint32_t counter) const noexcept
+{
+	uint64_t n = (uint64_t) counter + 1;
+	if(n > this->top) return true;
+	uint64_t age = this->top - n;
+	if(age >= CRYPTO_REPLAY_WINDOW) return false;
+	return !((this->seen >> age) & 1);
+}
+
+
+void ReplayWindow::accept(uint32_t counter) noexcept
+{
+	uint64_t n = (uint64_t) counter + 1;
+	if(n > this->top)
+	{
+		uint64_t shift = n - this->top;
+		this->seen = (shift >= CRYPTO_REPLAY_WINDOW) ? 0 : this->seen << shift;
+		this->seen |= 1;
+		this->top = n;
+	}
+	else this->seen |= (uint64_t) 1 << (this->top - n);
+}
+
+
+// AudioCipher ---------------------------------------------------------------------------
+AudioCipher::~AudioCipher() noexcept
+{
+	wipe(this->secret, sizeof(this->secret));
+	wipe(this->tx_key, sizeof(this->tx_key));
+	wipe(this->rx_key, sizeof(this->rx_key));
+}
+
+
+bool AudioCipher::ourKey(uint8_t out[CRYPTO_KEY_SIZE]) noexcept
+{
+	static const uint8_t base[CRYPTO_KEY_SIZE] = {9};
+	if(!this->has_ours)
+	{
+		if(!random_bytes(this->secret, sizeof(this->secret))) return false;
+		x25519(this->ours, this->secret, base);
+		this->has_ours = true;
+	}
+	std::memcpy(out, this->ours, CRYPTO_KEY_SIZE);
+	this->arm();
+	return true;
+}
+
+
+void AudioCipher::setTheirKey(const uint8_t key[CRYPTO_KEY_SIZE]) noexcept
+{
+	if(this->received) return;
+	std::memcpy(this->theirs, key, CRYPTO_KEY_SIZE);
+	this->received = true;
+	this->arm();
+}
+
+
+void AudioCipher::confirm() noexcept
+{
+	if(this->armed.load()) this->confirmed.store(true, std::memory_order_release);
+}
+
+
+void AudioCipher::arm() noexcept
+{
+	if(this->armed.load() || !this->has_ours || !this->received) return;
+
+	// Low order points give everyone the same secret, stay plain with them
+	uint8_t shared[CRYPTO_KEY_SIZE];
+	if(!x25519(shared, this->secret, this->theirs))
+	{
+		wipe(shared, sizeof(shared));
+		return;
+	}
+
+	// One key per direction, the lower public key sends with the first one
+	static const uint8_t zero[CRYPTO_NONCE_SIZE] = {0};
+	uint8_t keys[64];
+	chacha20_block(shared, 0, zero, keys);
+	bool lower = std::memcmp(this->ours, this->theirs, CRYPTO_KEY_SIZE) < 0;
+	std::memcpy(this->tx_key, keys + (lower ? 0 : 32), CRYPTO_KEY_SIZE);
+	std::memcpy(this->rx_key, keys + (lower ? 32 : 0), CRYPTO_KEY_SIZE);
+	wipe(shared, sizeof(shared));
+	wipe(keys, sizeof(keys));
+
+	this->armed.store(true, std::memory_order_release);
+}
+
+
+size_t AudioCipher::seal(uint8_t *datagram, size_t len) noexcept
+{
+	if(len < SENDA_HEADER_SIZE || datagram[0] != SENDA) return 0;
+	if(this->tx_counter == UINT32_MAX) return 0;
+
+	// Tag it SENDE first, the header goes in as associated data
+	uint32_t counter = this->tx_counter++;
+	datagram[0] = SENDE;
+	uint8_t nonce[CRYPTO_NONCE_SIZE] = {0};
+	uint8_t *trailer = datagram + len;
+	for(int i = 0; i < CRYPTO_COUNTER_SIZE; ++i)
+		trailer[i] = nonce[8 + i] = (uint8_t) (counter >> (24 - 8 * i));
+
+	aead_seal(this->tx_key, nonce, datagram, SENDA_HEADER_SIZE,
+	          datagram + SENDA_HEADER_SIZE, len - SENDA_HEADER_SIZE, trailer + CRYPTO_COUNTER_SIZE);
+	return len + CRYPTO_OVERHEAD;
+}
+
+
+ssize_t AudioCipher::open(uint8_t *datagram, size_t len) noexcept
+{
+	if(len <= SENDA_HEADER_SIZE + CRYPTO_OVERHEAD || datagram[0] != SENDE) return -1;
+	if(!this->armed.load(std::memory_order_acquire)) return -1;
+
+	// Cheap replay check before any work
+	const uint8_t *trailer = datagram + len - CRYPTO_OVERHEAD;
+	uint8_t nonce[CRYPTO_NONCE_SIZE] = {0};
+	uint32_t counter = 0;
+	for(int i = 0; i < CRYPTO_COUNTER_SIZE; ++i)
+	{
+		nonce[8 + i] = trailer[i];
+		counter = (counter << 8) | trailer[i];
+	}
+	if(!this->window.fresh(counter)) return -1;
+
+	size_t payload = len - SENDA_HEADER_SIZE - CRYPTO_OVERHEAD;
+	if(!aead_open(this->rx_key, nonce, datagram, SENDA_HEADER_SIZE,
+	              datagram + SENDA_HEADER_SIZE, payload, trailer + CRYPTO_COUNTER_SIZE))
+		return -1;
+
+	// The peer seals, so it has its keys -- Our turn, and no more plain audio from it
+	this->window.accept(counter);
+	this->confirmed.store(true, std::memory_order_release);
+	this->opened.store(true, std::memory_order_release);
+	datagram[0] = SENDA;
+	return len - CRYPTO_OVERHEAD;
+}
@@ -0,0 +1,215 @@
+#ifndef _PC_CRYPTO_HPP
+#define _PC_CRYPTO_HPP
+
+
+/*
+ *  PeersChat Crypto Header: Sealing audio datagrams between two peers
+ *
+ * Audio travels in UDP datagrams that anyone on the path can read, and anyone who can
+ * guess a stream id can forge.  Peers that both support it seal every audio datagram
+ * with ChaCha20-Poly1305 (RFC 8439) under keys only the two of them know.
+ *
+ * Keys: Every peer makes an X25519 (RFC 7748) key pair per peer it talks to.  Right
+ * after joining, the joiner sends each peer its public half over TCP and gets theirs
+ * back (KEY, below), trying again a few times like it does for names.  With both
+ * public keys either side computes the same shared secret.  One ChaCha20 block keyed
+ * with it (as NaCl's crypto_box_beforenm does with HSalsa20) gives two 256 bit keys,
+ * one per direction: the first half for audio from the peer with the lower public
+ * key, the second half for the other way.  Key pairs are made fresh for every call
+ * and never leave memory.
+ *
+ *   [KEY] [port:16] [version:8] [stream id:8] [key:256]
+ *                               Joiner to peer: the port it claims as in REQN, and the
+ *                               audio header version and stream id its SENDN would give
+ *   [KEY] [key:256]             Answer, once the peer has made its keys
+ *   [DENY]                      Answer from a peer that doesn't seal audio
+ *
+ * Switching over: Neither side sees when the other has made its keys, so they take
+ * turns.  The joiner seals from the moment the answer is in, the peer made its keys
+ * before answering.  The peer starts sealing once the joiner's first SENDE opens.
+ * Each side keeps taking plain audio from the other until that other's first SENDE
+ * opened, and refuses it from then on, so nothing is dropped while the keys cross.
+ * Only SENDA can be sealed: a side that doesn't know the other speaks it yet (its REQN
+ * went unanswered and no KEY told it) keeps sending plain SENDV, which the other
+ * still takes since it never opened a SENDE from it.
+ *
+ * Format, integers big endian:
+ *
+ *   [SENDE] [version:2 | flags:6] [sequence:16] [timestamp:16] [stream id:8]
+ *   [sealed payload...] [counter:32] [tag:128]
+ *
+ *   The header is a SENDA header (nettypes.hpp) with another tag.  It stays readable,
+ *   the receiver routes on the stream id before it can open anything, and it is
+ *   authenticated as associated data.
+ *   counter  Per direction datagram counter, the AEAD nonce is [0:64] [counter:32]
+ *   tag      Poly1305 tag over header and sealed payload
+ *
+ * Sealing appends CRYPTO_OVERHEAD bytes to a SENDA datagram where it lies, opening
+ * strips them and turns it back into the SENDA datagram it was, so nothing is copied
+ * or allocated per packet either way.
+ *
+ * Replays: The receiver keeps a window of the last CRYPTO_REPLAY_WINDOW counters and
+ * drops any counter it has seen or that is older than that (the jitter buffer gave
+ * up on those long ago).  A sender stops after 2^32 - 1 datagrams rather than reuse a
+ * nonce; that is two years of audio.
+ *
+ * What it doesn't do: The public keys travel over the same plain TCP connection as
+ * everything else, so someone who can rewrite that connection during the join can
+ * still sit in the middle.  Someone who can only listen, or send datagrams, can't,
+ * apart from slipping plain audio in before a peer's first SENDE (about a round trip).
+ * Peers that never agree on keys (older clients, PEERSCHAT_ENCRYPT=0, every KEY lost)
+ * keep plain SENDA/SENDV both ways; the joiner says so on stderr.  Membership, NAT
+ * and rebind datagrams are not sealed.
+ *
+ */
+
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <sys/types.h>
+#include "nettypes.hpp"
+
+
+// Pre-Compiler Constants
+#define CRYPTO_KEY_SIZE 32
+#define CRYPTO_NONCE_SIZE 12
+#define CRYPTO_TAG_SIZE 16
+#define CRYPTO_COUNTER_SIZE 4
+#define CRYPTO_OVERHEAD (CRYPTO_COUNTER_SIZE + CRYPTO_TAG_SIZE)
+#define CRYPTO_REPLAY_WINDOW 64
+
+
+/* x25519: @out = @scalar * @point on Curve25519 (RFC 7748)
+ *        @return (bool) false if @out came out all zero (@point had low order)
+ */
+bool x25519(uint8_t out[CRYPTO_KEY_SIZE], const uint8_t scalar[CRYPTO_KEY_SIZE],
+            const uint8_t point[CRYPTO_KEY_SIZE]) noexcept;
+
+/* aead_seal: ChaCha20-Poly1305 (RFC 8439) encrypt @data in place and write its tag
+ *           to @tag.  @aad is authenticated but not encrypted.
+ */
+void aead_seal(const uint8_t key[CRYPTO_KEY_SIZE], const uint8_t nonce[CRYPTO_NONCE_SIZE],
+               const uint8_t *aad, size_t aad_len, uint8_t *data, size_t len,
+               uint8_t tag[CRYPTO_TAG_SIZE]) noexcept;
+
+/* aead_open: Check @tag and decrypt @data in place.  @data is left alone if the tag
+ *           doesn't match.
+ *          @return (bool) did the tag match?
+ */
+bool aead_open(const uint8_t key[CRYPTO_KEY_SIZE], const uint8_t nonce[CRYPTO_NONCE_SIZE],
+               const uint8_t *aad, size_t aad_len, uint8_t *data, size_t len,
+               const uint8_t tag[CRYPTO_TAG_SIZE]) noexcept;
+
+
+// ReplayWindow Class --------------------------------------------------------------------
+/* ReplayWindow: Which of the last CRYPTO_REPLAY_WINDOW counters we took
+ *
+ * @member top  Highest counter taken plus one, 0 before the first
+ *
+ * @member seen  Bit k set if counter top - 1 - k was taken
+ *
+ * @method fresh(1)  Haven't seen @counter and it isn't too old?
+ *
+ * @method accept(1)  Note @counter as seen, only once its datagram checked out
+ */
+class ReplayWindow
+{
+private:
+	uint64_t top = 0;
+	uint64_t seen = 0;
+
+public:
+	bool fresh(uint32_t counter) const noexcept;
+	void accept(uint32_t counter) noexcept;
+};
+
+
+// AudioCipher Class ---------------------------------------------------------------------
+/* AudioCipher: Keys and counters for the audio between us and one peer
+ *
+(IMPLEMENTATION DETAILS)
+Members:
+ * secret/ours  Our key pair for this peer, made the first time we hand it out
+ *
+ * theirs  The peer's public key from the KEY exchange
+ *
+ * received  Did we get theirs?  Keys are made as soon as we have both public keys.
+ *
+ * tx_key/rx_key  Key for audio to/from the peer
+ *
+ * tx_counter  Counter of the next datagram we seal
+ *
+ * window  Counters we opened
+ *
+ * armed  Are the keys made?  Set once, the keys never change after that.
+ *
+ * confirmed  Does the peer have its keys too?  Set by confirm() or the first SENDE that
+ *            opens.  We seal from then on.
+ *
+ * opened  Did a SENDE from the peer open?  Its plain audio is refused from then on.
+ *
+ *
+(CLIENT INTERFACE)
+Setup (ourKey, setTheirKey, confirm) is not thread safe, NPeer locks around it.  After
+that seal() belongs to whoever sends to the peer and open() to the receive loop.
+ *
+Public Methods:
+ * ourKey(1)  Copy our public key (made on first use) into @out
+ *           @return (bool) false if no random bytes could be had
+ *
+ * setTheirKey(1)  Keep the peer's public key, the first one only
+ *
+ * confirm()  The peer answered our KEY, so it made its keys
+ *
+ * sealed()  Are we sealing?
+ *
+ * strict()  Is plain audio from the peer refused?
+ *
+ * seal(2)  Seal the SENDA datagram @len bytes long in @datagram, which must have
+ *          CRYPTO_OVERHEAD more bytes of room
+ *         @return (size_t) new length, 0 if it can't be sent (not SENDA, or out of
+ *                 counters)
+ *
+ * open(2)  Open the SENDE datagram @len bytes long in @datagram, it becomes the SENDA
+ *          datagram it was sealed from
+ *         @return (ssize_t) new length, -1 if forged, replayed or mangled
+ */
+class AudioCipher
+{
+	// Members
+private:
+	uint8_t secret[CRYPTO_KEY_SIZE] = {0};
+	uint8_t ours[CRYPTO_KEY_SIZE] = {0};
+	uint8_t theirs[CRYPTO_KEY_SIZE] = {0};
+	bool has_ours = false;
+	bool received = false;
+	uint8_t tx_key[CRYPTO_KEY_SIZE] = {0};
+	uint8_t rx_key[CRYPTO_KEY_SIZE] = {0};
+	uint32_t tx_counter = 0;
+	ReplayWindow window;
+	std::atomic<bool> armed = {false};
+	std::atomic<bool> confirmed = {false};
+	std::atomic<bool> opened = {false};
+
+public:
+	AudioCipher() noexcept { }
+	AudioCipher(const AudioCipher&) = delete;
+	AudioCipher& operator=(const AudioCipher&) = delete;
+	~AudioCipher() noexcept;
+
+	bool ourKey(uint8_t out[CRYPTO_KEY_SIZE]) noexcept;
+	void setTheirKey(const uint8_t key[CRYPTO_KEY_SIZE]) noexcept;
+	void confirm() noexcept;
+	inline bool sealed() const noexcept { return this->confirmed.load(std::memory_order_acquire); }
+	inline bool strict() const noexcept { return this->opened.load(std::memory_order_acquire); }
+
+	size_t seal(uint8_t *datagram, size_t len) noexcept;
+	ssize_t open(uint8_t *datagram, size_t len) noexcept;
+
+private:
+	void arm() noexcept;
+};
+
+
+#endif
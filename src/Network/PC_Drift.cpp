@@ -0,0 +1,79 @@
+#include "PC_Drift.hpp"
+
+#include <algorithm>
+
+
+// DriftEstimator ------------------------------------------------------------------------
+void DriftEstimator::add(int64_t media, int64_t arrival) noexcept
+{
+	int64_t transit = arrival - media;
+
+	// Media time went far back (timestamps wrapped) -- Nothing to fit it against
+	if(this->started && media < this->window_start - DRIFT_WINDOW)
+		this->restart();
+
+	if(!this->started)
+	{
+		this->started = true;
+		this->window_start = this->window_at = media;
+		this->window_min = transit;
+		return;
+	}
+
+	if(media - this->window_start < DRIFT_WINDOW)
+	{
+		if(transit < this->window_min)
+		{
+			this->window_min = transit;
+			this->window_at = media;
+		}
+		return;
+	}
+
+	// Window is over -- Its minimum goes into the fit and this packet opens the next one
+	this->fit(this->window_at, this->window_min);
+	this->window_start = this->window_at = media;
+	this->window_min = transit;
+}
+
+
+void DriftEstimator::restart() noexcept
+{
+	this->started = false;
+	this->windows = 0;
+	this->sw = this->sx = this->sy = this->sxx = this->sxy = 0.0;
+}
+
+
+void DriftEstimator::fit(int64_t at, int64_t transit) noexcept
+{
+	double y = (double) (transit - this->y0);
+
+	// A step no drift could make -- Fit from here on
+	if(this->windows > 0 && (y - this->last_y > DRIFT_JUMP || this->last_y - y > DRIFT_JUMP))
+		this->windows = 0;
+	if(this->windows == 0)
+	{
+		this->sw = this->sx = this->sy = this->sxx = this->sxy = 0.0;
+		this->x0 = at;
+		this->y0 = transit;
+		y = 0.0;
+	}
+	double x = (at - this->x0) / 1e6;
+	this->last_y = y;
+
+	this->sw = this->sw * DRIFT_FORGET + 1.0;
+	this->sx = this->sx * DRIFT_FORGET + x;
+	this->sy = this->sy * DRIFT_FORGET + y;
+	this->sxx = this->sxx * DRIFT_FORGET + x * x;
+	this->sxy = this->sxy * DRIFT_FORGET + x * y;
+	this->windows++;
+	if(this->windows < DRIFT_MIN_WINDOWS)
+		return;
+
+	double det = this->sw * this->sxx - this->sx * this->sx;
+	if(det <= 0.0)
+		return;
+	double slope = (this->sw * this->sxy - this->sx * this->sy) / det;
+	this->estimate = std::max<double>(-DRIFT_MAX_PPM, std::min<double>(DRIFT_MAX_PPM, slope));
+}
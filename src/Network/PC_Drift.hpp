@@ -0,0 +1,102 @@
+#ifndef _PC_DRIFT_HPP
+#define _PC_DRIFT_HPP
+
+
+/*
+ *  PeersChat Drift Header: How fast a peer's clock runs next to ours
+ *
+ * Every peer stamps its audio with its own sound card's clock and we play it on ours.
+ * No two crystals agree exactly; a few tens of ppm apart is normal, a few hundred
+ * happens.  Left alone the difference piles up in the jitter buffer (the peer is fast)
+ * or drains it (the peer is slow), 100 ppm being 6 ms a minute.
+ *
+ * Arrival time minus media time (transit) is the network delay plus a constant plus
+ * the drift times the time since the call started.  Queueing only ever adds delay, so
+ * the least transit in each DRIFT_WINDOW of media time is close to the bare path, and
+ * a line fitted through those minima has the drift as its slope.  The fit forgets
+ * old minima slowly (DRIFT_FORGET per window) so it can follow a clock that warms up.
+ *
+ * A minimum that lands more than DRIFT_JUMP off the previous one is a new path
+ * (rebind, route change) or a sender that restarted its clock, not drift.  The fit
+ * starts over from there and keeps giving the last slope until it has enough minima.
+ *
+ * The clock is always passed in, like JitterBuffer (PC_Jitter.hpp), so a trace can
+ * drive it just as well as steady_clock::now().
+ *
+ */
+
+
+#include <cstdint>
+
+
+// Pre-Compiler Constants
+#define DRIFT_WINDOW 1000000
+#define DRIFT_MIN_WINDOWS 10
+#define DRIFT_FORGET 0.98
+#define DRIFT_JUMP 20000
+#define DRIFT_MAX_PPM 500
+
+
+// DriftEstimator Class ------------------------------------------------------------------
+/* DriftEstimator: Fits a line through a peer's least transit times -- Not thread safe
+ *
+(IMPLEMENTATION DETAILS)
+Members:
+ * started  Has the current window seen a packet?
+ *
+ * window_start  Media time (us) the current window started at
+ *
+ * window_min/window_at  Least transit in the current window and the media time of the
+ *                       packet that had it
+ *
+ * x0/y0  Media time and transit of the first minimum in the fit.  The fit works
+ *        relative to them so the sums stay small.
+ *
+ * last_y  Transit of the previous minimum, relative to @y0
+ *
+ * sw/sx/sy/sxx/sxy  Weighted least squares sums, x in seconds and y in microseconds
+ *                   so the slope comes out in ppm
+ *
+ * windows  Minima in the fit
+ *
+ * estimate  Last slope we trusted, ppm
+ *
+ *
+(CLIENT INTERFACE)
+Public Methods:
+ * add(2)  A packet stamped @media (us, sender's clock) arrived at @arrival (us, ours)
+ *
+ * restart()  The path changed, start a new fit but keep the estimate
+ *
+ * ppm()  How much slower the peer's clock runs than ours.  Positive means its audio
+ *        comes in slower than we play, so it has to be stretched by 1 + ppm / 10^6.
+ *       @return (double) -DRIFT_MAX_PPM - DRIFT_MAX_PPM, 0 until DRIFT_MIN_WINDOWS
+ *               windows went by
+ *
+ */
+class DriftEstimator
+{
+	// Members
+private:
+	bool started = false;
+	int64_t window_start = 0;
+	int64_t window_min = 0;
+	int64_t window_at = 0;
+	int64_t x0 = 0;
+	int64_t y0 = 0;
+	double last_y = 0.0;
+	double sw = 0.0, sx = 0.0, sy = 0.0, sxx = 0.0, sxy = 0.0;
+	int windows = 0;
+	double estimate = 0.0;
+
+public:
+	void add(int64_t media, int64_t arrival) noexcept;
+	void restart() noexcept;
+	inline double ppm() const noexcept { return this->estimate; }
+
+private:
+	void fit(int64_t at, int64_t transit) noexcept;
+};
+
+
+#endif
@@ -0,0 +1,480 @@
+#include "PC_Gossip.hpp"
+
+#include <cstring>
+#include <algorithm>
+
+using namespace std::chrono;
+using namespace std::chrono_literals;
+
+
+// Globals -------------------------------------------------------------------------------
+std::chrono::milliseconds GOSSIP_INTERVAL = 200ms;
+std::chrono::milliseconds GOSSIP_SUSPECT_TIMEOUT = 2s;
+std::chrono::milliseconds GOSSIP_DEAD_TIMEOUT = 3s;
+std::chrono::milliseconds GOSSIP_FULL_INTERVAL = 1s;
+std::chrono::milliseconds GOSSIP_TOMBSTONE = 30s;
+
+
+// Big Endian Helpers --------------------------------------------------------------------
+static inline void put_be32(uint8_t *buffer, uint32_t x) noexcept
+{
+	buffer[0] = (uint8_t) (x >> 24);
+	buffer[1] = (uint8_t) (x >> 16);
+	buffer[2] = (uint8_t) (x >> 8);
+	buffer[3] = (uint8_t) x;
+}
+
+
+static inline uint32_t get_be32(const uint8_t *buffer) noexcept
+{
+	return ((uint32_t) buffer[0] << 24) | ((uint32_t) buffer[1] << 16) |
+	       ((uint32_t) buffer[2] << 8)  |  (uint32_t) buffer[3];
+}
+
+
+// Address in the narrow (IPv4) or wide form
+static inline void put_addr(uint8_t *buffer, const PeerAddr &addr, bool wide) noexcept
+{
+	if(wide) addr.write(buffer);
+	else addr.writeV4(buffer);
+}
+
+
+static inline PeerAddr get_addr(const uint8_t *buffer, bool wide) noexcept
+{
+	PeerAddr addr;
+	if(wide) addr.read(buffer);
+	else addr.readV4(buffer);
+	return addr;
+}
+
+
+// splitmix64 finalizer
+static inline uint64_t mix(uint64_t x) noexcept
+{
+	x ^= x >> 30;
+	x *= 0xbf58476d1ce4e5b9ULL;
+	x ^= x >> 27;
+	x *= 0x94d049bb133111ebULL;
+	x ^= x >> 31;
+	return x;
+}
+
+
+// Constructor ---------------------------------------------------------------------------
+GossipView::GossipView() noexcept : rng(std::random_device()())
+{
+}
+
+
+// View ----------------------------------------------------------------------------------
+void GossipView::reset(uint32_t incarnation) noexcept
+{
+	this->members.clear();
+	this->incarnation = incarnation;
+	this->heartbeat = 0;
+	this->self_known = false;
+	this->cursor = 0;
+}
+
+
+void GossipView::add(const PeerAddr &addr, time_point now) noexcept
+{
+	auto it = this->members.find(addr);
+	if(it == this->members.end())
+	{
+		Member &member = this->members[addr];
+		member.addr = addr;
+		member.last_heard = now;
+		this->changed(member, now);
+		return;
+	}
+
+	// Let back in -- Outrank the tombstone everyone else has
+	Member &member = it->second;
+	if(alive(member.state)) return;
+	member.moved = false;
+	member.incarnation++;
+	member.heartbeat = 0;
+	member.state = GOSSIP_ALIVE;
+	member.last_heard = now;
+	this->changed(member, now);
+}
+
+
+void GossipView::remove(const PeerAddr &addr, time_point now) noexcept
+{
+	auto it = this->members.find(addr);
+	if(it == this->members.end() || !alive(it->second.state)) return;
+	it->second.state = GOSSIP_LEFT;
+	this->changed(it->second, now);
+}
+
+
+void GossipView::rebind(const PeerAddr &from, const PeerAddr &to, time_point now) noexcept
+{
+	auto it = this->members.find(from);
+	if(it == this->members.end() || it->second.moved || from == to) return;
+
+	// Same entry under the new address -- Replaces whatever gossip told us about it so far
+	Member member = it->second;
+	member.addr = to;
+	member.last_heard = now;
+	this->changed(member, now);
+	this->leaveBehind(from, member.incarnation, now);
+	this->members[to] = member;
+}
+
+
+bool GossipView::gossips(const PeerAddr &addr) noexcept
+{
+	auto it = this->members.find(addr);
+	return it != this->members.end() && it->second.gossips;
+}
+
+
+void GossipView::live(std::vector<PeerAddr> &gossiping, std::vector<PeerAddr> *legacy) noexcept
+{
+	for(auto &pair : this->members)
+	{
+		if(!alive(pair.second.state)) continue;
+		if(pair.second.gossips) gossiping.push_back(pair.second.addr);
+		else if(legacy) legacy->push_back(pair.second.addr);
+	}
+}
+
+
+uint32_t GossipView::digest() noexcept
+{
+	if(!this->self_known) return 0;
+
+	uint64_t x = mix(key(this->self) ^ ((uint64_t) this->incarnation << 16) ^ GOSSIP_ALIVE);
+	for(auto &pair : this->members)
+	{
+		const Member &member = pair.second;
+		if(alive(member.state))
+			x ^= mix(key(pair.first) ^ ((uint64_t) member.incarnation << 16) ^ member.state);
+	}
+
+	uint32_t folded = (uint32_t) (x ^ (x >> 32));
+	return folded ? folded : 1;
+}
+
+
+// Datagrams -----------------------------------------------------------------------------
+GossipReceived GossipView::receive(const PeerAddr &from, const uint8_t *buffer, size_t len,
+                                   time_point now, std::vector<GossipEvent> &events) noexcept
+{
+	if(len < 2 || buffer[0] != GOSSIP) return GOSSIP_IGNORED;
+	uint8_t flags = buffer[1];
+	bool wide = (flags & GOSSIP_WIDE);
+	size_t header = wide ? GOSSIP_WIDE_HEADER_SIZE : GOSSIP_HEADER_SIZE;
+	size_t entry_size = wide ? GOSSIP_WIDE_ENTRY_SIZE : GOSSIP_ENTRY_SIZE;
+	size_t addr_size = wide ? PEER_ADDR_SIZE : PEER_ADDR_V4_SIZE;
+	if(len < header) return GOSSIP_IGNORED;
+
+	uint32_t incarnation = get_be32(buffer + 2);
+	uint32_t heartbeat = get_be32(buffer + 6);
+	uint32_t digest = get_be32(buffer + 10);
+	size_t count = buffer[header - 1];
+	if(len < header + count * entry_size) return GOSSIP_IGNORED;
+
+	// Only members get a say, strangers have to be let in first
+	auto it = this->members.find(from);
+	if(it == this->members.end() || it->second.moved) return GOSSIP_IGNORED;
+	Member &sender = it->second;
+	if(flags & (GOSSIP_WIDE | GOSSIP_WIDE_OK)) sender.wide = true;
+
+	// Told a new address for us -- We moved, our old one mustn't come back as a stranger
+	PeerAddr self = get_addr(buffer + 14, wide);
+	if(this->self_known && self != this->self)
+	{
+		auto old = this->members.find(self);
+		if(old != this->members.end() && old->second.moved)
+			this->members.erase(old);
+		this->leaveBehind(this->self, this->incarnation, now);
+	}
+	this->self = self;
+	this->self_known = true;
+
+	// The sender speaks for itself
+	bool was_alive = alive(sender.state);
+	this->merge(sender, incarnation, heartbeat, (flags & GOSSIP_LEAVING) ? GOSSIP_LEFT : GOSSIP_ALIVE, now, events);
+	if(alive(sender.state))
+	{
+		sender.gossips = true;
+		sender.last_heard = now;
+	}
+
+	// A member we gave up on that hasn't heard yet: Tell it, but don't listen to it
+	if(!was_alive && !alive(sender.state))
+	{
+		if(flags & GOSSIP_LEAVING) return GOSSIP_MERGED;
+		if(now - sender.last_full < GOSSIP_FULL_INTERVAL) return GOSSIP_MERGED;
+		sender.last_full = now;
+		return GOSSIP_REPLY_FULL;
+	}
+
+	// What it knows about everyone else
+	const uint8_t *entry = buffer + header;
+	for(size_t i = 0; i < count; ++i, entry += entry_size)
+	{
+		PeerAddr addr = get_addr(entry, wide);
+		uint32_t e_incarnation = get_be32(entry + addr_size);
+		uint32_t e_heartbeat = get_be32(entry + addr_size + 4);
+		uint8_t e_state = entry[addr_size + 8];
+		if(e_state > GOSSIP_LEFT) continue;
+
+		if(addr == this->self)
+		{
+			this->refute(e_incarnation, e_state);
+			continue;
+		}
+
+		auto known = this->members.find(addr);
+		if(known != this->members.end())
+		{
+			if(!known->second.moved)
+				this->merge(known->second, e_incarnation, e_heartbeat, e_state, now, events);
+			continue;
+		}
+
+		// Someone new -- Vouched for by a member.  Dead ones are kept as tombstones.
+		Member &member = this->members[addr];
+		member.addr = addr;
+		member.incarnation = e_incarnation;
+		member.heartbeat = e_heartbeat;
+		member.state = e_state;
+		member.gossips = (e_heartbeat > 0);
+		member.last_heard = now;
+		this->changed(member, now);
+		if(alive(e_state))
+			events.push_back({true, addr});
+	}
+
+	// Anti-entropy -- Still disagreeing after the merge, push them everything we know
+	if((flags & GOSSIP_LEAVING) || digest == 0) return GOSSIP_MERGED;
+	if(digest == this->digest() || now - sender.last_full < GOSSIP_FULL_INTERVAL) return GOSSIP_MERGED;
+	sender.last_full = now;
+	return GOSSIP_REPLY_FULL;
+}
+
+
+void GossipView::tick(time_point now, std::vector<PeerAddr> &targets, std::vector<GossipEvent> &events) noexcept
+{
+	this->heartbeat++;
+
+	std::vector<Member*> live;
+	for(auto it = this->members.begin(); it != this->members.end(); )
+	{
+		Member &member = it->second;
+
+		// Tombstones go once they outlived any stale gossip
+		if(!alive(member.state))
+		{
+			if(now - member.changed > GOSSIP_TOMBSTONE)
+				it = this->members.erase(it);
+			else ++it;
+			continue;
+		}
+
+		// Only members that ever gossiped can be caught going quiet
+		if(member.gossips)
+		{
+			auto quiet = now - member.last_heard;
+			if(member.state == GOSSIP_ALIVE && quiet > GOSSIP_SUSPECT_TIMEOUT)
+			{
+				member.state = GOSSIP_SUSPECT;
+				this->changed(member, now);
+			}
+			else if(member.state == GOSSIP_SUSPECT && quiet > GOSSIP_SUSPECT_TIMEOUT + GOSSIP_DEAD_TIMEOUT)
+			{
+				member.state = GOSSIP_DEAD;
+				this->changed(member, now);
+				events.push_back({false, member.addr});
+				++it;
+				continue;
+			}
+		}
+
+		live.push_back(&member);
+		++it;
+	}
+
+	// Fanout of about log2 N, picked with a partial shuffle
+	size_t fanout = 1;
+	while(((size_t) 1 << fanout) < live.size() + 1) fanout++;
+	fanout = std::min(fanout, live.size());
+	for(size_t i = 0; i < fanout; ++i)
+	{
+		std::uniform_int_distribution<size_t> pick(i, live.size() - 1);
+		std::swap(live[i], live[pick(this->rng)]);
+		targets.push_back(live[i]->addr);
+	}
+}
+
+
+size_t GossipView::write(const PeerAddr &to, uint8_t *buffer, size_t size, uint8_t flags) noexcept
+{
+	// Wide for whoever reads it, older clients only know IPv4 members
+	auto target = this->members.find(to);
+	bool wide = !to.isV4() || (target != this->members.end() && target->second.wide);
+	size_t header = wide ? GOSSIP_WIDE_HEADER_SIZE : GOSSIP_HEADER_SIZE;
+	size_t entry_size = wide ? GOSSIP_WIDE_ENTRY_SIZE : GOSSIP_ENTRY_SIZE;
+	if(size < header) return 0;
+	size_t room = std::min<size_t>(GOSSIP_MAX_ENTRIES, (size - header) / entry_size);
+
+	buffer[0] = GOSSIP;
+	buffer[1] = flags | (wide ? GOSSIP_WIDE : GOSSIP_WIDE_OK);
+	put_be32(buffer + 2, this->incarnation);
+	put_be32(buffer + 6, this->heartbeat);
+	put_be32(buffer + 10, (flags & GOSSIP_LEAVING) ? 0 : this->digest());
+	put_addr(buffer + 14, to, wide);
+
+	uint8_t *out = buffer + header;
+	size_t count = 0;
+	this->stamp++;
+
+	// Nothing but the goodbye
+	if(flags & GOSSIP_LEAVING)
+	{
+		buffer[header - 1] = 0;
+		return header;
+	}
+
+	// Everything, or what changed lately
+	for(auto &pair : this->members)
+	{
+		if(count >= room) break;
+		Member &member = pair.second;
+		if(member.moved || (!wide && !member.addr.isV4())) continue;
+		if(!(flags & GOSSIP_FULL) && member.transmits <= 0) continue;
+		if(member.transmits > 0) member.transmits--;
+		out = this->writeEntry(out, member, wide);
+		count++;
+	}
+
+	// Fill up with fresh heartbeats, a few members per datagram in turn
+	size_t fresh = 0;
+	if(!this->members.empty() && count < room)
+	{
+		this->cursor %= this->members.size();
+		auto it = std::next(this->members.begin(), this->cursor);
+		for(size_t seen = 0; seen < this->members.size() && fresh < GOSSIP_FRESH && count < room; ++seen)
+		{
+			Member &member = it->second;
+			if(member.stamp != this->stamp && alive(member.state) && member.gossips && (wide || member.addr.isV4()))
+			{
+				out = this->writeEntry(out, member, wide);
+				count++;
+				fresh++;
+			}
+			if(++it == this->members.end()) it = this->members.begin();
+		}
+		this->cursor += std::max<size_t>(fresh, 1);
+	}
+
+	buffer[header - 1] = (uint8_t) count;
+	return header + count * entry_size;
+}
+
+
+// Private -------------------------------------------------------------------------------
+uint64_t GossipView::key(const PeerAddr &addr) noexcept
+{
+	// IPv4 members hash the way older clients do, so a call without IPv6 agrees with them
+	if(!addr.isV4()) return addr.hash();
+	uint32_t ip;
+	std::memcpy(&ip, addr.ip + 12, 4);
+	return ((uint64_t) ip << 16) | addr.port;
+}
+
+
+int GossipView::retransmits() noexcept
+{
+	// lambda * log2(N + 1), N counting us
+	int log = 1;
+	while(((size_t) 1 << log) < this->members.size() + 2) log++;
+	return GOSSIP_RETRANSMIT_MULT * log;
+}
+
+
+void GossipView::changed(Member &member, time_point now) noexcept
+{
+	member.changed = now;
+	member.transmits = this->retransmits();
+}
+
+
+void GossipView::merge(Member &member, uint32_t incarnation, uint32_t heartbeat, uint8_t state,
+                       time_point now, std::vector<GossipEvent> &events) noexcept
+{
+	bool was_alive = alive(member.state);
+	bool change = false;
+
+	// A newer incarnation overrides everything, at the same one the worse state wins
+	if(incarnation > member.incarnation)
+	{
+		member.incarnation = incarnation;
+		member.heartbeat = 0;
+		member.state = state;
+		change = true;
+	}
+	else if(incarnation == member.incarnation && state > member.state)
+	{
+		member.state = state;
+		change = true;
+	}
+
+	// A heartbeat that moved means it was alive not long ago
+	if(incarnation == member.incarnation && heartbeat > member.heartbeat)
+	{
+		member.heartbeat = heartbeat;
+		member.gossips = true;
+		member.last_heard = now;
+	}
+
+	if(!change) return;
+	this->changed(member, now);
+	if(!was_alive && alive(member.state))
+	{
+		member.last_heard = now;
+		events.push_back({true, member.addr});
+	}
+	else if(was_alive && !alive(member.state))
+		events.push_back({false, member.addr});
+}
+
+
+void GossipView::refute(uint32_t incarnation, uint8_t state) noexcept
+{
+	// Our own heartbeat header carries the new incarnation to everyone we talk to
+	if(state != GOSSIP_ALIVE && incarnation >= this->incarnation)
+		this->incarnation = incarnation + 1;
+}
+
+
+void GossipView::leaveBehind(const PeerAddr &addr, uint32_t incarnation, time_point now) noexcept
+{
+	// Outranks anything still said about the old address, and is never sent
+	Member &member = this->members[addr];
+	member = Member();
+	member.addr = addr;
+	member.incarnation = incarnation;
+	member.state = GOSSIP_LEFT;
+	member.moved = true;
+	member.last_heard = now;
+	member.changed = now;
+}
+
+
+uint8_t* GossipView::writeEntry(uint8_t *out, Member &member, bool wide) noexcept
+{
+	size_t addr_size = wide ? PEER_ADDR_SIZE : PEER_ADDR_V4_SIZE;
+	put_addr(out, member.addr, wide);
+	put_be32(out + addr_size, member.incarnation);
+	put_be32(out + addr_size + 4, member.heartbeat);
+	out[addr_size + 8] = member.state;
+	member.stamp = this->stamp;
+	return out + addr_size + 9;
+}
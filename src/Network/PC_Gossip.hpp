@@ -0,0 +1,267 @@
+#ifndef _PC_GOSSIP_HPP
+#define _PC_GOSSIP_HPP
+
+
+/*
+ *  PeersChat Gossip Header: Epidemic membership for a call
+ *
+ * Every member keeps a view of who is in the call: an entry per address with an
+ * incarnation (bumped only by the member itself), a heartbeat counter and a state.
+ * Every GOSSIP_INTERVAL each member bumps its heartbeat and sends a GOSSIP datagram to
+ * a few random members (about log2 N of them).  A datagram carries the sender's own
+ * incarnation and heartbeat, a digest of its whole view, and piggybacks the entries
+ * that changed lately plus a few fresh heartbeats.  A change reaches everyone in
+ * O(log N) rounds; when two digests still disagree the receiver answers with its full
+ * view (push-pull anti-entropy, at most once per GOSSIP_FULL_INTERVAL per member).
+ *
+ * Crashes: A member whose heartbeat stops moving for GOSSIP_SUSPECT_TIMEOUT becomes
+ * SUSPECT, and DEAD GOSSIP_DEAD_TIMEOUT after that.  A member that hears it is suspected
+ * refutes by bumping its incarnation.  Members that never sent a heartbeat (older
+ * clients) are never suspected; they still leave over TCP with DISCONNECT.
+ *
+ * Leaving: The leaving member sends a last datagram with GOSSIP_LEAVING to everyone;
+ * its entry turns LEFT and spreads like any other change.  DEAD and LEFT entries stay
+ * around for GOSSIP_TOMBSTONE so stale gossip can't bring the member back, unless it
+ * comes back with a higher incarnation.
+ *
+ * Moving: When a member is rebound to a new address (PC_Session.hpp) its entry moves
+ * with it and the old address keeps a tombstone that is never sent.  Members that
+ * haven't rebound it yet still gossip the old address for a while; the tombstone keeps
+ * that from looking like someone joining.  The same goes for our own old address once
+ * the others start telling us a new one.
+ *
+ * Format, integers big endian, addresses as in PC_Addr.hpp:
+ *
+ *   [GOSSIP] [flags:8] [incarnation:32] [heartbeat:32] [digest:32] [your ip:32]
+ *   [your port:16] [count:8] [entry...]
+ *
+ *   entry: [ip:32] [port:16] [incarnation:32] [heartbeat:32] [state:8]
+ *
+ *   your ip/port  The receiver's address as the sender sees it.  That is how a member
+ *                 recognizes entries about itself.
+ *   digest        0 while the sender doesn't know its own address yet
+ *
+ * With GOSSIP_WIDE in the flags every ip is 128 bits (IPv4 mapped) instead, so IPv6
+ * members fit.  Older clients only read the narrow form, so a member only gets wide
+ * datagrams once it showed it reads them (GOSSIP_WIDE_OK, or a wide datagram of its
+ * own) or if it is on IPv6 itself.  Narrow datagrams leave IPv6 members out; the
+ * digest of a member that never hears of them never matches, so it gets our full view
+ * every GOSSIP_FULL_INTERVAL.
+ *
+ * GossipView is only the bookkeeping, it never touches a socket; PeersChatNetwork sends
+ * and receives the datagrams on the audio socket and acts on the GossipEvents.
+ *
+ */
+
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <unordered_map>
+#include <random>
+#include <chrono>
+#include "nettypes.hpp"
+#include "PC_Addr.hpp"
+
+
+// Pre-Compiler Constants
+#define GOSSIP_HEADER_SIZE 21
+#define GOSSIP_ENTRY_SIZE 15
+#define GOSSIP_WIDE_HEADER_SIZE 33
+#define GOSSIP_WIDE_ENTRY_SIZE 27
+#define GOSSIP_MAX_ENTRIES 64
+#define GOSSIP_FRESH 8
+#define GOSSIP_RETRANSMIT_MULT 3
+
+
+// Globals
+/*
+ * GOSSIP_INTERVAL is how often we send heartbeats.  Shorter finds crashes sooner and
+ * converges faster for a few more tiny datagrams.
+ *
+ * GOSSIP_SUSPECT_TIMEOUT/GOSSIP_DEAD_TIMEOUT: Heartbeat silence before a member is
+ * suspected, and further silence before it is declared dead and dropped.
+ *
+ * GOSSIP_FULL_INTERVAL caps how often we answer one member with our full view.
+ *
+ * GOSSIP_TOMBSTONE is how long DEAD/LEFT entries are remembered.
+ */
+extern std::chrono::milliseconds GOSSIP_INTERVAL;
+extern std::chrono::milliseconds GOSSIP_SUSPECT_TIMEOUT;
+extern std::chrono::milliseconds GOSSIP_DEAD_TIMEOUT;
+extern std::chrono::milliseconds GOSSIP_FULL_INTERVAL;
+extern std::chrono::milliseconds GOSSIP_TOMBSTONE;
+
+
+/* GossipState: Entry states, in order of precedence at equal incarnation
+ */
+enum GossipState
+{
+	GOSSIP_ALIVE,
+	GOSSIP_SUSPECT,
+	GOSSIP_DEAD,
+	GOSSIP_LEFT
+};
+
+/* GossipFlags: Header flags
+ *
+ *   GOSSIP_FULL     Datagram carries the sender's whole view
+ *   GOSSIP_LEAVING  Sender is leaving the call
+ *   GOSSIP_WIDE     Addresses are 128 bits
+ *   GOSSIP_WIDE_OK  Narrow, but the sender reads wide ones
+ */
+enum GossipFlags
+{
+	GOSSIP_FULL = 0x01,
+	GOSSIP_LEAVING = 0x02,
+	GOSSIP_WIDE = 0x04,
+	GOSSIP_WIDE_OK = 0x08
+};
+
+/* GossipReceived: What receive() wants done with a datagram
+ *
+ *   GOSSIP_IGNORED     Not from a member (or malformed), nothing changed
+ *   GOSSIP_MERGED      Merged into the view
+ *   GOSSIP_REPLY_FULL  Merged, and the sender should get our full view back
+ */
+enum GossipReceived
+{
+	GOSSIP_IGNORED,
+	GOSSIP_MERGED,
+	GOSSIP_REPLY_FULL
+};
+
+
+/* GossipEvent: A member joined or went away (left or died) according to the view
+ */
+struct GossipEvent
+{
+	bool joined;
+	PeerAddr addr;
+};
+
+
+// GossipView Class ----------------------------------------------------------------------
+/* GossipView: One member's view of the call
+ *
+(IMPLEMENTATION DETAILS)
+Members:
+ * members  Everyone we know of but ourselves, hashed by address
+ *
+ * incarnation/heartbeat  Ours
+ *
+ * self/self_known  Our address as the others see it, once someone told us
+ *
+ * rng  Picks heartbeat targets
+ *
+ * stamp  Bumped per write(), keeps an entry from going into one datagram twice
+ *
+ * cursor  Where the next round of fresh heartbeats starts
+ *
+ * Each entry also remembers when its heartbeat last moved (last_heard), when its
+ * state last changed, how many more datagrams should piggyback it (transmits),
+ * whether it ever sent a heartbeat at all (gossips) and whether it reads wide
+ * datagrams (wide).  Entries left behind by a member that moved (moved) are local
+ * tombstones, they are never sent and never merged.
+ *
+ *
+(CLIENT INTERFACE)
+Not thread safe, PeersChatNetwork locks around it.
+ *
+Public Methods:
+ * reset(1)  Forget everyone and start over with @incarnation (which must be higher
+ *           than the last one we used in this call, the time is a good choice)
+ *
+ * add(2)  We let @addr in (join, CONNECT, SENDP).  Spread as a join.
+ *
+ * remove(2)  @addr left without gossiping (DISCONNECT).  Spread as a leave.
+ *
+ * rebind(3)  The member at @from is at @to now.  Its entry moves, @from keeps a local
+ *            tombstone.
+ *
+ * gossips(1)  Did @addr ever send us a heartbeat?
+ *
+ * live(2)  Fill @gossiping with every live member that gossips, and @legacy (if not
+ *          NULL) with the live ones that never did
+ *
+ * receive(5)  Merge a GOSSIP datagram from @from
+ *            @param events (std::vector<GossipEvent>&) joins/leaves it caused
+ *            @return (GossipReceived)
+ *
+ * tick(3)  One round: bump our heartbeat, suspect/kill quiet members and pick who to
+ *          send a heartbeat to
+ *         @param targets (std::vector<PeerAddr>&) filled with the members to write()
+ *                        to this round
+ *         @param events (std::vector<GossipEvent>&) deaths it declared
+ *
+ * write(4)  Build a datagram for @to in @buffer (GOSSIP_FULL/GOSSIP_LEAVING in @flags),
+ *           wide if @to reads them
+ *          @return (size_t) bytes written
+ *
+ * digest()  Order independent hash of every live member's address, incarnation and
+ *           state, ours included
+ *          @return (uint32_t) 0 until we know our own address
+ *
+ */
+class GossipView
+{
+	// Types
+private:
+	typedef std::chrono::steady_clock::time_point time_point;
+	struct Member
+	{
+		PeerAddr addr;
+		uint32_t incarnation = 0;
+		uint32_t heartbeat = 0;
+		uint8_t state = GOSSIP_ALIVE;
+		bool gossips = false;
+		bool moved = false;
+		bool wide = false;
+		int transmits = 0;
+		uint32_t stamp = 0;
+		time_point last_heard;
+		time_point changed;
+		time_point last_full;
+	};
+
+	// Members
+private:
+	std::unordered_map<PeerAddr, Member, PeerAddrHash> members;
+	uint32_t incarnation = 0;
+	uint32_t heartbeat = 0;
+	PeerAddr self;
+	bool self_known = false;
+	std::minstd_rand rng;
+	uint32_t stamp = 0;
+	size_t cursor = 0;
+
+public:
+	GossipView() noexcept;
+
+	void reset(uint32_t incarnation) noexcept;
+	void add(const PeerAddr &addr, time_point now) noexcept;
+	void remove(const PeerAddr &addr, time_point now) noexcept;
+	void rebind(const PeerAddr &from, const PeerAddr &to, time_point now) noexcept;
+	bool gossips(const PeerAddr &addr) noexcept;
+	void live(std::vector<PeerAddr> &gossiping, std::vector<PeerAddr> *legacy) noexcept;
+
+	GossipReceived receive(const PeerAddr &from, const uint8_t *buffer, size_t len,
+	                       time_point now, std::vector<GossipEvent> &events) noexcept;
+	void tick(time_point now, std::vector<PeerAddr> &targets, std::vector<GossipEvent> &events) noexcept;
+	size_t write(const PeerAddr &to, uint8_t *buffer, size_t size, uint8_t flags) noexcept;
+	uint32_t digest() noexcept;
+
+private:
+	static uint64_t key(const PeerAddr &addr) noexcept;
+	static inline bool alive(uint8_t state) noexcept { return state <= GOSSIP_SUSPECT; }
+	int retransmits() noexcept;
+	void changed(Member &member, time_point now) noexcept;
+	void merge(Member &member, uint32_t incarnation, uint32_t heartbeat, uint8_t state,
+	           time_point now, std::vector<GossipEvent> &events) noexcept;
+	void refute(uint32_t incarnation, uint8_t state) noexcept;
+	void leaveBehind(const PeerAddr &addr, uint32_t incarnation, time_point now) noexcept;
+	uint8_t* writeEntry(uint8_t *out, Member &member, bool wide) noexcept;
+};
+
+
+#endif
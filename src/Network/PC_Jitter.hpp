@@ -0,0 +1,146 @@
+#ifndef _PC_JITTER_HPP
+#define _PC_JITTER_HPP
+
+
+/*
+ *  PeersChat Jitter Buffer Header: Puts a peer's audio packets back in order
+ *
+ * Packets from a peer can arrive late, out of order or not at all.  The jitter buffer
+ * holds every packet for a fixed delay so stragglers get a chance to slot in before
+ * their turn, then hands them out lowest id first.
+ *
+ * The clock is always passed in instead of read, so the same code that runs in NPeer
+ * on steady_clock::now() can be driven by a trace's arrival times (PeersChatReplay)
+ * and give the exact same result every run.
+ *
+ * Templated on the packet type so it doesn't drag PC_Network.hpp (and GTK) into tools.
+ * Packet needs a uint32_t packet_id.
+ *
+ */
+
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <algorithm>
+
+
+// JitterBuffer Class --------------------------------------------------------------------
+/* JitterBuffer: Reorders packets by id and holds them for a delay -- Not thread safe
+ *
+(IMPLEMENTATION DETAILS)
+Members:
+ * heap  Min-heap on packet_id of the held packets and when each arrived
+ *
+ * max_size  Held packets above which every pop() throws the oldest one away, so a
+ *           peer that sends faster than we play can't grow our latency forever
+ *
+ * last_id  Id of the last packet handed out.  Anything older that shows up is late
+ *          and gets dropped.
+ *
+ * dropped  Packets thrown away (too many held, or late)
+ *
+ *
+(CLIENT INTERFACE)
+The buffer owns every packet it holds.  Dropped packets are deleted.
+ *
+Public Methods:
+ * JitterBuffer(1)  @param max_size (size_t) see above
+ *
+ * push(2)  Hold a packet
+ *         @param packet (Packet*) takes ownership
+ *         @param now (time_point) when it arrived
+ *
+ * pop(3)  Next packet in order if it has been held for @delay
+ *        @param now (time_point) current time
+ *        @param delay (duration) how long packets are held
+ *        @param held (duration*) if not NULL, set to how long the packet was held
+ *        @return (Packet*) caller owns it, NULL if nothing is ready
+ *
+ * size()  Packets held
+ *
+ * getLastId()  Id of the last packet popped, 0 before the first
+ *
+ * getDropped()  Packets dropped so far
+ *
+ */
+template <typename Packet, typename Clock = std::chrono::steady_clock>
+class JitterBuffer
+{
+	// Members
+private:
+	struct Entry
+	{
+		Packet *packet;
+		typename Clock::time_point received;
+	};
+	std::vector<Entry> heap;
+	size_t max_size;
+	uint32_t last_id = 0;
+	uint32_t dropped = 0;
+
+	static inline bool later(const Entry &left, const Entry &right) { return left.packet->packet_id > right.packet->packet_id; }
+
+public:
+	explicit JitterBuffer(size_t max_size) noexcept : max_size(max_size) { }
+	~JitterBuffer() noexcept
+	{
+		for(Entry &entry : this->heap)
+			delete entry.packet;
+	}
+	JitterBuffer(const JitterBuffer&) = delete;
+	JitterBuffer& operator=(const JitterBuffer&) = delete;
+
+	void push(Packet *packet, typename Clock::time_point now)
+	{
+		this->heap.push_back({packet, now});
+		std::push_heap(this->heap.begin(), this->heap.end(), later);
+	}
+
+	Packet* pop(typename Clock::time_point now, typename Clock::duration delay,
+	            typename Clock::duration *held = NULL) noexcept
+	{
+		while(!this->heap.empty())
+		{
+			// Too many held -- Skip one
+			if(this->heap.size() > this->max_size)
+			{
+				std::pop_heap(this->heap.begin(), this->heap.end(), later);
+				delete this->heap.back().packet;
+				this->heap.pop_back();
+				this->dropped++;
+				if(this->heap.empty()) break;
+			}
+
+			// Packets must idle for a certain amount of time to allow UDP to catch up
+			Entry &top = this->heap.front();
+			if((now - top.received) <= delay)
+				return NULL;
+
+			if(held) *held = now - top.received;
+			std::pop_heap(this->heap.begin(), this->heap.end(), later);
+			Packet *packet = this->heap.back().packet;
+			this->heap.pop_back();
+
+			// Late -- Its turn already passed
+			if(packet->packet_id < this->last_id)
+			{
+				delete packet;
+				this->dropped++;
+				continue;
+			}
+			this->last_id = packet->packet_id;
+			return packet;
+		}
+		return NULL;
+	}
+
+	inline size_t size() const noexcept { return this->heap.size(); }
+	inline uint32_t getLastId() const noexcept { return this->last_id; }
+	inline uint32_t getDropped() const noexcept { return this->dropped; }
+};
+
+
+#endif
@@ -0,0 +1,48 @@
+#include "PC_NAT.hpp"
+
+#include <cstring>
+
+using namespace std::chrono_literals;
+
+
+// Globals -------------------------------------------------------------------------------
+std::chrono::milliseconds PUNCH_INTERVAL = 20ms;
+std::chrono::milliseconds PUNCH_DURATION = 2s;
+
+
+// Datagrams -----------------------------------------------------------------------------
+size_t nat_write_bind(uint8_t *buffer, uint32_t transaction) noexcept
+{
+	buffer[0] = BIND;
+	buffer[1] = (uint8_t) (transaction >> 24);
+	buffer[2] = (uint8_t) (transaction >> 16);
+	buffer[3] = (uint8_t) (transaction >> 8);
+	buffer[4] = (uint8_t) transaction;
+	return BIND_SIZE;
+}
+
+
+size_t nat_write_bound(uint8_t *buffer, const uint8_t *request, size_t len, const PeerAddr &from) noexcept
+{
+	if(len < BIND_SIZE || request[0] != BIND) return 0;
+	buffer[0] = BOUND;
+	std::memcpy(buffer + 1, request + 1, 4);
+
+	// Older peers only ever BIND over IPv4 and expect the short form
+	if(from.writeV4(buffer + 5)) return BOUND_SIZE;
+	from.write(buffer + 5);
+	return BOUND6_SIZE;
+}
+
+
+bool nat_read_bound(const uint8_t *buffer, size_t len, uint32_t transaction, PeerAddr &addr) noexcept
+{
+	if(len < BOUND_SIZE || buffer[0] != BOUND) return false;
+	uint32_t got = ((uint32_t) buffer[1] << 24) | ((uint32_t) buffer[2] << 16) |
+	               ((uint32_t) buffer[3] << 8)  |  (uint32_t) buffer[4];
+	if(got != transaction) return false;
+
+	if(len >= BOUND6_SIZE) addr.read(buffer + 5);
+	else addr.readV4(buffer + 5);
+	return true;
+}
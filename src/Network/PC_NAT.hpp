@@ -0,0 +1,83 @@
+#ifndef _PC_NAT_HPP
+#define _PC_NAT_HPP
+
+
+/*
+ *  PeersChat NAT Header: Finding our address outside the NAT and punching through it
+ *
+ * Peers reach each other at the address they gave when joining.  Behind a NAT that is a
+ * private address nobody outside can reach, and the port the NAT maps our audio socket
+ * to is usually not PORT either.
+ *
+ * Reflexive address (STUN style): Before asking to CONNECT, the joiner sends BIND from
+ * its audio socket to a rendezvous server (PEERSCHAT_RENDEZVOUS, see PeersChatRendezvous)
+ * or, without one, to the peer it is joining; every running peer answers BIND too.  The
+ * BOUND reply holds the address the datagram came from, which is where the NAT maps our
+ * audio socket.  The joiner then claims that port in CONNECT/REQN/DISCONNECT instead of
+ * PORT, so the call knows it by its outside address (the TCP source address supplies the
+ * IP as always) and hands that out in SENDP.
+ *
+ * Hole punching: Each side's NAT drops what the other sends until it sent something to
+ * the other first.  Whenever a peer is added, both sides learn of each other at about
+ * the same time (SENDP on one side, gossip or PROPOSE on the other) and start sending
+ * PUNCH datagrams every PUNCH_INTERVAL.  The first one out opens our NAT, the first one
+ * in shows theirs is open too; we stop once we heard anything from the peer, or after
+ * PUNCH_DURATION.  DTX keepalives and gossip keep the mappings open afterwards.
+ *
+ * Format, integers big endian, addresses as in PC_Addr.hpp:
+ *
+ *   [BIND] [transaction:32]
+ *   [BOUND] [transaction:32] [ip:32] [port:16]     BIND came over IPv4
+ *   [BOUND] [transaction:32] [ip:128] [port:16]    BIND came over IPv6
+ *   [PUNCH]
+ *
+ * Limits: NATs that map every destination to another port (symmetric NATs) can't be
+ * punched and there is no relay.  Peers behind the same NAT need it to hairpin.  TCP
+ * requests between two NATed peers (names, PROPOSE) still fail, so those peers keep
+ * their default names; audio and membership get through.
+ *
+ */
+
+
+#include <cstdint>
+#include <cstddef>
+#include <chrono>
+#include "nettypes.hpp"
+#include "PC_Addr.hpp"
+
+
+// Pre-Compiler Constants
+#define BIND_SIZE 5
+#define BOUND_SIZE 11
+#define BOUND6_SIZE 23
+#define RENDEZVOUS_PORT 3478
+#define BIND_ATTEMPTS 3
+
+
+// Globals
+/*
+ * PUNCH_INTERVAL/PUNCH_DURATION: How often we send PUNCH to a new peer, and for how long
+ * at most if we never hear back.
+ */
+extern std::chrono::milliseconds PUNCH_INTERVAL;
+extern std::chrono::milliseconds PUNCH_DURATION;
+
+
+/* nat_write_bind: Write a BIND with @transaction into @buffer (BIND_SIZE bytes)
+ *                @return (size_t) bytes written
+ */
+size_t nat_write_bind(uint8_t *buffer, uint32_t transaction) noexcept;
+
+/* nat_write_bound: Answer the BIND in @request, that came from @from, into @buffer
+ *                  (BOUND6_SIZE bytes)
+ *                 @return (size_t) bytes written, 0 if @request isn't a BIND
+ */
+size_t nat_write_bound(uint8_t *buffer, const uint8_t *request, size_t len, const PeerAddr &from) noexcept;
+
+/* nat_read_bound: Is @buffer the answer to our BIND with @transaction?  Fills @addr.
+ *                @return (bool)
+ */
+bool nat_read_bound(const uint8_t *buffer, size_t len, uint32_t transaction, PeerAddr &addr) noexcept;
+
+
+#endif
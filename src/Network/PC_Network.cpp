@@ -9,6 +9,16 @@ using namespace std::chrono_literals;
 
 // Pre-Compiler Constants ----------------------------------------------------------------
 #define IN_PACKET_BUFFER_TOO_LARGE 10
+#define DRIFT_TARGET_SLACK 10000.0f
+#define DRIFT_JITTER_MARGIN 4.0f
+#define DRIFT_GAIN 0.01f
+#define BUNDLE_MAX_LOSS 0.02f
+#define BUNDLE_MAX_BYTES 1200
+#define LOSS_WINDOW 256
+#define GOSSIP_LEAVE_REPEAT 3
+#define GOSSIP_NAME_ATTEMPTS 4
+#define PEER_RETIRE_GRACE 1s
+#define REBIND_POLL 10ms
 
 
 // Globals -------------------------------------------------------------------------------
@@ -16,8 +26,10 @@ std::chrono::milliseconds PACKET_DELAY = 50ms;
 std::chrono::milliseconds PEERS_CHAT_DESTRUCT_TIMEOUT = 2s;
 std::chrono::milliseconds SOCKET_TIMEOUT = 5s;
 std::chrono::milliseconds PEER_TIMEOUT = 15s;
+std::chrono::milliseconds KEEPALIVE_INTERVAL = 400ms;
+std::chrono::milliseconds BUNDLE_RTT = 80ms;
+std::chrono::milliseconds BUNDLE_MAX_HOLD = 100ms;
 uint16_t PORT = 8080;
-extern PC_GuiHandler *GUI;
 
 
 // Exceptions ----------------------------------------------------------------------------
@@ -34,7 +46,7 @@ struct IPStrNotNullTerm : std::exception {
 	const char* what() const noexcept { return "PC_Network.cpp ERROR: IP Address String is not Null Terminated.\n"; }
 };
 struct InvalidIPAddr : std::exception {
-	const char* what() const noexcept { return "PC_Network.cpp ERROR: IP Address String is not a valid IPv4 Address.\n"; }
+	const char* what() const noexcept { return "PC_Network.cpp ERROR: IP Address String is not a valid IPv4/IPv6 Address.\n"; }
 };
 struct InvalidRecvAmount : std::exception {
 	const char* what() const noexcept { return "PC_Network.cpp ERROR: Invalid Read Amount.\n"; }
@@ -49,6 +61,90 @@ struct TCPServerCreateFail : std::exception {
 
 
 
+// Audio Headers -------------------------------------------------------------------------
+// Legacy header: [SENDV] [id:32] [length:32]
+static size_t write_sendv_header(uint8_t *buffer, const AudioPacket *packet) noexcept
+{
+	buffer[0] = SENDV;
+	buffer[1] = (uint8_t) ((packet->packet_id  >> 24) & 0xFF);
+	buffer[2] = (uint8_t) ((packet->packet_id  >> 16) & 0xFF);
+	buffer[3] = (uint8_t) ((packet->packet_id  >>  8) & 0xFF);
+	buffer[4] = (uint8_t) ( packet->packet_id         & 0xFF);
+	buffer[5] = (uint8_t) ((packet->packet_len >> 24) & 0xFF);
+	buffer[6] = (uint8_t) ((packet->packet_len >> 16) & 0xFF);
+	buffer[7] = (uint8_t) ((packet->packet_len >>  8) & 0xFF);
+	buffer[8] = (uint8_t) ( packet->packet_len        & 0xFF);
+	return SENDV_HEADER_SIZE;
+}
+
+
+// Compact header: [SENDA] [version:2 | flags:6] [sequence:16] [timestamp:16] [stream id:8]
+static size_t write_senda_header(uint8_t *buffer, const AudioPacket *packet, uint8_t sid) noexcept
+{
+	uint16_t ticks = (uint16_t) (packet->timestamp / AUDIO_TS_UNIT);
+	buffer[0] = SENDA;
+	buffer[1] = (uint8_t) ((AUDIO_WIRE_VERSION << 6) | (packet->flags & 0x3F));
+	buffer[2] = (uint8_t) ((packet->packet_id >> 8) & 0xFF);
+	buffer[3] = (uint8_t) ( packet->packet_id       & 0xFF);
+	buffer[4] = (uint8_t) ((ticks >> 8) & 0xFF);
+	buffer[5] = (uint8_t) ( ticks       & 0xFF);
+	buffer[6] = sid;
+	return SENDA_HEADER_SIZE;
+}
+
+
+// Bundle: SENDA header + [count] [ticks per frame] [self-delimited lengths...] [frames...]
+static size_t write_bundle(uint8_t *buffer, AudioOutPacket **packets, int count, uint8_t sid) noexcept
+{
+	// Header carries the first frame's sequence/timestamp and everyone's flags
+	AudioPacket head;
+	head.packet_id = packets[0]->packet_id;
+	head.timestamp = packets[0]->timestamp;
+	head.flags = AUDIO_BUNDLE;
+	for(int i = 0; i < count; ++i)
+		head.flags |= packets[i]->flags;
+	size_t pos = write_senda_header(buffer, &head, sid);
+
+	buffer[pos++] = (uint8_t) count;
+	buffer[pos++] = (uint8_t) ((packets[1]->timestamp - packets[0]->timestamp) / AUDIO_TS_UNIT);
+
+	// Lengths of all but the last frame
+	for(int i = 0; i < count - 1; ++i)
+	{
+		uint16_t len = packets[i]->packet_len;
+		if(len < 252)
+			buffer[pos++] = (uint8_t) len;
+		else
+		{
+			buffer[pos] = (uint8_t) (252 + (len & 0x3));
+			buffer[pos + 1] = (uint8_t) ((len - buffer[pos]) >> 2);
+			pos += 2;
+		}
+	}
+
+	// Frames
+	for(int i = 0; i < count; ++i)
+	{
+		std::memcpy(buffer + pos, packets[i]->packet.get(), packets[i]->packet_len);
+		pos += packets[i]->packet_len;
+	}
+	return pos;
+}
+
+
+// Can @next go in a bundle after @packets?  The receiver spaces its frames evenly, by
+// the gap between the first two.
+static bool bundle_follows(AudioOutPacket **packets, int count, const AudioOutPacket *next) noexcept
+{
+	uint32_t step = next->timestamp - packets[count - 1]->timestamp;
+	if(count > 1)
+		return step == packets[1]->timestamp - packets[0]->timestamp;
+	return step > 0 && step % AUDIO_TS_UNIT == 0 && step / AUDIO_TS_UNIT <= 0xFF;
+}
+
+
+
+
 // NPeer ---------------------------------------------------------------------------------
 /* Member Implementation Documentation
  *  @member udp  Shared UDP socket used to send data out to all peers.  Setting
@@ -60,12 +156,16 @@ struct TCPServerCreateFail : std::exception {
  *              everything except for audio.
  *
  * @member destination  Destination address for this peer's UDP socket. Audio
- *                      data sent over @udp will be sent to this address.
+ *                      data sent over @udp will be sent to this address.  IPv4 or
+ *                      IPv6, kept IPv4 mapped (PC_Addr.hpp).
  *
- * @member in_packets  Priority queue of type @AudioInPacket ordered by
- *                     @packet_id such that popping off an element will get you
- *                     the lowest numbered packet.  This is used to get packets
- *                     in order even if they arrived out of order.
+ * @member udp_family  AF_INET6 when @udp is dual-stack, AF_INET when the host has
+ *                     IPv6 off.  Decides how @destination is handed to sendto().
+ *
+ * @member in_packets  JitterBuffer of @AudioInPacket ordered by @packet_id such
+ *                     that popping off an element will get you the lowest
+ *                     numbered packet once it has waited PACKET_DELAY.  This is
+ *                     used to get packets in order even if they arrived out of order.
  *
  * @member in_queue_lock  Mutex lock to ensure mutual exclusion with @in_packets
  *
@@ -94,14 +194,36 @@ struct TCPServerCreateFail : std::exception {
  * @member out_packet_id  Next id that will be assigned to @packet_id in
  *                        @AudioPacket.  Handles sequentially numbering packets.
  *
- * @member run_thread  (bool) True if you want the audio out net stream thread to run
+ * @member tx_wire  Audio header version to use when sending to this peer (high byte)
+ *                 and the stream id stamped onto SENDA packets to them (low byte).  The
+ *                 version stays 0 (legacy SENDV) until the peer's SENDN says otherwise,
+ *                 the peer picks the stream id.  Written by the control and TCP threads,
+ *                 read by the send tasks, so both go in one atomic and a frame never
+ *                 pairs a new version with an old stream id.
+ *
+ * @member rx_sid  Stream id this peer stamps onto SENDA packets to us.  We pick it when
+ *                 the peer is added and hand it out in our SENDN reply.
+ *
+ * @member in_highest_id/in_highest_ts  Highest extended sequence/timestamp received.
+ *                                      Used to extend the 16 bit SENDA fields.
+ *
+ * @member run_thread  (bool) True if you want audio sent out to this peer
  *
  * @member out_packet_count  The number of outgoing packet's queue'd for delivery
  *
- * @member audio_out_thread  std::thread for the audio_out_thread that handles sending
- *                           audio packets
+ * @member workers  (static) Worker pool the send tasks run on.  Owned by
+ *                  PeersChatNetwork.  Send tasks are tagged with the NPeer they serve.
+ *
+ * @member flush_scheduled  True while a @flush_out task is queued or running.  Keeps
+ *                          @enqueue_out from queuing one task per packet.
+ *
+ * @method (static) create_udp_socket  Creates/initializes a udp socket, dual-stack if
+ *                                     the host has IPv6
  *
- * @method (static) create_udp_socket  Creates/initializes a udp socket
+ * @method (static) send_udp  sendto() a PeerAddr on @udp.  -1 for IPv6 peers when
+ *                            @udp is IPv4 only.
+ *
+ * @method (static) recv_udp  recvfrom() on @udp into a PeerAddr
  *
  * @method getAudioOutPacket  Get AudioOutPacket that is populated with audio packet data.
  *                            The data should be provided by the client audio processor
@@ -112,27 +234,73 @@ struct TCPServerCreateFail : std::exception {
  *                               it can be recylced later.
  *                              @param packet  A pointer to the AudioOutPacket
  *
- * @method send_audio_over_network_thread  Function designed to run on its own thread
- *                                         to handle the sending of audio.
+ * @method bundleFrames  How many frames to pack into the next datagram.  One unless
+ *                       bundling is on, the peer speaks SENDA (@wire_version, as
+ *                       loaded from @tx_wire), the RTT is above BUNDLE_RTT and loss
+ *                       is below BUNDLE_MAX_LOSS.
+ *
+ * @method scheduleFlush  Queue a @flush_out task unless one is already pending, or
+ *                        there is nothing queued and no bundle waiting.  Every frame
+ *                        the audio thread hands over calls it, the held back DTX ones
+ *                        too, so a waiting bundle is sent within a frame of its
+ *                        BUNDLE_MAX_HOLD.
+ *
+ * @method flush_out  Worker task.  Calls @send_pending until @out_packets is drained.
+ *
+ * @method send_pending  Send one datagram worth of packets (a single packet or a
+ *                       bundle).  A DTX frame closes the bundle: nothing follows it
+ *                       for a while.  @return (bool) true if something was sent.
+ *
+ * @method extendSequence  Extend a 16 bit SENDA sequence/timestamp pair to 32 bits
+ *                         @return Extended packet id, @timestamp set to samples
+ *
+ * @method (static) connect_tcp  Open a TCP connection to @dest with SOCKET_TIMEOUT on it
+ *                              and time the handshake into @rtt_sample (us)
+ *                             @return (int) socket, -1 on failure
  *
  * @method createTCP  Create a TCP connection to this specific NPeer
  *                   @return (bool) True if the operation was successful
  *
- * @method getDest()  Returns sockaddr_in struct that represents NPeer address
+ * @method sampleRTT  Fold a handshake time (us) into @rtt_us
+ *
+ * @method getDest()  Returns the PeerAddr that represents NPeer address
+ *
+ * @method rebind  Point @destination at the address the peer moved to.  Receive loop.
+ *
+ * @method setToken  Keep the session token from the peer's SENDN
+ *
+ * @method hasToken  Did the peer give us a token?
+ *
+ * @method checkToken  Does @mac answer @nonce with the peer's token?
+ *
+ * @method ourToken  Our token for this peer, made on first use
+ *
+ * @method ourKey  Our public key for this peer, made on first use.  False if we aren't
+ *                 encrypting.
+ *
+ * @method setTheirKey  Keep the public key from the peer's KEY
+ *
+ * @method confirmKey  The peer answered our KEY, start sealing.  Not before we know the
+ *                     peer speaks SENDA, the only kind of datagram that can be sealed.
  *
  */
 // Static Initialization
 int NPeer::udp = -1;
+int NPeer::udp_family = AF_INET;
 int NPeer::id_counter = 1;
+std::atomic<bool> NPeer::bundling = {false};
+std::atomic<bool> NPeer::encrypting = {true};
+WorkerPool *NPeer::workers = NULL;
+std::atomic<PacketTap*> NPeer::tap = {NULL};
+std::atomic<RosterListener*> NPeer::roster = {NULL};
 
 
 // Constructor
-NPeer::NPeer() noexcept : in_packets(AudioInPacket_greater)
+NPeer::NPeer() noexcept : in_packets(IN_PACKET_BUFFER_TOO_LARGE)
 {
 	this->pname[0] = 0;
 	this->ID = NPeer::id_counter++;
-	std::memset((void*)&(this->destination), 0, sizeof(sockaddr_in));
-	destination.sin_family = AF_INET;
+	this->heard(steady_clock::now());
 	if(udp < 0)
 		if(!create_udp_socket())
 			exit(24);
@@ -143,17 +311,15 @@ NPeer::NPeer(const char *ip, const uint16_t &port) : NPeer()
 {
 	if(!ip) throw NullPtr();
 	for(int i = 0; ip[i] != 0; ++i)
-		if(i == INET_ADDRSTRLEN) throw IPStrNotNullTerm();
+		if(i == INET6_ADDRSTRLEN) throw IPStrNotNullTerm();
 
-	if(inet_pton(AF_INET, ip, &(this->destination.sin_addr)) != 1) throw InvalidIPAddr();
-	this->destination.sin_port = htons(port);
+	if(!PeerAddr::parse(ip, port, this->destination)) throw InvalidIPAddr();
 }
 
 
-NPeer::NPeer(const sockaddr_in &addr) noexcept : NPeer()
+NPeer::NPeer(const PeerAddr &addr) noexcept : NPeer()
 {
-	this->destination.sin_port = addr.sin_port;
-	this->destination.sin_addr = addr.sin_addr;
+	this->destination = addr;
 }
 
 
@@ -187,7 +353,8 @@ bool NPeer::setName(std::string name) noexcept
 	}
 
 	std::strncpy(this->pname, name.c_str(), MAX_NAME_LEN);
-	GUI->refresh_name_list();
+	RosterListener *listener = NPeer::roster.load();
+	if(listener) listener->onPeerRenamed(this);
 	return true;
 }
 
@@ -216,22 +383,39 @@ void NPeer::enqueue_out(AudioOutPacket *packet)
 	if(!packet) throw NullPtr();
 	else if(packet->packet_len == 0) throw EmptyPack();
 
+	// Silence: The first DTX frame tells the peer we went quiet, after that one every
+	// KEEPALIVE_INTERVAL is enough to show we're still here.  Frames we hold back don't
+	// use up a sequence number, so they don't look like loss.
+	steady_clock::time_point now = steady_clock::now();
+	bool dtx = (packet->flags & AUDIO_DTX);
+	if(dtx && this->out_dtx && (now - this->out_sent_at) < KEEPALIVE_INTERVAL)
+	{
+		retireEmptyOutPacket(packet);
+		scheduleFlush();
+		return;
+	}
+	this->out_dtx = dtx;
+	this->out_sent_at = now;
+
 	packet->packet_id = out_packet_id++;
 
+	PacketTap *t = tap.load();
+	if(t) t->onPacket(this, false, *packet);
+
 	out_queue_lock.lock();
 	out_packets.emplace(packet);
 	out_queue_lock.unlock();
 
 	out_packet_count++;
 	packet = NULL;
+	scheduleFlush();
 }
 
 
 void NPeer::startNetStream() noexcept
 {
-	if(run_thread) return;
-	run_thread = true;
-	audio_out_thread.reset(new std::thread(&NPeer::send_audio_over_network_thread, this));
+	if(run_thread.exchange(true)) return;
+	scheduleFlush();
 }
 
 
@@ -239,8 +423,13 @@ void NPeer::startNetStream() noexcept
 void NPeer::stopNetStream() noexcept
 {
 	run_thread = false;
-	if(audio_out_thread.get() && audio_out_thread->joinable())
-		audio_out_thread->join();
+	if(workers) workers->cancel(this);
+	flush_scheduled = false;
+
+	// Recycle whatever didn't make it out
+	int count = out_pending_count.exchange(0);
+	for(int i = 0; i < count; ++i)
+		retireEmptyOutPacket(out_pending[i]);
 }
 
 
@@ -276,10 +465,11 @@ void NPeer::enqueue_in(AudioInPacket *packet)
 	if(!packet) throw NullPtr();
 	else if(packet->packet_len == 0) throw EmptyPack();
 
-	packet->received = steady_clock::now();
+	PacketTap *t = tap.load();
+	if(t) t->onPacket(this, true, *packet);
 
 	in_queue_lock.lock();
-	in_packets.emplace(packet);
+	in_packets.push(packet, steady_clock::now());
 	in_queue_lock.unlock();
 }
 
@@ -287,40 +477,154 @@ void NPeer::enqueue_in(AudioInPacket *packet)
 AudioInPacket* NPeer::getAudioInPacket() noexcept
 {
 	std::unique_ptr<AudioInPacket> packet;
+	steady_clock::duration held;
 	in_queue_lock.lock();
-
-	// Loop until NULL or valid packet
-	do
+	packet.reset(in_packets.pop(steady_clock::now(), PACKET_DELAY, &held));
+	in_queue_lock.unlock();
+	if(packet.get())
 	{
-		packet.reset();
-		if(!in_packets.empty())
-		{
-			// Get a Packet -- If too many packets skip every other
-			if(in_packets.size() > IN_PACKET_BUFFER_TOO_LARGE)
-				in_packets.pop();
-			packet.reset(in_packets.top().get());
+		// Track Slack -- Smoothed over ~16 packets, network jitter comes and goes
+		float slack = (float) duration_cast<microseconds>(held - PACKET_DELAY).count();
+		if(in_slack < 0.0f)
+			in_slack = slack;
+		else
+			in_slack += (slack - in_slack) / 16.0f;
 
-			// Packets must idle for a certain amount of time to allow UDP to catch up
-			if((steady_clock::now() - packet->received) > PACKET_DELAY)
-			{
-				const_cast<std::unique_ptr<AudioInPacket>&>(in_packets.top()).release();
-				in_packets.pop();
-			}
-			else
-				packet.release();
+		// Track Loss -- Halve the counters every so often so old history fades
+		if(in_packet_id != 0)
+			in_lost += std::min<uint32_t>(packet->packet_id - in_packet_id - 1, LOSS_WINDOW);
+		if(++in_received > LOSS_WINDOW)
+		{
+			in_received = in_received / 2;
+			in_lost = in_lost / 2;
 		}
-	} while (packet.get() && (packet->packet_id < in_packet_id));
-
-	in_queue_lock.unlock();
-	if(packet.get()) in_packet_id = packet->packet_id;
+		in_packet_id = packet->packet_id;
+	}
 	return packet.release();
 }
 
 
-bool NPeer::operator==(const sockaddr_in &addr) noexcept
+double NPeer::getPlayoutRate() noexcept
 {
-	return (destination.sin_port        == addr.sin_port) &&
-	       (destination.sin_addr.s_addr == addr.sin_addr.s_addr);
+	// A packet gets ready anywhere within a frame before we pull it, so half a frame
+	// (DRIFT_TARGET_SLACK) past PACKET_DELAY is on time, plus some room for the ones
+	// that come in late.  Longer means they pile up and we should play faster, shorter
+	// that we are about to run dry.
+	float ppm = this->drift_ppm.load();
+	if(this->in_slack >= 0.0f)
+	{
+		float target = DRIFT_TARGET_SLACK + DRIFT_JITTER_MARGIN * this->jitter_us.load();
+		ppm -= DRIFT_GAIN * (this->in_slack - target);
+	}
+	ppm = std::max<float>(-DRIFT_MAX_PPM, std::min<float>(DRIFT_MAX_PPM, ppm));
+	return 1.0 + ppm * 1e-6;
+}
+
+
+float NPeer::getLoss() noexcept
+{
+	uint32_t lost = in_lost.load();
+	uint32_t total = lost + in_received.load();
+	return (total == 0) ? 0.0f : (float) lost / total;
+}
+
+
+void NPeer::updateJitter(uint32_t timestamp, steady_clock::time_point arrival) noexcept
+{
+	// Transit time up to a constant (the clocks aren't synced), only its change matters
+	int64_t media = (int64_t) timestamp * 1000000 / AUDIO_TS_RATE;
+	int64_t arrival_us = duration_cast<microseconds>(arrival.time_since_epoch()).count();
+	int64_t transit = arrival_us - media;
+	this->drift.add(media, arrival_us);
+	this->drift_ppm = (float) this->drift.ppm();
+	if(this->in_jitter < 0)
+	{
+		this->in_jitter = 0;
+		this->in_transit = transit;
+		return;
+	}
+
+	// J += (|D| - J) / 16, kept scaled by 16 so it stays in integers
+	int64_t d = transit - this->in_transit;
+	this->in_transit = transit;
+	if(d < 0) d = -d;
+	this->in_jitter += d - ((this->in_jitter + 8) >> 4);
+	this->jitter_us = (uint32_t) (this->in_jitter >> 4);
+}
+
+
+bool NPeer::operator==(const PeerAddr &addr) noexcept
+{
+	std::lock_guard<std::mutex> lock(this->session_lock);
+	return this->destination == addr;
+}
+
+
+// Session
+void NPeer::rebind(const PeerAddr &addr) noexcept
+{
+	{
+		std::lock_guard<std::mutex> lock(this->session_lock);
+		this->destination = addr;
+	}
+
+	// New path, new transit time -- Don't count the jump as jitter, or fit drift across it
+	this->in_jitter = -1;
+	this->drift.restart();
+}
+
+
+void NPeer::setToken(const uint8_t *bytes) noexcept
+{
+	std::lock_guard<std::mutex> lock(this->session_lock);
+	std::memcpy(this->token.bytes, bytes, SESSION_TOKEN_SIZE);
+}
+
+
+bool NPeer::hasToken() noexcept
+{
+	std::lock_guard<std::mutex> lock(this->session_lock);
+	return this->token.valid();
+}
+
+
+bool NPeer::checkToken(uint64_t nonce, uint64_t mac) noexcept
+{
+	std::lock_guard<std::mutex> lock(this->session_lock);
+	return this->token.valid() && this->token.mac(nonce) == mac;
+}
+
+
+SessionToken NPeer::ourToken() noexcept
+{
+	std::lock_guard<std::mutex> lock(this->session_lock);
+	if(!this->our_token.valid())
+		this->our_token = SessionToken::generate();
+	return this->our_token;
+}
+
+
+bool NPeer::ourKey(uint8_t *out) noexcept
+{
+	if(!encrypting) return false;
+	std::lock_guard<std::mutex> lock(this->session_lock);
+	return this->cipher.ourKey(out);
+}
+
+
+void NPeer::setTheirKey(const uint8_t *key) noexcept
+{
+	if(!encrypting) return;
+	std::lock_guard<std::mutex> lock(this->session_lock);
+	this->cipher.setTheirKey(key);
+}
+
+
+void NPeer::confirmKey() noexcept
+{
+	if((this->tx_wire.load() >> 8) < 1) return;
+	std::lock_guard<std::mutex> lock(this->session_lock);
+	this->cipher.confirm();
 }
 
 
@@ -329,18 +633,19 @@ bool NPeer::create_udp_socket() noexcept
 	if (udp > 0) close(udp);
 	udp = -1;
 
-	// Create Socket
-	if((udp = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+	// Create Socket -- One for IPv4 and IPv6 peers alike
+	if((udp = addr_socket(SOCK_DGRAM, udp_family)) < 0)
 	{
 		perror("NPeer::create_udp_socket()");
 		udp = -1;
 		return false;
 	}
 
-	// Create Timeval based on Timeout
+	// Create Timeval based on Timeout -- The receive loop sends heartbeats between
+	// packets, so it has to wake up at least once a gossip round
 	timeval timeout;
-	std::chrono::seconds     sec = (std::chrono::duration_cast<seconds>(SOCKET_TIMEOUT));
-	std::chrono::microseconds us = (std::chrono::duration_cast<microseconds>(SOCKET_TIMEOUT)) - sec;
+	std::chrono::seconds     sec = (std::chrono::duration_cast<seconds>(GOSSIP_INTERVAL));
+	std::chrono::microseconds us = (std::chrono::duration_cast<microseconds>(GOSSIP_INTERVAL)) - sec;
 	timeout.tv_sec  = sec.count();
 	timeout.tv_usec =  us.count();
 
@@ -350,14 +655,10 @@ bool NPeer::create_udp_socket() noexcept
 
 
 	// Bind UDP
-	sockaddr_in addr;
-	addr.sin_family = AF_INET;
-	addr.sin_addr.s_addr = INADDR_ANY;
-	addr.sin_port = htons(PORT);
-	if(bind(udp, (sockaddr*) &addr, sizeof(addr)) < 0)
+	if(addr_bind(udp, udp_family, PORT) < 0)
 	{
 		perror("NPeer::create_udp_socket() bind()");
-		fprintf(stderr, "Failed on port %" PRIu16 "\n", ntohs(addr.sin_port));
+		fprintf(stderr, "Failed on port %" PRIu16 "\n", PORT);
 		return false;
 	}
 
@@ -365,6 +666,26 @@ bool NPeer::create_udp_socket() noexcept
 }
 
 
+ssize_t NPeer::send_udp(const void *buffer, size_t len, const PeerAddr &to) noexcept
+{
+	// IPv6 peers are out of reach of an IPv4 only socket
+	sockaddr_storage storage;
+	socklen_t size = to.toSockaddr(udp_family, storage);
+	if(size == 0) return -1;
+	return sendto(udp, buffer, len, MSG_NOSIGNAL, (const sockaddr*) &storage, size);
+}
+
+
+ssize_t NPeer::recv_udp(void *buffer, size_t len, PeerAddr &from) noexcept
+{
+	sockaddr_storage storage;
+	socklen_t size = sizeof(storage);
+	ssize_t r = recvfrom(udp, buffer, len, 0, (sockaddr*) &storage, &size);
+	if(r >= 0 && !PeerAddr::from(storage, size, from)) return -1;
+	return r;
+}
+
+
 AudioOutPacket* NPeer::getAudioOutPacket() noexcept
 {
 	AudioOutPacket* packet = NULL;
@@ -389,69 +710,163 @@ void NPeer::retireEmptyOutPacket(AudioOutPacket *packet) noexcept
 }
 
 
-void NPeer::send_audio_over_network_thread() noexcept
+int NPeer::bundleFrames(uint8_t wire_version) noexcept
+{
+	if(!bundling || wire_version < 1 || getLoss() >= BUNDLE_MAX_LOSS)
+		return 1;
+
+	// One extra frame per BUNDLE_RTT of round trip time
+	uint32_t rtt = rtt_us.load() / 1000;
+	int frames = 1 + rtt / BUNDLE_RTT.count();
+	return (frames > AUDIO_MAX_BUNDLE) ? AUDIO_MAX_BUNDLE : frames;
+}
+
+
+void NPeer::scheduleFlush() noexcept
 {
-	static const int SENDV_SIZE = 9;
-	uint8_t buffer[BUFFER_SIZE + SENDV_SIZE];
-	union {
-		uint32_t word;
-		uint8_t  byte[4];
-	} split;
+	if(!run_thread || !workers) return;
+	if(out_packet_count.load() <= 0 && out_pending_count.load() <= 0) return;
+	if(flush_scheduled.exchange(true)) return;
+	if(!workers->post(this, [this]() { this->flush_out(); }))
+		flush_scheduled = false;
+}
 
 
-	// Main While Loop to stay in function
-	while(run_thread)
+void NPeer::flush_out() noexcept
+{
+	// Drain, then look again in case enqueue_out raced with clearing the flag
+	do
 	{
-		// Yield if no audio packets
-		if(out_packet_count.load() <= 0)
-		{
-			std::this_thread::yield();
-			continue;
-		}
+		while(run_thread && send_pending())
+			;
+		flush_scheduled = false;
+	} while(run_thread && out_packet_count.load() > 0 && !flush_scheduled.exchange(true));
+}
+
 
-		// Retrieve Audio Packet and decrement counter
+bool NPeer::send_pending() noexcept
+{
+	uint8_t buffer[BUFFER_SIZE + SENDV_HEADER_SIZE + CRYPTO_OVERHEAD];
+	AudioOutPacket **pending = out_pending;
+	int count = out_pending_count.load();
+	uint16_t wire = tx_wire.load();
+	uint8_t wire_version = (uint8_t) (wire >> 8);
+	uint8_t tx_sid = (uint8_t) (wire & 0xFF);
+
+	// Collect as many packets as the current bundle size asks for
+	int target = bundleFrames(wire_version);
+	AudioOutPacket *next = NULL;
+	while(count < target && out_packet_count.load() > 0)
+	{
 		AudioOutPacket *packet = getAudioOutPacket();
 		out_packet_count--;
+		if(!packet) break;
+
+		// A gap in media time (DTX frames held back, a capture glitch) -- It starts the
+		// next bundle
+		if(count > 0 && !bundle_follows(pending, count, packet))
+		{
+			next = packet;
+			break;
+		}
+		if(count == 0) out_pending_since = steady_clock::now();
+		pending[count++] = packet;
+
+		// We went quiet, or a keepalive -- Nothing comes after it for a while
+		if(packet->flags & AUDIO_DTX) target = count;
+	}
+
+	// Wait for more audio packets, unless the oldest one has waited too long
+	if(count == 0 || (!next && count < target && (steady_clock::now() - out_pending_since) < BUNDLE_MAX_HOLD))
+	{
+		out_pending_count = count;
+		return false;
+	}
 
-		// Copy into local buffer leaving room for meta data
-		std::memcpy(buffer + SENDV_SIZE, packet->packet.get(), packet->packet_len);
+	// Bundle them if they fit in one datagram
+	PeerAddr dest = getDest();
+	size_t total = 0;
+	for(int i = 0; i < count; ++i)
+		total += pending[i]->packet_len + 2;
+	bool bundle = (count > 1) && (total <= BUNDLE_MAX_BYTES);
 
-		// Tag Type
-		buffer[0] = SENDV;
+	for(int i = 0; i < count; ++i)
+	{
+		// Tag Header -- Compact header if the peer speaks it, SENDV otherwise
+		AudioOutPacket *packet = pending[i];
+		size_t len;
+		if(bundle)
+			len = write_bundle(buffer, pending, count, tx_sid);
+		else
+		{
+			if(wire_version >= 1)
+				len = write_senda_header(buffer, packet, tx_sid);
+			else
+				len = write_sendv_header(buffer, packet);
 
-		// Tag Packet ID
-		split.word = htonl(packet->packet_id);
-		buffer[1]  = split.byte[0];
-		buffer[2]  = split.byte[1];
-		buffer[3]  = split.byte[2];
-		buffer[4]  = split.byte[3];
+			// Copy into local buffer after the header
+			std::memcpy(buffer + len, packet->packet.get(), packet->packet_len);
+			len += packet->packet_len;
+		}
 
-		// Tag Packet Content Length
-		split.word = htonl(packet->packet_len);
-		buffer[5]  = split.byte[0];
-		buffer[6]  = split.byte[1];
-		buffer[7]  = split.byte[2];
-		buffer[8]  = split.byte[3];
+		// Seal it where it lies if we share keys with the peer -- SENDA only, legacy SENDV
+		// stays plain until we know they speak SENDA
+		if(wire_version >= 1 && this->cipher.sealed())
+			len = this->cipher.seal(buffer, len);
 
 		// Send
-		packet->packet_len += SENDV_SIZE;
-		ssize_t sent = sendto(udp, buffer, packet->packet_len + SENDV_SIZE, 0,
-		                                              (const sockaddr*) &destination, sizeof(destination));
+		ssize_t sent = (len > 0) ? send_udp(buffer, len, dest) : 0;
 		#ifdef NET_DEBUG
-		if(sent != packet->packet_len + SENDV_SIZE)
+		if(sent != (ssize_t) len)
 		{
-			std::cerr << "NPeer Audio Out Thread WARNING: Bytes Sent( " << sent << ") != Bytes Intended(" << packet->packet_len << ")\n";
+			std::cerr << "NPeer Audio Out WARNING: Bytes Sent( " << sent << ") != Bytes Intended(" << len << ")\n";
 		}
 		#endif
+		if(bundle) break;
+	}
 
+	for(int i = 0; i < count; ++i)
+		retireEmptyOutPacket(pending[i]);
+	count = 0;
+	if(next)
+	{
+		out_pending_since = steady_clock::now();
+		pending[count++] = next;
 	}
+	out_pending_count = count;
+	return true;
 }
 
 
-bool NPeer::createTCP()
+uint32_t NPeer::extendSequence(uint16_t seq, uint16_t ticks, uint32_t &timestamp) noexcept
 {
-	if((this->tcp = socket(AF_INET, SOCK_STREAM, 0)) < 0)
-		return false;
+	// First packet seeds the counters
+	if(!in_seen)
+	{
+		in_seen = true;
+		in_highest_id = seq;
+		in_highest_ts = ticks;
+	}
+
+	// Extend relative to the highest values seen so late packets land behind them
+	uint32_t id = in_highest_id + (int16_t) (seq   - (uint16_t) in_highest_id);
+	uint32_t ts = in_highest_ts + (int16_t) (ticks - (uint16_t) in_highest_ts);
+	if((int32_t) (id - in_highest_id) > 0) in_highest_id = id;
+	if((int32_t) (ts - in_highest_ts) > 0) in_highest_ts = ts;
+
+	timestamp = ts * AUDIO_TS_UNIT;
+	return id;
+}
+
+
+int NPeer::connect_tcp(const PeerAddr &dest, uint32_t &rtt_sample) noexcept
+{
+	// Plain IPv4 or IPv6 socket, whichever the peer is on
+	sockaddr_storage storage;
+	socklen_t size = dest.toSockaddr(dest.family(), storage);
+	int sock = socket(dest.family(), SOCK_STREAM, 0);
+	if(sock < 0)
+		return -1;
 
 	// Create Timeval based on Timeout
 	timeval timeout;
@@ -461,29 +876,43 @@ bool NPeer::createTCP()
 	timeout.tv_usec =  us.count();
 
 	// Set Timeout
-	if(setsockopt(this->tcp, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) < 0)
-	{
-		destroyTCP();
-		return false;
-	}
-	if(setsockopt(this->tcp, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0)
+	if(setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) < 0 ||
+	   setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0)
 	{
-		destroyTCP();
-		return false;
+		close(sock);
+		return -1;
 	}
 
-	// Connect to Peer
-	if(connect(this->tcp, (sockaddr*) &destination, sizeof(this->destination)) < 0)
+	// Connect to Peer -- The handshake doubles as an RTT sample
+	steady_clock::time_point begin = steady_clock::now();
+	if(connect(sock, (sockaddr*) &storage, size) < 0)
 	{
-		destroyTCP();
-		return false;
+		close(sock);
+		return -1;
 	}
+	rtt_sample = duration_cast<microseconds>(steady_clock::now() - begin).count();
+	return sock;
+}
 
 
+bool NPeer::createTCP()
+{
+	uint32_t sample = 0;
+	this->tcp = connect_tcp(getDest(), sample);
+	if(this->tcp < 0)
+		return false;
+	sampleRTT(sample);
 	return true;
 }
 
 
+void NPeer::sampleRTT(uint32_t sample) noexcept
+{
+	uint32_t rtt = rtt_us.load();
+	rtt_us = (rtt == 0) ? sample : (7 * rtt + sample) / 8;
+}
+
+
 void NPeer::destroyTCP()
 {
 	if(this->tcp < 0) return;
@@ -510,23 +939,31 @@ inline static ssize_t recv_timeout(int sockfd, void *buf, size_t len, int flags)
 PeersChatNetwork::PeersChatNetwork()
 {
 	peers.reserve(MAX_PEERS);
+	workers.start(NET_WORKERS, THREAD_NETWORK);
+	loops.start(NET_LOOPS, THREAD_NETWORK);
+	control.start(1, THREAD_CONTROL);
+	NPeerAttorney::setWorkers(&workers);
 }
 
 
 PeersChatNetwork::~PeersChatNetwork()
 {
-	this->stop();
+	// Behind whatever control work is queued, so nothing runs into the teardown
+	this->cancelJoin();
+	this->onControl([this]() { this->stop(); return true; });
+	this->control.stop();
+	NPeerAttorney::setWorkers(NULL);
+	this->workers.stop();
+	this->loops.stop();
 }
 
 
 // Operators
-NPeer* PeersChatNetwork::operator[](const sockaddr_in &addr) noexcept
+NPeer* PeersChatNetwork::operator[](const PeerAddr &addr) noexcept
 {
 	std::lock_guard<std::mutex> lock(this->peers_lock);
-	for(int i = 0; i < this->size; ++i)
-		if(peers[i].get() && (*peers[i].get() == addr))
-			return peers[i].get();
-	return NULL;
+	auto it = this->by_addr.find(addr);
+	return (it == this->by_addr.end()) ? NULL : it->second;
 }
 
 
@@ -565,6 +1002,16 @@ NPeer* PeersChatNetwork::findID(const int &x) noexcept
 }
 
 
+NPeer* PeersChatNetwork::findSID(const uint8_t &sid) noexcept
+{
+	std::lock_guard<std::mutex> lock(this->peers_lock);
+	for(int i = 0; i < this->size; ++i)
+		if(NPeerAttorney::getRxSID(this->peers[i].get()) == sid)
+			return this->peers[i].get();
+	return NULL;
+}
+
+
 std::string PeersChatNetwork::getMyName() noexcept
 {
 	if(myName[0] == 0)
@@ -595,113 +1042,135 @@ bool PeersChatNetwork::setMyName(const std::string &name) noexcept
 
 
 // Public Functions
-bool PeersChatNetwork::join(const sockaddr_in &addr) noexcept
+bool PeersChatNetwork::join(const PeerAddr &addr) noexcept
 {
-	#ifdef NET_DEBUG
-	std::cout << "Call to PeersChatNetwork::join with addr ";
-	char buffer[INET_ADDRSTRLEN+1] = {0};
-	inet_ntop(AF_INET, &addr.sin_addr, buffer, INET_ADDRSTRLEN);
-	std::cout << std::string(buffer) << ":" << ntohs(addr.sin_port) << std::endl;
-	#endif
+	return this->onControl([this, &addr]() {
+		this->join_cancel = false;
+		return this->join(addr, JoinCallback());
+	});
+}
 
 
-	// Make sure everything is stopped first
-	if(running) return false;
-	this->stop();
-	if(this->peers.size() != 0) return false;
+bool PeersChatNetwork::joinAsync(const PeerAddr &addr, JoinCallback progress) noexcept
+{
+	return this->postJoin([this, addr, progress]() { return this->join(addr, progress); }, progress);
+}
 
-	// Create NPeer
-	addPeer(addr);
-	NPeer *peer = (*this)[addr];
-	if(!peer) return false;
 
-	// Create TCP Connection to Peer
-	if(!NPeerAttorney::createTCP(peer))
+void PeersChatNetwork::getNames() noexcept
+{
+	// Peers only hear about us through gossip, the ones that haven't yet won't answer.
+	// Give them a few rounds.  Kept by address, any of them can leave meanwhile.
+	std::vector<PeerAddr> everyone;
 	{
-		this->stop();
-		return false;
+		std::lock_guard<std::mutex> lock(this->peers_lock);
+		for(int i = 0; i < this->size; ++i)
+			everyone.push_back(NPeerAttorney::getDest(this->peers[i].get()));
 	}
+	std::vector<PeerAddr> unnamed = everyone, unkeyed = everyone;
 
-	// Get TCP socket
-	int tcp = NPeerAttorney::getTCP(peer);
-
-	// Request to CONNECT
-	connect(tcp);
-
-	// Get Response
-	if(!getResponse(tcp))
-		return false;
-
-	// Request Peers
-	std::vector<sockaddr_in> peer_addr;
-	if(!requestPeers(tcp, peer_addr))
-		return false;
-
-	// Add Peers
-	for(sockaddr_in &addr : peer_addr)
-		addPeer(addr);
-
-	// Close Out TCP Connection
-	NPeerAttorney::destroyTCP(peer);
-
+	// Cancelled joins skip whoever is left, they keep their default name and plain audio
+	for(int attempt = 0; attempt < GOSSIP_NAME_ATTEMPTS && !this->join_cancel; ++attempt)
+	{
+		if(unnamed.empty() && unkeyed.empty()) break;
+		if(attempt > 0) std::this_thread::sleep_for(GOSSIP_INTERVAL);
 
-	#ifdef NET_DEBUG
-	std::cout << "Call to PeersChatNetwork::join completed" << std::endl;
-	#endif
+		for(auto it = unnamed.begin(); it != unnamed.end() && !this->join_cancel; )
+			it = this->getName(*it, true) ? unnamed.erase(it) : it + 1;
+		for(auto it = unkeyed.begin(); it != unkeyed.end() && !this->join_cancel; )
+			it = this->getKey(*it, true) ? unkeyed.erase(it) : it + 1;
+	}
 
-	// Start or fail sucessfully
-	if(this->start())
+	// Say who the audio stays plain with
+	if(!NPeerAttorney::getEncrypting()) return;
+	std::lock_guard<std::mutex> lock(this->peers_lock);
+	for(const PeerAddr &addr : everyone)
 	{
-		this->getNames();
-		return true;
+		auto it = this->by_addr.find(addr);
+		if(it != this->by_addr.end() && !NPeerAttorney::sealed(it->second))
+			std::cerr << "Audio is unencrypted with " << it->second->getName() << " (" << addr.str() << ")" << std::endl;
 	}
-	else
-	{
+}
+
+
+bool PeersChatNetwork::host() noexcept
+{
+	return this->onControl([this]() {
 		this->stop();
-		return false;
-	}
+		return this->start();
+	});
 }
 
 
-void PeersChatNetwork::getNames() noexcept
+bool PeersChatNetwork::hostAsync(JoinCallback progress) noexcept
 {
-	for(int i = 0; i < this->size; ++i)
-	{
-		NPeerAttorney::createTCP(this->peers[i].get());
-		this->peers[i]->setName(this->getName(NPeerAttorney::getTCP(this->peers[i].get())));
-		NPeerAttorney::destroyTCP(this->peers[i].get());
-	}
+	return this->postJoin([this, progress]() {
+		this->stop();
+		if(!this->start()) return false;
+		if(progress) progress(JOIN_STARTED);
+		return true;
+	}, progress);
 }
 
 
-bool PeersChatNetwork::host() noexcept
+void PeersChatNetwork::cancelJoin() noexcept
 {
-	this->stop();
-	return this->start();
+	if(!this->join_busy) return;
+	this->join_cancel = true;
+
+	// Wake join() out of whatever it is waiting on
+	std::lock_guard<std::mutex> lock(this->join_lock);
+	if(this->join_sock >= 0)
+		shutdown(this->join_sock, SHUT_RDWR);
 }
 
 
 void PeersChatNetwork::disconnect() noexcept
 {
-	#ifdef NET_DEBUG
+	this->onControl([this]() { this->leave(); return true; });
+}
+
+
+void PeersChatNetwork::disconnectAsync() noexcept
+{
+	// Queued behind any join/host, cancelJoin() first to cut that short
+	if(!this->control.post(this, [this]() { this->leave(); }))
+		this->leave();
+}
+
+
+// Private Functions
+void PeersChatNetwork::leave() noexcept
+{
+	#ifdef NET_DEBUG
 	std::cout << "Call to PeersChatNetwork::disconnect()" << std::endl;
 	#endif
 
+	// Say goodbye to everyone that gossips, a few times since it's UDP
+	std::vector<PeerAddr> gossiping, legacy;
 	{
-		std::lock_guard<std::mutex> lock(this->peers_lock);
+		std::lock_guard<std::mutex> lock(this->gossip_lock);
+		this->gossip.live(gossiping, &legacy);
+		for(int i = 0; i < GOSSIP_LEAVE_REPEAT; ++i)
+			for(const PeerAddr &addr : gossiping)
+				this->gossipSend(addr, GOSSIP_LEAVING);
+	}
 
-		// Open TCP To All Peers
-		std::vector<int> peer_fd;
-		for(int i = 0; i < this->getNumberPeers(); ++i)
-		{
-			NPeer *peer = this->peers[i].get();
-			NPeerAttorney::createTCP(peer);
-			peer_fd.push_back(NPeerAttorney::getTCP(peer));
-		}
+	// Open TCP To the Peers that don't gossip and are still in the call
+	std::vector<int> peer_fd;
+	for(const PeerAddr &addr : legacy)
+	{
+		uint32_t sample;
+		if(!(*this)[addr]) continue;
+		int fd = NPeerAttorney::connectTCP(addr, sample);
+		if(fd >= 0) peer_fd.push_back(fd);
+	}
 
-		// Tell Them you are disconnecting
-		for(const int &fd : peer_fd)
-			disconnect(fd);
+	// Tell Them you are disconnecting
+	for(const int &fd : peer_fd)
+	{
+		disconnect(fd);
+		close(fd);
 	}
 
 	// End it All
@@ -713,6 +1182,115 @@ void PeersChatNetwork::disconnect() noexcept
 }
 
 
+bool PeersChatNetwork::join(const PeerAddr &addr, const JoinCallback &progress) noexcept
+{
+	#ifdef NET_DEBUG
+	std::cout << "Call to PeersChatNetwork::join with addr " << addr.str() << std::endl;
+	#endif
+
+	auto report = [&progress](JoinStage stage) { if(progress) progress(stage); };
+	auto fail = [this]() {
+		this->setJoinSocket(-1);
+		this->stop();
+		return false;
+	};
+
+
+	// Make sure everything is stopped first
+	if(running) return false;
+	this->stop();
+	if(this->peers.size() != 0) return false;
+
+	// Create NPeer
+	report(JOIN_CONNECTING);
+	addPeer(addr);
+	NPeer *peer = (*this)[addr];
+	if(!peer) return false;
+
+	// Find where our NAT maps us, that's where the call has to reach us
+	this->discoverAddress(addr);
+
+	// Create TCP Connection to Peer
+	if(!NPeerAttorney::createTCP(peer) || this->join_cancel)
+		return fail();
+
+	// Get TCP socket
+	int tcp = NPeerAttorney::getTCP(peer);
+	this->setJoinSocket(tcp);
+
+	// Request to CONNECT
+	report(JOIN_WAITING);
+	connect(tcp);
+
+	// Get Response
+	if(!getResponse(tcp) || this->join_cancel)
+		return fail();
+
+	// Request Peers
+	report(JOIN_PEERS);
+	std::vector<PeerAddr> peer_addr;
+	if(!requestPeers(tcp, peer_addr) || this->join_cancel)
+		return fail();
+
+	// Add Peers
+	for(PeerAddr &addr : peer_addr)
+		addPeer(addr);
+
+	// Close Out TCP Connection
+	this->setJoinSocket(-1);
+	NPeerAttorney::destroyTCP(peer);
+
+
+	#ifdef NET_DEBUG
+	std::cout << "Call to PeersChatNetwork::join completed" << std::endl;
+	#endif
+
+	// Start or fail sucessfully -- Audio can go while we ask around for names
+	if(this->join_cancel || !this->start())
+		return fail();
+	report(JOIN_STARTED);
+	this->getNames();
+	return true;
+}
+
+
+bool PeersChatNetwork::postJoin(std::function<bool()> task, JoinCallback progress) noexcept
+{
+	// One at a time
+	bool idle = false;
+	if(!this->join_busy.compare_exchange_strong(idle, true))
+		return false;
+	this->join_cancel = false;
+
+	bool posted = this->control.post(this, [this, task, progress]() {
+		bool success = task();
+		JoinStage last = success ? JOIN_DONE : (this->join_cancel ? JOIN_CANCELLED : JOIN_FAILED);
+		this->join_busy = false;
+		if(progress) progress(last);
+	});
+	if(!posted) this->join_busy = false;
+	return posted;
+}
+
+
+bool PeersChatNetwork::onControl(std::function<bool()> task) noexcept
+{
+	// Wait our turn on the control thread -- Runs here if it is gone
+	std::promise<bool> result;
+	std::future<bool> outcome = result.get_future();
+	if(!this->control.post(this, [&task, &result]() { result.set_value(task()); }))
+		return task();
+	return outcome.get();
+}
+
+
+void PeersChatNetwork::setJoinSocket(int sock) noexcept
+{
+	std::lock_guard<std::mutex> lock(this->join_lock);
+	this->join_sock = sock;
+}
+
+
 bool PeersChatNetwork::start() noexcept
 {
 	#ifdef NET_DEBUG
@@ -723,8 +1301,9 @@ bool PeersChatNetwork::start() noexcept
 	if(tcp_listen > 0)
 		close(tcp_listen);
 
-	// Sock Create
-	if((tcp_listen = socket(AF_INET, SOCK_STREAM, 0)) <= 0)
+	// Sock Create -- Dual-stack, so IPv4 and IPv6 peers reach the same listener
+	int family;
+	if((tcp_listen = addr_socket(SOCK_STREAM, family)) <= 0)
 	{
 		perror("PeersChatNetwork::start() socket()");
 		stop();
@@ -762,14 +1341,10 @@ bool PeersChatNetwork::start() noexcept
 	}
 
 	// Sock Bind
-	sockaddr_in addr;
-	addr.sin_family = AF_INET;
-	addr.sin_addr.s_addr = INADDR_ANY;
-	addr.sin_port = htons(PORT);
-	if(bind(tcp_listen, (sockaddr*) &addr, sizeof(addr)) < 0)
+	if(addr_bind(tcp_listen, family, PORT) < 0)
 	{
 		perror("PeersChatNetwork::start() bind()");
-		fprintf(stderr, "Failed on port %" PRIu16 "\n", ntohs(addr.sin_port));
+		fprintf(stderr, "Failed on port %" PRIu16 "\n", PORT);
 		stop();
 		return false;
 	}
@@ -783,12 +1358,23 @@ bool PeersChatNetwork::start() noexcept
 	}
 
 
-	// Run Background threads
+	// The receive loop needs the audio socket even before the first peer makes it,
+	// a host waits on it alone
+	if(!NPeerAttorney::createUDP())
+	{
+		stop();
+		return false;
+	}
+
+	// Run Background loops on their own threads
 	running = true;
-	listen_thread.reset(new std::thread(&PeersChatNetwork::listen_on_tcp_thread, this));
-	recv_thread.reset(new std::thread(&PeersChatNetwork::receive_audio_thread, this));
+	loops.post(&running, std::bind(&PeersChatNetwork::listen_on_tcp_thread, this));
+	loops.post(&running, std::bind(&PeersChatNetwork::receive_audio_thread, this));
 	for(std::unique_ptr<NPeer> &ptr : this->peers)
+	{
 		ptr->startNetStream();
+		this->punch(NPeerAttorney::getDest(ptr.get()));
+	}
 
 	#ifdef NET_DEBUG
 	std::cout << "Call to PeersChatNetwork::start() completed" << std::endl;
@@ -804,60 +1390,86 @@ void PeersChatNetwork::stop() noexcept
 	std::cout << "Call to PeersChatNetwork::stop()" << std::endl;
 	#endif
 
-	std::lock_guard<std::mutex> lock(peers_lock);
 	running = false;
 
-	this->peers.clear();
-	this->size = 0;
+	// Wake the loops out of recvfrom()/accept() and wait for them to return
+	NPeerAttorney::wakeUDP();
+	if(tcp_listen > 0) shutdown(tcp_listen, SHUT_RDWR);
+	loops.cancel(&running);
 
-	NPeerAttorney::destroyUDP();
+	// The audio callback may still hold some of the peers this frame -- Retire them all
+	// like removePeer() does, only the ones retired a PEER_RETIRE_GRACE ago are freed
+	std::vector<std::unique_ptr<NPeer>> leaving, expired;
+	{
+		std::lock_guard<std::mutex> lock(peers_lock);
+		leaving.swap(this->peers);
+		this->peers.reserve(MAX_PEERS);
+		this->by_addr.clear();
+		this->size = 0;
+		this->unnamed.clear();
+	}
+	for(std::unique_ptr<NPeer> &peer : leaving)
+		peer->stopNetStream();
+	{
+		std::lock_guard<std::mutex> lock(peers_lock);
+		steady_clock::time_point now = steady_clock::now();
+		for(auto it = this->retired.begin(); it != this->retired.end(); )
+		{
+			if(now - it->first < PEER_RETIRE_GRACE) { ++it; continue; }
+			expired.push_back(std::move(it->second));
+			it = this->retired.erase(it);
+		}
+		for(std::unique_ptr<NPeer> &peer : leaving)
+			this->retired.emplace_back(now, std::move(peer));
+	}
 
-	if((recv_thread.get() && recv_thread->joinable()))
-		recv_thread->join();
+	// Next call starts with a fresh view and an incarnation that beats any we left behind
+	{
+		std::lock_guard<std::mutex> lock(this->gossip_lock);
+		this->gossip.reset((uint32_t) duration_cast<seconds>(system_clock::now().time_since_epoch()).count());
+	}
+	{
+		std::lock_guard<std::mutex> lock(this->rebind_lock);
+		this->rebinder.reset();
+	}
+	{
+		std::lock_guard<std::mutex> lock(this->punch_lock);
+		this->punching.clear();
+		this->punch_scheduled = false;
+	}
+	this->mapped_port = 0;
 
-	if(listen_thread.get() && listen_thread->joinable())
-		listen_thread->join();
+	NPeerAttorney::destroyUDP();
 
 	if(tcp_listen > 0) close(tcp_listen);
 	tcp_listen = -1;
 
-	recv_thread.reset();
-	listen_thread.reset();
-
 	#ifdef NET_DEBUG
 	std::cout << "Call to PeersChatNetwork::stop() completed" << std::endl;
 	#endif
 }
 
 
-bool PeersChatNetwork::propose(sockaddr_in &subject, int sock) noexcept
+bool PeersChatNetwork::propose(const PeerAddr &subject, int sock) noexcept
 {
-	// Tag Type of Request
-	uint8_t buffer[7];
-	buffer[0] = PROPOSE;
-
-	// Attach IP Address of subject
-	union {
-		uint32_t addr;
-		uint8_t  byte[4];
-	} ip;
-	ip.addr = subject.sin_addr.s_addr;
-	buffer[1] = ip.byte[0];
-	buffer[2] = ip.byte[1];
-	buffer[3] = ip.byte[2];
-	buffer[4] = ip.byte[3];
-
-	// Attach Port Num of subject
-	union {
-		uint16_t num;
-		uint8_t  byte[2];
-	} port;
-	port.num = subject.sin_port;
-	buffer[5] = port.byte[0];
-	buffer[6] = port.byte[1];
+	// Tag Type of Request and attach the subject's address -- IPv4 subjects the old way,
+	// older peers can't reach IPv6 ones and turn PROPOSE6 down
+	uint8_t buffer[1 + PEER_ADDR_SIZE];
+	ssize_t len;
+	if(subject.writeV4(buffer + 1))
+	{
+		buffer[0] = PROPOSE;
+		len = 1 + PEER_ADDR_V4_SIZE;
+	}
+	else
+	{
+		buffer[0] = PROPOSE6;
+		subject.write(buffer + 1);
+		len = 1 + PEER_ADDR_SIZE;
+	}
 
 	// Send Proposal
-	if(7 != send_timeout(sock, buffer, 7, MSG_NOSIGNAL))
+	if(len != send_timeout(sock, buffer, len, MSG_NOSIGNAL))
 		return false;
 	else return true;
 }
@@ -886,48 +1498,91 @@ bool PeersChatNetwork::getResponse(int sock) noexcept
 }
 
 
-bool PeersChatNetwork::addPeer(const sockaddr_in &addr) noexcept
+bool PeersChatNetwork::addPeer(const PeerAddr &addr) noexcept
 {
-	NPeer *peer = new NPeer(addr);
+	std::unique_ptr<NPeer> added(new NPeer(addr));
+	NPeer *peer = added.get();
 	if(running) peer->startNetStream();
 
 	{
 		std::lock_guard<std::mutex> lock(this->peers_lock);
-		if(this->size >= MAX_PEERS) return false;
-		this->peers.emplace_back(peer);
+		if(this->size >= MAX_PEERS || this->by_addr.count(addr)) return false;
+
+		// Hand out the lowest stream id nobody else is using
+		uint8_t sid = 1;
+		for(int i = 0; i < this->size; ++i)
+			if(NPeerAttorney::getRxSID(this->peers[i].get()) == sid)
+			{
+				sid++;
+				i = -1;
+			}
+		NPeerAttorney::setRxSID(peer, sid);
+		this->peers.push_back(std::move(added));
+		this->by_addr[addr] = peer;
 		this->size++;
 	}
 
-	GUI->add_npeer_to_gui(peer);
+	{
+		std::lock_guard<std::mutex> lock(this->gossip_lock);
+		this->gossip.add(addr, steady_clock::now());
+	}
+
+	// They are punching toward us about now, too
+	if(running) this->punch(addr);
+
+	RosterListener *listener = NPeerAttorney::getRoster();
+	if(listener) listener->onPeerAdded(peer);
 	return true;
 }
 
 
-void PeersChatNetwork::removePeer(sockaddr_in &addr) noexcept
+void PeersChatNetwork::removePeer(const PeerAddr &addr) noexcept
 {
-	// Search For That Peer
-	unsigned long loc;
-	for(loc = 0; (loc < peers.size()) && !(*peers[loc] == addr); loc++)
-		;
-
-	// They don't exist
-	if(loc >= peers.size()) return;
-
-	// They do exist now move them to the back
+	// Gossip removes peers from a worker while the listen loop handles DISCONNECT, so
+	// find and take them out in one go
+	std::unique_ptr<NPeer> gone;
 	{
 		std::lock_guard<std::mutex> lock(this->peers_lock);
-		this->size--;
+
+		// Search For That Peer
+		auto it = this->by_addr.find(addr);
+		if(it == this->by_addr.end()) return;
+		NPeer *target = it->second;
+		this->by_addr.erase(it);
+
+		unsigned long loc;
+		for(loc = 0; (loc < peers.size()) && (peers[loc].get() != target); loc++)
+			;
+
+		// They don't exist
+		if(loc >= peers.size()) return;
+
+		// They do exist now move them to the back and take them out
 		if(peers.size() > 1)
 			(peers[loc]).swap(peers[peers.size()-1]);
+		gone = std::move(this->peers.back());
+		this->peers.pop_back();
+		this->size--;
+	}
+
+	// Everyone else hears it through us (a no-op if that's how we heard it)
+	{
+		std::lock_guard<std::mutex> lock(this->gossip_lock);
+		this->gossip.remove(addr, steady_clock::now());
 	}
 
-	// Inform GUI and Eliminate Them
-	GUI->remove_npeer_from_gui(this->peers.back().get());
-	this->peers.pop_back();
+	// Stop sending to them, inform the roster listener and retire them -- The audio
+	// callback may still be using them this frame, checkLiveness() destroys them later
+	gone->stopNetStream();
+	RosterListener *listener = NPeerAttorney::getRoster();
+	if(listener) listener->onPeerRemoved(gone.get());
+
+	std::lock_guard<std::mutex> lock(this->peers_lock);
+	this->retired.emplace_back(steady_clock::now(), std::move(gone));
 }
 
 
-bool PeersChatNetwork::requestPeers(int sock, std::vector<sockaddr_in> &peers_addr) noexcept
+bool PeersChatNetwork::requestPeers(int sock, std::vector<PeerAddr> &peers_addr) noexcept
 {
 	uint8_t buffer[BUFFER_SIZE];
 
@@ -936,44 +1591,35 @@ bool PeersChatNetwork::requestPeers(int sock, std::vector<sockaddr_in> &peers_ad
 	ssize_t s = send_timeout(sock, buffer, 1, MSG_NOSIGNAL);
 	if(1 != s) return false;
 
-	// Receive SENDP and Content Length
+	// Receive SENDP/SENDP6 and Content Length
 	s = recv_timeout(sock, buffer, 5, MSG_WAITALL);
 	if(s != 5) return false;
-	if(buffer[0] != SENDP) return false;
+	if(buffer[0] != SENDP && buffer[0] != SENDP6) return false;
+	bool wide = (buffer[0] == SENDP6);
+	ssize_t entry = wide ? PEER_ADDR_SIZE : PEER_ADDR_V4_SIZE;
 	uint32_t content_length = (buffer[1] << 24) | (buffer[2] << 16) | (buffer[3] << 8) | (buffer[4]);
 
-	// Loop Over Addresses & Add to Vector
+	// Loop Over Addresses & Add to Vector -- Whole entries at a time
 	auto min = [](const ssize_t &a, const ssize_t &b) { return (a<b)?a:b; };
-	union { uint16_t num; uint8_t byte[2]; } port;
-	union { uint32_t num; uint8_t byte[4]; } ip;
-	sockaddr_in addr;
 	ssize_t total = 0;
 	while(total < content_length)
 	{
 		// Receive Data
-		s = recv_timeout(sock, buffer, min(BUFFER_SIZE, content_length-total), MSG_WAITALL);
-		if (s < 0) return false;
-		else if(s % 6 != 0) return false;
+		s = recv_timeout(sock, buffer, min(BUFFER_SIZE - BUFFER_SIZE % entry, content_length-total), MSG_WAITALL);
+		if (s <= 0) return false;
+		else if(s % entry != 0) return false;
 		total += s;
 
 		// Add each address to vector
-		for(ssize_t pos = 0; pos < s; pos += 6)
+		for(ssize_t pos = 0; pos < s; pos += entry)
 		{
-			ip.byte[0]   = buffer[pos + 0];
-			ip.byte[1]   = buffer[pos + 1];
-			ip.byte[2]   = buffer[pos + 2];
-			ip.byte[3]   = buffer[pos + 3];
-			port.byte[0] = buffer[pos + 4];
-			port.byte[1] = buffer[pos + 5];
-			addr.sin_family = AF_INET;
-			addr.sin_addr.s_addr = ip.num;
-			addr.sin_port = port.num;
+			PeerAddr addr;
+			if(wide) addr.read(buffer + pos);
+			else addr.readV4(buffer + pos);
 			peers_addr.push_back(addr);
 
 			#ifdef NET_DEBUG
-			char str[INET_ADDRSTRLEN+1] = {0};
-			inet_ntop(AF_INET, &addr.sin_addr, str, INET_ADDRSTRLEN);
-			std::cout << "Received Peer: " << str << ":" << ntohs(addr.sin_port) << std::endl;
+			std::cout << "Received Peer: " << addr.str() << std::endl;
 			#endif
 		}
 	}
@@ -981,19 +1627,31 @@ bool PeersChatNetwork::requestPeers(int sock, std::vector<sockaddr_in> &peers_ad
 }
 
 
-void PeersChatNetwork::sendPeers(int sock)
+void PeersChatNetwork::sendPeers(int sock, const PeerAddr &joiner)
 {
 	uint8_t buffer[BUFFER_SIZE];
 
-	// Tag Type
-	buffer[0] = SENDP;
+	// Only IPv4 fits in SENDP, which is all older clients read.  Anyone who has to hear
+	// about an IPv6 peer (or is on IPv6 itself) gets SENDP6; an older client couldn't
+	// reach them anyway.
+	std::vector<PeerAddr> addrs;
+	bool wide = !joiner.isV4();
+	{
+		std::lock_guard<std::mutex> lock(peers_lock);
+		for(std::unique_ptr<NPeer> &ptr : this->peers)
+		{
+			addrs.push_back(NPeerAttorney::getDest(ptr.get()));
+			if(!addrs.back().isV4()) wide = true;
+		}
+	}
 
-	// Unions
-	union { uint32_t num; uint8_t byte[4]; } word;
-	union { uint16_t num; uint8_t byte[2]; } port;
+	// Tag Type
+	buffer[0] = wide ? SENDP6 : SENDP;
 
 	// Add Content Length
-	uint32_t content_length = this->size * 6;
+	union { uint32_t num; uint8_t byte[4]; } word;
+	uint32_t entry = wide ? PEER_ADDR_SIZE : PEER_ADDR_V4_SIZE;
+	uint32_t content_length = addrs.size() * entry;
 	word.num = htonl(content_length);
 	buffer[1] = word.byte[0];
 	buffer[2] = word.byte[1];
@@ -1002,21 +1660,11 @@ void PeersChatNetwork::sendPeers(int sock)
 
 	// Populate With Peers
 	uint32_t pos = 5;
+	for(const PeerAddr &addr : addrs)
 	{
-		std::lock_guard<std::mutex> lock(peers_lock);
-		for(std::unique_ptr<NPeer> &ptr : this->peers)
-		{
-			sockaddr_in addr = NPeerAttorney::getDest(ptr.get());
-			word.num = addr.sin_addr.s_addr;
-			port.num = addr.sin_port;
-			buffer[pos + 0] = word.byte[0];
-			buffer[pos + 1] = word.byte[1];
-			buffer[pos + 2] = word.byte[2];
-			buffer[pos + 3] = word.byte[3];
-			buffer[pos + 4] = port.byte[0];
-			buffer[pos + 5] = port.byte[1];
-			pos += 6;
-		}
+		if(wide) addr.write(buffer + pos);
+		else addr.writeV4(buffer + pos);
+		pos += entry;
 	}
 	ssize_t size = send_timeout(sock, buffer, content_length + 5, MSG_NOSIGNAL);
 	#ifdef NET_DEBUG
@@ -1030,7 +1678,7 @@ void PeersChatNetwork::connect(int sock)
 {
 	uint8_t buff[3];
 	union { uint16_t num; uint8_t byte[2]; }port;
-	port.num = htons(PORT);
+	port.num = htons(this->myPort());
 	buff[0] = CONNECT;
 	buff[1] = port.byte[0];
 	buff[2] = port.byte[1];
@@ -1041,36 +1689,46 @@ void PeersChatNetwork::connect(int sock)
 void PeersChatNetwork::disconnect(int sock)
 {
 	uint8_t buff[3];
+	uint16_t port = this->myPort();
 	buff[0] = DISCONNECT;
-	buff[1] = (uint8_t) ((PORT >> 8) & 0xFF);
-	buff[2] = (uint8_t) (PORT & 0xFF);
+	buff[1] = (uint8_t) ((port >> 8) & 0xFF);
+	buff[2] = (uint8_t) (port & 0xFF);
 	send_timeout(sock, &buff, 3, MSG_NOSIGNAL);
 }
 
 
-std::string PeersChatNetwork::getName(int sock) noexcept
+bool PeersChatNetwork::getName(const PeerAddr &addr, bool cancellable) noexcept
 {
+	// A connection of our own -- The peer can be removed while we wait on them, so it is
+	// only looked up once the answer is in
+	uint32_t sample = 0;
+	int sock = NPeerAttorney::connectTCP(addr, sample);
+	if(sock < 0) return false;
+	if(cancellable) this->setJoinSocket(sock);
+
 	// Request Name
-	uint8_t buffer[300];
+	uint8_t buffer[320];
+	uint16_t port = this->myPort();
 	buffer[0] = REQN;
-	buffer[1] = (uint8_t) ((PORT >> 8) & 0xFF);
-	buffer[2] = (uint8_t) (PORT & 0xFF);
-	if(3 != send_timeout(sock, buffer, 3, MSG_NOSIGNAL))
-	{
-		#ifdef NET_DEBUG
-		std::cerr << "PeersChatNetwork::getName send_timeout(4): Failed" << std::endl;
-		#endif
-		return "";
-	}
+	buffer[1] = (uint8_t) ((port >> 8) & 0xFF);
+	buffer[2] = (uint8_t) (port & 0xFF);
+	ssize_t r = -1;
+	if(3 == send_timeout(sock, buffer, 3, MSG_NOSIGNAL))
+		r = recv_timeout(sock, buffer, sizeof(buffer), MSG_WAITALL);
+	#ifdef NET_DEBUG
+	else std::cerr << "PeersChatNetwork::getName send_timeout(4): Failed" << std::endl;
+	#endif
+
+	if(cancellable) this->setJoinSocket(-1);
+	close(sock);
 
 	// Receive Data Back and Perform Error Checks
-	ssize_t r = recv_timeout(sock, buffer, 300, MSG_WAITALL);
 	if(r < 2)
 	{
 		#ifdef NET_DEBUG
 		std::cerr << "PeersChatNetwork::getName recv_timeout(4) Failed" << std::endl;
 		#endif
-		return "";
+		return false;
 	}
 
 	if(buffer[0] != SENDN)
@@ -1078,15 +1736,429 @@ std::string PeersChatNetwork::getName(int sock) noexcept
 		#ifdef NET_DEBUG
 		std::cerr << "PeersChatNetwork::getName Failed: Received wrong type of response" << std::endl;
 		#endif
-		return "";
+		return false;
 	}
 
 	// Parse Name
 	std::string name = "";
-	for(unsigned i = 0; i < buffer[1]; ++i)
+	for(unsigned i = 0; i < buffer[1] && 2 + i < (unsigned) r; ++i)
 		name.push_back((char)buffer[2 + i]);
 
-	return name;
+	// Still one of ours?  Nothing left to ask if not
+	std::lock_guard<std::mutex> lock(this->peers_lock);
+	auto it = this->by_addr.find(addr);
+	if(it == this->by_addr.end()) return true;
+	NPeer *peer = it->second;
+	NPeerAttorney::sampleRTT(peer, sample);
+
+	// Negotiate Audio Header -- Older peers stop right after the name
+	if(r >= 4 + buffer[1])
+		NPeerAttorney::setWire(peer, buffer[2 + buffer[1]], buffer[3 + buffer[1]]);
+
+	// Session Token -- Older peers don't send one and can't be rebound
+	if(r >= 4 + buffer[1] + SESSION_TOKEN_SIZE)
+		NPeerAttorney::setToken(peer, buffer + 4 + buffer[1]);
+
+	return peer->setName(name);
+}
+
+
+bool PeersChatNetwork::getKey(const PeerAddr &addr, bool cancellable) noexcept
+{
+	// Nothing to trade with peers that left, that we seal with already, or if we don't
+	uint8_t buffer[5 + CRYPTO_KEY_SIZE];
+	{
+		std::lock_guard<std::mutex> lock(this->peers_lock);
+		auto it = this->by_addr.find(addr);
+		if(it == this->by_addr.end()) return true;
+		if(NPeerAttorney::sealed(it->second)) return true;
+		if(!NPeerAttorney::ourKey(it->second, buffer + 5)) return true;
+		buffer[4] = NPeerAttorney::getRxSID(it->second);
+	}
+
+	uint32_t sample = 0;
+	int sock = NPeerAttorney::connectTCP(addr, sample);
+	if(sock < 0) return false;
+	if(cancellable) this->setJoinSocket(sock);
+
+	// Send ours, the port claimed like REQN does and what our SENDN would tell them,
+	// their REQN to us may have come before we listened
+	uint16_t port = this->myPort();
+	buffer[0] = KEY;
+	buffer[1] = (uint8_t) ((port >> 8) & 0xFF);
+	buffer[2] = (uint8_t) (port & 0xFF);
+	buffer[3] = AUDIO_WIRE_VERSION;
+	bool answered = (ssize_t) sizeof(buffer) == send_timeout(sock, buffer, sizeof(buffer), MSG_NOSIGNAL) &&
+	                1 == recv_timeout(sock, buffer, 1, MSG_WAITALL);
+	bool denied = answered && buffer[0] == DENY;
+	answered = answered && buffer[0] == KEY &&
+	           CRYPTO_KEY_SIZE == recv_timeout(sock, buffer + 1, CRYPTO_KEY_SIZE, MSG_WAITALL);
+
+	if(cancellable) this->setJoinSocket(-1);
+	close(sock);
+
+	// DENY, they don't seal.  No answer, gossip hasn't told them about us yet (or they
+	// are an older client), so ask again.
+	if(denied) return true;
+	if(!answered)
+	{
+		#ifdef NET_DEBUG
+		std::cerr << "PeersChatNetwork::getKey: No KEY from " << addr.str() << std::endl;
+		#endif
+		return false;
+	}
+
+	// They made their keys before answering -- Ours now, and we can seal right away if
+	// we know they speak SENDA (else the next attempt, after their name)
+	std::lock_guard<std::mutex> lock(this->peers_lock);
+	auto it = this->by_addr.find(addr);
+	if(it == this->by_addr.end()) return true;
+	NPeerAttorney::sampleRTT(it->second, sample);
+	NPeerAttorney::setTheirKey(it->second, buffer + 1);
+	NPeerAttorney::confirmKey(it->second);
+	return NPeerAttorney::sealed(it->second);
+}
+
+
+void PeersChatNetwork::nameLater(const PeerAddr &addr) noexcept
+{
+	std::lock_guard<std::mutex> lock(this->peers_lock);
+	if(this->by_addr.count(addr))
+		this->unnamed.emplace_back(addr, GOSSIP_NAME_ATTEMPTS);
+}
+
+
+void PeersChatNetwork::retryNames() noexcept
+{
+	// Until they answer, their audio header version is unknown and we send them legacy
+	// SENDV, plain.  Asked on the control thread, one gossip round apart.
+	std::vector<std::pair<PeerAddr, int>> due;
+	{
+		std::lock_guard<std::mutex> lock(this->peers_lock);
+		if(this->unnamed.empty()) return;
+		due.swap(this->unnamed);
+	}
+	this->control.post(this, [this, due]() {
+		for(const std::pair<PeerAddr, int> &entry : due)
+		{
+			if(!this->running || this->getName(entry.first, false) || entry.second <= 1) continue;
+			std::lock_guard<std::mutex> lock(this->peers_lock);
+			if(this->by_addr.count(entry.first))
+				this->unnamed.emplace_back(entry.first, entry.second - 1);
+		}
+	});
+}
+
+
+bool PeersChatNetwork::setRendezvous(const std::string &where) noexcept
+{
+	PeerAddr addr;
+	if(!where.empty() && !PeerAddr::parse(where, RENDEZVOUS_PORT, addr)) return false;
+	this->rendezvous = addr;
+	return true;
+}
+
+
+bool PeersChatNetwork::startTrace(const std::string &path) noexcept
+{
+	if(this->trace) return false;
+	this->trace.reset(new TraceWriter(path));
+	if(!this->trace->good())
+	{
+		this->trace.reset();
+		return false;
+	}
+	this->trace_active = this->trace.get();
+	return true;
+}
+
+
+void PeersChatNetwork::gossipTick(bool everyone) noexcept
+{
+	std::vector<PeerAddr> targets;
+	std::vector<GossipEvent> events;
+	{
+		std::lock_guard<std::mutex> lock(this->gossip_lock);
+		this->gossip.tick(steady_clock::now(), targets, events);
+		if(everyone)
+		{
+			targets.clear();
+			this->gossip.live(targets, &targets);
+		}
+		for(const PeerAddr &addr : targets)
+			this->gossipSend(addr, 0);
+	}
+	this->gossipApply(events);
+}
+
+
+void PeersChatNetwork::gossipReceive(const PeerAddr &from, const uint8_t *buffer, size_t len) noexcept
+{
+	std::vector<GossipEvent> events;
+	steady_clock::time_point now = steady_clock::now();
+	GossipReceived result;
+	{
+		std::lock_guard<std::mutex> lock(this->gossip_lock);
+		result = this->gossip.receive(from, buffer, len, now, events);
+		if(result == GOSSIP_REPLY_FULL)
+			this->gossipSend(from, GOSSIP_FULL);
+	}
+
+	// A heartbeat is as good as audio for knowing they're there
+	if(result != GOSSIP_IGNORED)
+	{
+		NPeer *peer = (*this)[from];
+		if(peer) NPeerAttorney::heard(peer, now);
+	}
+	this->gossipApply(events);
+}
+
+
+void PeersChatNetwork::gossipSend(const PeerAddr &to, uint8_t flags) noexcept
+{
+	uint8_t buffer[GOSSIP_WIDE_HEADER_SIZE + GOSSIP_MAX_ENTRIES * GOSSIP_WIDE_ENTRY_SIZE];
+	size_t len = this->gossip.write(to, buffer, sizeof(buffer), flags);
+	if(len > 0)
+		NPeerAttorney::sendUDP(buffer, len, to);
+}
+
+
+void PeersChatNetwork::gossipApply(const std::vector<GossipEvent> &events) noexcept
+{
+	// Adding and removing peers opens TCP connections, keep it off the receive loop and
+	// in line with joins and leaves
+	for(const GossipEvent &event : events)
+	{
+		PeerAddr addr = event.addr;
+
+		#ifdef NET_DEBUG
+		std::cout << "Gossip: " << addr.str() << (event.joined ? " joined" : " is gone") << std::endl;
+		#endif
+
+		if(!event.joined)
+		{
+			this->control.post(this, [this, addr]() { this->removePeer(addr); });
+			continue;
+		}
+
+		// Same rules as a PROPOSE from one of our peers
+		if(!this->accept_indirect_join) continue;
+		this->control.post(this, [this, addr]() {
+			this->awaitRebind(addr);
+			if(!this->running || (*this)[addr] || this->size >= MAX_PEERS) return;
+			if(!this->addPeer(addr)) return;
+			if(!this->getName(addr, false))
+				this->nameLater(addr);
+		});
+	}
+}
+
+
+void PeersChatNetwork::checkLiveness() noexcept
+{
+	steady_clock::time_point now = steady_clock::now();
+	std::vector<PeerAddr> silent;
+	std::vector<std::unique_ptr<NPeer>> expired;
+	{
+		std::lock_guard<std::mutex> lock(this->peers_lock);
+
+		// Nothing at all from them in PEER_TIMEOUT
+		for(int i = 0; i < this->size; ++i)
+			if(now - NPeerAttorney::lastHeard(this->peers[i].get()) > PEER_TIMEOUT)
+				silent.push_back(NPeerAttorney::getDest(this->peers[i].get()));
+
+		// Removed long enough ago that nobody can still be using them
+		for(auto it = this->retired.begin(); it != this->retired.end(); )
+		{
+			if(now - it->first < PEER_RETIRE_GRACE) { ++it; continue; }
+			expired.push_back(std::move(it->second));
+			it = this->retired.erase(it);
+		}
+	}
+
+	for(const PeerAddr &addr : silent)
+	{
+		#ifdef NET_DEBUG
+		std::cout << "Peer " << addr.str() << " went silent, removing" << std::endl;
+		#endif
+		this->control.post(this, [this, addr]() { this->removePeer(addr); });
+	}
+}
+
+
+void PeersChatNetwork::rebindChallenge(NPeer *peer, const PeerAddr &addr) noexcept
+{
+	// Peers that never gave us a token couldn't answer anyway
+	if(!NPeerAttorney::hasToken(peer)) return;
+
+	uint8_t buffer[REBIND_CHALLENGE_SIZE];
+	size_t len;
+	{
+		std::lock_guard<std::mutex> lock(this->rebind_lock);
+		len = this->rebinder.challenge(addr, steady_clock::now(), buffer);
+	}
+	if(len > 0)
+		NPeerAttorney::sendUDP(buffer, len, addr);
+}
+
+
+void PeersChatNetwork::rebindReceive(const PeerAddr &from, const uint8_t *buffer, size_t len) noexcept
+{
+	if(len < 2) return;
+
+	// One of our peers wants us to prove it's us at this address
+	if(buffer[1] == REBIND_CHALLENGE)
+	{
+		NPeer *peer = (*this)[from];
+		if(!peer) return;
+
+		uint8_t reply[REBIND_RESPONSE_SIZE];
+		size_t n = Rebinder::respond(buffer, len, NPeerAttorney::ourToken(peer), reply);
+		if(n > 0)
+			NPeerAttorney::sendUDP(reply, n, from);
+		return;
+	}
+
+	// Answer to one of our challenges -- Whose token is it?
+	steady_clock::time_point now = steady_clock::now();
+	uint64_t nonce, mac;
+	{
+		std::lock_guard<std::mutex> lock(this->rebind_lock);
+		if(!this->rebinder.accept(from, buffer, len, now, nonce, mac)) return;
+	}
+
+	NPeer *moved = NULL;
+	PeerAddr old;
+	{
+		// A gossip join got there first, the old one times out
+		std::lock_guard<std::mutex> lock(this->peers_lock);
+		if(this->by_addr.count(from)) return;
+		for(int i = 0; i < this->size; ++i)
+			if(NPeerAttorney::checkToken(this->peers[i].get(), nonce, mac))
+				moved = this->peers[i].get();
+		if(!moved) return;
+
+		old = NPeerAttorney::getDest(moved);
+		NPeerAttorney::rebind(moved, from);
+		NPeerAttorney::heard(moved, now);
+		this->by_addr.erase(old);
+		this->by_addr[from] = moved;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(this->gossip_lock);
+		this->gossip.rebind(old, from, now);
+	}
+
+	#ifdef NET_DEBUG
+	std::cout << moved->getName() << " moved from " << old.str() << " to " << from.str() << std::endl;
+	#endif
+}
+
+
+void PeersChatNetwork::awaitRebind(const PeerAddr &addr) noexcept
+{
+	// A peer that moved looks like someone new to gossip until we rebound it ourselves
+	steady_clock::time_point deadline = steady_clock::now() + REBIND_TIMEOUT;
+	while(this->running && steady_clock::now() < deadline)
+	{
+		{
+			std::lock_guard<std::mutex> lock(this->rebind_lock);
+			if(!this->rebinder.pending(addr, steady_clock::now())) return;
+		}
+		std::this_thread::sleep_for(REBIND_POLL);
+	}
+}
+
+
+bool PeersChatNetwork::discoverAddress(const PeerAddr &peer) noexcept
+{
+	// Ask the rendezvous server, or the peer we're joining -- Runs before the receive loop
+	// so we can read the socket ourselves.  Only a server on the peer's family sees the
+	// port the peer will see, IPv6 usually has no NAT at all.
+	bool server_fits = this->rendezvous.valid() && this->rendezvous.isV4() == peer.isV4();
+	const PeerAddr &server = server_fits ? this->rendezvous : peer;
+	uint32_t transaction = std::random_device()();
+	uint8_t request[BIND_SIZE];
+	uint8_t buffer[BUFFER_SIZE];
+	nat_write_bind(request, transaction);
+
+	for(int attempt = 0; attempt < BIND_ATTEMPTS && !this->join_cancel; ++attempt)
+	{
+		NPeerAttorney::sendUDP(request, BIND_SIZE, server);
+
+		// recvfrom() times out after GOSSIP_INTERVAL, anything but the answer is dropped
+		steady_clock::time_point deadline = steady_clock::now() + GOSSIP_INTERVAL;
+		while(steady_clock::now() < deadline)
+		{
+			PeerAddr from, mapped;
+			ssize_t r = NPeerAttorney::recvUDP(buffer, BUFFER_SIZE, from);
+			if(r < 0) break;
+			if(from != server) continue;
+			if(!nat_read_bound(buffer, r, transaction, mapped)) continue;
+
+			#ifdef NET_DEBUG
+			std::cout << "Reflexive address " << mapped.str() << std::endl;
+			#endif
+
+			this->mapped_port = ntohs(mapped.port);
+			return true;
+		}
+	}
+	return false;
+}
+
+
+void PeersChatNetwork::punch(const PeerAddr &addr) noexcept
+{
+	{
+		std::lock_guard<std::mutex> lock(this->punch_lock);
+		this->punching.push_back({addr, steady_clock::now()});
+	}
+
+	// One task punches for everyone, on the loops' last thread
+	if(this->punch_scheduled.exchange(true)) return;
+	if(!this->loops.post(&this->running, [this]() { this->punchLoop(); }))
+		this->punch_scheduled = false;
+}
+
+
+void PeersChatNetwork::punchLoop() noexcept
+{
+	uint8_t punch = PUNCH;
+	std::vector<PeerAddr> targets;
+	while(this->running)
+	{
+		// Done with the ones we heard from, gone or given up on
+		targets.clear();
+		{
+			std::lock_guard<std::mutex> lock(this->punch_lock);
+			steady_clock::time_point now = steady_clock::now();
+			for(auto it = this->punching.begin(); it != this->punching.end(); )
+			{
+				NPeer *peer = (*this)[it->addr];
+				if(!peer || NPeerAttorney::lastHeard(peer) > it->since || now - it->since > PUNCH_DURATION)
+				{
+					it = this->punching.erase(it);
+					continue;
+				}
+				targets.push_back(it->addr);
+				++it;
+			}
+
+			// Cleared under the lock so punch() either sees it or we see its peer
+			if(targets.empty())
+			{
+				this->punch_scheduled = false;
+				return;
+			}
+		}
+
+		for(const PeerAddr &addr : targets)
+			NPeerAttorney::sendUDP(&punch, 1, addr);
+		std::this_thread::sleep_for(PUNCH_INTERVAL);
+	}
+	this->punch_scheduled = false;
 }
 
 
@@ -1095,43 +2167,168 @@ void PeersChatNetwork::receive_audio_thread()
 	uint8_t buffer[BUFFER_SIZE];
 
 	ssize_t r = 0;
-	sockaddr_in addr;
-	socklen_t addr_size = sizeof(addr);
+	PeerAddr addr;
+	steady_clock::time_point next_gossip = steady_clock::now();
 	while(running)
 	{
-		memset(&addr, 0, sizeof(addr));
+		// Heartbeat -- recvfrom() times out every GOSSIP_INTERVAL so this keeps going
+		// when nobody is talking
+		if(steady_clock::now() >= next_gossip)
+		{
+			next_gossip += GOSSIP_INTERVAL;
+			this->gossipTick();
+			this->checkLiveness();
+			this->retryNames();
+		}
 
 		// Receive Packet
-		r = recvfrom(NPeerAttorney::getUDP(), buffer, BUFFER_SIZE,
-		             MSG_WAITALL, (sockaddr*) &addr, &addr_size);
-		if(r < 0) continue;
-		if(buffer[0] != SENDV) continue;
+		r = NPeerAttorney::recvUDP(buffer, BUFFER_SIZE, addr);
+		if(r < 1) continue;
+		steady_clock::time_point arrival = steady_clock::now();
+
+		// Membership
+		if(buffer[0] == GOSSIP)
+		{
+			this->gossipReceive(addr, buffer, r);
+			continue;
+		}
+		else if(buffer[0] == REBIND)
+		{
+			this->rebindReceive(addr, buffer, r);
+			continue;
+		}
+
+		// NAT Traversal -- Tell anyone where they came from, note who punched through
+		if(buffer[0] == BIND)
+		{
+			uint8_t reply[BOUND6_SIZE];
+			size_t n = nat_write_bound(reply, buffer, r, addr);
+			if(n > 0)
+				NPeerAttorney::sendUDP(reply, n, addr);
+			continue;
+		}
+		else if(buffer[0] == PUNCH)
+		{
+			NPeer *from = (*this)[addr];
+			if(from) NPeerAttorney::heard(from, arrival);
+			continue;
+		}
+
+		// Sort -- SENDA/SENDE route on stream id, SENDV on source address.  Sealed audio
+		// is opened back into SENDA right here; once a peer's sealed audio opened, its
+		// plain audio isn't played any more.
+		NPeer *peer = NULL;
+		if((buffer[0] == SENDA || buffer[0] == SENDE) && r > SENDA_HEADER_SIZE)
+		{
+			if((buffer[1] >> 6) != AUDIO_WIRE_VERSION) continue;
+			peer = this->findSID(buffer[6]);
+			if(peer && buffer[0] == SENDA && NPeerAttorney::strict(peer)) continue;
+			if(peer && buffer[0] == SENDE && (r = NPeerAttorney::open(peer, buffer, r)) < 0) continue;
+
+			// One of ours from somewhere else -- Maybe they moved, ask them to prove it.
+			// Sealed ones got here only if they opened, so forgeries can't make us ask.
+			if(peer && !(*peer == addr))
+			{
+				this->rebindChallenge(peer, addr);
+				peer = NULL;
+			}
+		}
+		else if(buffer[0] == SENDV && r > SENDV_HEADER_SIZE)
+		{
+			peer = (*this)[addr];
+			if(peer && NPeerAttorney::strict(peer)) continue;
+		}
+		else continue;
 
-		// Sort
-		NPeer *peer = (*this)[addr];
 		if(!peer)
 		{
 			#ifdef NET_DEBUG
-			char str[INET_ADDRSTRLEN+1] = {0};
-			inet_ntop(AF_INET, &addr.sin_addr, str, INET_ADDRSTRLEN);
-			std::cout << "Packet from unknown source " << str << ":" << ntohs(addr.sin_port) << std::endl;
+			std::cout << "Packet from unknown source " << addr.str() << std::endl;
 			#endif
 			continue;
 		}
 
-		// Peer is Muted
-		if(peer->getMute()) continue;
+		NPeerAttorney::heard(peer, arrival);
+
+		// Trace it as it arrived, before any parsing
+		TraceWriter *t = this->trace_active.load();
+		if(t) t->write(peer->getID(), buffer, r, arrival);
+
+		// Parse Header
+		uint32_t id, timestamp = 0, len;
+		uint8_t flags = 0;
+		const uint8_t *payload;
+		if(buffer[0] == SENDA)
+		{
+			id      = NPeerAttorney::extendSequence(peer, (buffer[2] << 8) | buffer[3],
+			                                        (buffer[4] << 8) | buffer[5], timestamp);
+			NPeerAttorney::updateJitter(peer, timestamp, arrival);
+			flags   = buffer[1] & 0x3F;
+			len     = r - SENDA_HEADER_SIZE;
+			payload = buffer + SENDA_HEADER_SIZE;
+		}
+		else
+		{
+			id      = (buffer[1] << 24) | (buffer[2] << 16) | (buffer[3] << 8) | (buffer[4]);
+			len     = (buffer[5] << 24) | (buffer[6] << 16) | (buffer[7] << 8) | (buffer[8]);
+			payload = buffer + SENDV_HEADER_SIZE;
+			if(len > (uint32_t) (r - SENDV_HEADER_SIZE)) continue;
+		}
 
-		// Get Empty Packet
-		std::unique_ptr<AudioInPacket> pack(peer->getEmptyInPacket());
+		// Unbundle -- [count] [ticks per frame] [lengths...] [frames...]
+		uint16_t lengths[AUDIO_MAX_BUNDLE] = {0};
+		uint32_t count = 1, step = 0;
+		lengths[0] = (uint16_t) len;
+		if(flags & AUDIO_BUNDLE)
+		{
+			const uint8_t *end = payload + len;
+			if(len < 2) continue;
+			count = payload[0];
+			step  = payload[1] * AUDIO_TS_UNIT;
+			payload += 2;
+			if(count < 1 || count > AUDIO_MAX_BUNDLE) continue;
+
+			// Every length but the last has to be there, both bytes of the long ones --
+			// A truncated bundle is dropped whole
+			uint32_t total = 0, parsed = 0;
+			while(parsed < count - 1 && payload < end)
+			{
+				uint16_t length = *payload++;
+				if(length >= 252)
+				{
+					if(payload == end) break;
+					length += 4 * (*payload++);
+				}
+				lengths[parsed++] = length;
+				total += length;
+			}
+			if(parsed != count - 1 || total > (uint32_t) (end - payload)) continue;
+			lengths[count - 1] = (uint16_t) (end - payload - total);
+			flags &= ~AUDIO_BUNDLE;
+		}
 
-		// Set Packet ID, Packet Length, and Copy Data
-		pack->packet_id  = (buffer[1] << 24) | (buffer[2] << 16) | (buffer[3] << 8) | (buffer[4]);
-		pack->packet_len = (buffer[5] << 24) | (buffer[6] << 16) | (buffer[7] << 8) | (buffer[8]);
-		std::memcpy(pack->packet.get(), buffer + 9, pack->packet_len);
+		// Peer is Muted
+		if(peer->getMute()) continue;
 
-		// Queue
-		peer->enqueue_in(pack.release());
+		for(uint32_t i = 0; i < count; ++i)
+		{
+			// Get Empty Packet
+			std::unique_ptr<AudioInPacket> pack(peer->getEmptyInPacket());
+
+			// Set Packet ID, Packet Length, and Copy Data
+			pack->packet_id  = id + i;
+			pack->packet_len = lengths[i];
+			pack->timestamp  = timestamp + i * step;
+			pack->flags      = flags;
+			std::memcpy(pack->packet.get(), payload, pack->packet_len);
+			payload += lengths[i];
+
+			// Queue
+			if(pack->packet_len > 0)
+				peer->enqueue_in(pack.release());
+			else
+				peer->retireEmptyInPacket(pack.release());
+		}
 	}
 }
 
@@ -1140,21 +2337,23 @@ void PeersChatNetwork::listen_on_tcp_thread()
 {
 	int peer = -1;
 	uint8_t buffer[BUFFER_SIZE];
-	sockaddr_in addr;
-	socklen_t addr_size = sizeof(addr);
+	sockaddr_storage storage;
+	socklen_t addr_size;
+	PeerAddr addr;
 	while(running)
 	{
 		if(peer > 0) close(peer);
 		peer = -1;
 
 		// Accept connection
-		std::memset((void*) &addr, 0, addr_size);
-		if((peer = accept(tcp_listen, (sockaddr*) &addr, &addr_size)) < 0)
+		addr_size = sizeof(storage);
+		if((peer = accept(tcp_listen, (sockaddr*) &storage, &addr_size)) < 0)
 		{
 			if(errno == EAGAIN) continue;
 			perror("PeersChatNetwork::listen_on_tcp_thread() accept");
 			continue;
 		}
+		if(!PeerAddr::from(storage, addr_size, addr)) continue;
 
 		// Get Req Type
 		if(1 != recv_timeout(peer, buffer, 1, MSG_WAITALL)) continue;
@@ -1162,27 +2361,27 @@ void PeersChatNetwork::listen_on_tcp_thread()
 		// Handle Req Type
 		if(buffer[0] == CONNECT) //--------------------------------------------------
 		{
-			if(2 != recv_timeout(peer, &addr.sin_port, 2, MSG_WAITALL)) continue;
+			if(2 != recv_timeout(peer, &addr.port, 2, MSG_WAITALL)) continue;
 
 			#ifdef NET_DEBUG
-			inet_ntop(AF_INET, &addr.sin_addr, (char*)buffer, 50);
-			printf("CONNECT Request from %s:%" PRIu16 "\n", buffer, ntohs(addr.sin_port));
+			printf("CONNECT Request from %s\n", addr.str().c_str());
 			#endif
 			connectFulfill(peer, addr);
 		}
-		else if(buffer[0] == PROPOSE) //---------------------------------------------
+		else if(buffer[0] == PROPOSE || buffer[0] == PROPOSE6) //--------------------
 		{
 			#ifdef NET_DEBUG
-			if(inet_ntop(AF_INET, &addr.sin_addr, (char*) buffer, 50) == NULL) continue;
+			std::string proposer = addr.str();
 			#endif
 
-			recv_timeout(peer, &addr.sin_addr.s_addr, 4, MSG_WAITALL);
-			recv_timeout(peer, &addr.sin_port, 2, MSG_WAITALL);
+			// Who they'd like to add -- An IPv4 address the old way, or any address
+			ssize_t size = (buffer[0] == PROPOSE6) ? PEER_ADDR_SIZE : PEER_ADDR_V4_SIZE;
+			if(size != recv_timeout(peer, buffer + 1, size, MSG_WAITALL)) continue;
+			if(buffer[0] == PROPOSE6) addr.read(buffer + 1);
+			else addr.readV4(buffer + 1);
 
 			#ifdef NET_DEBUG
-			printf("PROPOSE Request from %s to add ", buffer);
-			if(inet_ntop(AF_INET, &addr.sin_addr, (char*) buffer, 50) == NULL) continue;
-			printf("%s:%" PRIu16 "\n", buffer, ntohs(addr.sin_port));
+			printf("PROPOSE Request from %s to add %s\n", proposer.c_str(), addr.str().c_str());
 			#endif
 
 			proposeFulfill(peer, addr);
@@ -1190,22 +2389,20 @@ void PeersChatNetwork::listen_on_tcp_thread()
 		else if(buffer[0] == DISCONNECT) //------------------------------------------
 		{
 			#ifdef NET_DEBUG
-			inet_ntop(AF_INET, &addr.sin_addr, (char*)buffer, INET_ADDRSTRLEN+10);
-			fprintf(stderr, "DISCONNECT Req recv'd from %s:%" PRIu16 "\n", buffer, ntohs(addr.sin_port));
+			fprintf(stderr, "DISCONNECT Req recv'd from %s\n", addr.str().c_str());
 			#endif
 
-			if(2 != recv_timeout(peer, &addr.sin_port, 2, MSG_WAITALL)) continue;
+			if(2 != recv_timeout(peer, &addr.port, 2, MSG_WAITALL)) continue;
 			removePeer(addr);
 		}
 		else if(buffer[0] == REQN) //------------------------------------------------
 		{
 			// Get Data and Find Peer
-			if(2 != recv_timeout(peer, &addr.sin_port, 2, MSG_WAITALL)) continue;
+			if(2 != recv_timeout(peer, &addr.port, 2, MSG_WAITALL)) continue;
 			NPeer *peer_ptr = (*this)[addr];
 
 			#ifdef NET_DEBUG
-			inet_ntop(AF_INET, &addr.sin_addr, (char*)std::memset(buffer, 0, INET_ADDRSTRLEN+1) , INET_ADDRSTRLEN);
-			printf("REQN request from %s:%" PRIu16 "\n", buffer, ntohs(addr.sin_port));
+			printf("REQN request from %s\n", addr.str().c_str());
 			#endif
 
 			// Requester is not affiliated with you
@@ -1215,13 +2412,52 @@ void PeersChatNetwork::listen_on_tcp_thread()
 				continue;
 			}
 
-			// Send them your name
+			// Send them your name followed by audio header version, their stream id
+			// and the token we'll prove ourselves with if we move
 			std::string name = this->getMyName();
+			SessionToken token = NPeerAttorney::ourToken(peer_ptr);
 			buffer[0] = SENDN;
 			buffer[1] = (uint8_t) name.length();
 			for(int i = 0; i < buffer[1]; ++i)
 				buffer[2 + i] = name[i];
-			send_timeout(peer, buffer, 2 + buffer[1], MSG_NOSIGNAL);
+			buffer[2 + buffer[1]] = AUDIO_WIRE_VERSION;
+			buffer[3 + buffer[1]] = NPeerAttorney::getRxSID(peer_ptr);
+			std::memcpy(buffer + 4 + buffer[1], token.bytes, SESSION_TOKEN_SIZE);
+			ssize_t len = 4 + buffer[1] + SESSION_TOKEN_SIZE;
+			send_timeout(peer, buffer, len, MSG_NOSIGNAL);
+		}
+		else if(buffer[0] == KEY) //-------------------------------------------------
+		{
+			// Their port, audio header version, stream id and public key
+			if(4 + CRYPTO_KEY_SIZE != recv_timeout(peer, buffer + 1, 4 + CRYPTO_KEY_SIZE, MSG_WAITALL)) continue;
+			std::memcpy(&addr.port, buffer + 1, 2);
+
+			#ifdef NET_DEBUG
+			printf("KEY request from %s\n", addr.str().c_str());
+			#endif
+
+			// Make our keys before answering, they seal as soon as they have ours.  We
+			// wait for their first SENDE.
+			uint8_t reply[1 + CRYPTO_KEY_SIZE];
+			bool known = false, keyed = false;
+			{
+				std::lock_guard<std::mutex> lock(this->peers_lock);
+				auto it = this->by_addr.find(addr);
+				if((known = (it != this->by_addr.end())))
+					NPeerAttorney::setWire(it->second, buffer[3], buffer[4]);
+				if(known && (keyed = NPeerAttorney::ourKey(it->second, reply + 1)))
+					NPeerAttorney::setTheirKey(it->second, buffer + 5);
+			}
+
+			// Requester is not affiliated with you (yet) -- They ask again
+			if(!known)
+			{
+				std::cerr << "Failed KEY Request: Peer Not Recognized" << std::endl;
+				continue;
+			}
+
+			reply[0] = keyed ? KEY : DENY;
+			send_timeout(peer, reply, keyed ? sizeof(reply) : 1, MSG_NOSIGNAL);
 		} // ------------------------------------------------------------------------
 
 		// End Request
@@ -1230,19 +2466,36 @@ void PeersChatNetwork::listen_on_tcp_thread()
 }
 
 
-bool PeersChatNetwork::connectFulfill(int new_member, sockaddr_in addr)
+bool PeersChatNetwork::connectFulfill(int new_member, PeerAddr addr)
 {
 	bool connect = accept_direct_join && (this->size < MAX_PEERS);
 	if(!connect) return false;
 
+	// Peers that gossip hear about the new guy from us afterwards.  Only the ones that
+	// don't still get asked, over TCP, one at a time.  By address, on sockets of our
+	// own: the control thread can remove any of them while we wait on the rest.
+	std::vector<PeerAddr> members, legacy;
+	{
+		std::lock_guard<std::mutex> lock(this->peers_lock);
+		for(int i = 0; i < this->size; ++i)
+			members.push_back(NPeerAttorney::getDest(this->peers[i].get()));
+	}
+	{
+		std::lock_guard<std::mutex> lock(this->gossip_lock);
+		for(const PeerAddr &member : members)
+			if(!this->gossip.gossips(member))
+				legacy.push_back(member);
+	}
+
 	// Open TCP to peers
 	std::vector<int> peer_fd;
-	for(std::unique_ptr<NPeer> &p : this->peers)
+	for(const PeerAddr &member : legacy)
 	{
-		connect &= NPeerAttorney::createTCP(p.get());
+		uint32_t sample;
+		int fd = NPeerAttorney::connectTCP(member, sample);
+		connect &= (fd >= 0);
 		if(!connect) break;
-		peer_fd.push_back(NPeerAttorney::getTCP(p.get()));
-
+		peer_fd.push_back(fd);
 	}
 
 	// Close Them If Failed
@@ -1254,11 +2507,9 @@ bool PeersChatNetwork::connectFulfill(int new_member, sockaddr_in addr)
 		uint8_t buff = CLOSE;
 		for(const int &fd : peer_fd)
 		{
-			if(fd > 0)
-				send_timeout(fd, &buff, 1, MSG_NOSIGNAL);
+			send_timeout(fd, &buff, 1, MSG_NOSIGNAL);
+			close(fd);
 		}
-		for(auto &p : this->peers)
-			NPeerAttorney::destroyTCP(p.get());
 		return false;
 	}
 
@@ -1276,7 +2527,10 @@ bool PeersChatNetwork::connectFulfill(int new_member, sockaddr_in addr)
 
 	// Let Everyone Know The Result
 	for(const int &fd : peer_fd)
+	{
 		respond(connect, fd);
+		close(fd);
+	}
 	respond(connect, new_member);
 
 	// Receive REQP Request
@@ -1287,21 +2541,19 @@ bool PeersChatNetwork::connectFulfill(int new_member, sockaddr_in addr)
 	#ifdef NET_DEBUG
 	std::cout << "REQP Received" << std::endl;
 	#endif
+	if(!connect) return false;
 
 	// SendP
-	sendPeers(new_member);
+	sendPeers(new_member, addr);
 
-	// Add Peer Yourself
+	// Add Peer Yourself and spread the word right away, so most peers know them by the
+	// time they ask for names
 	addPeer(addr);
+	this->gossipTick(true);
 
-	// Get His Name
-	NPeer *peer_ptr = (*this)[addr];
-	if(peer_ptr)
-	{
-		NPeerAttorney::createTCP(peer_ptr);
-		peer_ptr->setName(this->getName(NPeerAttorney::getTCP(peer_ptr)));
-		NPeerAttorney::destroyTCP(peer_ptr);
-	}
+	// Get His Name -- He only listens once he has everyone, so likely later
+	if(!this->getName(addr, false))
+		this->nameLater(addr);
 
 	#ifdef NET_DEBUG
 	std::cout << "Peer Successfully Added" << std::endl;
@@ -1314,7 +2566,7 @@ bool PeersChatNetwork::connectFulfill(int new_member, sockaddr_in addr)
  * Param @peer is a peer you are already connected to asking you if his friend
  * at @addr can join the call.
  */
-bool PeersChatNetwork::proposeFulfill(int peer, sockaddr_in addr)
+bool PeersChatNetwork::proposeFulfill(int peer, PeerAddr addr)
 {
 	// Let him know if his friend can join
 	bool decision = accept_indirect_join && (this->size < MAX_PEERS);
@@ -1335,13 +2587,8 @@ bool PeersChatNetwork::proposeFulfill(int peer, sockaddr_in addr)
 	if(tag == ACCEPT && decision)
 	{
 		addPeer(addr);
-		NPeer *peer_ptr = (*this)[addr];
-		if(peer_ptr)
-		{
-			NPeerAttorney::createTCP(peer_ptr);
-			peer_ptr->setName(this->getName(NPeerAttorney::getTCP(peer_ptr)));
-			NPeerAttorney::destroyTCP(peer_ptr);
-		}
+		if(!this->getName(addr, false))
+			this->nameLater(addr);
 		return true;
 	}
 	else return false;
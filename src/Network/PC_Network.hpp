@@ -17,6 +17,13 @@
  *      AudioPacket.  Don't concern yourself with their differences, the main reason
  *      for the difference in name is to cause a compiler error when you mix them
  *
+ *    PacketTap: Interface for anything that wants to see every encoded audio packet
+ *               going out to or coming in from a peer (the call recorder).
+ *
+ *    RosterListener: Interface for anything that wants to know when peers come, go or
+ *                    tell us their name (the GUI).  Keeps this library free of GTK so
+ *                    it can run headless (PeersChatd).
+ *
  *    NPeer: A class used to maintain communications with a single peer.  Contains several
  *           Queue's to handle Packets going in and out over network.  Ensures that
  *           you don't get packets out of order.  Handles sending audio for you.  Will
@@ -47,7 +54,9 @@
  *
  *   A GUI/Main Thread:  Whatever requests you have you can link to the public functions
  *                       made available to you through the PeersChatNetwork class.  Join,
- *                       host, etc. by calling the respective functions.
+ *                       host, etc. by calling the respective functions.  joinAsync() and
+ *                       hostAsync() return right away and report back through a callback
+ *                       on a network thread, so the GUI never blocks on a slow peer.
  *
  *
  */
@@ -97,22 +106,35 @@ static inline int close(int &x) { return closesocket(x); }
 #include <string>
 #include <vector>
 #include <queue>
+#include <unordered_map>
 #include <functional>
+#include <algorithm>
 #include <memory>
 #include <mutex>
 #include <atomic>
 #include <exception>
 #include <thread>
+#include <future>
 #include <stdio.h>
 #include <errno.h>
 #include "nettypes.hpp"
-#include <PC_Gui.hpp>
+#include "PC_Addr.hpp"
+#include "PC_Jitter.hpp"
+#include "PC_Drift.hpp"
+#include "PC_Trace.hpp"
+#include "PC_Gossip.hpp"
+#include "PC_Session.hpp"
+#include "PC_NAT.hpp"
+#include "PC_Crypto.hpp"
+#include <PC_Thread.hpp>
 
 
 // Pre-Compiler Constants
 #define BUFFER_SIZE 4096
 #define MAX_NAME_LEN 18
 #define MAX_PEERS 5
+#define NET_WORKERS 2
+#define NET_LOOPS 3
 
 
 // Globals
@@ -126,15 +148,26 @@ static inline int close(int &x) { return closesocket(x); }
  * this too long and the program will take longer to close and dead connections will
  * stick around longer.
  *
- * PEER_TIMEOUT is a duration of time that if you haven't received audio from a peer
- * for this long, then the peer will be disconnected.
+ * PEER_TIMEOUT is a duration of time that if you haven't received anything from a peer
+ * (audio, keepalive or gossip heartbeat) for this long, then the peer will be removed.
+ * Gossip usually notices a crash long before this; it is the backstop for peers that
+ * don't gossip.
+ *
+ * KEEPALIVE_INTERVAL: While we are silent (DTX) only one frame this often goes out to
+ * each peer, so they know we are still here without us sending 50 empty frames a second.
  *
  * PORT is the TCP/UDP port that this program will be using
  *
+ * BUNDLE_RTT is the round trip time above which bundling (see setBundling) starts to
+ * pack several frames into one datagram.  Every extra frame in a bundle adds a frame
+ * of latency, so only links that are already slow are worth it.
+ *
 */
 extern std::chrono::milliseconds PACKET_DELAY;
 extern std::chrono::milliseconds SOCKET_TIMEOUT;
 extern std::chrono::milliseconds PEER_TIMEOUT;
+extern std::chrono::milliseconds KEEPALIVE_INTERVAL;
+extern std::chrono::milliseconds BUNDLE_RTT;
 extern uint16_t PORT;
 
 
@@ -148,6 +181,11 @@ extern uint16_t PORT;
  *
  * @member packet_len The size of packet in bytes
  *
+ * @member timestamp  Media time of the first sample in the packet, counted in samples
+ *                    at SAMPLE_RATE.  Set by the audio encoder on outgoing packets.
+ *
+ * @member flags  AUDIOFLAGS bits describing the packet (DTX, FEC, ...)
+ *
  * @member packet  A unique pointer to a buffer meant for containing an encoded
  *                 audio packet from libopus
  *
@@ -158,20 +196,90 @@ struct AudioPacket
 {
 	uint32_t packet_id  = 0;
 	uint16_t packet_len = 0;
+	uint32_t timestamp  = 0;
+	uint8_t  flags      = 0;
 	std::unique_ptr<uint8_t[]> packet = std::make_unique<uint8_t[]>(BUFFER_SIZE);
 	inline bool operator<(const AudioPacket &other) { return this->packet_id < other.packet_id; }
 };
 
 	// Type change for static error checking
-struct AudioInPacket  : public AudioPacket {
-private:
-	std::chrono::time_point<std::chrono::steady_clock> received;
-	friend class NPeer;
-};
+struct AudioInPacket  : public AudioPacket { };
 struct AudioOutPacket : public AudioPacket { };
 
-	// Comparator for std::priority_queue that pops the smallest packet first
-inline bool AudioInPacket_greater(const std::unique_ptr<AudioInPacket> &left, const std::unique_ptr<AudioInPacket> &right) { return !((*left) < (*right)); }
+
+class NPeer;
+
+// PacketTap Interface -------------------------------------------------------------------
+/* PacketTap: Sees every encoded audio packet passed to NPeer::enqueue_out/enqueue_in
+ *
+ * onPacket() is called on the thread that enqueues the packet (the audio thread for
+ * outgoing packets, the receive loop for incoming ones) before the packet is queued.
+ * It must not block and must copy whatever it wants to keep; the packet is recycled
+ * afterwards.  Outgoing packets show up once per peer they are sent to.
+ *
+ * @method onPacket(3)  @param peer (NPeer*) who the packet is going to/coming from
+ *                     @param incoming (bool) from the peer?
+ *                     @param packet (const AudioPacket&) the packet
+ */
+class PacketTap
+{
+public:
+	virtual ~PacketTap() { }
+	virtual void onPacket(NPeer *peer, bool incoming, const AudioPacket &packet) noexcept = 0;
+};
+
+
+// RosterListener Interface --------------------------------------------------------------
+/* RosterListener: Told whenever the set of peers or a peer's name changes
+ *
+ * Called on whatever network thread made the change (listen loop, join worker) with
+ * the peer still alive.  Must not block or call back into the network (a rename comes
+ * with the peer list locked) and must copy what it wants to keep; the NPeer may be
+ * destroyed right after onPeerRemoved() returns.
+ *
+ * @method onPeerAdded(1)  @param peer (NPeer*) joined the call
+ *
+ * @method onPeerRemoved(1)  @param peer (NPeer*) left the call
+ *
+ * @method onPeerRenamed(1)  @param peer (NPeer*) whose name changed
+ */
+class RosterListener
+{
+public:
+	virtual ~RosterListener() { }
+	virtual void onPeerAdded(NPeer *peer) noexcept = 0;
+	virtual void onPeerRemoved(NPeer *peer) noexcept = 0;
+	virtual void onPeerRenamed(NPeer *peer) noexcept = 0;
+};
+
+
+// Join Progress -------------------------------------------------------------------------
+/* JoinStage: How far a joinAsync()/hostAsync() got, passed to its JoinCallback
+ *
+ *   JOIN_CONNECTING  Opening a TCP connection to the peer we were given
+ *   JOIN_WAITING     Asked to CONNECT, waiting for the call to let us in
+ *   JOIN_PEERS       Let in, getting the list of everyone else in the call
+ *   JOIN_STARTED     In the call and the network is running -- audio can start
+ *   JOIN_DONE        Everyone's name is in (last stage of a successful join/host)
+ *   JOIN_FAILED      Couldn't join/host, nothing is running (last stage)
+ *   JOIN_CANCELLED   cancelJoin() stopped it before JOIN_STARTED, nothing is running
+ *                    (last stage)
+ *
+ * Hosting goes straight to JOIN_STARTED.  The callback runs on the network's control
+ * thread, so it must not block and has to hand anything touching the GUI over to the
+ * main loop.
+ */
+enum JoinStage
+{
+	JOIN_CONNECTING,
+	JOIN_WAITING,
+	JOIN_PEERS,
+	JOIN_STARTED,
+	JOIN_DONE,
+	JOIN_FAILED,
+	JOIN_CANCELLED
+};
+typedef std::function<void(JoinStage)> JoinCallback;
 
 
 // NPeer Class ---------------------------------------------------------------------------
@@ -181,9 +289,26 @@ inline bool AudioInPacket_greater(const std::unique_ptr<AudioInPacket> &left, co
 Members:
  * tcp  TCP socket to connect to this NPeer to ask some sort of request
  *
- * udp  (static) UDP socket to send audio to Peers
+ * udp  (static) UDP socket to send audio to Peers.  Dual-stack unless IPv6 is off.
  *
- * destination  Address to this Peer
+ * udp_family  (static) AF_INET6 if @udp is dual-stack, AF_INET if it is IPv4 only
+ *
+ * destination  Address to this Peer, IPv4 or IPv6 (PC_Addr.hpp).  Changes if the peer
+ *              moves (see PC_Session.hpp).
+ *
+ * token  Session token the peer handed us in its SENDN, proves it is them when their
+ *        address changes
+ *
+ * our_token  Session token we hand the peer in our SENDN, made the first time they ask
+ *
+ * session_lock  Lock on @destination, the tokens and setting up @cipher, which the
+ *               receive loop changes while workers send
+ *
+ * cipher  Keys, counters and replay window for sealed audio with this peer
+ *         (PC_Crypto.hpp)
+ *
+ * encrypting  (static) Do we hand out a public key and seal audio?  Off only takes
+ *             effect for peers added afterwards.
  *
  * pname  Peer Name
  *
@@ -191,7 +316,15 @@ Members:
  *
  * muted  Are we ignoring/muting the peer?
  *
- * in_packets  Priority Queue of packets that are received from this peer
+ * gain  Playback volume multiplier for this peer
+ *
+ * tx_wire  Audio header version negotiated with this peer (0 = legacy SENDV) in the
+ *          high byte, stream id the peer asked us to stamp on audio we send them in the
+ *          low byte
+ *
+ * rx_sid  Stream id we asked the peer to stamp on audio they send us
+ *
+ * in_packets  Jitter buffer of packets that are received from this peer (PC_Jitter.hpp)
  *
  * in_queue_lock  Lock on the above for atomicity
  *
@@ -201,6 +334,10 @@ Members:
  *
  * in_packet_id  The id of the last packet that was returned by getAudioInPacket()
  *
+ * in_highest_id  Highest (extended) packet id received from the peer so far
+ *
+ * in_highest_ts  Highest (extended) timestamp in AUDIO_TS_UNIT ticks received so far
+ *
  * out_packets  Queue of packets that are going to be sent out over network
  *
  * out_queue_lock  Lock on the above
@@ -211,22 +348,64 @@ Members:
  *
  * out_packet_id  The id to stamp onto the next AudioOutPacket passed to @enqueue_out
  *
- * run_thread  Is this class running?  AKA are we receiving audio and listening on tcp?
+ * run_thread  Is the net stream on?  AKA are we sending audio to this peer?
+ *
+ * workers  (static) Pool the network's tasks run on.  Set by PeersChatNetwork.
+ *
+ * tap  (static) PacketTap shown every packet at @enqueue_out/@enqueue_in, or NULL
+ *
+ * roster  (static) RosterListener told about joins/leaves/renames, or NULL
+ *
+ * flush_scheduled  Is a task that sends @out_packets already queued on @workers?
+ *
+ * out_pending  Packets taken off @out_packets that wait to be bundled
+ *
+ * out_pending_count  Number of packets in @out_pending.  Set by the send task, read by
+ *                    the audio thread to know a bundle is waiting on its deadline.
+ *
+ * out_pending_since  When the oldest packet in @out_pending was taken
  *
  * out_packet_count  The number of AudioOutPacket objects that are queue'd out.
  *
+ * out_dtx  Was the last frame we let out a DTX frame?  Audio thread only.
+ *
+ * out_sent_at  When the last frame was let out.  Audio thread only.
+ *
+ * bundling  (static) Are we allowed to bundle several frames into one datagram?
+ *
+ * rtt_us  Smoothed round trip time to the peer in microseconds, measured on TCP connect
+ *
+ * in_received/in_lost  Packets received from/lost by the peer, decayed over time
+ *
+ * in_transit  Arrival time minus media time (us) of the last SENDA datagram
+ *
+ * in_jitter  Interarrival jitter (RFC 3550 6.4.1) in 1/16 us, receive loop only
+ *
+ * jitter_us  @in_jitter in microseconds, for everyone else
+ *
+ * drift  Fit of the peer's clock against ours (PC_Drift.hpp), receive loop only
+ *
+ * drift_ppm  @drift's estimate, for everyone else
+ *
+ * in_slack  How long popped packets waited past PACKET_DELAY lately, in us, -1 before
+ *           the first.  Audio thread only.
+ *
+ * heard_at  When anything last arrived from the peer (steady clock ticks).  Starts at
+ *           construction so new peers get a full PEER_TIMEOUT.
+ *
  *
 (CLIENT INTERFACE)
 Constructors:
  * @constructor NPeer(2)  Constructor that initializes address structure for peer
  *                        destination.
- *                      @param ip: (const char*)  IP address in standard string format
- *                                   Ex: 192.168.1.120 or 127.0.0.1 or ...
+ *                      @param ip: (const char*)  IPv4 or IPv6 address in standard string
+ *                                   format
+ *                                   Ex: 192.168.1.120 or 127.0.0.1 or 2001:db8::5 or ...
  *                      @param port: (const uint16_t)  Destination port number in host
  *                              byte order
  *                              Ex: 8080
  *
- * @constructor NPeer(1)  Same as above but if you already created a sockaddr
+ * @constructor NPeer(1)  Same as above but if you already have a PeerAddr
  *
  *
 Public Methods:
@@ -245,6 +424,35 @@ Public Methods:
  * @method getMute()  Method that tells you if the peer is muted or not
  *                   @return (bool) are they muted?
  *
+ * @method setGain(1)  Set the playback volume multiplier for this peer.  Safe to call
+ *                     from any thread, the mixer ramps to the new value.
+ *                    @param x (float) 0.0 - 2.0
+ *
+ * @method getGain()  Get the playback volume multiplier for this peer
+ *                   @return (float)
+ *
+ * @method getRTT()  Smoothed round trip time to the peer
+ *                  @return (uint32_t) microseconds, 0 if never measured
+ *
+ * @method getLoss()  Fraction of packets from this peer that never showed up
+ *                   @return (float) 0.0 - 1.0
+ *
+ * @method getJitter()  How much the peer's packets vary in transit time.  Only known
+ *                      for peers on SENDA.
+ *                     @return (uint32_t) microseconds, 0 if not known
+ *
+ * @method getDrift()  How much slower the peer's clock runs than ours (PC_Drift.hpp).
+ *                     Only known for peers on SENDA.
+ *                    @return (float) ppm, 0 if not known
+ *
+ * @method getPlayoutRate()  How many samples to play per sample the peer sent so its
+ *                           jitter buffer neither fills up nor runs dry: the drift,
+ *                           plus a nudge toward packets waiting half a frame and a few
+ *                           times the jitter past PACKET_DELAY, for whatever the drift
+ *                           misses (our own sound card included).  Call from the
+ *                           thread that calls @getAudioInPacket.
+ *                          @return (double) 1 +/- DRIFT_MAX_PPM / 10^6
+ *
  * @method getEmptyOutPacket()  Method that returns an @AudioOutPacket.  Packet may have
  *                              junk/old data in it.  @AudioOutPacket returned should be
  *                              passed to @enqueue_out after being populated with audio
@@ -253,13 +461,17 @@ Public Methods:
  *                              given to the client to be populated with audio/mic data.
  *
  * @method enqueue_out(1)  Enqueue's encoded audio packet in the form of @AudioOutPacket
- *                         for the purposes of being sent to peer through @udp socket
+ *                         for the purposes of being sent to peer through @udp socket.
+ *                         DTX frames after the first are dropped (recycled) except for
+ *                         one every KEEPALIVE_INTERVAL; they take no sequence number.
  *                       @param packet: (AudioOutPacket*)  A pointer to an AudioOutPacket
  *                               that is populated with audio data from client.
  *
- * @method startNetStream()  Method that starts thread to output audio on @udp to peer
+ * @method startNetStream()  Method that starts outputting audio on @udp to peer.  The
+ *                           sending happens on the network's worker pool.
  *
- * @method stopNetStream()  Method that stops thread outputting audio on @udp to peer
+ * @method stopNetStream()  Method that stops outputting audio on @udp to peer.  Waits
+ *                          only for a send that is already in progress.
  *
  * @method getEmptyInPacket()  Method that returns a @AudioInPacket.  Packet may contain
  *                             junk data.  Should be populated with opus data from peer.
@@ -297,8 +509,8 @@ Public Methods:
  *
 Operators:
  * @operator ==(1)  Equivalence operator.  Compare an address to see if this NPeer routes
- *                  to that address.
- *                 @param addr (sockaddr_in)  Adress you want to check equivalence with
+ *                  to that address (the one it was last rebound to).
+ *                 @param addr (PeerAddr)  Adress you want to check equivalence with
  *                 @return (bool) true if the addresses match, false otherwise
  *
  */
@@ -309,34 +521,65 @@ private:
 		// Network
 	int tcp = -1;
 	static int udp;
-	sockaddr_in destination;
+	static int udp_family;
+	PeerAddr destination;
+	SessionToken token;
+	SessionToken our_token;
+	std::mutex session_lock;
+	AudioCipher cipher;
+	static std::atomic<bool> encrypting;
 		// Identification
 	char pname[MAX_NAME_LEN+1];
 	int ID;
-	bool muted = false;
+	std::atomic<bool> muted = {false};
+	std::atomic<float> gain = {1.0f};
+	std::atomic<uint16_t> tx_wire = {0};
+	uint8_t rx_sid = 0;
 		// Audio Incoming
-	std::priority_queue<std::unique_ptr<AudioInPacket>,
-	                    std::vector<std::unique_ptr<AudioInPacket>>,
-	                    std::function<bool(std::unique_ptr<AudioInPacket>&, std::unique_ptr<AudioInPacket>&)>> in_packets;
+	JitterBuffer<AudioInPacket> in_packets;
 	std::mutex in_queue_lock;
 	std::queue<std::unique_ptr<AudioInPacket>> in_bucket;
 	std::mutex in_bucket_lock;
 	uint32_t in_packet_id = 0;
+	uint32_t in_highest_id = 0;
+	uint32_t in_highest_ts = 0;
+	bool in_seen = false;
 		// Audio Outgoing
 	std::queue<std::unique_ptr<AudioOutPacket>> out_packets;
 	std::mutex out_queue_lock;
 	std::queue<std::unique_ptr<AudioOutPacket>> out_bucket;
 	std::mutex out_bucket_lock;
 	uint32_t out_packet_id = 1;
-	bool run_thread = false;
+	std::atomic<bool> run_thread = {false};
 	std::atomic<int> out_packet_count = {0};
+	bool out_dtx = false;
+	std::chrono::steady_clock::time_point out_sent_at;
+	static std::atomic<bool> bundling;
+	static WorkerPool *workers;
+	static std::atomic<PacketTap*> tap;
+	static std::atomic<RosterListener*> roster;
+	std::atomic<bool> flush_scheduled = {false};
+	AudioOutPacket *out_pending[AUDIO_MAX_BUNDLE];
+	std::atomic<int> out_pending_count = {0};
+	std::chrono::steady_clock::time_point out_pending_since;
+		// Link Quality
+	std::atomic<uint32_t> rtt_us = {0};
+	std::atomic<uint32_t> in_received = {0};
+	std::atomic<uint32_t> in_lost = {0};
+	int64_t in_transit = 0;
+	int64_t in_jitter = -1;
+	std::atomic<uint32_t> jitter_us = {0};
+	DriftEstimator drift;
+	std::atomic<float> drift_ppm = {0.0f};
+	float in_slack = -1.0f;
+	std::atomic<std::chrono::steady_clock::rep> heard_at;
 
 	// Constructor
 private:
 	NPeer() noexcept;
 public:
 	NPeer(const char* ip, const uint16_t &port);
-	NPeer(const sockaddr_in &addr) noexcept;
+	NPeer(const PeerAddr &addr) noexcept;
 	~NPeer() noexcept;
 
 	// Name/ID/Mute
@@ -345,6 +588,13 @@ public:
 	inline int getID() noexcept { return this->ID; }
 	inline void setMute(bool x) noexcept { this->muted = x; }
 	inline bool getMute() noexcept { return this->muted; }
+	inline void setGain(float x) noexcept { if(x >= 0.0f && x <= 2.0f) this->gain = x; }
+	inline float getGain() noexcept { return this->gain; }
+	inline uint32_t getRTT() noexcept { return this->rtt_us.load(); }
+	float getLoss() noexcept;
+	inline uint32_t getJitter() noexcept { return this->jitter_us.load(); }
+	inline float getDrift() noexcept { return this->drift_ppm.load(); }
+	double getPlayoutRate() noexcept;
 
 
 	// Sending Audio -- All the functions you need to send audio
@@ -361,20 +611,40 @@ public:
 	inline uint32_t getInPacketId() noexcept { return in_packet_id; }
 
 	// Equivalence Operator
-	bool operator==(const sockaddr_in &addr) noexcept;
+	bool operator==(const PeerAddr &addr) noexcept;
 
-	// Outgoing Audio Network Thread w/ Sending Audio Functions
+	// Outgoing Audio Network Tasks w/ Sending Audio Functions
 private:
-	std::unique_ptr<std::thread> audio_out_thread;
 	static bool create_udp_socket() noexcept;
+	static int connect_tcp(const PeerAddr &dest, uint32_t &rtt_sample) noexcept;
+	static ssize_t send_udp(const void *buffer, size_t len, const PeerAddr &to) noexcept;
+	static ssize_t recv_udp(void *buffer, size_t len, PeerAddr &from) noexcept;
 	AudioOutPacket* getAudioOutPacket() noexcept;
 	void retireEmptyOutPacket(AudioOutPacket *packet) noexcept;
-	void send_audio_over_network_thread() noexcept;
+	int bundleFrames(uint8_t wire_version) noexcept;
+	void scheduleFlush() noexcept;
+	void flush_out() noexcept;
+	bool send_pending() noexcept;
 
 	// Connections over TCP
 	bool createTCP();
 	void destroyTCP();
-	inline sockaddr_in getDest() { return destination; }
+	void sampleRTT(uint32_t sample) noexcept;
+	inline PeerAddr getDest() { std::lock_guard<std::mutex> lock(this->session_lock); return destination; }
+	void rebind(const PeerAddr &addr) noexcept;
+	void setToken(const uint8_t *bytes) noexcept;
+	bool hasToken() noexcept;
+	bool checkToken(uint64_t nonce, uint64_t mac) noexcept;
+	SessionToken ourToken() noexcept;
+	bool ourKey(uint8_t *out) noexcept;
+	void setTheirKey(const uint8_t *key) noexcept;
+	void confirmKey() noexcept;
+	uint32_t extendSequence(uint16_t seq, uint16_t ticks, uint32_t &timestamp) noexcept;
+	void updateJitter(uint32_t timestamp, std::chrono::steady_clock::time_point arrival) noexcept;
+	inline void heard(std::chrono::steady_clock::time_point t) noexcept { this->heard_at = t.time_since_epoch().count(); }
+	inline std::chrono::steady_clock::time_point lastHeard() noexcept {
+		return std::chrono::steady_clock::time_point(std::chrono::steady_clock::duration(this->heard_at.load()));
+	}
 
 	static int id_counter;
 	friend class NPeerAttorney;
@@ -400,7 +670,15 @@ class NPeerAttorney
 		peer->destroyTCP();
 	}
 
-	static inline sockaddr_in getDest(NPeer *peer) {
+	static inline int connectTCP(const PeerAddr &dest, uint32_t &rtt_sample) {
+		return NPeer::connect_tcp(dest, rtt_sample);
+	}
+
+	static inline void sampleRTT(NPeer *peer, uint32_t sample) {
+		peer->sampleRTT(sample);
+	}
+
+	static inline PeerAddr getDest(NPeer *peer) {
 		return peer->getDest();
 	}
 
@@ -408,15 +686,132 @@ class NPeerAttorney
 		return NPeer::udp;
 	}
 
+	static inline ssize_t sendUDP(const void *buffer, size_t len, const PeerAddr &to) {
+		return NPeer::send_udp(buffer, len, to);
+	}
+
+	static inline ssize_t recvUDP(void *buffer, size_t len, PeerAddr &from) {
+		return NPeer::recv_udp(buffer, len, from);
+	}
+
+	static inline bool createUDP() {
+		return NPeer::udp > 0 || NPeer::create_udp_socket();
+	}
+
 	static inline void destroyUDP() {
 		if(NPeer::udp > 0) close(NPeer::udp);
 		NPeer::udp = -1;
 	}
 
+	static inline void wakeUDP() {
+		if(NPeer::udp > 0) shutdown(NPeer::udp, SHUT_RD);
+	}
+
+	static inline void setWorkers(WorkerPool *pool) {
+		NPeer::workers = pool;
+	}
+
 	static inline int getTCP(NPeer *peer) {
 		return peer->tcp;
 	}
 
+	static inline uint8_t getRxSID(NPeer *peer) {
+		return peer->rx_sid;
+	}
+
+	static inline void setRxSID(NPeer *peer, uint8_t sid) {
+		peer->rx_sid = sid;
+	}
+
+	static inline void setWire(NPeer *peer, uint8_t version, uint8_t sid) {
+		version = (version < AUDIO_WIRE_VERSION) ? version : AUDIO_WIRE_VERSION;
+		peer->tx_wire = (uint16_t) ((version << 8) | sid);
+	}
+
+	static inline void setBundling(bool x) {
+		NPeer::bundling = x;
+	}
+
+	static inline void setTap(PacketTap *tap) {
+		NPeer::tap = tap;
+	}
+
+	static inline void setRoster(RosterListener *roster) {
+		NPeer::roster = roster;
+	}
+
+	static inline RosterListener* getRoster() {
+		return NPeer::roster.load();
+	}
+
+	static inline uint32_t extendSequence(NPeer *peer, uint16_t seq, uint16_t ticks, uint32_t &timestamp) {
+		return peer->extendSequence(seq, ticks, timestamp);
+	}
+
+	static inline void updateJitter(NPeer *peer, uint32_t timestamp, std::chrono::steady_clock::time_point arrival) {
+		peer->updateJitter(timestamp, arrival);
+	}
+
+	static inline void heard(NPeer *peer, std::chrono::steady_clock::time_point t) {
+		peer->heard(t);
+	}
+
+	static inline std::chrono::steady_clock::time_point lastHeard(NPeer *peer) {
+		return peer->lastHeard();
+	}
+
+	static inline void rebind(NPeer *peer, const PeerAddr &addr) {
+		peer->rebind(addr);
+	}
+
+	static inline void setToken(NPeer *peer, const uint8_t *bytes) {
+		peer->setToken(bytes);
+	}
+
+	static inline bool hasToken(NPeer *peer) {
+		return peer->hasToken();
+	}
+
+	static inline bool checkToken(NPeer *peer, uint64_t nonce, uint64_t mac) {
+		return peer->checkToken(nonce, mac);
+	}
+
+	static inline SessionToken ourToken(NPeer *peer) {
+		return peer->ourToken();
+	}
+
+	static inline bool ourKey(NPeer *peer, uint8_t *out) {
+		return peer->ourKey(out);
+	}
+
+	static inline void setTheirKey(NPeer *peer, const uint8_t *key) {
+		peer->setTheirKey(key);
+	}
+
+	static inline void confirmKey(NPeer *peer) {
+		peer->confirmKey();
+	}
+
+	static inline bool sealed(NPeer *peer) {
+		return peer->cipher.sealed() && (peer->tx_wire.load() >> 8) >= 1;
+	}
+
+	static inline bool strict(NPeer *peer) {
+		return peer->cipher.strict();
+	}
+
+	static inline ssize_t open(NPeer *peer, uint8_t *datagram, size_t len) {
+		return peer->cipher.open(datagram, len);
+	}
+
+	static inline void setEncrypting(bool x) {
+		NPeer::encrypting = x;
+	}
+
+	static inline bool getEncrypting() {
+		return NPeer::encrypting;
+	}
+
 
 	friend class PeersChatNetwork;
 };
@@ -433,6 +828,9 @@ Members:
  *
  * peers_lock  mutex on @peers
  *
+ * by_addr  @peers hashed by address, IPv4 and IPv6 alike.  Under @peers_lock, follows
+ *          the peers as they are added, removed and rebound.
+ *
  * size  Number of people in the call
  *
  * tcp_listen  Socket we are listening for tcp requests on
@@ -445,9 +843,61 @@ Members:
  *
  * running  Flag that indicates whether PeersChatNetwork is currently running
  *
- * listen_thread  Thread that listens for tcp requests (CONNECT/REQN/etc)
+ * join_busy  Set while a joinAsync()/hostAsync() task is queued or running on @control
+ *
+ * join_cancel  Set by cancelJoin(), checked by join() between steps
+ *
+ * join_sock  TCP socket join() is currently blocked on, so cancelJoin() can shut it down
+ *            and wake it up.  -1 when there is none.
+ *
+ * join_lock  mutex on @join_sock, held while it is shut down or closed
+ *
+ * trace  Trace of every audio datagram routed to a peer (see PC_Trace.hpp), NULL when
+ *        not tracing.  Outlives the receive loop.
+ *
+ * gossip  Our view of the call's membership (see PC_Gossip.hpp).  The receive loop
+ *         sends its heartbeats and merges what other peers send; joins and leaves it
+ *         learns about are carried out on @control.  @peers is who we send audio to,
+ *         @gossip is who we know is in the call.
+ *
+ * gossip_lock  mutex on @gossip
+ *
+ * rendezvous  Where to send BIND (see PC_NAT.hpp) when joining, unless unset
+ *
+ * mapped_port  Port our NAT maps the audio socket to, found while joining.  Claimed in
+ *              CONNECT/REQN/DISCONNECT instead of PORT.  0 when not known.
+ *
+ * punching  Peers we keep sending PUNCH to until we hear from them, and since when
+ *
+ * punch_lock  mutex on @punching
+ *
+ * punch_scheduled  Is the task sending the PUNCHes queued or running?
+ *
+ * rebinder  Challenges sent to addresses that claim to be one of our peers (see
+ *           PC_Session.hpp).  Receive loop, plus gossip joins waiting on it.
  *
- * recv_thread  Thread that receives audio from peers and sorts to respective NPeer
+ * rebind_lock  mutex on @rebinder
+ *
+ * retired  Peers that were removed, and when.  The audio callback may still hold a
+ *          pointer from before the removal, so they are only destroyed a
+ *          PEER_RETIRE_GRACE later by checkLiveness() or the next stop() (which retires
+ *          everyone left in the call), or with the network.  Under @peers_lock.
+ *
+ * unnamed  Peers we added that didn't answer our REQN, often because they weren't
+ *          listening yet, and how many more times to ask.  Asked again every gossip
+ *          round by retryNames().  Under @peers_lock.
+ *
+ * workers  Fixed pool of NET_WORKERS threads that only sends audio for every NPeer, so
+ *          nothing that blocks ever holds up a frame
+ *
+ * loops  NET_LOOPS threads for the tcp listen loop (CONNECT/REQN/etc), the audio
+ *        receive loop and punchLoop(), all tagged with &running
+ *
+ * control  One thread that runs the session's control work, tagged with this: joining,
+ *          hosting, leaving and the joins/leaves gossip and checkLiveness() find.  Its
+ *          queue runs them one at a time in the order they came, which is all that
+ *          keeps them off each other's peers.  A control task may wait for @loops
+ *          tasks (stop() does), never for another control task.
  *
  *
 (CLIENT INTERFACE)
@@ -456,9 +906,9 @@ Constructors:
  * ~PeersChatNetwork()  Destroy PeersChatNetwork Object
  *
 Operators:
- * operator[sockaddr_in]  Return the a pointer to the NPeer object corresonpding to a
- *                        specific destination address
- *                       @return NPeer* (non owning)
+ * operator[PeerAddr]  Return the a pointer to the NPeer object corresonpding to a
+ *                     specific destination address (IPv4 or IPv6)
+ *                    @return NPeer* (non owning)
  *
  * operator[int]  Return the pointer to the Npeer object stored at position x.  Useful
  *                for looping through all NPeer objects.
@@ -472,21 +922,46 @@ Public Methods:
  * findID(int)  Get a Peer by their ID number
  *             @return NPeer* (non owning)
  *
+ * findSID(uint8_t)  Get a Peer by the stream id they stamp on their SENDA packets
+ *                  @return NPeer* (non owning)
+ *
  * getMyName()  Get my (the client's) name
  *             @return (std::string) name
  *
  * setMyName(std::string)  Set my (the client's) name
  *                        @return (bool) success?
  *
- * join(sockaddr_in)  Join a PeersChat session using a sockaddr_in struct as the dest
- *                   @return (bool) success?
+ * join(PeerAddr)  Join a PeersChat session at an IPv4 or IPv6 address (a sockaddr_in
+ *                converts).  Runs on the control thread once the work queued before
+ *                it is done.
+ *               @return (bool) success?
+ *
+ * joinAsync(PeerAddr, JoinCallback)  join() on the control thread.  Returns right away;
+ *                                   progress and the outcome go to the callback.
+ *                                  @return (bool) false if a join/host is already
+ *                                                 under way
  *
- * getNames()  Request name from every NPeer
+ * getNames()  Request name from every NPeer and trade keys for sealed audio with them
+ *             (PC_Crypto.hpp), a few times over.  Tells stderr about every peer the
+ *             audio stays unencrypted with.
  *
- * host()  Host your own PeersChat session
+ * host()  Host your own PeersChat session, on the control thread like join()
  *        @return (bool) success?
  *
- * disconnect()  Leave the current call
+ * hostAsync(JoinCallback)  host() on the control thread, like joinAsync()
+ *                         @return (bool) false if a join/host is already under way
+ *
+ * cancelJoin()  Stop a joinAsync() at its next step, waking it if it is blocked on a
+ *               peer.  Once it reached JOIN_STARTED the call stays up (disconnect() to
+ *               leave) and only the name requests still to go are skipped.
+ *
+ * joining()  Is a joinAsync()/hostAsync() under way?
+ *
+ * disconnect()  Leave the current call, on the control thread like join()
+ *
+ * disconnectAsync()  Leave the current call on the control thread, after any
+ *                    joinAsync()/hostAsync() queued before it (cancelJoin() first to
+ *                    cut that short).  Returns right away.
  *
  * getNumberPeers()  Get number of peers.  Useful for looping over them.
  *                  @return (int) number of peers
@@ -495,63 +970,146 @@ Public Methods:
  *
  * setDirectJoin(bool)  Allow or disallow direct joins
  *
+ * setBundling(bool)  Allow or disallow packing several frames into one datagram on slow,
+ *                    clean links.  Peers still on SENDV never get bundles.
+ *
+ * setEncryption(bool)  Allow or disallow sealing audio (PC_Crypto.hpp) with peers that
+ *                      support it, on by default.  Set it before joining or hosting.
+ *
+ * setPacketTap(PacketTap*)  Show every audio packet sent/received to @tap (NULL to stop).
+ *                           The tap has to outlive the network or be removed first.
+ *
+ * setRosterListener(RosterListener*)  Tell @listener about every join, leave and rename
+ *                                     (NULL to stop).  Same lifetime rule as the tap.
+ *
+ * setRendezvous(std::string)  Learn our address outside the NAT from the rendezvous
+ *                             server at "ip[:port]" or "[v6]:port" (port
+ *                             RENDEZVOUS_PORT if none) when
+ *                             joining, instead of from the peer we join.  "" to unset.
+ *                             Call it before joining.
+ *                            @return (bool) false if it isn't an address
+ *
+ * startTrace(std::string)  Write every received audio datagram and its arrival time to
+ *                          the file at the path given, for PeersChatReplay.  Runs until
+ *                          the network is destroyed.
+ *                         @return (bool) success?
+ *
  */
 class PeersChatNetwork
 {
+	// Types
+private:
+	struct Punch
+	{
+		PeerAddr addr;
+		std::chrono::steady_clock::time_point since;
+	};
+
 	// Members
 private:
 	char myName[MAX_NAME_LEN+1] = {0};
 	std::vector<std::unique_ptr<NPeer>> peers;
 	std::mutex peers_lock;
+	std::unordered_map<PeerAddr, NPeer*, PeerAddrHash> by_addr;
 	int size = 0;
 	int tcp_listen = -1;
 	bool accept_direct_join = true;
 	bool accept_indirect_join = true;
-	bool running = false;
-	std::unique_ptr<std::thread> listen_thread;
-	std::unique_ptr<std::thread> recv_thread;
+	std::atomic<bool> running = {false};
+	std::atomic<bool> join_busy = {false};
+	std::atomic<bool> join_cancel = {false};
+	int join_sock = -1;
+	std::mutex join_lock;
+	std::unique_ptr<TraceWriter> trace;
+	std::atomic<TraceWriter*> trace_active = {NULL};
+	GossipView gossip;
+	std::mutex gossip_lock;
+	PeerAddr rendezvous;
+	std::atomic<uint16_t> mapped_port = {0};
+	std::vector<Punch> punching;
+	std::mutex punch_lock;
+	std::atomic<bool> punch_scheduled = {false};
+	Rebinder rebinder;
+	std::mutex rebind_lock;
+	std::vector<std::pair<std::chrono::steady_clock::time_point, std::unique_ptr<NPeer>>> retired;
+	std::vector<std::pair<PeerAddr, int>> unnamed;
+	WorkerPool workers;
+	WorkerPool loops;
+	WorkerPool control;
 
 public:
 	PeersChatNetwork();
 	~PeersChatNetwork();
 
-	NPeer* operator[](const sockaddr_in &addr) noexcept;
+	NPeer* operator[](const PeerAddr &addr) noexcept;
 	NPeer* operator[](const int &x) noexcept;
 	NPeer* operator[](const std::string &x) noexcept;
 
 	NPeer* findID(const int &x) noexcept;
+	NPeer* findSID(const uint8_t &sid) noexcept;
 
 	std::string getMyName() noexcept;
 	bool setMyName(const std::string&) noexcept;
 
-	bool join(const sockaddr_in &addr) noexcept;
+	bool join(const PeerAddr &addr) noexcept;
+	bool joinAsync(const PeerAddr &addr, JoinCallback progress) noexcept;
 	void getNames() noexcept;
 	bool host() noexcept;
+	bool hostAsync(JoinCallback progress) noexcept;
+	void cancelJoin() noexcept;
+	inline bool joining() noexcept { return this->join_busy; }
 	void disconnect() noexcept;
+	void disconnectAsync() noexcept;
 	inline int getNumberPeers() { return this->size; }
 
 	inline void setIndirectJoin(bool x) noexcept { this->accept_indirect_join = x; }
 	inline void setDirectJoin(bool x) noexcept { this->accept_direct_join = x; }
+	inline void setBundling(bool x) noexcept { NPeerAttorney::setBundling(x); }
+	inline void setEncryption(bool x) noexcept { NPeerAttorney::setEncrypting(x); }
+	inline void setPacketTap(PacketTap *tap) noexcept { NPeerAttorney::setTap(tap); }
+	inline void setRosterListener(RosterListener *listener) noexcept { NPeerAttorney::setRoster(listener); }
+	bool setRendezvous(const std::string &where) noexcept;
+	bool startTrace(const std::string &path) noexcept;
 
 private:
 	bool start() noexcept;
 	void stop() noexcept;
-	bool propose(sockaddr_in &subject, int sock) noexcept;
+	bool join(const PeerAddr &addr, const JoinCallback &progress) noexcept;
+	bool postJoin(std::function<bool()> task, JoinCallback progress) noexcept;
+	bool onControl(std::function<bool()> task) noexcept;
+	void leave() noexcept;
+	void setJoinSocket(int sock) noexcept;
+	bool propose(const PeerAddr &subject, int sock) noexcept;
 	bool respond(bool decision, int sock) noexcept;
 	bool getResponse(int sock) noexcept;
-	bool addPeer(const sockaddr_in &addr) noexcept; //new person joining group, add them
-	void removePeer(sockaddr_in &addr) noexcept;
-	bool requestPeers(int sock, std::vector<sockaddr_in>& provide_empty_vector) noexcept;
-	void sendPeers(int sock);
+	bool addPeer(const PeerAddr &addr) noexcept; //new person joining group, add them
+	void removePeer(const PeerAddr &addr) noexcept;
+	bool requestPeers(int sock, std::vector<PeerAddr>& provide_empty_vector) noexcept;
+	void sendPeers(int sock, const PeerAddr &joiner);
 	void connect(int sock);
 	void disconnect(int sock);
-	std::string getName(int sock) noexcept;
+	bool getName(const PeerAddr &addr, bool cancellable) noexcept;
+	bool getKey(const PeerAddr &addr, bool cancellable) noexcept;
+	void nameLater(const PeerAddr &addr) noexcept;
+	void retryNames() noexcept;
+	void gossipTick(bool everyone = false) noexcept;
+	void gossipReceive(const PeerAddr &from, const uint8_t *buffer, size_t len) noexcept;
+	void gossipSend(const PeerAddr &to, uint8_t flags) noexcept;
+	void gossipApply(const std::vector<GossipEvent> &events) noexcept;
+	void checkLiveness() noexcept;
+	void rebindChallenge(NPeer *peer, const PeerAddr &addr) noexcept;
+	void rebindReceive(const PeerAddr &from, const uint8_t *buffer, size_t len) noexcept;
+	void awaitRebind(const PeerAddr &addr) noexcept;
+	bool discoverAddress(const PeerAddr &peer) noexcept;
+	inline uint16_t myPort() noexcept { uint16_t port = this->mapped_port; return port ? port : PORT; }
+	void punch(const PeerAddr &addr) noexcept;
+	void punchLoop() noexcept;
 
-	void receive_audio_thread(); //thread that receives audio
+	void receive_audio_thread(); //loop that receives audio
 	void listen_on_tcp_thread();
 
-	bool connectFulfill(int sock, sockaddr_in addr);
-	bool proposeFulfill(int sock, sockaddr_in addr);
+	bool connectFulfill(int sock, PeerAddr addr);
+	bool proposeFulfill(int sock, PeerAddr addr);
 };
 
 
@@ -0,0 +1,197 @@
+#include "PC_Session.hpp"
+
+#include <cstring>
+#include <random>
+#include <algorithm>
+
+using namespace std::chrono;
+using namespace std::chrono_literals;
+
+
+// Globals -------------------------------------------------------------------------------
+std::chrono::milliseconds REBIND_TIMEOUT = 250ms;
+
+
+// Big Endian Helpers --------------------------------------------------------------------
+static inline void put_be64(uint8_t *buffer, uint64_t x) noexcept
+{
+	for(int i = 7; i >= 0; --i, x >>= 8)
+		buffer[i] = (uint8_t) x;
+}
+
+
+static inline uint64_t get_be64(const uint8_t *buffer) noexcept
+{
+	uint64_t x = 0;
+	for(int i = 0; i < 8; ++i)
+		x = (x << 8) | buffer[i];
+	return x;
+}
+
+
+static inline uint64_t get_le64(const uint8_t *buffer) noexcept
+{
+	uint64_t x = 0;
+	for(int i = 7; i >= 0; --i)
+		x = (x << 8) | buffer[i];
+	return x;
+}
+
+
+static uint64_t random64() noexcept
+{
+	std::random_device device;
+	return ((uint64_t) device() << 32) | device();
+}
+
+
+// SipHash-2-4 ---------------------------------------------------------------------------
+#define ROTL(x, b) (uint64_t) (((x) << (b)) | ((x) >> (64 - (b))))
+
+static inline void sip_round(uint64_t &v0, uint64_t &v1, uint64_t &v2, uint64_t &v3) noexcept
+{
+	v0 += v1; v1 = ROTL(v1, 13); v1 ^= v0; v0 = ROTL(v0, 32);
+	v2 += v3; v3 = ROTL(v3, 16); v3 ^= v2;
+	v0 += v3; v3 = ROTL(v3, 21); v3 ^= v0;
+	v2 += v1; v1 = ROTL(v1, 17); v1 ^= v2; v2 = ROTL(v2, 32);
+}
+
+
+static uint64_t siphash24(const uint8_t key[16], const uint8_t *data, size_t len) noexcept
+{
+	uint64_t k0 = get_le64(key);
+	uint64_t k1 = get_le64(key + 8);
+	uint64_t v0 = k0 ^ 0x736f6d6570736575ULL;
+	uint64_t v1 = k1 ^ 0x646f72616e646f6dULL;
+	uint64_t v2 = k0 ^ 0x6c7967656e657261ULL;
+	uint64_t v3 = k1 ^ 0x7465646279746573ULL;
+
+	// Whole words
+	size_t end = len - (len % 8);
+	for(size_t i = 0; i < end; i += 8)
+	{
+		uint64_t m = get_le64(data + i);
+		v3 ^= m;
+		sip_round(v0, v1, v2, v3);
+		sip_round(v0, v1, v2, v3);
+		v0 ^= m;
+	}
+
+	// Last word carries the length in its top byte
+	uint64_t b = (uint64_t) len << 56;
+	for(size_t i = end; i < len; ++i)
+		b |= (uint64_t) data[i] << (8 * (i - end));
+	v3 ^= b;
+	sip_round(v0, v1, v2, v3);
+	sip_round(v0, v1, v2, v3);
+	v0 ^= b;
+
+	v2 ^= 0xff;
+	for(int i = 0; i < 4; ++i)
+		sip_round(v0, v1, v2, v3);
+	return v0 ^ v1 ^ v2 ^ v3;
+}
+
+
+// SessionToken --------------------------------------------------------------------------
+bool SessionToken::valid() const noexcept
+{
+	for(uint8_t byte : this->bytes)
+		if(byte) return true;
+	return false;
+}
+
+
+SessionToken SessionToken::generate() noexcept
+{
+	SessionToken token;
+	while(!token.valid())
+	{
+		put_be64(token.bytes, random64());
+		put_be64(token.bytes + 8, random64());
+	}
+	return token;
+}
+
+
+uint64_t SessionToken::mac(uint64_t nonce) const noexcept
+{
+	uint8_t message[8];
+	put_be64(message, nonce);
+	return siphash24(this->bytes, message, sizeof(message));
+}
+
+
+// Rebinder ------------------------------------------------------------------------------
+void Rebinder::reset() noexcept
+{
+	this->waiting.clear();
+}
+
+
+size_t Rebinder::challenge(const PeerAddr &to, time_point now, uint8_t *buffer) noexcept
+{
+	this->expire(now);
+	if(this->waiting.size() >= REBIND_MAX_PENDING) return 0;
+	for(const Challenge &challenge : this->waiting)
+		if(challenge.addr == to) return 0;
+
+	Challenge challenge = {to, random64(), now};
+	this->waiting.push_back(challenge);
+
+	buffer[0] = REBIND;
+	buffer[1] = REBIND_CHALLENGE;
+	put_be64(buffer + 2, challenge.nonce);
+	return REBIND_CHALLENGE_SIZE;
+}
+
+
+size_t Rebinder::respond(const uint8_t *buffer, size_t len, const SessionToken &token, uint8_t *out) noexcept
+{
+	if(len < REBIND_CHALLENGE_SIZE || buffer[0] != REBIND || buffer[1] != REBIND_CHALLENGE) return 0;
+	if(!token.valid()) return 0;
+
+	uint64_t nonce = get_be64(buffer + 2);
+	out[0] = REBIND;
+	out[1] = REBIND_RESPONSE;
+	put_be64(out + 2, nonce);
+	put_be64(out + 10, token.mac(nonce));
+	return REBIND_RESPONSE_SIZE;
+}
+
+
+bool Rebinder::accept(const PeerAddr &from, const uint8_t *buffer, size_t len, time_point now,
+                      uint64_t &nonce, uint64_t &mac) noexcept
+{
+	if(len < REBIND_RESPONSE_SIZE || buffer[0] != REBIND || buffer[1] != REBIND_RESPONSE) return false;
+	this->expire(now);
+
+	// Has to come back from where the challenge went, with its nonce
+	nonce = get_be64(buffer + 2);
+	auto it = std::find_if(this->waiting.begin(), this->waiting.end(), [&from, nonce](const Challenge &x) {
+		return x.addr == from && x.nonce == nonce;
+	});
+	if(it == this->waiting.end()) return false;
+
+	this->waiting.erase(it);
+	mac = get_be64(buffer + 10);
+	return true;
+}
+
+
+bool Rebinder::pending(const PeerAddr &addr, time_point now) noexcept
+{
+	this->expire(now);
+	for(const Challenge &challenge : this->waiting)
+		if(challenge.addr == addr) return true;
+	return false;
+}
+
+
+// Private -------------------------------------------------------------------------------
+void Rebinder::expire(time_point now) noexcept
+{
+	this->waiting.erase(std::remove_if(this->waiting.begin(), this->waiting.end(), [now](const Challenge &x) {
+		return now - x.sent >= REBIND_TIMEOUT;
+	}), this->waiting.end());
+}
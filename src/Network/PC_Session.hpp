@@ -0,0 +1,153 @@
+#ifndef _PC_SESSION_HPP
+#define _PC_SESSION_HPP
+
+
+/*
+ *  PeersChat Session Header: Session tokens and moving a peer to a new address
+ *
+ * Peers are known by the address their audio comes from.  When a laptop goes from Wi-Fi
+ * to Ethernet (or its NAT mapping changes) that address changes in the middle of a call
+ * and everything it sends looks like it comes from a stranger.
+ *
+ * Tokens: While naming each other (REQN/SENDN) every peer hands every other peer a
+ * random SessionToken of its own.  It only ever travels over that TCP exchange.  The
+ * token A handed B is how A proves to B that it is A.  Tokens are per pair, so one peer
+ * can't pass itself off as another to a third.
+ *
+ * Rebinding: A SENDA datagram whose stream id belongs to a peer but comes from another
+ * address is not played.  Instead the receiver challenges the new address with a
+ * random nonce.  The peer, still reachable at the challenger's (unchanged) address,
+ * answers with a MAC of the nonce keyed with its token.  If the answer comes back from
+ * the challenged address and matches a peer's token, that peer is moved to the new
+ * address.  Its streams, names and stats stay as they are, nobody rejoins.  A peer in
+ * DTX still sends a keepalive every KEEPALIVE_INTERVAL, so a move is noticed well
+ * within a second.  Peers still on SENDV can't be told apart and don't get rebound.
+ *
+ * Format, integers big endian:
+ *
+ *   [REBIND] [REBIND_CHALLENGE] [nonce:64]
+ *   [REBIND] [REBIND_RESPONSE] [nonce:64] [mac:64]
+ *
+ *   mac  SipHash-2-4 of the nonce (8 bytes, big endian) keyed with the token
+ *
+ * Rebinder is only the bookkeeping, it never touches a socket; PeersChatNetwork sends
+ * and receives the datagrams on the audio socket and moves the peer.
+ *
+ */
+
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <chrono>
+#include "nettypes.hpp"
+#include "PC_Addr.hpp"
+
+
+// Pre-Compiler Constants
+#define SESSION_TOKEN_SIZE 16
+#define REBIND_CHALLENGE_SIZE 10
+#define REBIND_RESPONSE_SIZE 18
+#define REBIND_MAX_PENDING 8
+
+
+// Globals
+/*
+ * REBIND_TIMEOUT is how long a challenge waits for its answer.  After that the address
+ * may be challenged again.
+ */
+extern std::chrono::milliseconds REBIND_TIMEOUT;
+
+
+/* RebindKind: Second byte of a REBIND datagram
+ */
+enum RebindKind
+{
+	REBIND_CHALLENGE,
+	REBIND_RESPONSE
+};
+
+
+// SessionToken Struct -------------------------------------------------------------------
+/* SessionToken: Secret one peer hands another while naming itself
+ *
+ * @member bytes  The token, all zero until one was made or received
+ *
+ * @method valid()  Was one made or received?
+ *
+ * @method generate()  (static) Make a new random token
+ *
+ * @method mac(1)  Keyed hash of @nonce, what answers a challenge
+ *                @return (uint64_t)
+ */
+struct SessionToken
+{
+	uint8_t bytes[SESSION_TOKEN_SIZE] = {0};
+
+	bool valid() const noexcept;
+	static SessionToken generate() noexcept;
+	uint64_t mac(uint64_t nonce) const noexcept;
+};
+
+
+// Rebinder Class ------------------------------------------------------------------------
+/* Rebinder: Challenges we sent and are waiting on
+ *
+(IMPLEMENTATION DETAILS)
+Members:
+ * waiting  One challenge per address: the nonce and when it went out.  At most
+ *          REBIND_MAX_PENDING at a time so a flood of spoofed datagrams can't make us
+ *          send more than a handful.
+ *
+ *
+(CLIENT INTERFACE)
+Not thread safe, PeersChatNetwork locks around it.
+ *
+Public Methods:
+ * reset()  Forget every challenge
+ *
+ * challenge(3)  Write a challenge to @to into @buffer (REBIND_CHALLENGE_SIZE bytes),
+ *               unless @to already has one waiting
+ *              @return (size_t) bytes written, 0 if there is nothing to send
+ *
+ * respond(4)  (static) Answer the challenge in @buffer with @token into @out
+ *             (REBIND_RESPONSE_SIZE bytes)
+ *            @return (size_t) bytes written, 0 if @buffer isn't a challenge
+ *
+ * accept(6)  Is @buffer the answer to the challenge we sent @from?  Takes the challenge
+ *            off the list and fills @nonce/@mac, check them with SessionToken::mac()
+ *           @return (bool)
+ *
+ * pending(2)  Is a challenge to @addr still waiting for an answer?
+ *
+ */
+class Rebinder
+{
+	// Types
+private:
+	typedef std::chrono::steady_clock::time_point time_point;
+	struct Challenge
+	{
+		PeerAddr addr;
+		uint64_t nonce;
+		time_point sent;
+	};
+
+	// Members
+private:
+	std::vector<Challenge> waiting;
+
+public:
+	void reset() noexcept;
+	size_t challenge(const PeerAddr &to, time_point now, uint8_t *buffer) noexcept;
+	static size_t respond(const uint8_t *buffer, size_t len, const SessionToken &token, uint8_t *out) noexcept;
+	bool accept(const PeerAddr &from, const uint8_t *buffer, size_t len, time_point now,
+	            uint64_t &nonce, uint64_t &mac) noexcept;
+	bool pending(const PeerAddr &addr, time_point now) noexcept;
+
+private:
+	void expire(time_point now) noexcept;
+};
+
+
+#endif
@@ -0,0 +1,92 @@
+#include "PC_Trace.hpp"
+
+#include <cstring>
+
+
+// Little Endian Helpers -----------------------------------------------------------------
+static inline void put_le(uint8_t *buffer, uint64_t x, int bytes) noexcept
+{
+	for(int i = 0; i < bytes; ++i)
+		buffer[i] = (uint8_t) (x >> (8 * i));
+}
+
+
+static inline uint64_t get_le(const uint8_t *buffer, int bytes) noexcept
+{
+	uint64_t x = 0;
+	for(int i = 0; i < bytes; ++i)
+		x |= (uint64_t) buffer[i] << (8 * i);
+	return x;
+}
+
+
+// TraceWriter ---------------------------------------------------------------------------
+TraceWriter::TraceWriter(const std::string &path) noexcept
+{
+	this->file = std::fopen(path.c_str(), "wb");
+	if(!this->file)
+	{
+		perror("TraceWriter()");
+		return;
+	}
+	std::setvbuf(this->file, NULL, _IOFBF, TRACE_FILE_BUFFER);
+	std::fwrite(TRACE_MAGIC, 1, 8, this->file);
+	this->start = std::chrono::steady_clock::now();
+}
+
+
+TraceWriter::~TraceWriter() noexcept
+{
+	if(this->file) std::fclose(this->file);
+}
+
+
+void TraceWriter::write(int peer, const uint8_t *data, size_t len, std::chrono::steady_clock::time_point arrival) noexcept
+{
+	if(!this->file) return;
+	if(len > TRACE_MAX_DATAGRAM) len = TRACE_MAX_DATAGRAM;
+
+	uint8_t header[14];
+	auto us = std::chrono::duration_cast<std::chrono::microseconds>(arrival - this->start).count();
+	put_le(header, (uint64_t) (us < 0 ? 0 : us), 8);
+	put_le(header + 8, (uint32_t) peer, 4);
+	put_le(header + 12, (uint16_t) len, 2);
+	std::fwrite(header, 1, sizeof(header), this->file);
+	std::fwrite(data, 1, len, this->file);
+	this->records++;
+}
+
+
+// TraceReader ---------------------------------------------------------------------------
+TraceReader::TraceReader(const std::string &path) noexcept
+{
+	this->file = std::fopen(path.c_str(), "rb");
+	if(!this->file) return;
+
+	char magic[8];
+	if(std::fread(magic, 1, 8, this->file) != 8 || std::memcmp(magic, TRACE_MAGIC, 8) != 0)
+	{
+		std::fclose(this->file);
+		this->file = NULL;
+	}
+}
+
+
+TraceReader::~TraceReader() noexcept
+{
+	if(this->file) std::fclose(this->file);
+}
+
+
+bool TraceReader::next(TraceRecord &record) noexcept
+{
+	if(!this->file) return false;
+
+	uint8_t header[14];
+	if(std::fread(header, 1, sizeof(header), this->file) != sizeof(header)) return false;
+	record.arrival_us = get_le(header, 8);
+	record.peer       = (int32_t) get_le(header + 8, 4);
+	record.len        = (uint16_t) get_le(header + 12, 2);
+	if(record.len > TRACE_MAX_DATAGRAM) return false;
+	return std::fread(record.data, 1, record.len, this->file) == record.len;
+}
@@ -0,0 +1,135 @@
+#ifndef _PC_TRACE_HPP
+#define _PC_TRACE_HPP
+
+
+/*
+ *  PeersChat Trace Header: Record received audio datagrams to a file and read them back
+ *
+ * With a trace of what actually arrived from the network (and when) a bad call can be
+ * replayed offline through the jitter buffer, concealment and mixer (PeersChatReplay)
+ * as often as needed, with different settings, and always with the same result.
+ *
+ * File format, all integers little endian:
+ *
+ *   [magic "PCTRACE1":8]
+ *   [arrival us:64] [peer id:32] [length:16] [datagram...]    <- one per datagram
+ *
+ *   arrival  Microseconds since the trace was started (steady clock)
+ *   peer id  NPeer ID the receive loop routed the datagram to
+ *   datagram Exactly what recvfrom() returned, SENDV or SENDA header included
+ *
+ */
+
+
+#include <cstdio>
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <chrono>
+
+
+// Pre-Compiler Constants
+#define TRACE_MAGIC "PCTRACE1"
+#define TRACE_MAX_DATAGRAM 4096
+#define TRACE_FILE_BUFFER (256 * 1024)
+
+
+// TraceRecord Struct --------------------------------------------------------------------
+/* TraceRecord: One datagram read back from a trace
+ *
+ * @member arrival_us  When it arrived, microseconds since the trace started
+ *
+ * @member peer  NPeer ID it came from
+ *
+ * @member len  Bytes in @data
+ *
+ * @member data  The datagram
+ */
+struct TraceRecord
+{
+	uint64_t arrival_us = 0;
+	int32_t  peer       = 0;
+	uint16_t len        = 0;
+	uint8_t  data[TRACE_MAX_DATAGRAM];
+};
+
+
+// TraceWriter Class ---------------------------------------------------------------------
+/* TraceWriter: Appends received datagrams to a trace file -- Single writer thread
+ *
+(IMPLEMENTATION DETAILS)
+Members:
+ * file  The trace, with a TRACE_FILE_BUFFER stdio buffer so the receive loop only
+ *       does a memcpy per datagram and the disk sees few large writes
+ *
+ * start  Time zero of the trace
+ *
+ * records  Datagrams written
+ *
+ *
+(CLIENT INTERFACE)
+Public Methods:
+ * TraceWriter(1)  Create/truncate the file at @path and write the magic
+ *
+ * good()  Did the file open?
+ *
+ * write(4)  Append a datagram
+ *          @param peer (int) NPeer ID
+ *          @param data (const uint8_t*) datagram
+ *          @param len (size_t) its length, clipped to TRACE_MAX_DATAGRAM
+ *          @param arrival (time_point) when recvfrom() returned it
+ *
+ * getRecords()  Datagrams written so far
+ *
+ */
+class TraceWriter
+{
+	// Members
+private:
+	FILE *file = NULL;
+	std::chrono::steady_clock::time_point start;
+	uint64_t records = 0;
+
+public:
+	explicit TraceWriter(const std::string &path) noexcept;
+	~TraceWriter() noexcept;
+	TraceWriter(const TraceWriter&) = delete;
+	TraceWriter& operator=(const TraceWriter&) = delete;
+
+	inline bool good() noexcept { return this->file != NULL; }
+	void write(int peer, const uint8_t *data, size_t len, std::chrono::steady_clock::time_point arrival) noexcept;
+	inline uint64_t getRecords() noexcept { return this->records; }
+};
+
+
+// TraceReader Class ---------------------------------------------------------------------
+/* TraceReader: Reads a trace file written by TraceWriter
+ *
+(CLIENT INTERFACE)
+Public Methods:
+ * TraceReader(1)  Open the trace at @path and check the magic
+ *
+ * good()  Is it open and a trace?
+ *
+ * next(1)  Read the next datagram into @record
+ *         @return (bool) false at the end of the file (or a truncated record)
+ *
+ */
+class TraceReader
+{
+	// Members
+private:
+	FILE *file = NULL;
+
+public:
+	explicit TraceReader(const std::string &path) noexcept;
+	~TraceReader() noexcept;
+	TraceReader(const TraceReader&) = delete;
+	TraceReader& operator=(const TraceReader&) = delete;
+
+	inline bool good() noexcept { return this->file != NULL; }
+	bool next(TraceRecord &record) noexcept;
+};
+
+
+#endif
@@ -12,16 +12,68 @@ enum NETCODES {
                 CONNECT=0x1,    // Request to connect to an existing call
                 SHARE=0x81,     // Share user info with host
                 SENDP=0x82,     // Share list of peers with joined user
+                SENDP6=0x8D,    // SENDP with 128 bit addresses, when any peer is on IPv6
                 SENDV=0x83,     // Send voice to other peers
                 REQP=0x3,       // Send voice to other peers
                 DENY=0x4,       // Deny request to join
                 ACCEPT=0x84,    // Accept request to join
                 PROPOSE=0x5,    // Ask current peers if new peer can join
+                PROPOSE6=0x85,  // PROPOSE for a new peer on IPv6
                 DISCONNECT=0x6, // Disconnect from call; Leave server
                 REQN=0x08,      // Request Peer Name
                 SENDN=0x88,     // Send Peer Name
+                SENDA=0x89,     // Send voice with the compact audio header
+                SENDE=0x8E,     // SENDA sealed with the peer's key (see PC_Crypto.hpp)
+                KEY=0x8F,       // Trade public keys for sealing audio (see PC_Crypto.hpp)
+                GOSSIP=0x8A,    // Membership heartbeat over UDP (see PC_Gossip.hpp)
+                REBIND=0x8B,    // Prove a peer moved to a new address (see PC_Session.hpp)
+                BIND=0x0B,      // Ask where our NAT maps us (see PC_NAT.hpp)
+                BOUND=0x8C,     // Answer to BIND: the address it came from
+                PUNCH=0x0C,     // Open our NAT toward a new peer
                 CLOSE=0x7       // Close TCP pipe; end request
 };
 
+
+/* Compact Audio Header: Header used by SENDA datagrams.  Replaces the SENDV header
+ * ([SENDV] [id:32] [length:32]) once both peers agreed on a wire version.  The
+ * payload length is whatever is left of the UDP datagram.
+ *
+ * Format: [SENDA] [version:2 | flags:6] [sequence:16] [timestamp:16] [stream id:8] [opus...]
+ *
+ *   sequence   Wrapping packet counter.  Receiver extends it back to 32 bits.
+ *   timestamp  Media time of the first sample in AUDIO_TS_UNIT sample ticks, wrapping.
+ *              Samples are counted at AUDIO_TS_RATE.
+ *   stream id  Short id the receiver handed us during the join handshake (see SENDN)
+ *              so it can route the packet without comparing addresses.
+ *
+ * Version negotiation: SENDN replies carry [version] [stream id] after the name.
+ * Peers that don't send them (or send version 0) keep getting SENDV.  Newer peers
+ * follow up with the session token the requester can rebind them with
+ * ([token:128], see PC_Session.hpp).  Keys for sealing audio are traded separately
+ * with KEY (see PC_Crypto.hpp).
+ *
+ * Bundles: With AUDIO_BUNDLE set the payload holds up to AUDIO_MAX_BUNDLE consecutive
+ * frames.  sequence/timestamp belong to the first frame, frame k is sequence + k at
+ * timestamp + k * ticks per frame.  Frames that aren't evenly spaced go out separately.
+ *
+ *   [count:8] [ticks per frame:8] [length 1] ... [length count-1] [frame 1] ... [frame count]
+ *
+ * Lengths use Opus' self-delimiting encoding (one byte below 252, else two bytes).
+ * The last frame's length is whatever is left of the datagram.
+ */
+#define AUDIO_WIRE_VERSION 1
+#define AUDIO_TS_UNIT 120
+#define AUDIO_TS_RATE 48000
+#define SENDA_HEADER_SIZE 7
+#define SENDV_HEADER_SIZE 9
+#define AUDIO_MAX_BUNDLE 4
+
+enum AUDIOFLAGS {
+                AUDIO_DTX=0x01,    // Packet is a DTX/comfort noise frame
+                AUDIO_FEC=0x02,    // Packet carries in-band FEC for the previous frame
+                AUDIO_CONFIG=0x04, // Codec configuration changed with this packet
+                AUDIO_BUNDLE=0x08  // Payload is a bundle of consecutive frames
+};
+
 #endif
 
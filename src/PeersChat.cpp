@@ -3,10 +3,13 @@
 #include <PC_Network.hpp>
 #include <PC_Audio.hpp>
 #include <PC_Gui.hpp>
+#include <PC_Thread.hpp>
+#include <PC_Recorder.hpp>
 
 class PeersChat
 {
 	public:
+		std::unique_ptr<CallRecorder> recorder;
 		PeersChatNetwork network;
 		APeer audio;
 		PC_GuiHandler GUI;
@@ -18,6 +21,9 @@ PC_GuiHandler *GUI = NULL;
 
 int main(const int argc, char *argv[])
 {
+	// Scheduling policy must be known before any threads start
+	thread_policy_from_env();
+
 	// Create PeersChat Object
 	std::unique_ptr<PeersChat> pchat(new PeersChat);
 
@@ -25,8 +31,34 @@ int main(const int argc, char *argv[])
 	Network = &(pchat->network);
 	Audio = &(pchat->audio);
 	GUI = &(pchat->GUI);
+	Network->setRosterListener(GUI);
+
+	// Record every call to PEERSCHAT_RECORD (a directory)
+	const char *record = std::getenv("PEERSCHAT_RECORD");
+	if(record && *record)
+	{
+		pchat->recorder.reset(new CallRecorder(record));
+		pchat->recorder->start();
+		Network->setPacketTap(pchat->recorder.get());
+	}
+
+	// Trace received audio to PEERSCHAT_TRACE (a file) for PeersChatReplay
+	const char *trace = std::getenv("PEERSCHAT_TRACE");
+	if(trace && *trace)
+		Network->startTrace(trace);
+
+	// Learn our address outside the NAT from PEERSCHAT_RENDEZVOUS (ip[:port] or [v6][:port])
+	const char *rendezvous = std::getenv("PEERSCHAT_RENDEZVOUS");
+	if(rendezvous && *rendezvous && !Network->setRendezvous(rendezvous))
+		std::cerr << "PEERSCHAT_RENDEZVOUS: not an IP address: " << rendezvous << std::endl;
+
+	// Seal audio with peers that support it unless PEERSCHAT_ENCRYPT=0
+	const char *encrypt = std::getenv("PEERSCHAT_ENCRYPT");
+	if(encrypt && std::string(encrypt) == "0")
+		Network->setEncryption(false);
 
 	pchat->GUI.runGui(argc,argv);
+	Network->setRosterListener(NULL);
 
 	return EXIT_SUCCESS;
 }
@@ -0,0 +1,86 @@
+#include <string>
+#include <csignal>
+#include <unistd.h>
+#include <PC_Network.hpp>
+#include <PC_Audio.hpp>
+#include <PC_Thread.hpp>
+#include <PC_Recorder.hpp>
+#include <PC_Daemon.hpp>
+
+/*
+ *  PeersChatd: The PeersChat engine without a GUI
+ *
+ *  Usage: PeersChatd [socket]
+ *
+ *  Front ends (PeersChatCtl) attach over the control socket, see PC_IPC.hpp.
+ *  The call keeps going while they come and go.
+ */
+
+class PeersChatEngine
+{
+	public:
+		std::unique_ptr<CallRecorder> recorder;
+		PeersChatNetwork network;
+		APeer audio;
+};
+
+PeersChatNetwork *Network = NULL;
+APeer *Audio = NULL;
+
+static void on_signal(int)
+{
+	PeersChatDaemon::requestQuit();
+}
+
+int main(const int argc, char *argv[])
+{
+	// Scheduling policy must be known before any threads start
+	thread_policy_from_env();
+
+	// Create Engine
+	std::unique_ptr<PeersChatEngine> engine(new PeersChatEngine);
+	Network = &(engine->network);
+	Audio = &(engine->audio);
+
+	// Record every call to PEERSCHAT_RECORD (a directory)
+	const char *record = std::getenv("PEERSCHAT_RECORD");
+	if(record && *record)
+	{
+		engine->recorder.reset(new CallRecorder(record));
+		engine->recorder->start();
+		Network->setPacketTap(engine->recorder.get());
+	}
+
+	// Trace received audio to PEERSCHAT_TRACE (a file) for PeersChatReplay
+	const char *trace = std::getenv("PEERSCHAT_TRACE");
+	if(trace && *trace)
+		Network->startTrace(trace);
+
+	// Learn our address outside the NAT from PEERSCHAT_RENDEZVOUS (ip[:port] or [v6][:port])
+	const char *rendezvous = std::getenv("PEERSCHAT_RENDEZVOUS");
+	if(rendezvous && *rendezvous && !Network->setRendezvous(rendezvous))
+		std::cerr << "PEERSCHAT_RENDEZVOUS: not an IP address: " << rendezvous << std::endl;
+
+	// Seal audio with peers that support it unless PEERSCHAT_ENCRYPT=0
+	const char *encrypt = std::getenv("PEERSCHAT_ENCRYPT");
+	if(encrypt && std::string(encrypt) == "0")
+		Network->setEncryption(false);
+
+	// Serve front ends until told to stop
+	std::signal(SIGINT, on_signal);
+	std::signal(SIGTERM, on_signal);
+	std::signal(SIGPIPE, SIG_IGN);
+	int status = EXIT_FAILURE;
+	{
+		PeersChatDaemon daemon(argc > 1 ? argv[1] : ipc_default_socket());
+		if(daemon.good())
+			status = daemon.run();
+	}
+
+	// Leave politely -- Audio first, so nothing reads the peers the network retires
+	Network->cancelJoin();
+	Audio->stopVoiceStream();
+	Network->disconnect();
+
+	return status;
+}
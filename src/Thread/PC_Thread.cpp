@@ -0,0 +1,382 @@
+#include "PC_Thread.hpp"
+
+
+// Pre-Compiler Constants ----------------------------------------------------------------
+#define FALLBACK_NICE -10
+
+
+// Globals -------------------------------------------------------------------------------
+bool REALTIME_THREADS = true;
+int AUDIO_THREAD_PRIORITY = 70;
+int NETWORK_THREAD_PRIORITY = 60;
+int AUDIO_THREAD_CORE = -1;
+int NETWORK_THREAD_CORE = -1;
+
+
+// Functions -----------------------------------------------------------------------------
+void thread_policy_from_env() noexcept
+{
+	const char *value;
+	if((value = std::getenv("PEERSCHAT_REALTIME")))
+		REALTIME_THREADS = std::atoi(value) != 0;
+	if((value = std::getenv("PEERSCHAT_AUDIO_CORE")))
+		AUDIO_THREAD_CORE = std::atoi(value);
+	if((value = std::getenv("PEERSCHAT_NETWORK_CORE")))
+		NETWORK_THREAD_CORE = std::atoi(value);
+}
+
+
+bool apply_thread_policy(ThreadRole role) noexcept
+{
+	if(role == THREAD_CONTROL) return false;
+
+	#ifdef __linux__
+	int priority = (role == THREAD_AUDIO) ? AUDIO_THREAD_PRIORITY : NETWORK_THREAD_PRIORITY;
+	int core     = (role == THREAD_AUDIO) ? AUDIO_THREAD_CORE     : NETWORK_THREAD_CORE;
+	pin_thread_to_core(core);
+
+	if(!REALTIME_THREADS) return false;
+
+	// Ask for SCHED_FIFO -- Children shouldn't inherit it
+	sched_param param;
+	param.sched_priority = priority;
+	int policy = SCHED_FIFO;
+	#ifdef SCHED_RESET_ON_FORK
+	policy |= SCHED_RESET_ON_FORK;
+	#endif
+	if(pthread_setschedparam(pthread_self(), policy, &param) == 0)
+		return true;
+
+	// Not allowed, settle for a better nice value (per thread on Linux)
+	if(setpriority(PRIO_PROCESS, (id_t) syscall(SYS_gettid), FALLBACK_NICE) == 0)
+		return true;
+
+	#ifdef DEBUG
+	perror("apply_thread_policy()");
+	#endif
+	#endif
+
+	return false;
+}
+
+
+bool pin_thread_to_core(int core) noexcept
+{
+	if(core < 0) return false;
+
+	#ifdef __linux__
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(core, &set);
+	if(pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0)
+		return true;
+
+	#ifdef DEBUG
+	fprintf(stderr, "pin_thread_to_core(): Failed to pin to core %d\n", core);
+	#endif
+	#endif
+
+	return false;
+}
+
+
+
+// WorkerPool ----------------------------------------------------------------------------
+WorkerPool::~WorkerPool() noexcept
+{
+	stop();
+}
+
+
+bool WorkerPool::start(int count, ThreadRole role) noexcept
+{
+	std::lock_guard<std::mutex> guard(this->lock);
+	if(!this->threads.empty()) return false;
+
+	this->stopping = false;
+	this->busy.assign(count, NULL);
+	try
+	{
+		for(int i = 0; i < count; ++i)
+			this->threads.emplace_back(&WorkerPool::worker, this, i, role);
+	}
+	catch(const std::system_error &e)
+	{
+		#ifdef DEBUG
+		fprintf(stderr, "WorkerPool::start(): %s\n", e.what());
+		#endif
+		return !this->threads.empty();
+	}
+	return true;
+}
+
+
+void WorkerPool::stop() noexcept
+{
+	{
+		std::lock_guard<std::mutex> guard(this->lock);
+		this->stopping = true;
+		this->tasks.clear();
+	}
+	this->wake.notify_all();
+
+	for(std::thread &t : this->threads)
+		if(t.joinable())
+			t.join();
+	this->threads.clear();
+}
+
+
+bool WorkerPool::post(const void *owner, std::function<void()> task)
+{
+	{
+		std::lock_guard<std::mutex> guard(this->lock);
+		if(this->stopping || this->threads.empty()) return false;
+		this->tasks.push_back({owner, std::move(task)});
+	}
+	this->wake.notify_one();
+	return true;
+}
+
+
+void WorkerPool::cancel(const void *owner) noexcept
+{
+	std::unique_lock<std::mutex> guard(this->lock);
+	for(auto it = this->tasks.begin(); it != this->tasks.end(); )
+	{
+		if(it->owner == owner)
+			it = this->tasks.erase(it);
+		else
+			++it;
+	}
+	this->done.wait(guard, [&]() { return !running(owner); });
+}
+
+
+void WorkerPool::wait(const void *owner) noexcept
+{
+	std::unique_lock<std::mutex> guard(this->lock);
+	this->done.wait(guard, [&]() {
+		for(const Task &t : this->tasks)
+			if(t.owner == owner)
+				return false;
+		return !running(owner);
+	});
+}
+
+
+// Lock must be held
+bool WorkerPool::running(const void *owner) noexcept
+{
+	for(const void *b : this->busy)
+		if(b == owner)
+			return true;
+	return false;
+}
+
+
+void WorkerPool::worker(size_t index, ThreadRole role) noexcept
+{
+	apply_thread_policy(role);
+
+	std::unique_lock<std::mutex> guard(this->lock);
+	while(true)
+	{
+		this->wake.wait(guard, [&]() { return this->stopping || !this->tasks.empty(); });
+		if(this->stopping) break;
+
+		// Take a Task
+		Task task = std::move(this->tasks.front());
+		this->tasks.pop_front();
+		this->busy[index] = task.owner;
+
+		// Run it without holding the lock
+		guard.unlock();
+		task.run();
+		guard.lock();
+
+		this->busy[index] = NULL;
+		this->done.notify_all();
+	}
+}
+
+
+
+// Semaphore -----------------------------------------------------------------------------
+void Semaphore::wait() noexcept
+{
+	while(sem_wait(&this->sem) < 0 && errno == EINTR) { }
+}
+
+
+bool Semaphore::waitUntil(std::chrono::steady_clock::time_point deadline) noexcept
+{
+	// Absolute time on CLOCK_MONOTONIC where there's sem_clockwait(), the wall clock else
+	#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 30))
+	clockid_t clock = CLOCK_MONOTONIC;
+	#else
+	clockid_t clock = CLOCK_REALTIME;
+	#endif
+	std::chrono::nanoseconds left = deadline - std::chrono::steady_clock::now();
+	if(left.count() <= 0) return this->tryWait();
+
+	timespec at;
+	clock_gettime(clock, &at);
+	long long ns = at.tv_nsec + left.count();
+	at.tv_sec += ns / 1000000000;
+	at.tv_nsec = ns % 1000000000;
+
+	int r;
+	#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 30))
+	while((r = sem_clockwait(&this->sem, clock, &at)) < 0 && errno == EINTR) { }
+	#else
+	while((r = sem_timedwait(&this->sem, &at)) < 0 && errno == EINTR) { }
+	#endif
+	return r == 0;
+}
+
+
+
+// ForkJoin ------------------------------------------------------------------------------
+ForkJoin::~ForkJoin() noexcept
+{
+	stop();
+}
+
+
+bool ForkJoin::start(size_t count, int helpers, ThreadRole role, std::function<bool(size_t)> task) noexcept
+{
+	if(!this->threads.empty()) return false;
+
+	this->task = std::move(task);
+	this->jobs.reset(new Job[count]);
+	this->batch.assign(count, false);
+	this->count = count;
+	this->queued = 0;
+	this->stopping = false;
+	try
+	{
+		for(int i = 0; i < helpers; ++i)
+			this->threads.emplace_back(&ForkJoin::helper, this, role);
+	}
+	catch(const std::system_error &e)
+	{
+		#ifdef DEBUG
+		fprintf(stderr, "ForkJoin::start(): %s\n", e.what());
+		#endif
+		return !this->threads.empty();
+	}
+	return true;
+}
+
+
+void ForkJoin::stop() noexcept
+{
+	this->stopping = true;
+	for(size_t i = 0; i < this->threads.size(); ++i)
+		this->wake.post();
+
+	for(std::thread &t : this->threads)
+		if(t.joinable())
+			t.join();
+	this->threads.clear();
+}
+
+
+bool ForkJoin::queue(size_t i) noexcept
+{
+	int state = this->jobs[i].state.load(std::memory_order_acquire);
+	if(state != JOB_IDLE && state != JOB_DONE) return false;
+
+	// Nobody else moves it out of idle/done, a plain store does
+	if(!this->batch[i]) this->queued++;
+	this->batch[i] = true;
+	this->jobs[i].state.store(JOB_QUEUED, std::memory_order_release);
+	return true;
+}
+
+
+void ForkJoin::run(std::chrono::steady_clock::time_point deadline) noexcept
+{
+	// Results of earlier runs don't count as done anymore
+	for(size_t i = 0; i < this->count; ++i)
+	{
+		int expected = JOB_DONE;
+		if(!this->batch[i])
+			this->jobs[i].state.compare_exchange_strong(expected, JOB_IDLE, std::memory_order_relaxed);
+	}
+	if(this->queued == 0) return;
+
+	// Fork -- Posts left over from the last run would only wake us for nothing
+	while(this->finished.tryWait()) { }
+	int wanted = std::min(this->queued - 1, this->helpers());
+	for(int i = 0; i < wanted; ++i)
+		this->wake.post();
+	this->work(false);
+
+	// Join -- Look again every time a helper finished a job, until the deadline
+	while(true)
+	{
+		bool active = false;
+		for(size_t i = 0; i < this->count && !active; ++i)
+		{
+			int state = this->jobs[i].state.load(std::memory_order_acquire);
+			active = this->batch[i] && (state == JOB_QUEUED || state == JOB_RUNNING);
+		}
+		if(!active || !this->finished.waitUntil(deadline)) break;
+	}
+
+	// Give up on what's left -- Not started goes back to idle, running is abandoned
+	for(size_t i = 0; i < this->count; ++i)
+	{
+		if(!this->batch[i]) continue;
+		this->batch[i] = false;
+		int expected = JOB_QUEUED;
+		if(this->jobs[i].state.compare_exchange_strong(expected, JOB_IDLE, std::memory_order_acq_rel))
+			continue;
+		if(expected == JOB_RUNNING && this->jobs[i].state.compare_exchange_strong(expected, JOB_ABANDONED, std::memory_order_acq_rel))
+			this->late++;
+	}
+	this->queued = 0;
+}
+
+
+bool ForkJoin::busy(size_t i) noexcept
+{
+	int state = this->jobs[i].state.load(std::memory_order_acquire);
+	return state == JOB_RUNNING || state == JOB_ABANDONED;
+}
+
+
+void ForkJoin::work(bool helper) noexcept
+{
+	for(size_t i = 0; i < this->count; ++i)
+	{
+		Job &job = this->jobs[i];
+		int expected = JOB_QUEUED;
+		if(!job.state.compare_exchange_strong(expected, JOB_RUNNING, std::memory_order_acquire))
+			continue;
+
+		job.result = this->task(i);
+
+		// Too late if the caller abandoned it meanwhile -- Hand it back unpublished
+		expected = JOB_RUNNING;
+		if(!job.state.compare_exchange_strong(expected, JOB_DONE, std::memory_order_release))
+			job.state.store(JOB_IDLE, std::memory_order_release);
+		else if(helper)
+			this->finished.post();
+	}
+}
+
+
+void ForkJoin::helper(ThreadRole role) noexcept
+{
+	apply_thread_policy(role);
+
+	while(true)
+	{
+		this->wake.wait();
+		if(this->stopping) break;
+		this->work(true);
+	}
+}
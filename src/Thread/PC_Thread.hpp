@@ -0,0 +1,613 @@
+#ifndef _PC_THREAD_HPP
+#define _PC_THREAD_HPP
+
+
+/*
+ *  PeersChat Threading Header: Scheduling policy for the threads PeersChat runs on
+ *
+ * Audio and network threads have to wake up on time every frame.  On a busy desktop
+ * they compete with GTK, compilers, browsers, etc. for the CPU and lose often enough
+ * to cause underruns.  This library lets those threads ask the kernel for real-time
+ * scheduling and optionally pins them to a core of the user's choosing.
+ *
+ * Every function applies to the *calling* thread, so call it first thing on the thread
+ * you want to change.  Threads we don't create ourselves (the PortAudio callback) call
+ * it from their first invocation.
+ *
+ *    WorkerPool: A fixed set of threads that runs posted tasks.  Used so the number of
+ *                threads doesn't depend on how many peers are in the call and nobody
+ *                has to spawn or join a thread when a peer comes or goes.
+ *
+ *    Semaphore: Counting semaphore on a futex.  Posting never takes a lock or allocates,
+ *               so a real-time thread can wake another one.
+ *
+ *    ForkJoin: A batch of numbered jobs run by a fixed set of helper threads and the
+ *              caller, until they are done or a deadline passes.  Lock-free on the
+ *              caller's side, for the audio thread.
+ *
+ *    SPSCRing: Lock-free ring buffer between exactly one producer thread and one
+ *              consumer thread.  Lets a real-time thread hand data to another thread
+ *              without ever taking a lock or allocating.
+ *
+ *    SeqLock: Latest value of a small struct from one writer thread to any number of
+ *             readers.  The writer never waits; readers retry if they overlapped a
+ *             write.  For meters the audio thread publishes and the GUI samples.
+ *
+ *    MPSCQueue: Lock-free queue from any number of producer threads to one consumer.
+ *               For events (roster changes) that many threads post and one thread
+ *               handles in batches.
+ *
+ */
+
+
+#ifdef __linux__
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#endif
+
+#include <semaphore.h>
+#include <time.h>
+#include <cstdlib>
+#include <cstdint>
+#include <cstdio>
+#include <cerrno>
+#include <cstring>
+#include <atomic>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <algorithm>
+#include <memory>
+#include <chrono>
+
+
+// Thread Roles --------------------------------------------------------------------------
+/* ThreadRole: What kind of work a thread does.  Decides its priority and core.
+ *
+ *   THREAD_AUDIO    Audio callback.  Highest priority, misses are audible right away.
+ *   THREAD_NETWORK  Threads moving audio packets on/off the network.
+ *   THREAD_CONTROL  Everything else (TCP requests, GUI work).  Left alone.
+ */
+enum ThreadRole { THREAD_AUDIO, THREAD_NETWORK, THREAD_CONTROL };
+
+
+// Globals
+/*
+ * REALTIME_THREADS enables asking for SCHED_FIFO.  If the kernel says no (no
+ * CAP_SYS_NICE and RLIMIT_RTPRIO of 0) we fall back to a negative nice value and
+ * if that's refused too we run as a normal thread.
+ *
+ * AUDIO_THREAD_PRIORITY / NETWORK_THREAD_PRIORITY are the SCHED_FIFO priorities to ask
+ * for.  The network one should stay below the audio one.
+ *
+ * AUDIO_THREAD_CORE / NETWORK_THREAD_CORE pin threads of that role to a core.  -1
+ * leaves them wherever the scheduler puts them.
+ *
+ * All of them can be set through the environment, see thread_policy_from_env().
+ */
+extern bool REALTIME_THREADS;
+extern int AUDIO_THREAD_PRIORITY;
+extern int NETWORK_THREAD_PRIORITY;
+extern int AUDIO_THREAD_CORE;
+extern int NETWORK_THREAD_CORE;
+
+
+// Functions -----------------------------------------------------------------------------
+/* thread_policy_from_env()  Read the globals above from PEERSCHAT_REALTIME (0/1),
+ *                           PEERSCHAT_AUDIO_CORE and PEERSCHAT_NETWORK_CORE.  Call once
+ *                           before any threads are started.
+ *
+ * apply_thread_policy(1)  Apply the scheduling policy for a role to the calling thread.
+ *                        @param role (ThreadRole) what the calling thread does
+ *                        @return (bool) true if the thread got real-time or raised
+ *                          priority, false if it runs as a normal thread
+ *
+ * pin_thread_to_core(1)  Pin the calling thread to one core
+ *                       @param core (int) core index, negative does nothing
+ *                       @return (bool) success?
+ */
+void thread_policy_from_env() noexcept;
+bool apply_thread_policy(ThreadRole role) noexcept;
+bool pin_thread_to_core(int core) noexcept;
+
+
+
+
+// WorkerPool Class ----------------------------------------------------------------------
+/* WorkerPool: A fixed size pool of threads that run posted tasks
+ *
+(IMPLEMENTATION DETAILS)
+Members:
+ * tasks  Queue of tasks waiting for a worker
+ *
+ * busy  Owner of the task each worker is running right now, NULL if idle
+ *
+ * threads  The worker threads
+ *
+ * lock  Mutex on everything above
+ *
+ * wake  Signalled when a task is posted or the pool stops
+ *
+ * done  Signalled whenever a worker finishes a task
+ *
+ * stopping  Set by @stop to send the workers home
+ *
+ *
+(CLIENT INTERFACE)
+Every task is tagged with an owner pointer (usually the object the task works on) so it
+can be cancelled or waited on as a group.  Tasks may run for a long time (a receive loop)
+but then the owner has to have a way of telling them to return.
+ *
+Public Methods:
+ * start(2)  Start the worker threads
+ *          @param count (int) number of threads
+ *          @param role (ThreadRole) scheduling policy applied to every worker
+ *          @return (bool) success?
+ *
+ * stop()  Drop all queued tasks and join the workers once their current task returns
+ *
+ * post(2)  Queue a task
+ *         @param owner (const void*) tag for @cancel/@wait
+ *         @param task (std::function<void()>) the work
+ *         @return (bool) false if the pool isn't running
+ *
+ * cancel(1)  Drop every queued task of @owner and wait for its running ones to return.
+ *            Must not be called from a task of the same owner.
+ *
+ * wait(1)  Wait until @owner has no queued or running tasks left.  Same caveat.
+ *
+ * size()  Number of worker threads
+ *
+ */
+class WorkerPool
+{
+	// Members
+private:
+	struct Task
+	{
+		const void *owner;
+		std::function<void()> run;
+	};
+	std::deque<Task> tasks;
+	std::vector<const void*> busy;
+	std::vector<std::thread> threads;
+	std::mutex lock;
+	std::condition_variable wake;
+	std::condition_variable done;
+	bool stopping = false;
+
+public:
+	WorkerPool() noexcept { }
+	~WorkerPool() noexcept;
+	WorkerPool(const WorkerPool&) = delete;
+	WorkerPool& operator=(const WorkerPool&) = delete;
+
+	bool start(int count, ThreadRole role) noexcept;
+	void stop() noexcept;
+	bool post(const void *owner, std::function<void()> task);
+	void cancel(const void *owner) noexcept;
+	void wait(const void *owner) noexcept;
+	inline int size() noexcept { return (int) this->threads.size(); }
+
+private:
+	void worker(size_t index, ThreadRole role) noexcept;
+	bool running(const void *owner) noexcept;
+};
+
+
+// Semaphore Class -----------------------------------------------------------------------
+/* Semaphore: POSIX counting semaphore
+ *
+(IMPLEMENTATION DETAILS)
+Members:
+ * sem  The semaphore.  A post only makes a system call (futex wake) if a thread is
+ *      waiting on it.
+ *
+ *
+(CLIENT INTERFACE)
+Public Methods:
+ * post()  Add one, waking a waiting thread
+ *
+ * wait()  Take one, waiting for a post if there is none
+ *
+ * tryWait()  Take one if there is one
+ *           @return (bool) took one?
+ *
+ * waitUntil(1)  wait(), but give up at @deadline
+ *              @return (bool) took one?
+ *
+ */
+class Semaphore
+{
+	// Members
+private:
+	sem_t sem;
+
+public:
+	Semaphore() noexcept { sem_init(&this->sem, 0, 0); }
+	~Semaphore() noexcept { sem_destroy(&this->sem); }
+	Semaphore(const Semaphore&) = delete;
+	Semaphore& operator=(const Semaphore&) = delete;
+
+	inline void post() noexcept { sem_post(&this->sem); }
+	void wait() noexcept;
+	inline bool tryWait() noexcept { return sem_trywait(&this->sem) == 0; }
+	bool waitUntil(std::chrono::steady_clock::time_point deadline) noexcept;
+};
+
+
+// ForkJoin Class ------------------------------------------------------------------------
+/* ForkJoin: Runs a batch of jobs on helper threads and the caller, up to a deadline
+ *
+(IMPLEMENTATION DETAILS)
+Members:
+ * task  What job i is, set by @start.  Returns that job's result.
+ *
+ * jobs  State of every job (JOB_*) and its last result
+ *
+ * batch  Which jobs the caller queued for the current run().  Caller only.
+ *
+ * queued  Number of jobs in @batch.  Caller only.
+ *
+ * threads  The helpers
+ *
+ * wake  Posted once per helper the caller wants working
+ *
+ * finished  Posted by a helper every time it finished a job, so the caller can sleep
+ *           until there's something to look at
+ *
+ * stopping  Set by @stop to send the helpers home
+ *
+ * late  Jobs that were still running at a deadline
+ *
+A job goes JOB_IDLE -> JOB_QUEUED (queue()) -> JOB_RUNNING (claimed by whoever gets the
+compare-and-swap first) -> JOB_DONE.  At the deadline queued jobs go back to JOB_IDLE
+and running ones to JOB_ABANDONED.  The helper still finishes an abandoned job but
+can't publish it (its swap to JOB_DONE fails), and puts it back to JOB_IDLE instead.
+So the caller sees every result it reads come in before its deadline, and a late
+helper never writes into a result the caller is reading.
+ *
+ *
+(CLIENT INTERFACE)
+The caller side (queue(), run(), done(), result(), busy()) is one thread, the same one
+every time.  It never takes a lock or allocates.  Whatever data job i works on belongs
+to the helper that runs it until busy(i) is false again.
+ *
+Public Methods:
+ * start(4)  Start the helpers
+ *          @param count (size_t) number of jobs, numbered 0 to @count - 1
+ *          @param helpers (int) number of helper threads
+ *          @param role (ThreadRole) scheduling policy applied to every helper
+ *          @param task (std::function<bool(size_t)>) runs one job
+ *          @return (bool) success?
+ *
+ * stop()  Join the helpers once their current job returns
+ *
+ * queue(1)  Add job @i to the next run()
+ *          @return (bool) false if it is still busy from an earlier run
+ *
+ * run(1)  Wake as many helpers as there are queued jobs past the first, run jobs
+ *         alongside them, and wait for the rest until @deadline.  Whatever hasn't
+ *         finished then is left out (see above).
+ *
+ * done(1)  Did job @i finish in the last run()?
+ *
+ * result(1)  What job @i returned, if done()
+ *
+ * busy(1)  Is a helper still on job @i?  Its data isn't the caller's until it's not.
+ *
+ * helpers()  Number of helper threads
+ *
+ * getLate()  Jobs given up on at a deadline so far
+ *
+ */
+class ForkJoin
+{
+	// Types
+public:
+	enum { JOB_IDLE, JOB_QUEUED, JOB_RUNNING, JOB_DONE, JOB_ABANDONED };
+
+private:
+	struct Job
+	{
+		std::atomic<int> state = {JOB_IDLE};
+		bool result = false;
+	};
+
+	// Members
+private:
+	std::function<bool(size_t)> task;
+	std::unique_ptr<Job[]> jobs;
+	std::vector<bool> batch;
+	size_t count = 0;
+	int queued = 0;
+	std::vector<std::thread> threads;
+	Semaphore wake;
+	Semaphore finished;
+	std::atomic<bool> stopping = {false};
+	std::atomic<uint32_t> late = {0};
+
+public:
+	ForkJoin() noexcept { }
+	~ForkJoin() noexcept;
+	ForkJoin(const ForkJoin&) = delete;
+	ForkJoin& operator=(const ForkJoin&) = delete;
+
+	bool start(size_t count, int helpers, ThreadRole role, std::function<bool(size_t)> task) noexcept;
+	void stop() noexcept;
+	bool queue(size_t i) noexcept;
+	void run(std::chrono::steady_clock::time_point deadline) noexcept;
+	inline bool done(size_t i) noexcept { return this->jobs[i].state.load(std::memory_order_acquire) == JOB_DONE; }
+	inline bool result(size_t i) noexcept { return this->jobs[i].result; }
+	bool busy(size_t i) noexcept;
+	inline int helpers() noexcept { return (int) this->threads.size(); }
+	inline uint32_t getLate() noexcept { return this->late; }
+
+private:
+	void work(bool helper) noexcept;
+	void helper(ThreadRole role) noexcept;
+};
+
+
+// SPSCRing Class ------------------------------------------------------------------------
+/* SPSCRing: Fixed size lock-free FIFO of T between one producer and one consumer thread
+ *
+(IMPLEMENTATION DETAILS)
+Members:
+ * buffer  Storage, its size is a power of two so positions wrap with a mask
+ *
+ * head  Total elements ever written.  Only the producer stores it.
+ *
+ * tail  Total elements ever read (or discarded).  Only the consumer stores it.
+ *
+head and tail are kept on separate cache lines so the two threads don't keep stealing
+the line from each other.  The producer publishes data with a release store of head
+that the consumer's acquire load of head pairs with, and the other way around for tail.
+ *
+ *
+(CLIENT INTERFACE)
+T has to be trivially copyable, elements are moved with memcpy.
+ *
+Public Methods:
+ * SPSCRing(1)  Allocate room for at least @capacity elements
+ *
+ * write(2)  Producer: Copy up to @n elements in
+ *          @return (size_t) how many fit
+ *
+ * read(2)  Consumer: Copy up to @n elements out
+ *         @return (size_t) how many there were
+ *
+ * discard(1)  Consumer: Drop up to @n of the oldest elements
+ *            @return (size_t) how many were dropped
+ *
+ * available()  Elements waiting to be read.  Exact for the consumer, a lower bound
+ *              for anyone else.
+ *
+ * space()  Room left to write.  Exact for the producer, a lower bound for anyone else.
+ *
+ * clear()  Empty the ring.  Only while neither side is using it.
+ *
+ */
+template <typename T>
+class SPSCRing
+{
+	// Members
+private:
+	std::vector<T> buffer;
+	size_t mask;
+	std::atomic<size_t> head;
+	char pad[64];
+	std::atomic<size_t> tail;
+
+public:
+	explicit SPSCRing(size_t capacity) : head(0), tail(0)
+	{
+		size_t size = 1;
+		while(size < capacity) size <<= 1;
+		this->buffer.resize(size);
+		this->mask = size - 1;
+	}
+	SPSCRing(const SPSCRing&) = delete;
+	SPSCRing& operator=(const SPSCRing&) = delete;
+
+	size_t write(const T *src, size_t n) noexcept
+	{
+		size_t h = this->head.load(std::memory_order_relaxed);
+		size_t t = this->tail.load(std::memory_order_acquire);
+		n = std::min(n, this->buffer.size() - (h - t));
+		size_t first = std::min(n, this->buffer.size() - (h & this->mask));
+		std::memcpy(&this->buffer[h & this->mask], src, sizeof(T) * first);
+		std::memcpy(&this->buffer[0], src + first, sizeof(T) * (n - first));
+		this->head.store(h + n, std::memory_order_release);
+		return n;
+	}
+
+	size_t read(T *dst, size_t n) noexcept
+	{
+		size_t t = this->tail.load(std::memory_order_relaxed);
+		size_t h = this->head.load(std::memory_order_acquire);
+		n = std::min(n, h - t);
+		size_t first = std::min(n, this->buffer.size() - (t & this->mask));
+		std::memcpy(dst, &this->buffer[t & this->mask], sizeof(T) * first);
+		std::memcpy(dst + first, &this->buffer[0], sizeof(T) * (n - first));
+		this->tail.store(t + n, std::memory_order_release);
+		return n;
+	}
+
+	size_t discard(size_t n) noexcept
+	{
+		size_t t = this->tail.load(std::memory_order_relaxed);
+		size_t h = this->head.load(std::memory_order_acquire);
+		n = std::min(n, h - t);
+		this->tail.store(t + n, std::memory_order_release);
+		return n;
+	}
+
+	inline size_t available() const noexcept
+	{
+		return this->head.load(std::memory_order_acquire) - this->tail.load(std::memory_order_acquire);
+	}
+	inline size_t space() const noexcept { return this->buffer.size() - this->available(); }
+	inline void clear() noexcept { this->head = 0; this->tail = 0; }
+};
+
+
+// SeqLock Class -------------------------------------------------------------------------
+/* SeqLock: Lock-free snapshot of a T written by one thread and read by any
+ *
+(IMPLEMENTATION DETAILS)
+Members:
+ * sequence  Odd while a write is in progress, bumped twice per write
+ *
+ * words  The value, copied in and out as relaxed atomic words so a reader overlapping
+ *        a write sees torn data (and retries) instead of a data race
+ *
+A reader takes the sequence, the words, then the sequence again and keeps the copy
+only if both were the same even number.  The writer never waits on readers.
+ *
+ *
+(CLIENT INTERFACE)
+T has to be trivially copyable and small, it is copied on every store() and load().
+ *
+Public Methods:
+ * store(1)  Writer: Publish @value
+ *
+ * load()  Any thread: The last value published
+ *        @return (T) a copy
+ *
+ */
+template <typename T>
+class SeqLock
+{
+	// Members
+private:
+	static constexpr size_t WORDS = (sizeof(T) + sizeof(uint32_t) - 1) / sizeof(uint32_t);
+	std::atomic<uint32_t> sequence;
+	std::atomic<uint32_t> words[WORDS];
+
+public:
+	SeqLock() noexcept : sequence(0)
+	{
+		for(size_t i = 0; i < WORDS; ++i)
+			this->words[i].store(0, std::memory_order_relaxed);
+		this->store(T());
+	}
+	SeqLock(const SeqLock&) = delete;
+	SeqLock& operator=(const SeqLock&) = delete;
+
+	void store(const T &value) noexcept
+	{
+		uint32_t buffer[WORDS] = {0};
+		std::memcpy(buffer, &value, sizeof(T));
+
+		uint32_t s = this->sequence.load(std::memory_order_relaxed);
+		this->sequence.store(s + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		for(size_t i = 0; i < WORDS; ++i)
+			this->words[i].store(buffer[i], std::memory_order_relaxed);
+		this->sequence.store(s + 2, std::memory_order_release);
+	}
+
+	T load() const noexcept
+	{
+		uint32_t buffer[WORDS];
+		uint32_t before, after;
+		do
+		{
+			before = this->sequence.load(std::memory_order_acquire);
+			for(size_t i = 0; i < WORDS; ++i)
+				buffer[i] = this->words[i].load(std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_acquire);
+			after = this->sequence.load(std::memory_order_relaxed);
+		} while((before & 1) || before != after);
+
+		T value;
+		std::memcpy(&value, buffer, sizeof(T));
+		return value;
+	}
+};
+
+
+// MPSCQueue Class -----------------------------------------------------------------------
+/* MPSCQueue: Unbounded lock-free FIFO of T from any number of producers to one consumer
+ *
+(IMPLEMENTATION DETAILS)
+Members:
+ * top  Most recently pushed node.  Producers link theirs in front of it with a CAS and
+ *      the consumer takes the whole list at once with an exchange, so there is no ABA
+ *      problem and no producer ever waits on the consumer.  The consumer reverses what
+ *      it took to hand it out oldest first.
+ *
+ *
+(CLIENT INTERFACE)
+Every push allocates a node, so this is for events, not for audio.
+ *
+Public Methods:
+ * push(1)  Any thread: Queue a copy of @value
+ *         @return (bool) true if the queue was empty before, i.e. the consumer has to
+ *                        be told there is something to drain
+ *
+ * drain(1)  Consumer: Move everything queued to the end of @out, oldest first
+ *          @return (size_t) how many
+ *
+ * empty()  Is nothing queued?  Only a hint for anyone but the consumer.
+ *
+ */
+template <typename T>
+class MPSCQueue
+{
+	// Members
+private:
+	struct Node
+	{
+		T value;
+		Node *next;
+	};
+	std::atomic<Node*> top;
+
+public:
+	MPSCQueue() noexcept : top(NULL) { }
+	~MPSCQueue() noexcept
+	{
+		std::vector<T> rest;
+		this->drain(rest);
+	}
+	MPSCQueue(const MPSCQueue&) = delete;
+	MPSCQueue& operator=(const MPSCQueue&) = delete;
+
+	bool push(const T &value)
+	{
+		Node *node = new Node{value, this->top.load(std::memory_order_relaxed)};
+		while(!this->top.compare_exchange_weak(node->next, node, std::memory_order_release, std::memory_order_relaxed))
+			;
+		return node->next == NULL;
+	}
+
+	size_t drain(std::vector<T> &out)
+	{
+		Node *node = this->top.exchange(NULL, std::memory_order_acquire);
+		size_t first = out.size();
+		while(node)
+		{
+			Node *next = node->next;
+			out.push_back(std::move(node->value));
+			delete node;
+			node = next;
+		}
+		std::reverse(out.begin() + first, out.end());
+		return out.size() - first;
+	}
+
+	inline bool empty() const noexcept { return this->top.load(std::memory_order_acquire) == NULL; }
+};
+
+
+#endif
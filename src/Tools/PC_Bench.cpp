@@ -0,0 +1,911 @@
+/*
+ *  PeersChatBench: Times the audio and network hot paths on synthetic data
+ *
+ * Each test runs a piece of the pipeline the way the client calls it, on data made up
+ * here, and prints what it cost.  No sound card, network or peers are needed, so the
+ * numbers can be compared across machines and builds.
+ *
+ * Usage: PeersChatBench [-r rounds] [-t threads] [-f far.wav -m mic.wav] test...
+ *   dsp  Every DSP kernel (PC_DSP.hpp) against its scalar version, on one frame
+ *   aec  The echo canceller (PC_AEC.hpp) on 30 s of far end played into a made-up
+ *        room, with near end speech over it for 3 s.  Or on a recording: -f what was
+ *        played, -m what the mic picked up meanwhile (16 bit mono 48 kHz WAV).
+ *   resample  The resampler (PC_Resampler.hpp) between the rates devices run at, and
+ *             nudged 200 ppm for drift: CPU per 20 ms, delay, and how clean tones
+ *             come out (SNR) or how well ones past the new Nyquist are kept out
+ *   decode  Decoding and mixing 1 to 64 Opus streams a frame the way the mixer does with
+ *           PEERSCHAT_DECODE_THREADS, on 1 thread up to one per core (-t to change
+ *           the most): wall time per frame and streams that missed the deadline
+ *   record  The call recorder (PC_Recorder.hpp) writing a 50 stream call at 10x to
+ *           300x real time: cost of handing it a packet, packets it had to drop,
+ *           disk throughput and how long stop() takes to write out the rest
+ *   gossip  Membership gossip (PC_Gossip.hpp) in calls of 5 to 100 members, on a
+ *           made-up network with and without loss: rounds until a join, a leave
+ *           and a crash reach everyone, and the bytes and CPU it costs a member
+ *   crypto  Sealing and opening audio (PC_Crypto.hpp) for small to full sized packets
+ *           next to what encoding and decoding a frame costs, and agreeing keys
+ *
+ * Every timing is the best of -r rounds (default 5), so a stray context switch doesn't
+ * count, except record's, which are the median, 99th percentile and worst of every
+ * call, and gossip's, which are the mean of -r made-up calls.  Output is one key=value per line, for scripts.
+ *
+ */
+
+#include <cstdio>
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <memory>
+#include <unordered_map>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <opus.h>
+
+#include "PC_DSP.hpp"
+#include "PC_AEC.hpp"
+#include "PC_Resampler.hpp"
+#include "PC_Recorder.hpp"
+#include "PC_Gossip.hpp"
+#include "PC_Crypto.hpp"
+#include <PC_Thread.hpp>
+
+/* Constants -- Keep in step with PC_Audio.hpp
+ * SAMPLE_RATE, FRAME_SIZE, BITRATE: What APeer encodes, decodes and mixes at
+ * DECODE_DEADLINE_US: How long the mixer waits for the decode helpers
+ * DEFAULT_ROUNDS: Timings per measurement, the best one is kept
+ * RECORD_STREAMS, RECORD_SECONDS: Size and length of the call the recorder is fed
+ * GOSSIP_LEAVE_REPEAT: Goodbyes a leaving member sends everyone (PC_Network.cpp)
+ * GOSSIP_SIM_MAX_ROUNDS: Rounds after which the gossip test gives up on a change
+ * GOSSIP_SIM_STEADY_ROUNDS: Rounds the settled traffic and CPU are measured over
+ * CRYPTO_SIM_PACKETS: Datagrams sealed and opened per round
+ */
+#define SAMPLE_RATE 48000
+#define FRAME_SIZE 960
+#define BITRATE 24000
+#define DECODE_DEADLINE_US 4000
+#define DEFAULT_ROUNDS 5
+#define RECORD_STREAMS 50
+#define RECORD_SECONDS 60
+#define GOSSIP_LEAVE_REPEAT 3
+#define GOSSIP_SIM_MAX_ROUNDS 500
+#define GOSSIP_SIM_STEADY_ROUNDS 50
+#define CRYPTO_SIM_PACKETS 10000
+
+typedef std::chrono::steady_clock Clock;
+
+static int rounds = DEFAULT_ROUNDS;
+static int max_threads = 0;
+static const char *far_path = nullptr;
+static const char *mic_path = nullptr;
+
+// Keeps results alive so the compiler can't drop the work
+static volatile float sink;
+
+/* best_ns()
+ * Runs f() iterations times per round and returns the fastest round in ns per call.
+ */
+template<class F>
+static double best_ns(F f, int iterations) {
+	double best = 1e300;
+	for (int round = 0; round < rounds; ++round) {
+		Clock::time_point begin = Clock::now();
+		for (int i = 0; i < iterations; ++i)
+			f();
+		std::chrono::duration<double, std::nano> took = Clock::now() - begin;
+		best = std::min(best, took.count() / iterations);
+	}
+	return best;
+}
+
+/* noise()
+ * n samples of white noise at amplitude a, always the same for the same seed.
+ */
+static std::vector<float> noise(size_t n, float a, unsigned seed) {
+	std::mt19937 rng(seed);
+	std::uniform_real_distribution<float> dist(-a, a);
+	std::vector<float> x(n);
+	for (float &s : x)
+		s = dist(rng);
+	return x;
+}
+
+// dsp ---------------------------------------------------------------------------------
+/* bench_dsp_kernels()
+ * Times every kernel of k on one frame, ns per call into ns in DSPKernels order.
+ */
+static void bench_dsp_kernels(const DSPKernels &k, std::vector<double> &ns) {
+	const int iterations = 20000;
+	std::vector<float> a = noise(2 * FRAME_SIZE, 0.5f, 1), b = noise(2 * FRAME_SIZE, 0.5f, 2);
+	std::vector<int16_t> pcm(FRAME_SIZE);
+	float peak = 0.0f, rms = 0.0f;
+
+	// Gains close to 1 so repeating them doesn't run into denormals or infinities
+	ns.push_back(best_ns([&]() { k.gain(a.data(), 0.9999f, FRAME_SIZE); k.gain(a.data(), 1.0001f, FRAME_SIZE); }, iterations) / 2);
+	ns.push_back(best_ns([&]() { k.gain_ramp(a.data(), 0.9999f, 1.0001f, FRAME_SIZE); }, iterations));
+	ns.push_back(best_ns([&]() { k.mix(a.data(), b.data(), 1e-6f, FRAME_SIZE); }, iterations));
+	ns.push_back(best_ns([&]() { k.mix_ramp(a.data(), b.data(), 1e-6f, -1e-6f, FRAME_SIZE); }, iterations));
+	ns.push_back(best_ns([&]() { k.soft_clip(a.data(), FRAME_SIZE); }, iterations));
+	ns.push_back(best_ns([&]() { k.peak_rms(a.data(), FRAME_SIZE, &peak, &rms); sink = rms; }, iterations));
+	ns.push_back(best_ns([&]() { sink = k.dot(a.data(), b.data(), FRAME_SIZE); }, iterations));
+	ns.push_back(best_ns([&]() { k.to_int16(a.data(), pcm.data(), FRAME_SIZE); }, iterations));
+	ns.push_back(best_ns([&]() { k.from_int16(pcm.data(), b.data(), FRAME_SIZE); }, iterations));
+	ns.push_back(best_ns([&]() { k.mix_pan(a.data(), b.data(), 1e-6f, 1e-6f, -1e-6f, -1e-6f, FRAME_SIZE); }, iterations));
+	sink = a[0] + b[0] + pcm[0] + peak;
+}
+
+/* bench_dsp()
+ * Every kernel, scalar and the set dsp() picked, on a frame of FRAME_SIZE samples.
+ */
+static void bench_dsp() {
+	static const char *names[] = {"gain", "gain_ramp", "mix", "mix_ramp", "soft_clip", "peak_rms",
+	                              "dot", "to_int16", "from_int16", "mix_pan"};
+	const DSPKernels &best = dsp(), &scalar = dsp_scalar();
+	std::vector<double> best_ns, scalar_ns;
+	bench_dsp_kernels(scalar, scalar_ns);
+	bench_dsp_kernels(best, best_ns);
+
+	std::printf("dsp.set=%s\ndsp.frame=%d\n", best.name, FRAME_SIZE);
+	for (size_t i = 0; i < scalar_ns.size(); ++i)
+		std::printf("dsp.%s.scalar_ns=%.0f\ndsp.%s.%s_ns=%.0f\ndsp.%s.speedup=%.2f\n",
+		            names[i], scalar_ns[i], names[i], best.name, best_ns[i], names[i], scalar_ns[i] / best_ns[i]);
+}
+
+// aec ---------------------------------------------------------------------------------
+/* read_wav()
+ * Samples of a 16 bit mono 48 kHz WAV file, empty if it is anything else.
+ */
+static std::vector<float> read_wav(const char *path) {
+	std::vector<float> x;
+	FILE *f = std::fopen(path, "rb");
+	if (!f)
+		return x;
+	uint8_t h[12], chunk[8], fmt[16] = {0};
+	bool ok = std::fread(h, 1, 12, f) == 12 && !std::memcmp(h, "RIFF", 4) && !std::memcmp(h + 8, "WAVE", 4);
+	while (ok && std::fread(chunk, 1, 8, f) == 8) {
+		uint32_t size = chunk[4] | (chunk[5] << 8) | (chunk[6] << 16) | ((uint32_t) chunk[7] << 24);
+		if (!std::memcmp(chunk, "fmt ", 4)) {
+			ok = size >= 16 && std::fread(fmt, 1, 16, f) == 16 && std::fseek(f, size - 16 + (size & 1), SEEK_CUR) == 0;
+			continue;
+		}
+		if (std::memcmp(chunk, "data", 4)) {
+			ok = std::fseek(f, size + (size & 1), SEEK_CUR) == 0;
+			continue;
+		}
+		uint32_t rate = fmt[4] | (fmt[5] << 8) | (fmt[6] << 16) | ((uint32_t) fmt[7] << 24);
+		if (fmt[0] != 1 || fmt[2] != 1 || fmt[14] != 16 || rate != SAMPLE_RATE)
+			break;
+		std::vector<int16_t> pcm(size / 2);
+		pcm.resize(std::fread(pcm.data(), 2, pcm.size(), f));
+		x.resize(pcm.size());
+		dsp().from_int16(pcm.data(), x.data(), pcm.size());
+		break;
+	}
+	std::fclose(f);
+	return x;
+}
+
+/* speech()
+ * n samples that come and go like talking: low passed noise in syllables, a pause
+ * every couple of seconds.
+ */
+static std::vector<float> speech(size_t n, float a, unsigned seed) {
+	std::vector<float> x = noise(n, 1.0f, seed);
+	float lp = 0.0f;
+	for (size_t i = 0; i < n; ++i) {
+		double t = (double) i / SAMPLE_RATE;
+		double envelope = std::fmod(t, 2.0) < 1.5 ? std::fabs(std::sin(M_PI * 4.0 * t)) : 0.0;
+		lp += 0.3f * (x[i] - lp);
+		x[i] = (float) (a * envelope) * lp;
+	}
+	return x;
+}
+
+/* room()
+ * What the mic hears of far played into a room: the direct path 30 ms late, then
+ * reflections out to 150 ms that die away.
+ */
+static std::vector<float> room(const std::vector<float> &far) {
+	std::mt19937 rng(3);
+	std::vector<std::pair<size_t, float>> taps = {{SAMPLE_RATE * 30 / 1000, 0.5f}};
+	for (int i = 0; i < 40; ++i) {
+		size_t d = SAMPLE_RATE * 30 / 1000 + rng() % (SAMPLE_RATE * 120 / 1000);
+		float g = 0.3f * std::exp(-3.0f * (d - taps[0].first) / (SAMPLE_RATE * 120 / 1000.0f));
+		taps.push_back({d, (rng() & 1) ? g : -g});
+	}
+	std::vector<float> mic(far.size(), 0.0f);
+	for (const auto &tap : taps)
+		for (size_t i = tap.first; i < far.size(); ++i)
+			mic[i] += tap.second * far[i - tap.first];
+	return mic;
+}
+
+/* energy()
+ * Sum of x[i]^2 over [begin, end), only where mask is set if there is a mask.
+ */
+static double energy(const std::vector<float> &x, size_t begin, size_t end, const std::vector<bool> *mask = nullptr) {
+	double sum = 0.0;
+	for (size_t i = begin; i < std::min(end, x.size()); ++i)
+		if (!mask || (*mask)[i])
+			sum += (double) x[i] * x[i];
+	return sum;
+}
+
+/* bench_aec()
+ * Plays far and captures mic through an EchoCanceller one callback at a time, like
+ * Pa_Callback: capture() at the start, playback() at the end.  ERLE leaves out the
+ * double talk and is given from 5 s in and for the last 5 s, where it has converged.
+ */
+static void bench_aec() {
+	std::vector<float> far, mic, near;
+	std::vector<bool> far_only;
+	if (far_path || mic_path) {
+		far = far_path ? read_wav(far_path) : far;
+		mic = mic_path ? read_wav(mic_path) : mic;
+		if (far.empty() || mic.empty()) {
+			std::fprintf(stderr, "aec: -f and -m have to be 16 bit mono %d Hz WAV files\n", SAMPLE_RATE);
+			return;
+		}
+		size_t n = std::min(far.size(), mic.size());
+		far.resize(n);
+		mic.resize(n);
+	} else {
+		// Near end talks over the far end from 14 s to 17 s
+		const size_t n = 30 * SAMPLE_RATE, dt_begin = 14 * SAMPLE_RATE, dt_end = 17 * SAMPLE_RATE;
+		far = speech(n, 0.5f, 4);
+		mic = room(far);
+		near = speech(n, 0.3f, 5);
+		std::vector<float> hiss = noise(n, 1e-3f, 6);
+		far_only.assign(n, true);
+		for (size_t i = 0; i < n; ++i) {
+			bool talking = i >= dt_begin && i < dt_end;
+			mic[i] += hiss[i] + (talking ? near[i] : 0.0f);
+			far_only[i] = !talking;
+		}
+	}
+
+	const size_t frames = far.size() / FRAME_SIZE;
+	std::vector<float> out(frames * FRAME_SIZE);
+	double best = 1e300;
+	float erle_reported = 0.0f, load = 0.0f;
+	uint32_t skipped = 0;
+	for (int round = 0; round < rounds; ++round) {
+		EchoCanceller aec(SAMPLE_RATE);
+		std::memcpy(out.data(), mic.data(), sizeof(float) * out.size());
+		Clock::time_point begin = Clock::now();
+		for (size_t k = 0; k < frames; ++k) {
+			aec.capture(&out[k * FRAME_SIZE], FRAME_SIZE);
+			aec.playback(&far[k * FRAME_SIZE], FRAME_SIZE, 1);
+		}
+		std::chrono::duration<double, std::nano> took = Clock::now() - begin;
+		best = std::min(best, took.count() / frames);
+		erle_reported = aec.getERLE();
+		load = aec.getLoad();
+		skipped = aec.getSkipped();
+	}
+
+	const size_t settled = std::min(out.size(), (size_t) 5 * SAMPLE_RATE);
+	const size_t last = out.size() - settled;
+	const std::vector<bool> *mask = far_only.empty() ? nullptr : &far_only;
+	double erle = 10.0 * std::log10((energy(mic, settled, out.size(), mask) + 1e-12) /
+	                                (energy(out, settled, out.size(), mask) + 1e-12));
+	double erle_last = 10.0 * std::log10((energy(mic, last, out.size(), mask) + 1e-12) /
+	                                     (energy(out, last, out.size(), mask) + 1e-12));
+	std::printf("aec.source=%s\naec.seconds=%.1f\naec.frame_ns=%.0f\naec.load_pct=%.2f\n",
+	            far_only.empty() ? "wav" : "synthetic", (double) out.size() / SAMPLE_RATE, best,
+	            100.0 * best / (1e9 * FRAME_SIZE / SAMPLE_RATE));
+	std::printf("aec.reported_load_pct=%.2f\naec.over_budget_frames=%u\n", 100.0 * load, skipped);
+	std::printf("aec.erle_db=%.1f\naec.erle_last_5s_db=%.1f\naec.reported_erle_db=%.1f\n", erle, erle_last, erle_reported);
+
+	// How much of the near end made it through the double talk, in dB (0 is all of it)
+	if (!near.empty()) {
+		const size_t dt_begin = 14 * SAMPLE_RATE, dt_end = 17 * SAMPLE_RATE;
+		std::vector<float> residual(out.size());
+		for (size_t i = dt_begin; i < std::min(dt_end, out.size()); ++i)
+			residual[i] = out[i] - near[i];
+		double kept = energy(near, dt_begin, dt_end), error = energy(residual, dt_begin, dt_end);
+		std::printf("aec.double_talk_snr_db=%.1f\n", 10.0 * std::log10((kept + 1e-12) / (error + 1e-12)));
+	}
+}
+
+// resample ----------------------------------------------------------------------------
+/* resample_tone()
+ * 1 s of a sine at freq through r, 20 ms at a time.  Returns the output after the
+ * filter settled.
+ */
+static std::vector<float> resample_tone(Resampler &r, int in_rate, double freq, float a) {
+	const size_t block = in_rate / 50;
+	std::vector<float> in(block), out(r.maxOutput(block)), all;
+	for (size_t done = 0; done < (size_t) in_rate; done += block) {
+		for (size_t i = 0; i < block; ++i)
+			in[i] = a * (float) std::sin(2.0 * M_PI * freq * (done + i) / in_rate);
+		size_t n = r.process(in.data(), block, out.data(), out.size());
+		all.insert(all.end(), out.begin(), out.begin() + n);
+	}
+	all.erase(all.begin(), all.begin() + std::min(all.size(), all.size() / 10));
+	return all;
+}
+
+/* tone_snr()
+ * Fits a sine at freq (cycles per output sample) to x and returns its power over
+ * what is left, in dB.
+ */
+static double tone_snr(const std::vector<float> &x, double freq) {
+	double ss = 0.0, cc = 0.0, sc = 0.0, xs = 0.0, xc = 0.0;
+	for (size_t i = 0; i < x.size(); ++i) {
+		double s = std::sin(2.0 * M_PI * freq * i), c = std::cos(2.0 * M_PI * freq * i);
+		ss += s * s; cc += c * c; sc += s * c;
+		xs += x[i] * s; xc += x[i] * c;
+	}
+	double det = ss * cc - sc * sc;
+	double a = (xs * cc - xc * sc) / det, b = (xc * ss - xs * sc) / det;
+	double tone = 0.0, rest = 0.0;
+	for (size_t i = 0; i < x.size(); ++i) {
+		double fit = a * std::sin(2.0 * M_PI * freq * i) + b * std::cos(2.0 * M_PI * freq * i);
+		tone += fit * fit;
+		rest += (x[i] - fit) * (x[i] - fit);
+	}
+	return 10.0 * std::log10((tone + 1e-20) / (rest + 1e-20));
+}
+
+/* bench_resample()
+ * Mono like the capture side.  Tones at 1 kHz and 80% of the lower Nyquist should
+ * come out clean.  Going down, a tone between the two Nyquists has to be filtered
+ * out: stopband_db is how much of it is left.
+ */
+static void bench_resample() {
+	struct Pair { int in, out; double ratio; };
+	static const Pair pairs[] = {{44100, 48000, 1.0}, {48000, 44100, 1.0}, {16000, 48000, 1.0},
+	                             {48000, 16000, 1.0}, {96000, 48000, 1.0}, {48000, 48000, 1.0002}};
+	for (const Pair &pair : pairs) {
+		const bool adjustable = pair.ratio != 1.0;
+		const size_t block = pair.in / 50;
+		char key[32];
+		std::snprintf(key, sizeof(key), "%d_%d%s", pair.in, pair.out, adjustable ? "_drift" : "");
+
+		Resampler r(pair.in, pair.out, 1, block, adjustable);
+		if (adjustable)
+			r.setRatio(pair.ratio);
+		std::vector<float> in = noise(block, 0.5f, 7), out(r.maxOutput(block));
+		double ns = best_ns([&]() { r.process(in.data(), block, out.data(), out.size()); }, 2000);
+		std::printf("resample.%s.block_ns=%.0f\nresample.%s.load_pct=%.3f\nresample.%s.delay_ms=%.2f\n",
+		            key, ns, key, 100.0 * ns / 20e6, key, 1000.0 * r.getDelay() / pair.out);
+
+		// Drift makes everything come out ratio times longer, so tones that much lower
+		const double low = std::min(pair.in, pair.out), stretch = pair.out * pair.ratio;
+		for (double freq : {1000.0, 0.4 * low}) {
+			Resampler tone(pair.in, pair.out, 1, block, adjustable);
+			if (adjustable)
+				tone.setRatio(pair.ratio);
+			std::printf("resample.%s.snr_%.0fhz_db=%.1f\n", key, freq,
+			            tone_snr(resample_tone(tone, pair.in, freq, 0.5f), freq / stretch));
+		}
+		if (pair.out < pair.in) {
+			Resampler stop(pair.in, pair.out, 1, block);
+			double freq = std::min(0.49 * pair.in, 0.75 * pair.out);
+			std::vector<float> left = resample_tone(stop, pair.in, freq, 0.5f);
+			std::printf("resample.%s.stopband_%.0fhz_db=%.1f\n", key, freq,
+			            10.0 * std::log10(energy(left, 0, left.size()) / left.size() / 0.125 + 1e-20));
+		}
+	}
+}
+
+// decode ------------------------------------------------------------------------------
+/* voice_packets()
+ * frames packets of "speech" the way APeer's encoder packs it, empty if there is no
+ * encoder.
+ */
+static std::vector<std::vector<unsigned char>> voice_packets(int frames, unsigned seed) {
+	std::vector<std::vector<unsigned char>> packets;
+	int error = 0;
+	OpusEncoder *encoder = opus_encoder_create(SAMPLE_RATE, 1, OPUS_APPLICATION_VOIP, &error);
+	if (error != OPUS_OK) {
+		std::fprintf(stderr, "opus: %s\n", opus_strerror(error));
+		return packets;
+	}
+	opus_encoder_ctl(encoder, OPUS_SET_SIGNAL(OPUS_SIGNAL_VOICE));
+	opus_encoder_ctl(encoder, OPUS_SET_VBR(0));
+	opus_encoder_ctl(encoder, OPUS_SET_BITRATE(BITRATE));
+	std::vector<float> voice = speech(frames * FRAME_SIZE, 0.5f, seed);
+	packets.resize(frames);
+	for (int k = 0; k < frames; ++k) {
+		unsigned char buffer[1500];
+		int len = opus_encode_float(encoder, &voice[k * FRAME_SIZE], FRAME_SIZE, buffer, sizeof(buffer));
+		packets[k].assign(buffer, buffer + std::max(0, len));
+	}
+	opus_encoder_destroy(encoder);
+	return packets;
+}
+
+/* bench_decode()
+ * APeer::decodeAll() with helpers: every stream's next packet is queued on a ForkJoin,
+ * the mixing thread decodes alongside the helpers until all are done or the deadline,
+ * then mixes what came in.  Each stream has its own decoder and plays 1 s of speech
+ * encoded like our mic, looped.  Threads counts the mixing thread.
+ */
+static void bench_decode() {
+	const int frames = 500, loop = 50;
+	const int cores = max_threads > 0 ? max_threads : std::max(1, (int) std::thread::hardware_concurrency());
+
+	std::vector<std::vector<unsigned char>> packets = voice_packets(loop, 8);
+	if (packets.empty())
+		return;
+	int error = 0;
+
+	const DSPKernels &kernels = dsp();
+	std::printf("decode.cores=%d\ndecode.deadline_us=%d\n", cores, DECODE_DEADLINE_US);
+	for (int streams : {1, 2, 4, 8, 16, 32, 64}) {
+		std::vector<OpusDecoder*> decoders(streams);
+		std::vector<std::vector<float>> pcm(streams, std::vector<float>(FRAME_SIZE));
+		for (OpusDecoder *&decoder : decoders)
+			decoder = opus_decoder_create(SAMPLE_RATE, 1, &error);
+		std::vector<int> next(streams);
+		int frame = 0;
+
+		// 1, 2, 4... threads and the core count
+		for (int threads = 1; threads <= cores; threads = (threads * 2 > cores && threads < cores) ? cores : threads * 2) {
+			ForkJoin jobs;
+			jobs.start(streams, threads - 1, THREAD_AUDIO, [&](size_t i) {
+				const std::vector<unsigned char> &packet = packets[next[i] % loop];
+				return opus_decode_float(decoders[i], packet.data(), (opus_int32) packet.size(), pcm[i].data(), FRAME_SIZE, 0) > 0;
+			});
+
+			std::vector<double> took;
+			std::vector<float> mix(FRAME_SIZE);
+			uint64_t skipped = 0;
+			for (int n = 0; n < frames; ++n, ++frame) {
+				Clock::time_point begin = Clock::now();
+				int queued = 0;
+				for (int i = 0; i < streams; ++i) {
+					if (jobs.busy(i))
+						continue;
+					next[i] = frame + i;
+					queued += jobs.queue(i);
+				}
+				jobs.run(begin + std::chrono::microseconds(DECODE_DEADLINE_US));
+				std::fill(mix.begin(), mix.end(), 0.0f);
+				for (int i = 0; i < streams; ++i) {
+					if (jobs.done(i) && jobs.result(i))
+						kernels.mix(mix.data(), pcm[i].data(), 1.0f / streams, FRAME_SIZE);
+					else
+						skipped++;
+				}
+				kernels.soft_clip(mix.data(), FRAME_SIZE);
+				took.push_back(std::chrono::duration<double, std::micro>(Clock::now() - begin).count());
+				sink = mix[0] + queued;
+			}
+			jobs.stop();
+
+			double mean = 0.0;
+			for (double t : took)
+				mean += t;
+			mean /= took.size();
+			std::sort(took.begin(), took.end());
+			std::printf("decode.%d_streams.%d_threads.frame_us=%.0f\ndecode.%d_streams.%d_threads.frame_p99_us=%.0f\n",
+			            streams, threads, mean, streams, threads, took[took.size() * 99 / 100]);
+			std::printf("decode.%d_streams.%d_threads.skipped=%llu\n", streams, threads, (unsigned long long) skipped);
+		}
+		for (OpusDecoder *decoder : decoders)
+			opus_decoder_destroy(decoder);
+	}
+}
+
+// record ------------------------------------------------------------------------------
+/* remove_dir()
+ * Deletes the files in path and then path itself.
+ */
+static void remove_dir(const std::string &path) {
+	DIR *dir = opendir(path.c_str());
+	if (dir) {
+		while (struct dirent *entry = readdir(dir))
+			if (std::strcmp(entry->d_name, ".") && std::strcmp(entry->d_name, ".."))
+				unlink((path + "/" + entry->d_name).c_str());
+		closedir(dir);
+	}
+	rmdir(path.c_str());
+}
+
+/* bench_record()
+ * CallRecorder in a call of RECORD_STREAMS streams: our mic and a peer for each of the
+ * rest, a packet each every 20 ms fed through onPacket() the way the audio and network
+ * threads do, for RECORD_SECONDS of call played faster than real time.  onPacket() is
+ * timed on its own since it runs on those threads; it keeps up at a speed if nothing
+ * was dropped, i.e. RECORDER_FLUSH_MS worth of packets fit in RECORDER_RING_SIZE and
+ * the writer drained them in time.  The files go to a directory under $TMPDIR that is removed after.
+ */
+static void bench_record() {
+	const int streams = RECORD_STREAMS, frames = RECORD_SECONDS * SAMPLE_RATE / FRAME_SIZE, loop = 50;
+	std::vector<std::vector<unsigned char>> packets = voice_packets(loop, 9);
+	if (packets.empty())
+		return;
+
+	const char *tmp = std::getenv("TMPDIR");
+	std::string pattern = std::string(tmp ? tmp : "/tmp") + "/peerschat-bench-XXXXXX";
+	if (!mkdtemp(&pattern[0])) {
+		std::fprintf(stderr, "record: can't make a directory in %s\n", tmp ? tmp : "/tmp");
+		return;
+	}
+
+	std::vector<std::unique_ptr<NPeer>> peers;
+	for (int i = 1; i < streams; ++i)
+		peers.emplace_back(new NPeer(PeerAddr()));
+
+	// The recorder says where it records on std::cout, keep the output key=value
+	std::cout.setstate(std::ios::failbit);
+
+	std::printf("record.streams=%d\nrecord.call_s=%d\nrecord.packet_bytes=%zu\n", streams, RECORD_SECONDS, packets[0].size());
+	for (int speed : {10, 30, 100, 300}) {
+		CallRecorder recorder(pattern);
+		if (!recorder.start()) {
+			std::fprintf(stderr, "record: can't start the recorder\n");
+			break;
+		}
+
+		std::vector<AudioPacket> sent(streams);
+		std::vector<double> took;
+		took.reserve((size_t) frames * streams);
+		const std::chrono::nanoseconds tick(20000000 / speed);
+		Clock::time_point begin = Clock::now(), next = begin;
+		for (int n = 0; n < frames; ++n) {
+			for (int i = 0; i < streams; ++i) {
+				const std::vector<unsigned char> &data = packets[(n + i) % loop];
+				AudioPacket &packet = sent[i];
+				packet.packet_id = n;
+				packet.timestamp = (uint32_t) (n + i) * FRAME_SIZE;
+				packet.packet_len = (uint16_t) data.size();
+				std::memcpy(packet.packet.get(), data.data(), data.size());
+
+				Clock::time_point start = Clock::now();
+				recorder.onPacket(i ? peers[i - 1].get() : nullptr, i != 0, packet);
+				took.push_back(std::chrono::duration<double, std::nano>(Clock::now() - start).count());
+			}
+			next += tick;
+			std::this_thread::sleep_until(next);
+		}
+		double wall = std::chrono::duration<double>(Clock::now() - begin).count();
+		Clock::time_point stopping = Clock::now();
+		recorder.stop();
+		double stop_ms = std::chrono::duration<double, std::milli>(Clock::now() - stopping).count();
+
+		std::sort(took.begin(), took.end());
+		std::printf("record.%dx.packet_ns=%.0f\nrecord.%dx.packet_p99_ns=%.0f\nrecord.%dx.packet_max_ns=%.0f\n",
+		            speed, took[took.size() / 2], speed, took[took.size() * 99 / 100], speed, took.back());
+		std::printf("record.%dx.dropped=%u\nrecord.%dx.written_mb_s=%.2f\nrecord.%dx.stop_ms=%.0f\n",
+		            speed, recorder.getDropped(), speed, recorder.getBytes() / wall / 1e6, speed, stop_ms);
+		remove_dir(pattern);
+		mkdir(pattern.c_str(), 0700);
+	}
+	std::cout.clear();
+	remove_dir(pattern);
+}
+
+// gossip ------------------------------------------------------------------------------
+/* GossipSim: A made-up call of GossipViews that hand their datagrams straight to each
+ * other, dropping some at random, on a clock that moves GOSSIP_INTERVAL per round.
+ * No sockets; what PeersChatNetwork does with the datagrams and events is done here.
+ */
+struct GossipSim {
+	std::vector<GossipView> views;
+	std::vector<PeerAddr> addrs;
+	std::unordered_map<PeerAddr, int, PeerAddrHash> index;
+	std::vector<bool> up;
+	std::vector<std::vector<GossipEvent>> events;
+	Clock::time_point now = Clock::now();
+	std::mt19937 rng;
+	double loss;
+	uint64_t bytes = 0;
+
+	GossipSim(int members, double loss, unsigned seed) : rng(seed), loss(loss) {
+		for (int i = 0; i < members; ++i)
+			member();
+	}
+
+	// A new member at 10.0.x.y:8080
+	int member() {
+		int i = (int) views.size();
+		sockaddr_in in;
+		std::memset(&in, 0, sizeof(in));
+		in.sin_family = AF_INET;
+		in.sin_addr.s_addr = htonl(0x0a000001 + i);
+		in.sin_port = htons(8080);
+		views.emplace_back();
+		views.back().reset(1000 + i);
+		addrs.push_back(PeerAddr(in));
+		index[addrs.back()] = i;
+		up.push_back(true);
+		events.emplace_back();
+		return i;
+	}
+
+	void send(int from, int to, uint8_t flags) {
+		uint8_t buffer[BUFFER_SIZE];
+		size_t len = views[from].write(addrs[to], buffer, sizeof(buffer), flags);
+		bytes += len;
+		if (!up[to] || std::uniform_real_distribution<double>(0.0, 1.0)(rng) < loss)
+			return;
+		if (views[to].receive(addrs[from], buffer, len, now, events[to]) == GOSSIP_REPLY_FULL)
+			send(to, from, GOSSIP_FULL);
+	}
+
+	// Everyone we know of, gossiping or not
+	std::vector<int> known(int i) {
+		std::vector<PeerAddr> live;
+		views[i].live(live, &live);
+		std::vector<int> members;
+		for (const PeerAddr &addr : live)
+			members.push_back(index[addr]);
+		return members;
+	}
+
+	void round() {
+		for (size_t i = 0; i < views.size(); ++i) {
+			if (!up[i])
+				continue;
+			std::vector<PeerAddr> targets;
+			views[i].tick(now, targets, events[i]);
+			for (const PeerAddr &addr : targets)
+				send((int) i, index[addr], 0);
+		}
+		now += GOSSIP_INTERVAL;
+	}
+
+	bool converged() {
+		uint32_t digest = 0;
+		for (size_t i = 0; i < views.size(); ++i) {
+			if (!up[i])
+				continue;
+			uint32_t x = views[i].digest();
+			if (x == 0 || (digest != 0 && x != digest))
+				return false;
+			digest = x;
+		}
+		return true;
+	}
+
+	// Has every member that is up, but @except, seen @subject join/go?
+	bool heard(int subject, bool joined, int except) {
+		for (size_t i = 0; i < views.size(); ++i) {
+			if (!up[i] || (int) i == subject || (int) i == except)
+				continue;
+			bool seen = false;
+			for (const GossipEvent &event : events[i])
+				seen |= event.joined == joined && event.addr == addrs[subject];
+			if (!seen)
+				return false;
+		}
+		return true;
+	}
+
+	// Rounds until done() (GOSSIP_SIM_MAX_ROUNDS if never)
+	template<class F>
+	int until(F done) {
+		int rounds = 0;
+		while (!done() && rounds < GOSSIP_SIM_MAX_ROUNDS) {
+			round();
+			rounds++;
+		}
+		return rounds;
+	}
+};
+
+/* bench_gossip()
+ * How fast membership news spreads in calls of 5 to 100, with no loss and with 10% of
+ * the datagrams lost.  The call starts with everyone added everywhere (as after SENDP)
+ * and settles; then someone joins through member 0 (which tells everyone right away,
+ * like connectFulfill()), member 1 leaves (GOSSIP_LEAVE_REPEAT goodbyes to everyone, like
+ * leave()) and member 2 crashes.  Rounds are GOSSIP_INTERVAL each and the counts are
+ * the mean of -r calls.  Bytes and CPU are per member per second/round while settled.
+ */
+static void bench_gossip() {
+	std::printf("gossip.interval_ms=%d\n", (int) GOSSIP_INTERVAL.count());
+	for (double loss : {0.0, 0.1}) {
+		for (int members : {5, 10, 25, 50, 100}) {
+			double settle = 0, join = 0, join_settle = 0, leave = 0, crash = 0, bytes = 0, cpu = 0;
+			for (int run = 0; run < rounds; ++run) {
+				GossipSim sim(members, loss, run + 1);
+				for (int i = 0; i < members; ++i)
+					for (int j = 0; j < members; ++j)
+						if (i != j)
+							sim.views[i].add(sim.addrs[j], sim.now);
+				settle += sim.until([&]() { return sim.converged(); });
+
+				// Settled traffic
+				sim.bytes = 0;
+				Clock::time_point begin = Clock::now();
+				for (int n = 0; n < GOSSIP_SIM_STEADY_ROUNDS; ++n)
+					sim.round();
+				std::chrono::duration<double, std::micro> took = Clock::now() - begin;
+				cpu += took.count() / GOSSIP_SIM_STEADY_ROUNDS / members;
+				bytes += sim.bytes / (GOSSIP_SIM_STEADY_ROUNDS * (GOSSIP_INTERVAL.count() / 1000.0)) / members;
+
+				// Join through member 0
+				int joiner = sim.member();
+				for (int i : sim.known(0))
+					sim.views[joiner].add(sim.addrs[i], sim.now);
+				sim.views[joiner].add(sim.addrs[0], sim.now);
+				sim.views[0].add(sim.addrs[joiner], sim.now);
+				for (int i : sim.known(0))
+					sim.send(0, i, 0);
+				join += sim.until([&]() { return sim.heard(joiner, true, 0); });
+				join_settle += sim.until([&]() { return sim.converged(); });
+
+				// Member 1 leaves, member 2 crashes
+				for (int n = 0; n < GOSSIP_LEAVE_REPEAT; ++n)
+					for (int i : sim.known(1))
+						sim.send(1, i, GOSSIP_LEAVING);
+				sim.up[1] = false;
+				leave += sim.until([&]() { return sim.heard(1, false, -1); });
+				sim.up[2] = false;
+				crash += sim.until([&]() { return sim.heard(2, false, -1); });
+			}
+
+			const char *tag = loss > 0.0 ? "lossy" : "clean";
+			double interval_s = GOSSIP_INTERVAL.count() / 1000.0;
+			std::printf("gossip.%s.%d.settle_rounds=%.1f\ngossip.%s.%d.join_rounds=%.1f\ngossip.%s.%d.join_settle_rounds=%.1f\n",
+			            tag, members, settle / rounds, tag, members, join / rounds, tag, members, join_settle / rounds);
+			std::printf("gossip.%s.%d.leave_rounds=%.1f\ngossip.%s.%d.crash_s=%.1f\n",
+			            tag, members, leave / rounds, tag, members, crash / rounds * interval_s);
+			std::printf("gossip.%s.%d.bytes_s=%.0f\ngossip.%s.%d.round_us=%.1f\n",
+			            tag, members, bytes / rounds, tag, members, cpu / rounds);
+		}
+	}
+}
+
+// crypto ------------------------------------------------------------------------------
+/* bench_crypto()
+ * Two AudioCiphers that traded keys, one sealing SENDA datagrams with payload opus
+ * bytes (60 is what BITRATE gives per frame, 1200 about the most a datagram holds) and
+ * the other opening them, ns per datagram.  A counter only opens once, so every round
+ * opens datagrams sealed for it beforehand.  Encoding and decoding a frame of speech
+ * like APeer are given alongside, and a key agreement (both keys and both X25519) in us.
+ */
+static void bench_crypto() {
+	AudioCipher tx, rx;
+	uint8_t tx_key[CRYPTO_KEY_SIZE], rx_key[CRYPTO_KEY_SIZE];
+	if (!tx.ourKey(tx_key) || !rx.ourKey(rx_key)) {
+		std::fprintf(stderr, "crypto: no random bytes\n");
+		return;
+	}
+	tx.setTheirKey(rx_key);
+	rx.setTheirKey(tx_key);
+	tx.confirm();
+
+	std::mt19937 rng(11);
+	for (int payload : {60, 240, 1200}) {
+		size_t len = SENDA_HEADER_SIZE + payload;
+		std::vector<uint8_t> plain(len);
+		for (uint8_t &byte : plain)
+			byte = (uint8_t) rng();
+		plain[0] = SENDA;
+
+		std::vector<uint8_t> buffer(len + CRYPTO_OVERHEAD);
+		double seal = best_ns([&]() {
+			std::memcpy(buffer.data(), plain.data(), len);
+			sink = tx.seal(buffer.data(), len);
+		}, CRYPTO_SIM_PACKETS);
+
+		std::vector<std::vector<uint8_t>> sealed(CRYPTO_SIM_PACKETS, std::vector<uint8_t>(len + CRYPTO_OVERHEAD));
+		double open = 1e300;
+		uint64_t failed = 0;
+		for (int round = 0; round < rounds; ++round) {
+			for (std::vector<uint8_t> &datagram : sealed) {
+				std::memcpy(datagram.data(), plain.data(), len);
+				tx.seal(datagram.data(), len);
+			}
+			Clock::time_point begin = Clock::now();
+			for (std::vector<uint8_t> &datagram : sealed)
+				failed += rx.open(datagram.data(), datagram.size()) < 0;
+			std::chrono::duration<double, std::nano> took = Clock::now() - begin;
+			open = std::min(open, took.count() / CRYPTO_SIM_PACKETS);
+		}
+		std::printf("crypto.%d_bytes.seal_ns=%.0f\ncrypto.%d_bytes.open_ns=%.0f\n", payload, seal, payload, open);
+		if (failed)
+			std::printf("crypto.%d_bytes.failed=%llu\n", payload, (unsigned long long) failed);
+	}
+
+	double agree = best_ns([&]() {
+		AudioCipher a, b;
+		uint8_t ka[CRYPTO_KEY_SIZE], kb[CRYPTO_KEY_SIZE];
+		a.ourKey(ka);
+		b.ourKey(kb);
+		a.setTheirKey(kb);
+		b.setTheirKey(ka);
+		sink = a.sealed() + b.sealed();
+	}, 20);
+	std::printf("crypto.agree_us=%.0f\n", agree / 1000.0);
+
+	// What the audio path already spends on a frame
+	int error = 0;
+	OpusEncoder *encoder = opus_encoder_create(SAMPLE_RATE, 1, OPUS_APPLICATION_VOIP, &error);
+	OpusDecoder *decoder = opus_decoder_create(SAMPLE_RATE, 1, &error);
+	if (!encoder || !decoder) {
+		std::fprintf(stderr, "opus: %s\n", opus_strerror(error));
+		if (encoder)
+			opus_encoder_destroy(encoder);
+		return;
+	}
+	opus_encoder_ctl(encoder, OPUS_SET_SIGNAL(OPUS_SIGNAL_VOICE));
+	opus_encoder_ctl(encoder, OPUS_SET_VBR(0));
+	opus_encoder_ctl(encoder, OPUS_SET_BITRATE(BITRATE));
+	const int frames = 50;
+	std::vector<float> voice = speech(frames * FRAME_SIZE, 0.5f, 12);
+	std::vector<std::vector<unsigned char>> packets = voice_packets(frames, 12);
+	std::vector<float> pcm(FRAME_SIZE);
+	int frame = 0;
+	double encode = best_ns([&]() {
+		unsigned char packet[1500];
+		sink = opus_encode_float(encoder, &voice[(frame++ % frames) * FRAME_SIZE], FRAME_SIZE, packet, sizeof(packet));
+	}, frames * 4);
+	frame = 0;
+	double decode = best_ns([&]() {
+		const std::vector<unsigned char> &packet = packets[frame++ % frames];
+		sink = opus_decode_float(decoder, packet.data(), (opus_int32) packet.size(), pcm.data(), FRAME_SIZE, 0);
+	}, frames * 4);
+	std::printf("crypto.opus_encode_ns=%.0f\ncrypto.opus_decode_ns=%.0f\n", encode, decode);
+	opus_encoder_destroy(encoder);
+	opus_decoder_destroy(decoder);
+}
+
+/* Bench: One test, by the name it's asked for on the command line
+ */
+struct Bench {
+	const char *name;
+	void (*run)();
+};
+
+static const Bench benches[] = {
+	{"dsp", bench_dsp},
+	{"aec", bench_aec},
+	{"resample", bench_resample},
+	{"decode", bench_decode},
+	{"record", bench_record},
+	{"gossip", bench_gossip},
+	{"crypto", bench_crypto},
+};
+
+static void usage(const char *self) {
+	std::fprintf(stderr, "Usage: %s [-r rounds] [-t threads] [-f far.wav -m mic.wav] test...\nTests:", self);
+	for (const Bench &bench : benches)
+		std::fprintf(stderr, " %s", bench.name);
+	std::fprintf(stderr, "\n");
+}
+
+int main(int argc, char *argv[]) {
+	int opt;
+	while ((opt = getopt(argc, argv, "r:t:f:m:")) != -1) {
+		switch (opt) {
+			case 'r': rounds = std::max(1, std::atoi(optarg)); break;
+			case 't': max_threads = std::atoi(optarg); break;
+			case 'f': far_path = optarg; break;
+			case 'm': mic_path = optarg; break;
+			default:
+				usage(argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+	if (optind >= argc) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	for (int i = optind; i < argc; ++i) {
+		const Bench *found = nullptr;
+		for (const Bench &bench : benches)
+			if (std::strcmp(bench.name, argv[i]) == 0)
+				found = &bench;
+		if (!found) {
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+		found->run();
+	}
+	return EXIT_SUCCESS;
+}
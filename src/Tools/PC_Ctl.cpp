@@ -0,0 +1,136 @@
+/*
+ *  PeersChatCtl: Command line front end for PeersChatd
+ *
+ * Usage: PeersChatCtl [-s socket] status|watch
+ *        PeersChatCtl [-s socket] <command...>
+ *
+ * status prints one snapshot of the shared state, watch keeps printing them until
+ * interrupted.  Anything else is sent to the daemon as is (see PC_IPC.hpp) and the reply
+ * is printed; the exit status is 0 only if it starts with "OK".
+ *
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "PC_IPC.hpp"
+
+/* Stage names -- Keep in step with JoinStage in PC_Network.hpp
+ */
+static const char *STAGES[] = {"connecting", "waiting", "peers", "started", "done", "failed", "cancelled"};
+#define WATCH_INTERVAL_US 200000
+
+static void usage(const char *self)
+{
+	fprintf(stderr, "Usage: %s [-s socket] status|watch\n", self);
+	fprintf(stderr, "       %s [-s socket] <command...>\n", self);
+}
+
+static void print_snapshot(const SharedSnapshot &s)
+{
+	const char *stage = (s.stage >= 0 && s.stage < (int) (sizeof(STAGES) / sizeof(STAGES[0]))) ? STAGES[s.stage] : "idle";
+	printf("serial=%u stage=%s in_call=%d port=%u xruns=%u\n", s.serial, stage, s.in_call, s.port, s.xruns);
+	printf("mic muted=%d volume=%.2f peak=%.3f rms=%.3f output_volume=%.2f\n",
+	       s.mic_muted, s.input_volume, s.mic_peak, s.mic_rms, s.output_volume);
+	for(int i = 0; i < s.count && i < IPC_MAX_PEERS; ++i)
+	{
+		const SharedPeer &p = s.peers[i];
+		printf("peer id=%d name=%s muted=%d gain=%.2f peak=%.3f rms=%.3f loss=%.3f jitter_ms=%.1f rtt_ms=%.1f\n",
+		       p.id, p.name, p.muted, p.gain, p.peak, p.rms, p.loss, p.jitter_us / 1000.0, p.rtt_us / 1000.0);
+	}
+	fflush(stdout);
+}
+
+static int show(int sock, bool watch)
+{
+	std::string reply;
+	int fd = -1;
+	if(!ipc_send(sock, "ATTACH") || !ipc_recv(sock, reply, &fd) || fd < 0)
+	{
+		fprintf(stderr, "ATTACH failed: %s\n", reply.c_str());
+		return EXIT_FAILURE;
+	}
+
+	const SharedState *state = ipc_attach_shared(fd);
+	close(fd);
+	if(!state)
+	{
+		fprintf(stderr, "Shared memory doesn't match this version of PeersChatCtl\n");
+		return EXIT_FAILURE;
+	}
+
+	// Redraw only when the daemon published something new
+	uint32_t last = 0;
+	do
+	{
+		SharedSnapshot snapshot = state->snapshot.load();
+		if(snapshot.serial != last)
+		{
+			if(watch && last) printf("\n");
+			print_snapshot(snapshot);
+			last = snapshot.serial;
+		}
+		if(watch) usleep(WATCH_INTERVAL_US);
+	} while(watch);
+
+	munmap((void*) state, sizeof(SharedState));
+	return EXIT_SUCCESS;
+}
+
+int main(int argc, char *argv[])
+{
+	std::string path = ipc_default_socket();
+	int opt;
+	while((opt = getopt(argc, argv, "+s:h")) != -1)
+	{
+		switch(opt)
+		{
+			case 's': path = optarg; break;
+			default: usage(argv[0]); return EXIT_FAILURE;
+		}
+	}
+	if(optind >= argc)
+	{
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	int sock = ipc_connect(path);
+	if(sock < 0)
+	{
+		fprintf(stderr, "Can't reach PeersChatd on %s\n", path.c_str());
+		return EXIT_FAILURE;
+	}
+
+	std::string verb = argv[optind];
+	if(verb == "status" || verb == "watch")
+	{
+		int status = show(sock, verb == "watch");
+		close(sock);
+		return status;
+	}
+
+	// Everything else goes over as one line
+	std::string line;
+	for(int i = optind; i < argc; ++i)
+	{
+		if(i > optind) line += ' ';
+		line += argv[i];
+	}
+
+	std::string reply;
+	if(!ipc_send(sock, line) || !ipc_recv(sock, reply))
+	{
+		fprintf(stderr, "PeersChatd hung up\n");
+		close(sock);
+		return EXIT_FAILURE;
+	}
+	close(sock);
+
+	printf("%s\n", reply.c_str());
+	return reply.compare(0, 2, "OK") == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,105 @@
+/*
+ *  PeersChatRendezvous: Tells PeersChat clients where their NAT maps them
+ *
+ * Usage: PeersChatRendezvous [-p port] [-v]
+ *
+ * Answers every BIND with a BOUND holding the address the BIND came from (see
+ * PC_NAT.hpp), on port RENDEZVOUS_PORT unless told otherwise.  Keeps no state and never
+ * relays audio; clients point at it with PEERSCHAT_RENDEZVOUS=<ip>[:port] (or
+ * [<ipv6>][:port]).  The socket is dual-stack, so one server answers both families.
+ * -v prints every client it answers.
+ *
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <csignal>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include "PC_NAT.hpp"
+
+static volatile sig_atomic_t quit = 0;
+
+static void on_signal(int)
+{
+	quit = 1;
+}
+
+static void usage(const char *self)
+{
+	fprintf(stderr, "Usage: %s [-p port] [-v]\n", self);
+}
+
+int main(int argc, char *argv[])
+{
+	long port = RENDEZVOUS_PORT;
+	bool verbose = false;
+	int opt;
+	while((opt = getopt(argc, argv, "p:vh")) != -1)
+	{
+		switch(opt)
+		{
+			case 'p': port = std::strtol(optarg, NULL, 10); break;
+			case 'v': verbose = true; break;
+			default: usage(argv[0]); return EXIT_FAILURE;
+		}
+	}
+	if(port <= 0 || port > 65535)
+	{
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	int family;
+	int sock = addr_socket(SOCK_DGRAM | SOCK_CLOEXEC, family);
+	if(sock < 0)
+	{
+		perror("socket()");
+		return EXIT_FAILURE;
+	}
+
+	if(addr_bind(sock, family, (uint16_t) port) < 0)
+	{
+		perror("bind()");
+		close(sock);
+		return EXIT_FAILURE;
+	}
+
+	// No SA_RESTART, so a signal wakes recvfrom() up
+	struct sigaction action;
+	std::memset(&action, 0, sizeof(action));
+	action.sa_handler = on_signal;
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+
+	printf("PeersChatRendezvous listening on UDP port %ld\n", port);
+	fflush(stdout);
+
+	uint8_t request[64], reply[BOUND6_SIZE];
+	while(!quit)
+	{
+		sockaddr_storage storage;
+		socklen_t size = sizeof(storage);
+		ssize_t r = recvfrom(sock, request, sizeof(request), 0, (sockaddr*) &storage, &size);
+		if(r < 0) continue;
+
+		// Anything that isn't a BIND is dropped
+		PeerAddr from;
+		if(!PeerAddr::from(storage, size, from)) continue;
+		size_t len = nat_write_bound(reply, request, r, from);
+		if(len == 0) continue;
+		sendto(sock, reply, len, 0, (const sockaddr*) &storage, size);
+
+		if(verbose)
+		{
+			printf("BIND from %s\n", from.str().c_str());
+			fflush(stdout);
+		}
+	}
+
+	close(sock);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,336 @@
+/*
+ *  PeersChatReplay: Plays a trace (PEERSCHAT_TRACE) through the receive side offline
+ *
+ * Every datagram in the trace is parsed like receive_audio_thread() does, pushed into a
+ * JitterBuffer at its recorded arrival time, and pulled out again every 20 ms of trace
+ * time, decoded (or concealed like APeer::decodePeer() does) and mixed.  Nothing waits
+ * on a real clock, so a long call replays in seconds and the same trace always gives the
+ * same numbers.  Run it with different -d/-b values to compare jitter buffer settings.
+ *
+ * Usage: PeersChatReplay [-d delay_ms] [-b max_packets] [-w mix.wav] trace
+ *
+ * Output is one key=value per line, for scripts: totals first, then per peer.
+ *
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <algorithm>
+#include <chrono>
+#include <unistd.h>
+#include <opus.h>
+
+#include "nettypes.hpp"
+#include "PC_Jitter.hpp"
+#include "PC_Trace.hpp"
+#include "PC_DSP.hpp"
+
+/* Constants -- Keep in step with PC_Audio.hpp / PC_Network.cpp
+ * SAMPLE_RATE, FRAME_SIZE: What APeer decodes and mixes at
+ * PLC_MAX_FRAMES: Frames concealed in a row before a peer counts as silent
+ * DEFAULT_DELAY_MS: PACKET_DELAY
+ * DEFAULT_MAX_PACKETS: IN_PACKET_BUFFER_TOO_LARGE
+ */
+#define SAMPLE_RATE 48000
+#define FRAME_SIZE 960
+#define PLC_MAX_FRAMES 5
+#define DEFAULT_DELAY_MS 50
+#define DEFAULT_MAX_PACKETS 10
+
+typedef std::chrono::steady_clock Clock;
+
+/* ReplayPacket: One frame out of a datagram, what NPeer would have queued
+ */
+struct ReplayPacket
+{
+	uint32_t packet_id = 0;
+	uint32_t timestamp = 0;
+	uint64_t arrival_us = 0;
+	uint16_t len = 0;
+	uint8_t data[TRACE_MAX_DATAGRAM];
+};
+
+/* Peer: Receive side state and statistics for one peer in the trace
+ */
+struct Peer
+{
+	JitterBuffer<ReplayPacket> buffer;
+	OpusDecoder *decoder = nullptr;
+	float pcm[FRAME_SIZE];
+	bool seen = false;
+	uint32_t highest_id = 0;
+	uint32_t highest_ts = 0;
+	int concealed = PLC_MAX_FRAMES;
+
+	uint64_t received = 0;
+	uint64_t played = 0;
+	uint64_t lost = 0;
+	uint64_t plc = 0;
+	uint64_t silent = 0;
+	std::vector<double> delays;
+
+	explicit Peer(size_t max_packets) : buffer(max_packets) {
+		int error = 0;
+		decoder = opus_decoder_create(SAMPLE_RATE, 1, &error);
+	}
+	~Peer() {
+		if (decoder)
+			opus_decoder_destroy(decoder);
+	}
+};
+
+/* extend()
+ * NPeer::extendSequence(): 16 bit SENDA sequence/timestamp to 32 bits.
+ */
+static uint32_t extend(Peer &peer, uint16_t seq, uint16_t ticks, uint32_t &timestamp) {
+	if (!peer.seen) {
+		peer.seen = true;
+		peer.highest_id = seq;
+		peer.highest_ts = ticks;
+	}
+	uint32_t id = peer.highest_id + (int16_t) (seq - (uint16_t) peer.highest_id);
+	uint32_t ts = peer.highest_ts + (int16_t) (ticks - (uint16_t) peer.highest_ts);
+	if ((int32_t) (id - peer.highest_id) > 0) peer.highest_id = id;
+	if ((int32_t) (ts - peer.highest_ts) > 0) peer.highest_ts = ts;
+	timestamp = ts * AUDIO_TS_UNIT;
+	return id;
+}
+
+/* receive()
+ * receive_audio_thread() from the header on: parse, unbundle, queue each frame.
+ */
+static void receive(Peer &peer, const TraceRecord &record, Clock::time_point arrival) {
+	const uint8_t *buffer = record.data;
+	const long r = record.len;
+	uint32_t id, timestamp = 0, len;
+	uint8_t flags = 0;
+	const uint8_t *payload;
+	if (buffer[0] == SENDA && r > SENDA_HEADER_SIZE) {
+		if ((buffer[1] >> 6) != AUDIO_WIRE_VERSION) return;
+		id = extend(peer, (buffer[2] << 8) | buffer[3], (buffer[4] << 8) | buffer[5], timestamp);
+		flags = buffer[1] & 0x3F;
+		len = r - SENDA_HEADER_SIZE;
+		payload = buffer + SENDA_HEADER_SIZE;
+	} else if (buffer[0] == SENDV && r > SENDV_HEADER_SIZE) {
+		id = (buffer[1] << 24) | (buffer[2] << 16) | (buffer[3] << 8) | (buffer[4]);
+		len = (buffer[5] << 24) | (buffer[6] << 16) | (buffer[7] << 8) | (buffer[8]);
+		payload = buffer + SENDV_HEADER_SIZE;
+		if (len > (uint32_t) (r - SENDV_HEADER_SIZE)) return;
+	} else {
+		return;
+	}
+
+	uint16_t lengths[AUDIO_MAX_BUNDLE] = {0};
+	uint32_t count = 1, step = 0;
+	lengths[0] = (uint16_t) len;
+	if (flags & AUDIO_BUNDLE) {
+		const uint8_t *end = payload + len;
+		if (len < 2) return;
+		count = payload[0];
+		step = payload[1] * AUDIO_TS_UNIT;
+		payload += 2;
+		if (count < 1 || count > AUDIO_MAX_BUNDLE) return;
+		uint32_t total = 0, parsed = 0;
+		while (parsed < count - 1 && payload < end) {
+			uint16_t length = *payload++;
+			if (length >= 252) {
+				if (payload == end) break;
+				length += 4 * (*payload++);
+			}
+			lengths[parsed++] = length;
+			total += length;
+		}
+		if (parsed != count - 1 || total > (uint32_t) (end - payload)) return;
+		lengths[count - 1] = (uint16_t) (end - payload - total);
+	}
+
+	for (uint32_t i = 0; i < count; ++i) {
+		if (lengths[i] > 0) {
+			ReplayPacket *packet = new ReplayPacket;
+			packet->packet_id = id + i;
+			packet->timestamp = timestamp + i * step;
+			packet->arrival_us = record.arrival_us;
+			packet->len = lengths[i];
+			std::memcpy(packet->data, payload, lengths[i]);
+			peer.buffer.push(packet, arrival);
+			peer.received++;
+		}
+		payload += lengths[i];
+	}
+}
+
+/* play()
+ * APeer::decodePeer() for one frame.  Returns true if pcm holds audio.
+ */
+static bool play(Peer &peer, Clock::time_point now, Clock::duration delay) {
+	uint32_t last = peer.buffer.getLastId();
+	std::unique_ptr<ReplayPacket> packet(peer.buffer.pop(now, delay));
+	if (!packet) {
+		if (peer.concealed >= PLC_MAX_FRAMES) {
+			peer.silent++;
+			return false;
+		}
+		peer.concealed++;
+		peer.plc++;
+		return opus_decode_float(peer.decoder, nullptr, 0, peer.pcm, FRAME_SIZE, 0) > 0;
+	}
+	if (last != 0)
+		peer.lost += packet->packet_id - last - 1;
+	peer.played++;
+	peer.concealed = 0;
+	auto now_us = std::chrono::duration_cast<std::chrono::microseconds>(now.time_since_epoch()).count();
+	peer.delays.push_back((now_us - (int64_t) packet->arrival_us) / 1000.0);
+	return opus_decode_float(peer.decoder, packet->data, packet->len, peer.pcm, FRAME_SIZE, 0) > 0;
+}
+
+/* percentile()
+ * p-th percentile (0..1) of v, sorts v.
+ */
+static double percentile(std::vector<double> &v, double p) {
+	if (v.empty())
+		return 0.0;
+	std::sort(v.begin(), v.end());
+	return v[std::min(v.size() - 1, (size_t) (p * v.size()))];
+}
+
+/* write_wav()
+ * 16 bit mono WAV header for a file of n samples.
+ */
+static void write_wav_header(FILE *f, uint32_t n) {
+	uint8_t h[44] = {'R', 'I', 'F', 'F', 0, 0, 0, 0, 'W', 'A', 'V', 'E', 'f', 'm', 't', ' ', 16, 0, 0, 0, 1, 0, 1, 0};
+	auto put32 = [&](int at, uint32_t x) { for (int i = 0; i < 4; ++i) h[at + i] = (uint8_t) (x >> (8 * i)); };
+	put32(4, 36 + 2 * n);
+	put32(24, SAMPLE_RATE);
+	put32(28, SAMPLE_RATE * 2);
+	h[32] = 2;
+	h[34] = 16;
+	std::memcpy(h + 36, "data", 4);
+	put32(40, 2 * n);
+	std::fseek(f, 0, SEEK_SET);
+	std::fwrite(h, 1, sizeof(h), f);
+}
+
+int main(int argc, char *argv[]) {
+	int delay_ms = DEFAULT_DELAY_MS;
+	size_t max_packets = DEFAULT_MAX_PACKETS;
+	const char *wav_path = nullptr;
+	int opt;
+	while ((opt = getopt(argc, argv, "d:b:w:")) != -1) {
+		switch (opt) {
+			case 'd': delay_ms = std::atoi(optarg); break;
+			case 'b': max_packets = (size_t) std::atoi(optarg); break;
+			case 'w': wav_path = optarg; break;
+			default:
+				std::fprintf(stderr, "Usage: %s [-d delay_ms] [-b max_packets] [-w mix.wav] trace\n", argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+	if (optind >= argc) {
+		std::fprintf(stderr, "Usage: %s [-d delay_ms] [-b max_packets] [-w mix.wav] trace\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	TraceReader trace(argv[optind]);
+	if (!trace.good()) {
+		std::fprintf(stderr, "%s: not a PeersChat trace\n", argv[optind]);
+		return EXIT_FAILURE;
+	}
+	FILE *wav = wav_path ? std::fopen(wav_path, "wb") : nullptr;
+	if (wav)
+		write_wav_header(wav, 0);
+
+	const DSPKernels &kernels = dsp();
+	const Clock::duration delay = std::chrono::milliseconds(delay_ms);
+	const auto frame = std::chrono::microseconds(1000000LL * FRAME_SIZE / SAMPLE_RATE);
+	std::map<int32_t, std::unique_ptr<Peer>> peers;
+	std::unique_ptr<TraceRecord> record(new TraceRecord);
+	bool more = trace.next(*record);
+	Clock::time_point now = Clock::time_point(std::chrono::microseconds(more ? record->arrival_us : 0));
+
+	float mix[FRAME_SIZE];
+	int16_t samples[FRAME_SIZE];
+	uint64_t frames = 0, datagrams = 0, clipped = 0;
+	double energy = 0.0;
+	auto started = std::chrono::steady_clock::now();
+
+	for (;;) {
+		// Everything that arrived by now
+		while (more && Clock::time_point(std::chrono::microseconds(record->arrival_us)) <= now) {
+			std::unique_ptr<Peer> &peer = peers[record->peer];
+			if (!peer)
+				peer.reset(new Peer(max_packets));
+			receive(*peer, *record, Clock::time_point(std::chrono::microseconds(record->arrival_us)));
+			datagrams++;
+			more = trace.next(*record);
+		}
+
+		bool held = false;
+		for (auto &entry : peers)
+			held = held || entry.second->buffer.size() > 0;
+		if (!more && !held)
+			break;
+
+		// One frame of the mixer
+		std::memset(mix, 0, sizeof(mix));
+		for (auto &entry : peers) {
+			Peer &peer = *entry.second;
+			if (play(peer, now, delay))
+				kernels.mix(mix, peer.pcm, 1.0f, FRAME_SIZE);
+		}
+		for (float s : mix) {
+			energy += (double) s * s;
+			if (std::fabs(s) > 1.0f)
+				clipped++;
+		}
+		kernels.soft_clip(mix, FRAME_SIZE);
+		if (wav) {
+			kernels.to_int16(mix, samples, FRAME_SIZE);
+			std::fwrite(samples, sizeof(int16_t), FRAME_SIZE, wav);
+		}
+		frames++;
+		now += frame;
+	}
+	std::chrono::duration<double> took = std::chrono::steady_clock::now() - started;
+
+	if (wav) {
+		write_wav_header(wav, (uint32_t) (frames * FRAME_SIZE));
+		std::fclose(wav);
+	}
+
+	// Totals
+	double seconds = (double) frames * FRAME_SIZE / SAMPLE_RATE;
+	std::printf("delay_ms=%d\nmax_packets=%zu\n", delay_ms, max_packets);
+	std::printf("datagrams=%llu\nframes=%llu\naudio_s=%.2f\nreplay_s=%.3f\nspeedup=%.1f\n",
+	            (unsigned long long) datagrams, (unsigned long long) frames, seconds, took.count(),
+	            took.count() > 0 ? seconds / took.count() : 0.0);
+	std::printf("mix_rms_db=%.1f\nmix_clipped=%llu\n",
+	            10.0 * std::log10(energy / std::max<double>(1.0, (double) frames * FRAME_SIZE) + 1e-12),
+	            (unsigned long long) clipped);
+
+	// Per peer
+	for (auto &entry : peers) {
+		Peer &peer = *entry.second;
+		uint64_t expected = peer.played + peer.lost;
+		double mean = 0.0;
+		for (double d : peer.delays)
+			mean += d;
+		mean = peer.delays.empty() ? 0.0 : mean / peer.delays.size();
+		double p95 = percentile(peer.delays, 0.95);
+		double max = peer.delays.empty() ? 0.0 : peer.delays.back();
+		std::printf("peer%d.received=%llu\npeer%d.played=%llu\npeer%d.dropped=%u\npeer%d.lost=%llu\n",
+		            entry.first, (unsigned long long) peer.received, entry.first, (unsigned long long) peer.played,
+		            entry.first, peer.buffer.getDropped(), entry.first, (unsigned long long) peer.lost);
+		std::printf("peer%d.loss_pct=%.2f\npeer%d.concealed=%llu\npeer%d.silent=%llu\n",
+		            entry.first, expected ? 100.0 * peer.lost / expected : 0.0,
+		            entry.first, (unsigned long long) peer.plc, entry.first, (unsigned long long) peer.silent);
+		std::printf("peer%d.buffer_ms_mean=%.1f\npeer%d.buffer_ms_p95=%.1f\npeer%d.buffer_ms_max=%.1f\n",
+		            entry.first, mean, entry.first, p95, entry.first, max);
+	}
+	return EXIT_SUCCESS;
+}